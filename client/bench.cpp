@@ -0,0 +1,300 @@
+/*
+ * bench.cpp - SIOS userspace client: thread per source against the reactor
+ *
+ * Copyright (C) 2008 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA, or http://www.gnu.org/licenses/gpl.html
+ */
+
+/*
+ * Each simulated source is a pipe carrying struct sios_power_record, as
+ * /dev/sios_power would, fed by one producer thread in bursts of
+ * BURST records round robin. The same records are taken once by a
+ * blocking reader thread per source and once by coroutines on a single
+ * reactor. Besides time and CPU the table shows context switches, reads
+ * (or epoll waits) per record and what was allocated while running.
+ *
+ *	sios-bench [records per source]
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "sios/client.hpp"
+
+#define BURST		16
+#define BATCH		256	/* records per read, as record_stream */
+#define DEFAULT_RECORDS	100000
+
+static std::atomic<unsigned long> allocations;
+
+void *operator new(std::size_t size)
+{
+	void *p;
+
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	p = std::malloc(size ? size : 1);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void *p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+struct pipes {
+	std::vector<int> rd, wr;
+
+	pipes(int n, bool nonblock)
+	{
+		int fds[2];
+
+		for (int i=0; i<n; i++) {
+			if (pipe2(fds, O_CLOEXEC | (nonblock ? O_NONBLOCK : 0)) < 0) {
+				std::perror("pipe2");
+				std::exit(1);
+			}
+			/* only the read end is the consumer's */
+			fcntl(fds[1], F_SETFL, 0);
+			rd.push_back(fds[0]);
+			wr.push_back(fds[1]);
+		}
+	}
+};
+
+/* started before the meter and let go by it, so it allocates nothing counted */
+struct producer {
+	std::vector<unsigned long> sent;
+	std::atomic<bool> go;
+	std::thread thread;
+
+	producer(const pipes &p, unsigned long records)
+		: sent(p.wr.size()), go(false),
+		  thread(&producer::produce, this, std::cref(p.wr), records) {}
+
+	void start() { go.store(true, std::memory_order_release); }
+	void produce(const std::vector<int> &wr, unsigned long records);
+};
+
+void producer::produce(const std::vector<int> &wr, unsigned long records)
+{
+	sios_power_record rec[BURST] = {};
+	unsigned long done = 0, n;
+	std::size_t i;
+	int j;
+
+	while (!go.load(std::memory_order_acquire))
+		std::this_thread::yield();
+
+	while (done < records) {
+		n = std::min<unsigned long>(BURST, records - done);
+		for (i=0; i<wr.size(); i++) {
+			for (j=0; j<int(n); j++) {
+				rec[j].time_ns = sent[i]++;
+				rec[j].board = i;
+				rec[j].power_uw = 1000;
+			}
+			if (write(wr[i], rec, n * sizeof(rec[0])) != ssize_t(n * sizeof(rec[0]))) {
+				std::perror("write");
+				std::exit(1);
+			}
+		}
+		done += n;
+	}
+	for (int fd : wr)
+		close(fd);
+}
+
+struct result {
+	double wall_ms, cpu_ms;
+	long csw;
+	unsigned long records, reads, allocs;
+	bool ok;
+};
+
+struct meter {
+	std::chrono::steady_clock::time_point t0;
+	struct rusage ru0;
+	unsigned long a0;
+
+	meter() : t0(std::chrono::steady_clock::now()), a0(allocations.load())
+	{
+		getrusage(RUSAGE_SELF, &ru0);
+	}
+
+	void finish(result &r) const
+	{
+		struct rusage ru;
+
+		r.allocs = allocations.load() - a0;
+		getrusage(RUSAGE_SELF, &ru);
+		r.wall_ms = std::chrono::duration<double, std::milli>(
+				std::chrono::steady_clock::now() - t0).count();
+		r.cpu_ms = (ru.ru_utime.tv_sec - ru0.ru_utime.tv_sec) * 1e3 +
+			   (ru.ru_utime.tv_usec - ru0.ru_utime.tv_usec) / 1e3 +
+			   (ru.ru_stime.tv_sec - ru0.ru_stime.tv_sec) * 1e3 +
+			   (ru.ru_stime.tv_usec - ru0.ru_stime.tv_usec) / 1e3;
+		r.csw = (ru.ru_nvcsw - ru0.ru_nvcsw) + (ru.ru_nivcsw - ru0.ru_nivcsw);
+	}
+};
+
+/* one blocking reader per source, whole records as they come */
+static result run_threads(int n, unsigned long records)
+{
+	pipes p(n, false);
+	std::vector<unsigned long> got(n), reads(n);
+	std::vector<char> in_order(n, 1);
+	std::vector<std::thread> readers;
+	result r = {};
+
+	readers.reserve(n);
+	producer prod(p, records);
+	meter m;
+	prod.start();
+
+	for (int i=0; i<n; i++)
+		readers.emplace_back([&, i] {
+			sios_power_record buf[BATCH];
+			std::size_t have = 0, whole, k;
+			ssize_t len;
+
+			while ((len = read(p.rd[i], reinterpret_cast<char *>(buf) + have,
+					   sizeof(buf) - have)) > 0) {
+				reads[i]++;
+				have += len;
+				whole = have / sizeof(buf[0]);
+				for (k=0; k<whole; k++)
+					if (buf[k].time_ns != got[i]++)
+						in_order[i] = 0;
+				have -= whole * sizeof(buf[0]);
+				std::memmove(buf, buf + whole, have);
+			}
+		});
+	for (auto &t : readers)
+		t.join();
+	prod.thread.join();
+	m.finish(r);
+
+	r.ok = true;
+	for (int i=0; i<n; i++) {
+		r.records += got[i];
+		r.reads += reads[i];
+		r.ok = r.ok && in_order[i] && got[i] == records;
+		close(p.rd[i]);
+	}
+	return r;
+}
+
+struct tally {
+	unsigned long got = 0;
+	bool in_order = true;
+};
+
+static sios::task consume(sios::record_stream<sios_power_record> &s, tally &t,
+			  int &open, sios::reactor &r)
+{
+	for (;;) {
+		for (const sios_power_record &rec : co_await s.next())
+			if (rec.time_ns != t.got++)
+				t.in_order = false;
+		if (s.closed())
+			break;
+	}
+	if (!--open)
+		r.stop();
+}
+
+/* all sources on one reactor thread, one coroutine each */
+static result run_reactor(int n, unsigned long records)
+{
+	pipes p(n, true);
+	sios::reactor r;
+	std::vector<std::unique_ptr<sios::record_stream<sios_power_record>>> streams;
+	std::vector<tally> tallies(n);
+	int open = n;
+	result res = {};
+
+	for (int i=0; i<n; i++)
+		streams.emplace_back(new sios::record_stream<sios_power_record>(r, p.rd[i], BATCH));
+
+	/* the coroutine frames are allocated once here, not in the loop */
+	for (int i=0; i<n; i++)
+		consume(*streams[i], tallies[i], open, r);
+
+	producer prod(p, records);
+	meter m;
+	prod.start();
+	r.run();
+	prod.thread.join();
+	m.finish(res);
+
+	res.reads = r.waits();
+	res.ok = true;
+	for (auto &t : tallies) {
+		res.records += t.got;
+		res.ok = res.ok && t.in_order && t.got == records;
+	}
+	return res;
+}
+
+static void report(const char *mode, int n, const result &r)
+{
+	std::printf("%-8s %4d %10lu %9.1f %9.1f %10.0f %9ld %9.3f %7lu %s\n",
+		    mode, n, r.records, r.wall_ms, r.cpu_ms,
+		    r.records / (r.wall_ms / 1e3), r.csw,
+		    double(r.reads) / r.records, r.allocs, r.ok ? "ok" : "BAD");
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long records = argc > 1 ? std::strtoul(argv[1], nullptr, 0) : DEFAULT_RECORDS;
+	static const int sources[] = { 1, 8, 64 };
+	bool ok = true;
+
+	std::printf("records per source %lu, producer bursts of %d, "
+		    "reads per record are epoll waits for the reactor\n", records, BURST);
+	std::printf("%-8s %4s %10s %9s %9s %10s %9s %9s %7s\n", "mode", "srcs",
+		    "records", "wall ms", "cpu ms", "rec/s", "ctxsw", "rd/rec", "allocs");
+
+	for (int n : sources) {
+		result t = run_threads(n, records);
+		result r = run_reactor(n, records);
+
+		report("threads", n, t);
+		report("reactor", n, r);
+		ok = ok && t.ok && r.ok && r.allocs == 0;
+	}
+
+	return ok ? 0 : 1;
+}
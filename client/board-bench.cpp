@@ -0,0 +1,116 @@
+/*
+ * board-bench.cpp - SIOS userspace client: event throughput over N boards
+ *
+ * Copyright (C) 2008 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA, or http://www.gnu.org/licenses/gpl.html
+ */
+
+/*
+ * Runs the simulated boards of sios_boardtest.ko for 1, 2, 4, ... up
+ * to max boards, each board producing the same number of events, and
+ * shows the total event rate against the one of a single board. With
+ * per-board state and locks the rate per board should hold as boards
+ * are added, and the total grow with the CPUs there are.
+ *
+ *	modprobe sios_boardtest
+ *	sios-board-bench [max boards [events per board]]
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <unistd.h>
+
+#define BOARD_TEST	"/sys/bus/sios/board_test"
+#define DEFAULT_BOARDS	8
+#define DEFAULT_EVENTS	200000
+
+struct run {
+	int boards;
+	int error;
+	unsigned long long ns, rate;
+};
+
+static bool board_test(int boards, unsigned int events, run &r)
+{
+	char line[128], key[32];
+	unsigned long long val;
+	FILE *f;
+
+	f = std::fopen(BOARD_TEST, "w");
+	if (!f) {
+		std::perror(BOARD_TEST);
+		return false;
+	}
+	std::fprintf(f, "%d %u\n", boards, events);
+	if (std::fclose(f)) {
+		std::fprintf(stderr, "%d boards: %s\n", boards, std::strerror(errno));
+		return false;
+	}
+
+	f = std::fopen(BOARD_TEST, "r");
+	if (!f) {
+		std::perror(BOARD_TEST);
+		return false;
+	}
+	r = {};
+	while (std::fgets(line, sizeof(line), f)) {
+		if (std::sscanf(line, "%31s %llu", key, &val) != 2)
+			continue;
+		if (!std::strcmp(key, "boards"))
+			r.boards = val;
+		else if (!std::strcmp(key, "error"))
+			r.error = val;
+		else if (!std::strcmp(key, "ns"))
+			r.ns = val;
+		else if (!std::strcmp(key, "events_per_sec"))
+			r.rate = val;
+	}
+	std::fclose(f);
+
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	int max = argc > 1 ? std::atoi(argv[1]) : DEFAULT_BOARDS;
+	unsigned int events = argc > 2 ? std::strtoul(argv[2], nullptr, 0) : DEFAULT_EVENTS;
+	unsigned long long base = 0;
+	run r;
+
+	std::printf("events per board %u, online CPUs %ld\n", events,
+		    sysconf(_SC_NPROCESSORS_ONLN));
+	std::printf("%6s %10s %12s %12s %8s\n", "boards", "ms", "events/s",
+		    "per board", "scaling");
+
+	for (int n=1; n<=max; n*=2) {
+		if (!board_test(n, events, r))
+			return 1;
+		if (r.boards != n) {
+			std::fprintf(stderr, "only %d of %d boards came up\n", r.boards, n);
+			return 1;
+		}
+		if (!base)
+			base = r.rate;
+		std::printf("%6d %10.1f %12llu %12llu %8.2f\n", n, r.ns / 1e6, r.rate,
+			    r.rate / n, base ? double(r.rate) / base : 0.0);
+	}
+
+	return 0;
+}
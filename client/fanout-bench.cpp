@@ -0,0 +1,311 @@
+/*
+ * fanout-bench.cpp - SIOS userspace client: CPU against capture readers
+ *
+ * Copyright (C) 2008 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA, or http://www.gnu.org/licenses/gpl.html
+ */
+
+/*
+ * Runs 1, 2, 4, ... up to max processes reading /dev/sios_capture at
+ * once, each for the same time, by read or by mmap with PEEK and
+ * CONSUME, and shows what the readers and the whole system spent. The
+ * capture is shared, so the driver's share should stay put as readers
+ * are added and only the readers' own CPU grow, by a copy per block
+ * for read and next to nothing for mmap.
+ *
+ * Blocks, entries and lost blocks are per reader, cpu ms/s is what all
+ * readers took per second and sys % the busy share of all CPUs. Start
+ * the sampling first, e.g. a converter at a high rate; the table is
+ * only as good as the load is steady.
+ *
+ *	sios-fanout-bench [max readers [seconds [read|mmap]]]
+ */
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <endian.h>
+#include <linux/types.h>
+#include "sios/capture.h"
+
+#define CAPTURE_DEV	"/dev/sios_capture"
+#define DEFAULT_READERS	8
+#define DEFAULT_SECONDS	10
+#define READ_BLOCKS	16
+
+typedef std::chrono::steady_clock clk;
+
+struct tally {
+	unsigned long blocks, entries, lost;
+	int error;
+};
+
+/* busy and total jiffies of all CPUs */
+static bool cpu_jiffies(unsigned long long &busy, unsigned long long &total)
+{
+	unsigned long long v[8] = {};
+	FILE *f = std::fopen("/proc/stat", "r");
+	int n;
+
+	if (!f)
+		return false;
+	n = std::fscanf(f, "cpu %llu %llu %llu %llu %llu %llu %llu %llu", &v[0], &v[1],
+			&v[2], &v[3], &v[4], &v[5], &v[6], &v[7]);
+	std::fclose(f);
+	if (n < 4)
+		return false;
+
+	/* user nice system idle iowait irq softirq steal */
+	busy = v[0] + v[1] + v[2] + v[5] + v[6] + v[7];
+	total = busy + v[3] + v[4];
+	return true;
+}
+
+static double cpu_ms(const rusage &ru)
+{
+	return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1e3 +
+		(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e3;
+}
+
+/* what a reader does with a block: look at every entry header once */
+static void take(const sios_cap_block *blk, tally &t, std::uint32_t &seq, bool &started)
+{
+	std::uint32_t s = le32toh(blk->seq);
+
+	if (started && s != seq)
+		t.lost += s - seq;
+	seq = s + 1;
+	started = true;
+	t.blocks++;
+	t.entries += le32toh(blk->count);
+}
+
+static int wait_in(int fd, clk::time_point end)
+{
+	auto left = std::chrono::duration_cast<std::chrono::milliseconds>(end - clk::now());
+	pollfd p = { fd, POLLIN, 0 };
+
+	if (left.count() <= 0)
+		return 0;
+	return poll(&p, 1, left.count());
+}
+
+static void read_reader(int fd, clk::time_point end, tally &t)
+{
+	static char buf[READ_BLOCKS * SIOS_CAP_BLOCK_SIZE];
+	std::uint32_t seq = 0;
+	bool started = false;
+	ssize_t n;
+
+	while (clk::now() < end) {
+		n = read(fd, buf, sizeof(buf));
+		if (n < 0 && errno == EAGAIN) {
+			if (wait_in(fd, end) < 0 && errno != EINTR)
+				break;
+			continue;
+		}
+		if (n <= 0) {
+			t.error = n ? errno : EPIPE;
+			return;
+		}
+		for (ssize_t off = 0; off < n; off += SIOS_CAP_BLOCK_SIZE)
+			take(reinterpret_cast<const sios_cap_block *>(buf + off), t, seq, started);
+	}
+}
+
+static void mmap_reader(int fd, clk::time_point end, tally &t)
+{
+	std::uint32_t seq = 0, n;
+	bool started = false;
+	sios_cap_ring ring;
+	const char *map;
+	size_t len;
+
+	if (ioctl(fd, SIOS_CAP_IOC_PEEK, &ring) < 0) {
+		t.error = errno;
+		return;
+	}
+	len = size_t(ring.blocks) * SIOS_CAP_BLOCK_SIZE;
+	map = static_cast<const char *>(mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, 0));
+	if (map == MAP_FAILED) {
+		t.error = errno;
+		return;
+	}
+
+	while (clk::now() < end) {
+		if (ioctl(fd, SIOS_CAP_IOC_PEEK, &ring) < 0) {
+			t.error = errno;
+			break;
+		}
+		if (!ring.count) {
+			if (wait_in(fd, end) < 0 && errno != EINTR)
+				break;
+			continue;
+		}
+		tally got = {};
+		std::uint32_t got_seq = seq;
+		bool got_started = started;
+		for (n=0; n<ring.count; n++) {
+			size_t off = size_t((ring.first + n) % ring.blocks) * SIOS_CAP_BLOCK_SIZE;
+			take(reinterpret_cast<const sios_cap_block *>(map + off), got, got_seq,
+			     got_started);
+		}
+		if (ioctl(fd, SIOS_CAP_IOC_CONSUME, &ring.count) < 0) {
+			if (errno != EOVERFLOW) {
+				t.error = errno;
+				break;
+			}
+			/* overwritten while we looked, dropped */
+			continue;
+		}
+		t.blocks += got.blocks;
+		t.entries += got.entries;
+		t.lost += got.lost;
+		seq = got_seq;
+		started = got_started;
+	}
+	if (ioctl(fd, SIOS_CAP_IOC_PEEK, &ring) == 0)
+		t.lost += ring.lost;
+
+	munmap(const_cast<char *>(map), len);
+}
+
+static void reader(bool use_mmap, clk::time_point end, int out)
+{
+	tally t = {};
+	int fd;
+
+	fd = open(CAPTURE_DEV, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0)
+		t.error = errno;
+	else if (use_mmap)
+		mmap_reader(fd, end, t);
+	else
+		read_reader(fd, end, t);
+	if (fd >= 0)
+		close(fd);
+
+	if (write(out, &t, sizeof(t)) != sizeof(t))
+		_exit(1);
+	_exit(0);
+}
+
+static bool run(int readers, int seconds, bool use_mmap)
+{
+	unsigned long long busy0, total0, busy1, total1;
+	std::vector<pid_t> pids;
+	tally sum = {}, t;
+	rusage ru0, ru1;
+	clk::time_point t0, end;
+	double wall;
+	int fds[2], error = 0;
+
+	if (pipe(fds) < 0) {
+		std::perror("pipe");
+		return false;
+	}
+	getrusage(RUSAGE_CHILDREN, &ru0);
+	if (!cpu_jiffies(busy0, total0)) {
+		std::perror("/proc/stat");
+		return false;
+	}
+	t0 = clk::now();
+	end = t0 + std::chrono::seconds(seconds);
+
+	for (int i=0; i<readers; i++) {
+		pid_t pid = fork();
+
+		if (pid < 0) {
+			std::perror("fork");
+			break;
+		}
+		if (!pid) {
+			close(fds[0]);
+			reader(use_mmap, end, fds[1]);
+		}
+		pids.push_back(pid);
+	}
+	close(fds[1]);
+
+	for (size_t i=0; i<pids.size(); i++) {
+		if (read(fds[0], &t, sizeof(t)) != sizeof(t))
+			break;
+		sum.blocks += t.blocks;
+		sum.entries += t.entries;
+		sum.lost += t.lost;
+		if (t.error)
+			error = t.error;
+	}
+	close(fds[0]);
+	for (pid_t pid : pids)
+		waitpid(pid, nullptr, 0);
+
+	wall = std::chrono::duration<double>(clk::now() - t0).count();
+	cpu_jiffies(busy1, total1);
+	getrusage(RUSAGE_CHILDREN, &ru1);
+
+	if (error) {
+		std::fprintf(stderr, "%d readers: %s\n", readers, std::strerror(error));
+		return false;
+	}
+	if (int(pids.size()) != readers)
+		return false;
+
+	std::printf("%7d %12.0f %12.0f %8lu %12.1f %12.1f %8.1f\n", readers,
+		    sum.blocks / wall / readers, sum.entries / wall / readers,
+		    sum.lost / readers, (cpu_ms(ru1) - cpu_ms(ru0)) / wall,
+		    (cpu_ms(ru1) - cpu_ms(ru0)) / wall / readers,
+		    total1 > total0 ? 100.0 * (busy1 - busy0) / (total1 - total0) : 0.0);
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	int max = argc > 1 ? std::atoi(argv[1]) : DEFAULT_READERS;
+	int seconds = argc > 2 ? std::atoi(argv[2]) : DEFAULT_SECONDS;
+	bool use_mmap = argc > 3 && !std::strcmp(argv[3], "mmap");
+
+	if (max < 1 || seconds < 1) {
+		std::fprintf(stderr, "usage: %s [max readers [seconds [read|mmap]]]\n", argv[0]);
+		return 2;
+	}
+
+	std::printf("%s readers, %d s each, online CPUs %ld\n", use_mmap ? "mmap" : "read",
+		    seconds, sysconf(_SC_NPROCESSORS_ONLN));
+	std::printf("%7s %12s %12s %8s %12s %12s %8s\n", "readers", "blocks/s", "entries/s",
+		    "lost", "cpu ms/s", "per reader", "sys %");
+
+	for (int n=1; n<=max; n*=2) {
+		if (!run(n, seconds, use_mmap))
+			return 1;
+	}
+
+	return 0;
+}
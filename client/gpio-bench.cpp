@@ -0,0 +1,201 @@
+/*
+ * gpio-bench.cpp - SIOS userspace client: pin toggle rate per access path
+ *
+ * Copyright (C) 2008 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA, or http://www.gnu.org/licenses/gpl.html
+ */
+
+/*
+ * Toggles one output pin through each way userspace has to a pin and
+ * shows the level changes per second:
+ *
+ *	file		a write per change to a pin file, by default the
+ *			Gumstix /proc/gpio/GPIOn, before the pin is claimed
+ *	ioctl		SIOS_GPIO_IOC_BATCH with one op per call
+ *	ioctl batch	SIOS_GPIO_IOC_BATCH with SIOS_GPIO_MAX_BATCH ops
+ *	mmap		GPSR/GPCR written through the mapped register page,
+ *			needs gpio_mmap=1 and CAP_SYS_RAWIO
+ *
+ *	sios-gpio-bench pin [changes [file on off]]
+ *
+ * The pin must be free and able to drive, it is left low.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <linux/types.h>
+#include "sios/gpiodev.h"
+
+#define GPIO_DEV	"/dev/sios_gpio"
+#define DEFAULT_CHANGES	100000
+
+typedef std::chrono::steady_clock clk;
+
+static void report(const char *path, unsigned long changes, clk::time_point t0)
+{
+	double ms = std::chrono::duration<double, std::milli>(clk::now() - t0).count();
+
+	std::printf("%-12s %10lu %10.1f %12.0f\n", path, changes, ms, changes / (ms / 1e3));
+}
+
+static void bench_file(const char *path, const char *on, const char *off,
+		       unsigned long changes)
+{
+	size_t on_len = std::strlen(on), off_len = std::strlen(off);
+	clk::time_point t0;
+	unsigned long i;
+	int fd;
+
+	fd = open(path, O_WRONLY);
+	if (fd < 0) {
+		std::printf("%-12s skipped, %s: %s\n", "file", path, std::strerror(errno));
+		return;
+	}
+
+	t0 = clk::now();
+	for (i=0; i<changes; i++) {
+		const char *s = (i & 1) ? off : on;
+		if (pwrite(fd, s, (i & 1) ? off_len : on_len, 0) < 0) {
+			std::printf("%-12s failed, %s: %s\n", "file", path, std::strerror(errno));
+			close(fd);
+			return;
+		}
+	}
+	report("file", changes, t0);
+	close(fd);
+}
+
+static void bench_ioctl(int fd, unsigned int pin, unsigned long changes, unsigned int per_call)
+{
+	std::vector<sios_gpio_op> ops(std::max(per_call, 2u));
+	sios_gpio_batch batch = {};
+	std::uint32_t bit = 1u << (pin & 0x1f);
+	unsigned long done = 0;
+	clk::time_point t0;
+	unsigned int i;
+
+	for (i=0; i<ops.size(); i++) {
+		ops[i] = {};
+		if (i & 1)
+			ops[i].clear[pin >> 5] = bit;
+		else
+			ops[i].set[pin >> 5] = bit;
+	}
+	t0 = clk::now();
+	while (done < changes) {
+		/* set then clear, so that the pin ends low */
+		batch.ops = (unsigned long)(ops.data() + (done & 1));
+		batch.count = std::min<unsigned long>(per_call, changes - done);
+		if (ioctl(fd, SIOS_GPIO_IOC_BATCH, &batch) < 0) {
+			std::printf("%-12s failed: %s\n", "ioctl", std::strerror(errno));
+			return;
+		}
+		done += batch.count;
+	}
+	report(per_call > 1 ? "ioctl batch" : "ioctl", changes, t0);
+}
+
+static void bench_mmap(int fd, unsigned int pin, unsigned long changes)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	volatile std::uint32_t *set, *clr;
+	std::uint32_t bit = 1u << (pin & 0x1f);
+	clk::time_point t0;
+	unsigned long i;
+	char *regs;
+
+	regs = static_cast<char *>(mmap(nullptr, page, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+	if (regs == MAP_FAILED) {
+		std::printf("%-12s skipped: %s\n", "mmap", std::strerror(errno));
+		return;
+	}
+	set = reinterpret_cast<volatile std::uint32_t *>(regs + sios_gpio_gpsr(pin >> 5));
+	clr = reinterpret_cast<volatile std::uint32_t *>(regs + sios_gpio_gpcr(pin >> 5));
+
+	t0 = clk::now();
+	for (i=0; i<changes; i++) {
+		if (i & 1)
+			*clr = bit;
+		else
+			*set = bit;
+	}
+	*clr = bit;
+	report("mmap", changes, t0);
+
+	munmap(regs, page);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long changes = DEFAULT_CHANGES;
+	sios_gpio_claim claim = {};
+	char path[64];
+	const char *file = path, *on = "GPIO out set", *off = "GPIO out clear";
+	unsigned int pin;
+	int fd;
+
+	if (argc < 2) {
+		std::fprintf(stderr, "usage: %s pin [changes [file on off]]\n", argv[0]);
+		return 2;
+	}
+	pin = std::strtoul(argv[1], nullptr, 0);
+	if (argc > 2)
+		changes = std::strtoul(argv[2], nullptr, 0);
+	changes &= ~1ul;
+	std::snprintf(path, sizeof(path), "/proc/gpio/GPIO%u", pin);
+	if (argc > 5) {
+		file = argv[3];
+		on = argv[4];
+		off = argv[5];
+	}
+
+	std::printf("%-12s %10s %10s %12s\n", "path", "changes", "ms", "changes/s");
+	bench_file(file, on, off, changes);
+
+	fd = open(GPIO_DEV, O_RDWR | O_CLOEXEC);
+	if (fd < 0) {
+		std::perror(GPIO_DEV);
+		return 1;
+	}
+	claim.start = claim.end = pin;
+	claim.flags = SIOS_GPIO_OUTPUT;
+	if (ioctl(fd, SIOS_GPIO_IOC_CLAIM, &claim) < 0) {
+		std::fprintf(stderr, "claim of pin %u: %s\n", pin, std::strerror(errno));
+		return 1;
+	}
+
+	bench_ioctl(fd, pin, changes, 1);
+	bench_ioctl(fd, pin, changes, SIOS_GPIO_MAX_BATCH);
+	bench_mmap(fd, pin, changes);
+
+	if (ioctl(fd, SIOS_GPIO_IOC_RELEASE, &claim) < 0)
+		std::fprintf(stderr, "release of pin %u: %s\n", pin, std::strerror(errno));
+	close(fd);
+	return 0;
+}
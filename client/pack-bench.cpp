@@ -0,0 +1,270 @@
+/*
+ * pack-bench.cpp - SIOS userspace client: packed against unpacked capture
+ *
+ * Copyright (C) 2008 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA, or http://www.gnu.org/licenses/gpl.html
+ */
+
+/*
+ * The same 8 channel scans stored as a capture would with and without
+ * capture_packed: DATA blocks of one entry per sample, or SCAN blocks
+ * of one 17 byte record per scan. For each the table shows how many
+ * scans a block holds and three rates in scans per second:
+ *
+ *	build	filling the blocks, what the driver does per scan
+ *	copy	copying the blocks out in reads of 16 blocks, what
+ *		read does per reader
+ *	decode	the blocks through a pipe into a capture_stream, each
+ *		sample checked as it comes out
+ *
+ * Needs no board, the blocks are made here.
+ *
+ *	sios-pack-bench [scans]
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <endian.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "sios/client.hpp"
+
+#define CHANNELS	8
+#define PERIOD_NS	125000		/* 8 kHz scans */
+#define READ_BLOCKS	16
+#define DEFAULT_SCANS	1000000
+
+typedef std::chrono::steady_clock clk;
+
+typedef std::vector<std::uint8_t> capture;
+
+static std::uint16_t sample(unsigned long scan, int ch)
+{
+	return (scan * CHANNELS + ch) & 0x0fff;
+}
+
+static sios_cap_block *new_block(capture &cap, std::uint32_t seq, int type, std::uint64_t ns)
+{
+	sios_cap_block *blk;
+
+	cap.resize(cap.size() + SIOS_CAP_BLOCK_SIZE);
+	blk = reinterpret_cast<sios_cap_block *>(cap.data() + cap.size() - SIOS_CAP_BLOCK_SIZE);
+	blk->magic = htole32(SIOS_CAP_MAGIC);
+	blk->version = htole16(SIOS_CAP_VERSION);
+	blk->type = htole16(type);
+	blk->seq = htole32(seq);
+	blk->base_ns = htole64(ns);
+	return blk;
+}
+
+/* unpacked: CHANNELS DATA entries per scan, no scan split over two blocks */
+static capture build_data(unsigned long scans)
+{
+	const unsigned int per_block = SIOS_CAP_EVENTS_PER_BLOCK / CHANNELS;
+	sios_cap_block *blk = nullptr;
+	sios_cap_event *ev = nullptr;
+	std::uint64_t base = 0, ns;
+	std::uint32_t seq = 0, n = 0;
+	capture cap;
+
+	cap.reserve((scans / per_block + 1) * SIOS_CAP_BLOCK_SIZE);
+	for (unsigned long s=0; s<scans; s++) {
+		ns = s * PERIOD_NS;
+		if (!blk || n == per_block) {
+			blk = new_block(cap, seq++, SIOS_CAP_BLK_DATA, ns);
+			ev = reinterpret_cast<sios_cap_event *>(blk + 1);
+			base = ns;
+			n = 0;
+		}
+		for (int ch=0; ch<CHANNELS; ch++) {
+			ev->delta_ns = htole32(ns - base);
+			ev->source = ch;
+			ev->flags = 0;
+			ev->value = htole16(sample(s, ch));
+			ev++;
+		}
+		n++;
+		blk->count = htole32(n * CHANNELS);
+	}
+	return cap;
+}
+
+/* packed: one set of all channels, a record per scan */
+static capture build_scan(unsigned long scans)
+{
+	const unsigned int rec_len = SIOS_CAP_SCAN_REC_LEN(CHANNELS);
+	const unsigned int per_block = (SIOS_CAP_BLOCK_SIZE - SIOS_CAP_SCAN_DATA) / rec_len;
+	sios_cap_block *blk = nullptr;
+	std::uint16_t vals[CHANNELS];
+	std::uint64_t base = 0, ns;
+	std::uint32_t seq = 0, n = 0, delta;
+	std::uint8_t *rec = nullptr;
+	capture cap;
+
+	cap.reserve((scans / per_block + 1) * SIOS_CAP_BLOCK_SIZE);
+	for (unsigned long s=0; s<scans; s++) {
+		ns = s * PERIOD_NS;
+		if (!blk || n == per_block) {
+			blk = new_block(cap, seq++, SIOS_CAP_BLK_SCAN, ns);
+			auto *set = reinterpret_cast<sios_cap_scan_set *>(blk + 1);
+			set->nr = CHANNELS;
+			for (int ch=0; ch<CHANNELS; ch++)
+				set->source[ch] = ch;
+			rec = reinterpret_cast<std::uint8_t *>(blk) + SIOS_CAP_SCAN_DATA;
+			base = ns;
+			n = 0;
+		}
+		for (int ch=0; ch<CHANNELS; ch++)
+			vals[ch] = sample(s, ch);
+		delta = htole32(ns - base);
+		std::memcpy(rec, &delta, 4);
+		rec[4] = 0;
+		sios_cap_pack12(rec + 5, vals, CHANNELS);
+		rec += rec_len;
+		n++;
+		blk->count = htole32(n);
+	}
+	return cap;
+}
+
+static double secs(clk::time_point t0)
+{
+	return std::chrono::duration<double>(clk::now() - t0).count();
+}
+
+/* read's share: the blocks copied out READ_BLOCKS at a time */
+static double copy_rate(const capture &cap, unsigned long scans)
+{
+	static std::uint8_t buf[READ_BLOCKS * SIOS_CAP_BLOCK_SIZE];
+	const int passes = 10;
+	volatile std::uint8_t sink = 0;
+	clk::time_point t0 = clk::now();
+	std::size_t off, len;
+
+	for (int p=0; p<passes; p++) {
+		for (off=0; off<cap.size(); off+=len) {
+			len = std::min(sizeof(buf), cap.size() - off);
+			std::memcpy(buf, cap.data() + off, len);
+			sink = sink + buf[len - 1];
+		}
+	}
+	return scans * passes / secs(t0);
+}
+
+struct check {
+	unsigned long samples = 0;
+	bool ok = true;
+};
+
+static sios::task consume(sios::capture_stream &s, check &c, sios::reactor &r)
+{
+	for (;;) {
+		for (const sios::event &ev : co_await s.next()) {
+			unsigned long scan = c.samples / CHANNELS;
+			int ch = c.samples % CHANNELS;
+
+			if (ev.source != ch || ev.value != sample(scan, ch) ||
+			    ev.ns != scan * PERIOD_NS)
+				c.ok = false;
+			c.samples++;
+		}
+		if (s.closed())
+			break;
+	}
+	r.stop();
+}
+
+/* the blocks written into a pipe and decoded from it by the client */
+static double decode_rate(const capture &cap, unsigned long scans, bool &ok)
+{
+	char path[32];
+	clk::time_point t0;
+	int fds[2];
+	check c;
+
+	if (pipe2(fds, O_CLOEXEC) < 0) {
+		std::perror("pipe2");
+		std::exit(1);
+	}
+	std::snprintf(path, sizeof(path), "/proc/self/fd/%d", fds[0]);
+
+	sios::reactor r;
+	sios::capture_stream s(r, path);
+	close(fds[0]);
+	consume(s, c, r);
+
+	t0 = clk::now();
+	std::thread writer([&] {
+		/* a block per write, so that the pipe keeps them whole */
+		for (std::size_t off=0; off<cap.size(); off+=SIOS_CAP_BLOCK_SIZE) {
+			if (write(fds[1], cap.data() + off, SIOS_CAP_BLOCK_SIZE) !=
+			    SIOS_CAP_BLOCK_SIZE) {
+				std::perror("write");
+				std::exit(1);
+			}
+		}
+		close(fds[1]);
+	});
+	r.run();
+	writer.join();
+
+	ok = c.ok && c.samples == scans * CHANNELS && !s.lost_blocks();
+	return scans / secs(t0);
+}
+
+static bool run(const char *name, capture (*build)(unsigned long), unsigned long scans)
+{
+	clk::time_point t0 = clk::now();
+	capture cap = build(scans);
+	double build_rate = scans / secs(t0);
+	std::size_t blocks = cap.size() / SIOS_CAP_BLOCK_SIZE;
+	double copy = copy_rate(cap, scans);
+	bool ok;
+	double decode = decode_rate(cap, scans, ok);
+
+	std::printf("%-8s %8zu %11.1f %11.1f %10.2f %10.2f %10.2f %s\n", name, blocks,
+		    double(cap.size()) / scans, double(scans) / blocks, build_rate / 1e6,
+		    copy / 1e6, decode / 1e6, ok ? "ok" : "BAD");
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long scans = argc > 1 ? std::strtoul(argv[1], nullptr, 0) : DEFAULT_SCANS;
+	bool ok;
+
+	if (!scans) {
+		std::fprintf(stderr, "usage: %s [scans]\n", argv[0]);
+		return 2;
+	}
+
+	std::printf("%lu scans of %d channels, rates in Mscans/s\n", scans, CHANNELS);
+	std::printf("%-8s %8s %11s %11s %10s %10s %10s\n", "format", "blocks",
+		    "bytes/scan", "scans/block", "build", "copy", "decode");
+	ok = run("data", build_data, scans);
+	ok = run("scan", build_scan, scans) && ok;
+
+	return ok ? 0 : 1;
+}
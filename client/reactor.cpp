@@ -0,0 +1,174 @@
+/*
+ * reactor.cpp - SIOS userspace client: the epoll reactor
+ *
+ * Copyright (C) 2008 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA, or http://www.gnu.org/licenses/gpl.html
+ */
+
+#include <cerrno>
+#include <exception>
+#include <system_error>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "sios/client.hpp"
+
+namespace sios {
+
+/* readiness events taken per epoll_wait */
+#define REACTOR_EVENTS	64
+
+static std::system_error sys_error(const char *what)
+{
+	return std::system_error(errno, std::generic_category(), what);
+}
+
+void task::promise_type::unhandled_exception() noexcept
+{
+	std::terminate();
+}
+
+reactor::reactor()
+	: stopping_(false), waits_(0), wakeups_(0)
+{
+	struct epoll_event ev = {};
+
+	epfd_ = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd_ < 0)
+		throw sys_error("epoll_create1");
+
+	stopfd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (stopfd_ < 0) {
+		close(epfd_);
+		throw sys_error("eventfd");
+	}
+
+	/* the only entry without a source */
+	ev.events = EPOLLIN;
+	ev.data.ptr = nullptr;
+	if (epoll_ctl(epfd_, EPOLL_CTL_ADD, stopfd_, &ev) < 0) {
+		close(stopfd_);
+		close(epfd_);
+		throw sys_error("epoll_ctl");
+	}
+}
+
+reactor::~reactor()
+{
+	close(stopfd_);
+	close(epfd_);
+}
+
+void reactor::run()
+{
+	struct epoll_event evs[REACTOR_EVENTS];
+	std::uint64_t val;
+	int i, n;
+
+	stopping_ = false;
+	while (!stopping_) {
+		n = epoll_wait(epfd_, evs, REACTOR_EVENTS, -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			throw sys_error("epoll_wait");
+		}
+		waits_++;
+
+		for (i=0; i<n; i++) {
+			if (!evs[i].data.ptr) {
+				if (read(stopfd_, &val, sizeof(val)) < 0 && errno != EAGAIN)
+					throw sys_error("read");
+				stopping_ = true;
+				continue;
+			}
+			wakeups_++;
+			static_cast<source *>(evs[i].data.ptr)->ready(evs[i].events);
+		}
+	}
+}
+
+void reactor::stop()
+{
+	std::uint64_t one = 1;
+
+	/* only fails when the counter is full, which stops just as well */
+	if (write(stopfd_, &one, sizeof(one)) < 0 && errno != EAGAIN)
+		throw sys_error("write");
+}
+
+void reactor::add(source *s, std::uint32_t events)
+{
+	struct epoll_event ev = {};
+
+	ev.events = events | EPOLLET;
+	ev.data.ptr = s;
+	if (epoll_ctl(epfd_, EPOLL_CTL_ADD, s->fd(), &ev) < 0)
+		throw sys_error("epoll_ctl");
+}
+
+void reactor::remove(source *s)
+{
+	epoll_ctl(epfd_, EPOLL_CTL_DEL, s->fd(), nullptr);
+}
+
+source::source(reactor &r, int fd, std::uint32_t events)
+	: drained_(false), hangup_(false), reactor_(r), fd_(fd), error_(0), closed_(false)
+{
+	try {
+		reactor_.add(this, events);
+	} catch (...) {
+		close(fd_);
+		throw;
+	}
+}
+
+source::~source()
+{
+	reactor_.remove(this);
+	close(fd_);
+}
+
+void source::ready(std::uint32_t events)
+{
+	std::coroutine_handle<> h;
+
+	drained_ = false;
+	if (events & EPOLLHUP)
+		hangup_ = true;
+	if (!waiter_ || !fill())
+		return;
+
+	/* the coroutine may wait on this source again before it returns */
+	h = waiter_;
+	waiter_ = nullptr;
+	h.resume();
+}
+
+void source::check()
+{
+	int error = error_;
+
+	if (error) {
+		error_ = 0;
+		throw std::system_error(error, std::generic_category());
+	}
+}
+
+} /* namespace sios */
@@ -0,0 +1,291 @@
+/* -*-c++-*-
+ * client.hpp - SIOS userspace client: awaitable sensor and event streams
+ *
+ * Copyright (C) 2008 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA, or http://www.gnu.org/licenses/gpl.html
+ */
+
+#ifndef _SIOS_CLIENT_HPP_
+#define _SIOS_CLIENT_HPP_
+
+/*
+ * Every SIOS stream is a file that poll works on: the capture ring
+ * (/dev/sios_capture, sensor samples, see sios/capture.h), the power
+ * telemetry (/dev/sios_power, see sios/powerdev.h) and the POLLPRI
+ * state attributes of the power button and the power device. One
+ * reactor waits on all of them with epoll from a single thread, and
+ * coroutines take what arrived a batch at a time:
+ *
+ *	sios::task watch(sios::capture_stream &cap)
+ *	{
+ *		for (;;) {
+ *			for (const sios::event &ev : co_await cap.next())
+ *				use(ev);
+ *			if (cap.closed())
+ *				co_return;
+ *		}
+ *	}
+ *
+ *	sios::reactor r;
+ *	sios::capture_stream cap(r);
+ *	watch(cap);
+ *	r.run();
+ *
+ * A batch is everything one read returned, in a buffer the stream owns
+ * and reuses; it stays valid until the next co_await on that stream.
+ * Once the coroutines are started nothing is allocated: the buffers are
+ * sized when a stream is made and the coroutine frames live as long as
+ * their loops. A read error is thrown as std::system_error from the
+ * co_await; a task lets nothing escape, see task.
+ *
+ * Streams and coroutines belong to the reactor thread. Only stop may
+ * be called from elsewhere.
+ */
+
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include <linux/types.h>
+#include "sios/capture.h"
+#include "sios/powerdev.h"
+
+namespace sios {
+
+/*
+ * A coroutine started right away and run by whatever resumes it. The
+ * frame goes away when the body returns; an exception leaving the body
+ * ends the program.
+ */
+struct task {
+	struct promise_type {
+		task get_return_object() noexcept { return {}; }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() noexcept {}
+		void unhandled_exception() noexcept;
+	};
+};
+
+class source;
+
+class reactor {
+public:
+	reactor();
+	~reactor();
+	reactor(const reactor &) = delete;
+	reactor &operator=(const reactor &) = delete;
+
+	/* wait and dispatch until stop */
+	void run();
+	/* from any thread, run returns after the events at hand */
+	void stop();
+
+	/* epoll_wait calls and the readiness events they returned */
+	std::uint64_t waits() const { return waits_; }
+	std::uint64_t wakeups() const { return wakeups_; }
+
+private:
+	friend class source;
+	void add(source *s, std::uint32_t events);
+	void remove(source *s);
+
+	int epfd_;
+	int stopfd_;
+	bool stopping_;
+	std::uint64_t waits_;
+	std::uint64_t wakeups_;
+};
+
+/*
+ * One pollable file registered with a reactor, edge triggered. fill
+ * reads what is there without blocking and keeps it as the batch; a
+ * coroutine only waits when it found nothing.
+ *
+ * A read that came back short emptied the file, fill then sets drained
+ * and leaves the file alone until the next edge instead of spending a
+ * read on EAGAIN. After a hangup there is no edge to come, fill reads
+ * on to end of file.
+ */
+class source {
+public:
+	source(const source &) = delete;
+	source &operator=(const source &) = delete;
+	virtual ~source();
+
+	int fd() const { return fd_; }
+	/* end of file, the batch that came with it is the last */
+	bool closed() const { return closed_; }
+
+protected:
+	/* takes fd, which must be non-blocking */
+	source(reactor &r, int fd, std::uint32_t events);
+
+	/*
+	 * true for a batch, also for an empty one at end of file or error;
+	 * false once drained or a read would block, an edge comes after that
+	 */
+	virtual bool fill() = 0;
+	void fail(int error) { error_ = error; }
+	void close_stream() { closed_ = true; }
+	void check();
+
+	bool drained_;
+	bool hangup_;
+
+	template<class Batch>
+	struct awaiter {
+		source &s;
+		Batch (*batch)(source &);
+
+		bool await_ready() { return s.fill(); }
+		void await_suspend(std::coroutine_handle<> h) noexcept { s.waiter_ = h; }
+		Batch await_resume()
+		{
+			s.check();
+			return batch(s);
+		}
+	};
+
+private:
+	friend class reactor;
+	/* the file is ready, hand a batch to a waiting coroutine */
+	void ready(std::uint32_t events);
+
+	reactor &reactor_;
+	int fd_;
+	int error_;
+	bool closed_;
+	std::coroutine_handle<> waiter_;
+};
+
+/*
+ * Fixed size records from a character device or pipe, up to capacity
+ * per read. Devices hand out whole records; a record split over two
+ * reads of a pipe is put back together.
+ */
+class record_source : public source {
+protected:
+	record_source(reactor &r, int fd, std::size_t size, std::size_t capacity);
+
+	bool fill() override;
+	std::span<const std::byte> bytes() const { return {buf_.data(), count_ * size_}; }
+
+private:
+	std::size_t size_;
+	std::size_t count_;	/* whole records in buf_ */
+	std::size_t carry_;	/* bytes of an incomplete record after them */
+	std::vector<std::byte> buf_;
+};
+
+template<class T>
+class record_stream : public record_source {
+public:
+	record_stream(reactor &r, int fd, std::size_t capacity = 256)
+		: record_source(r, fd, sizeof(T), capacity) {}
+
+	awaiter<std::span<const T>> next() { return {*this, &batch_of}; }
+
+private:
+	static std::span<const T> batch_of(source &s)
+	{
+		auto b = static_cast<record_stream &>(s).bytes();
+		return {reinterpret_cast<const T *>(b.data()), b.size() / sizeof(T)};
+	}
+};
+
+/* /dev/sios_power, rail power and energy per telemetry period */
+class power_stream : public record_stream<sios_power_record> {
+public:
+	explicit power_stream(reactor &r, const char *path = "/dev/sios_power");
+};
+
+/* one sample or event of the capture ring, time on the event clock */
+struct event {
+	std::uint64_t ns;
+	std::uint8_t source;	/* id in the SOURCES table, see source_name */
+	std::uint8_t shift;	/* of the rate, max_rate >> shift */
+	std::uint16_t value;
+};
+
+/*
+ * /dev/sios_capture, decoded: DATA and SCAN blocks become events, the
+ * SOURCES blocks update the names. Each read takes up to blocks blocks.
+ */
+class capture_stream : public source {
+public:
+	explicit capture_stream(reactor &r, const char *path = "/dev/sios_capture",
+				std::size_t blocks = 4);
+
+	awaiter<std::span<const event>> next() { return {*this, &batch_of}; }
+
+	/* "" for an id not in the table */
+	std::string_view source_name(std::uint8_t id) const;
+	std::uint16_t source_max_rate(std::uint8_t id) const { return max_rate_[id]; }
+	/* blocks missed, events the kernel dropped */
+	std::uint64_t lost_blocks() const { return lost_blocks_; }
+	std::uint64_t dropped() const { return dropped_; }
+
+protected:
+	bool fill() override;
+
+private:
+	static std::span<const event> batch_of(source &s);
+	void decode(const sios_cap_block *blk);
+
+	std::vector<std::byte> buf_;
+	std::vector<event> events_;
+	std::size_t nr_events_;
+	char names_[256][SIOS_CAP_NAME_LEN + 1];
+	std::uint16_t max_rate_[256];
+	bool started_;
+	std::uint32_t next_seq_;
+	std::uint64_t lost_blocks_;
+	std::uint64_t dropped_;
+};
+
+/*
+ * A sysfs attribute that notifies its changes, such as the power
+ * device's "state" or the power button's. The first batch is the value
+ * at open, then one per change; changes in between are folded.
+ */
+class attr_stream : public source {
+public:
+	attr_stream(reactor &r, const char *path);
+
+	awaiter<std::string_view> next() { return {*this, &batch_of}; }
+
+protected:
+	bool fill() override;
+
+private:
+	static std::string_view batch_of(source &s);
+
+	std::size_t len_;
+	char buf_[4096];
+};
+
+/* board 0 unless told otherwise, device names as sios_board_devname */
+attr_stream button_state(reactor &r, int board = 0);
+attr_stream power_state(reactor &r, int board = 0);
+
+} /* namespace sios */
+
+#endif /* _SIOS_CLIENT_HPP_ */
@@ -0,0 +1,312 @@
+/*
+ * streams.cpp - SIOS userspace client: capture, telemetry and attributes
+ *
+ * Copyright (C) 2008 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA, or http://www.gnu.org/licenses/gpl.html
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <system_error>
+
+#include <endian.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "sios/client.hpp"
+
+namespace sios {
+
+/* most events one capture block decodes to, a SCAN block of full scans */
+#define CAP_MAX_EVENTS \
+	std::max<std::size_t>(SIOS_CAP_EVENTS_PER_BLOCK, \
+		((SIOS_CAP_BLOCK_SIZE - SIOS_CAP_SCAN_DATA) / \
+		 SIOS_CAP_SCAN_REC_LEN(SIOS_CAP_SCAN_MAX) + 1) * SIOS_CAP_SCAN_MAX)
+
+static int open_stream(const char *path)
+{
+	int fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+
+	if (fd < 0)
+		throw std::system_error(errno, std::generic_category(), path);
+	return fd;
+}
+
+/* read what fits, setting drained when the file is empty after it */
+static ssize_t read_batch(int fd, void *buf, std::size_t len, bool &drained, bool hangup)
+{
+	ssize_t n;
+
+	do {
+		n = read(fd, buf, len);
+	} while (n < 0 && errno == EINTR);
+
+	if ((n < 0 && errno == EAGAIN) || (n > 0 && std::size_t(n) < len && !hangup))
+		drained = true;
+	return n;
+}
+
+record_source::record_source(reactor &r, int fd, std::size_t size, std::size_t capacity)
+	: source(r, fd, EPOLLIN), size_(size), count_(0), carry_(0),
+	  buf_(size * capacity)
+{
+}
+
+bool record_source::fill()
+{
+	ssize_t n;
+
+	/* the previous batch is done with, keep only a split record */
+	if (carry_)
+		std::memmove(buf_.data(), buf_.data() + count_ * size_, carry_);
+	count_ = 0;
+
+	while (!drained_) {
+		n = read_batch(fd(), buf_.data() + carry_, buf_.size() - carry_, drained_, hangup_);
+		if (n < 0) {
+			if (errno == EAGAIN)
+				return false;
+			fail(errno);
+			return true;
+		}
+		if (n == 0) {
+			close_stream();
+			return true;
+		}
+
+		count_ = (carry_ + n) / size_;
+		carry_ = (carry_ + n) % size_;
+		if (count_)
+			return true;
+	}
+
+	return false;
+}
+
+power_stream::power_stream(reactor &r, const char *path)
+	: record_stream(r, open_stream(path))
+{
+}
+
+capture_stream::capture_stream(reactor &r, const char *path, std::size_t blocks)
+	: source(r, open_stream(path), EPOLLIN),
+	  buf_(blocks * SIOS_CAP_BLOCK_SIZE), events_(blocks * CAP_MAX_EVENTS),
+	  nr_events_(0), names_(), max_rate_(), started_(false), next_seq_(0),
+	  lost_blocks_(0), dropped_(0)
+{
+}
+
+std::string_view capture_stream::source_name(std::uint8_t id) const
+{
+	return names_[id];
+}
+
+std::span<const event> capture_stream::batch_of(source &s)
+{
+	auto &cs = static_cast<capture_stream &>(s);
+
+	return {cs.events_.data(), cs.nr_events_};
+}
+
+bool capture_stream::fill()
+{
+	std::size_t i;
+	ssize_t n;
+
+	nr_events_ = 0;
+
+	/* a read of SOURCES or INDEX blocks only is no batch, go on */
+	while (!drained_) {
+		n = read_batch(fd(), buf_.data(), buf_.size(), drained_, hangup_);
+		if (n < 0) {
+			if (errno == EAGAIN)
+				return false;
+			fail(errno);
+			return true;
+		}
+		if (n == 0) {
+			close_stream();
+			return true;
+		}
+
+		for (i=0; i + SIOS_CAP_BLOCK_SIZE <= std::size_t(n); i += SIOS_CAP_BLOCK_SIZE)
+			decode(reinterpret_cast<const sios_cap_block *>(buf_.data() + i));
+		if (nr_events_)
+			return true;
+	}
+
+	return false;
+}
+
+void capture_stream::decode(const sios_cap_block *blk)
+{
+	const std::uint8_t *p = reinterpret_cast<const std::uint8_t *>(blk + 1);
+	const std::uint8_t *end = reinterpret_cast<const std::uint8_t *>(blk) +
+				  SIOS_CAP_BLOCK_SIZE;
+	event *ev = events_.data() + nr_events_;
+	std::uint32_t i, j, seq, count, delta;
+	std::uint64_t base;
+	std::uint16_t vals[SIOS_CAP_SCAN_MAX], version;
+	std::uint8_t rate_flags;
+
+	/* older versions are a subset, see sios/capture.h */
+	version = le16toh(blk->version);
+	if (le32toh(blk->magic) != SIOS_CAP_MAGIC || !version || version > SIOS_CAP_VERSION)
+		return;
+
+	seq = le32toh(blk->seq);
+	if (started_ && seq != next_seq_)
+		lost_blocks_ += seq - next_seq_;
+	started_ = true;
+	next_seq_ = seq + 1;
+	dropped_ += le32toh(blk->dropped);
+
+	count = le32toh(blk->count);
+	base = le64toh(blk->base_ns);
+	/* the flags byte only carries the rate shift */
+	rate_flags = (version >= SIOS_CAP_VERSION_RATE) ? 0xff : 0;
+
+	switch (le16toh(blk->type)) {
+	case SIOS_CAP_BLK_SOURCES: {
+		auto *src = reinterpret_cast<const sios_cap_source *>(p);
+
+		count = std::min<std::uint32_t>(count, SIOS_CAP_SOURCES_PER_BLOCK);
+		for (i=0; i<count; i++) {
+			std::memcpy(names_[src[i].id], src[i].name, SIOS_CAP_NAME_LEN);
+			names_[src[i].id][SIOS_CAP_NAME_LEN] = '\0';
+			max_rate_[src[i].id] = rate_flags ? le16toh(src[i].max_rate) : 0;
+		}
+		break;
+	}
+
+	case SIOS_CAP_BLK_DATA: {
+		auto *e = reinterpret_cast<const sios_cap_event *>(p);
+
+		count = std::min<std::uint32_t>(count, SIOS_CAP_EVENTS_PER_BLOCK);
+		for (i=0; i<count; i++)
+			*ev++ = { base + le32toh(e[i].delta_ns), e[i].source,
+				  std::uint8_t(SIOS_CAP_EV_SHIFT(e[i].flags & rate_flags)),
+				  le16toh(e[i].value) };
+		break;
+	}
+
+	case SIOS_CAP_BLK_SCAN: {
+		auto *sets = reinterpret_cast<const sios_cap_scan_set *>(p);
+		const std::uint8_t *rec = reinterpret_cast<const std::uint8_t *>(blk) +
+					  SIOS_CAP_SCAN_DATA;
+		std::uint8_t set, nr;
+
+		if (version < SIOS_CAP_VERSION_SCAN)
+			break;
+		/* records are packed, take them apart bytewise */
+		for (i=0; i<count && rec + 5 <= end; i++) {
+			std::memcpy(&delta, rec, 4);
+			delta = le32toh(delta);
+			set = rec[4];
+
+			if (set == SIOS_CAP_SCAN_EVENT) {
+				if (rec + SIOS_CAP_SCAN_EV_LEN > end)
+					break;
+				*ev++ = { base + delta, rec[5],
+					  std::uint8_t(SIOS_CAP_EV_SHIFT(rec[6] & rate_flags)),
+					  std::uint16_t(rec[7] | rec[8] << 8) };
+				rec += SIOS_CAP_SCAN_EV_LEN;
+				continue;
+			}
+
+			if (set >= SIOS_CAP_SCAN_SETS)
+				break;
+			nr = std::min<std::uint8_t>(sets[set].nr, SIOS_CAP_SCAN_MAX);
+			if (!nr || rec + SIOS_CAP_SCAN_REC_LEN(nr) > end)
+				break;
+			sios_cap_unpack12(vals, rec + 5, nr);
+			for (j=0; j<nr; j++)
+				*ev++ = { base + delta, sets[set].source[j], 0, vals[j] };
+			rec += SIOS_CAP_SCAN_REC_LEN(nr);
+		}
+		break;
+	}
+
+	default:	/* INDEX, and types from later versions */
+		break;
+	}
+
+	nr_events_ = ev - events_.data();
+}
+
+attr_stream::attr_stream(reactor &r, const char *path)
+	: source(r, open_stream(path), EPOLLPRI | EPOLLERR), len_(0)
+{
+}
+
+std::string_view attr_stream::batch_of(source &s)
+{
+	auto &as = static_cast<attr_stream &>(s);
+
+	return {as.buf_, as.len_};
+}
+
+/* sysfs hands the whole value to a read at offset 0, then wants a new poll */
+bool attr_stream::fill()
+{
+	ssize_t n;
+
+	if (drained_)
+		return false;
+	drained_ = true;
+
+	do {
+		n = pread(fd(), buf_, sizeof(buf_) - 1, 0);
+	} while (n < 0 && errno == EINTR);
+	if (n < 0) {
+		fail(errno);
+		len_ = 0;
+		return true;
+	}
+
+	len_ = n;
+	while (len_ && buf_[len_ - 1] == '\n')
+		len_--;
+	return true;
+}
+
+static attr_stream device_state(reactor &r, const char *dev, int board)
+{
+	char path[64];
+
+	if (board)
+		std::snprintf(path, sizeof(path), "/sys/bus/sios/devices/sios:%s.%d/state",
+			      dev, board);
+	else
+		std::snprintf(path, sizeof(path), "/sys/bus/sios/devices/sios:%s/state", dev);
+	return attr_stream(r, path);
+}
+
+attr_stream button_state(reactor &r, int board)
+{
+	return device_state(r, "button", board);
+}
+
+attr_stream power_state(reactor &r, int board)
+{
+	return device_state(r, "power", board);
+}
+
+} /* namespace sios */
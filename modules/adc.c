@@ -0,0 +1,1241 @@
+/* -*-linux-c-*- */
+
+#include <linux/device.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/i2c.h>
+#include <linux/ktime.h>
+#include <asm/arch/gpio.h>
+
+#include "sios/sios.h"
+#include "sios/resource.h"
+#include "sios/hardware.h"
+#include "sios/board.h"
+#include "sios/event.h"
+#include "sios/adc.h"
+
+/*
+ * AD7998 (8 channels) and AD7994 (4 channels) in command mode (mode 2).
+ * A conversion is started by writing the address pointer with the
+ * channel selection in its upper nibble; every 2-byte result read
+ * after it returns the next channel of the selected sequence, so a
+ * burst scan is one write of the command byte followed by one read of
+ * all results. Each result word carries the channel id, which is used
+ * to check the ordering.
+ */
+struct sios_adc_info {
+	const char *name;
+	int nr_channels;
+	int cnv_claim;		/* SIOS_CLAIM_* of the CONVST pin */
+	u8 (*cmd_single)(int ch);
+	u8 (*cmd_seq)(u8 mask);
+	int seq_in_config;	/* cmd_seq converts the configured channels */
+	int config_bytes;	/* width of the configuration register */
+};
+
+/* AD7998: C4..C1 = 1xxx converts one channel, 0111 the config sequence */
+static u8 ad7998_cmd_single(int ch)
+{
+	return (0x8 | ch) << 4;
+}
+
+static u8 ad7998_cmd_seq(u8 mask)
+{
+	return 0x7 << 4;
+}
+
+/* AD7994: C4..C1 select the channels to convert directly */
+static u8 ad7994_cmd_single(int ch)
+{
+	return (1 << ch) << 4;
+}
+
+static u8 ad7994_cmd_seq(u8 mask)
+{
+	return (mask & 0xf) << 4;
+}
+
+static const struct sios_adc_info adc_info[SIOS_NR_ADC] = {
+	[SIOS_ADC_AD7998] = {
+		.name = "ad7998",
+		.nr_channels = 8,
+		.cnv_claim = SIOS_CLAIM_AD7998_CNVST,
+		.cmd_single = ad7998_cmd_single,
+		.cmd_seq = ad7998_cmd_seq,
+		.seq_in_config = 1,
+		.config_bytes = 2,
+	},
+	[SIOS_ADC_AD7994] = {
+		.name = "ad7994",
+		.nr_channels = 4,
+		.cnv_claim = SIOS_CLAIM_AD7994_CNVST,
+		.cmd_single = ad7994_cmd_single,
+		.cmd_seq = ad7994_cmd_seq,
+		.config_bytes = 1,
+	},
+};
+
+static LIST_HEAD(adc_list);
+static DEFINE_MUTEX(adc_list_lock);
+
+/* called with adc_list_lock held, the adc stays only as long as it is */
+static struct sios_adc *sios_adc_find(struct sios_board *board, int chip)
+{
+	struct sios_adc *adc;
+
+	list_for_each_entry(adc, &adc_list, list) {
+		if (adc->board == board && adc->info == &adc_info[chip])
+			return adc;
+	}
+	return NULL;
+}
+
+/* the result is only good until a hot-swap removes the chip */
+struct sios_adc *sios_adc_get(struct sios_board *board, int chip)
+{
+	struct sios_adc *found;
+
+	mutex_lock(&adc_list_lock);
+	found = sios_adc_find(board, chip);
+	mutex_unlock(&adc_list_lock);
+
+	return found;
+}
+EXPORT_SYMBOL_GPL(sios_adc_get);
+
+/*
+ * Register write: the address pointer, then the value MSB first. The
+ * limit registers are 16 bits on both chips, the configuration
+ * register only on the AD7998; the AD7994 takes a single byte there.
+ */
+static void ad799x_reg_msg(struct sios_adc *adc, struct i2c_msg *msg, u8 *buf,
+			   u8 reg, u16 val)
+{
+	buf[0] = reg;
+	if (reg == AD799X_REG_CONFIG && adc->info->config_bytes == 1) {
+		buf[1] = val & 0xff;
+		msg->len = 2;
+	} else {
+		buf[1] = val >> 8;
+		buf[2] = val & 0xff;
+		msg->len = 3;
+	}
+
+	msg->addr = adc->addr;
+	msg->flags = 0;
+	msg->buf = buf;
+}
+
+/* alerts are on when any channel has a limit inside the range */
+static int ad799x_alerts(struct sios_adc *adc)
+{
+	int ch;
+
+	for (ch=0; ch<AD799X_LIMIT_CHANNELS && ch<adc->info->nr_channels; ch++) {
+		if (adc->alert_low[ch] || adc->alert_high[ch] != AD799X_RESULT_MASK)
+			return 1;
+	}
+	return 0;
+}
+
+/* configuration register for a sequence of the channels in mask */
+static u16 ad799x_config(struct sios_adc *adc, u8 mask)
+{
+	u16 cfg = adc->filter ? AD799X_CFG_FLTR : 0;
+	int ch;
+
+	for (ch=0; ch<adc->info->nr_channels; ch++) {
+		if (mask & (1 << ch))
+			cfg |= AD799X_CFG_CHAN(ch);
+	}
+	if (ad799x_alerts(adc))
+		cfg |= AD799X_CFG_ALERT_EN;
+
+	return cfg;
+}
+
+/* configuration, and the limits if alerts are on; returns the message count */
+static int ad799x_setup_msgs(struct sios_adc *adc, u8 (*buf)[3], struct i2c_msg *msg)
+{
+	int alerts = ad799x_alerts(adc);
+	int ch, n = 0;
+
+	ad799x_reg_msg(adc, &msg[n], buf[n], AD799X_REG_CONFIG,
+		       ad799x_config(adc, adc->channels));
+	n++;
+
+	for (ch=0; alerts && ch<AD799X_LIMIT_CHANNELS && ch<adc->info->nr_channels; ch++) {
+		ad799x_reg_msg(adc, &msg[n], buf[n], AD799X_REG_DATA_LOW(ch),
+			       adc->alert_low[ch]);
+		n++;
+		ad799x_reg_msg(adc, &msg[n], buf[n], AD799X_REG_DATA_HIGH(ch),
+			       adc->alert_high[ch]);
+		n++;
+	}
+
+	return n;
+}
+
+static int ad799x_write_config(struct sios_adc *adc)
+{
+	u8 buf[AD799X_SETUP_MSGS][3];
+	struct i2c_msg msg[AD799X_SETUP_MSGS];
+	int n, ret;
+
+	n = ad799x_setup_msgs(adc, buf, msg);
+	ret = sios_i2c_transfer(adc->i2c, msg, n, SIOS_I2C_PRIO_NORMAL);
+	if (ret != n)
+		return (ret < 0) ? ret : -EIO;
+
+	adc->config_mask = adc->channels;
+	return 0;
+}
+
+/* VDD2 feeds the converters, they need their setup again after it was off */
+static int sios_adc_power_get(struct sios_adc *adc)
+{
+	u32 gen;
+	int ret = sios_power_rail_get(adc->board, SIOS_PIN_VDD2, &gen);
+
+	if (ret == -ENODEV)
+		return 0;
+	if (ret)
+		return ret;
+
+	/* switched on since our last setup, by us or anyone else */
+	if (!adc->power_valid || gen != adc->power_gen) {
+		ret = ad799x_write_config(adc);
+		if (ret) {
+			sios_power_rail_put(adc->board, SIOS_PIN_VDD2);
+			return ret;
+		}
+		adc->power_gen = gen;
+		adc->power_valid = 1;
+	}
+	return 0;
+}
+
+static void sios_adc_power_put(struct sios_adc *adc)
+{
+	sios_power_rail_put(adc->board, SIOS_PIN_VDD2);
+}
+
+/* a recovered bus may have had the chip reset or power cycled */
+static void sios_adc_reinit(struct sios_i2c_reinit *r)
+{
+	struct sios_adc *adc = container_of(r, struct sios_adc, reinit);
+
+	mutex_lock(&adc->lock);
+	if (ad799x_write_config(adc))
+		printk(KERN_WARNING "%s: setup lost after bus recovery\n", adc->name);
+	mutex_unlock(&adc->lock);
+}
+
+static int ad799x_xfer(struct sios_adc *adc, u8 cmd, u8 *buf, int len, int prio)
+{
+	struct i2c_msg msg[2] = {
+		{
+			.addr = adc->addr,
+			.flags = 0,
+			.len = 1,
+			.buf = &cmd,
+		}, {
+			.addr = adc->addr,
+			.flags = I2C_M_RD,
+			.len = len,
+			.buf = buf,
+		},
+	};
+	int ret;
+
+	ret = sios_i2c_transfer(adc->i2c, msg, 2, prio);
+	return (ret == 2) ? 0 : (ret < 0) ? ret : -EIO;
+}
+
+/* results of a sequence come back in ascending channel order */
+static int ad799x_parse(struct sios_adc *adc, u8 mask, const u8 *buf, u16 *vals)
+{
+	int ch, n = 0;
+
+	for (ch=0; ch<adc->info->nr_channels; ch++) {
+		u16 w;
+
+		if (!(mask & (1 << ch)))
+			continue;
+		w = (buf[2 * n] << 8) | buf[2 * n + 1];
+		if (AD799X_CHAN_ID(w) != ch)
+			return -EIO;
+		vals[ch] = w & AD799X_RESULT_MASK;
+		n++;
+	}
+
+	return 0;
+}
+
+static int ad799x_scan_burst(struct sios_adc *adc, u16 *vals)
+{
+	u8 buf[2 * AD799X_MAX_CHANNELS];
+	int n = hweight8(adc->channels), error;
+
+	error = ad799x_xfer(adc, adc->info->cmd_seq(adc->channels), buf, 2 * n,
+			    SIOS_I2C_PRIO_HIGH);
+	if (error)
+		return error;
+
+	error = ad799x_parse(adc, adc->channels, buf, vals);
+	if (error) {
+		adc->stats.order_errors++;
+		return error;
+	}
+
+	adc->stats.bytes_per_scan = 3 + 2 * n;
+	return 0;
+}
+
+static int ad799x_scan_single(struct sios_adc *adc, u16 *vals)
+{
+	u8 buf[2];
+	int ch, n = 0, error;
+
+	for (ch=0; ch<adc->info->nr_channels; ch++) {
+		u16 w;
+
+		if (!(adc->channels & (1 << ch)))
+			continue;
+		error = ad799x_xfer(adc, adc->info->cmd_single(ch), buf, 2,
+				    SIOS_I2C_PRIO_HIGH);
+		if (error)
+			return error;
+		w = (buf[0] << 8) | buf[1];
+		if (AD799X_CHAN_ID(w) != ch) {
+			adc->stats.order_errors++;
+			return -EIO;
+		}
+		vals[ch] = w & AD799X_RESULT_MASK;
+		n++;
+	}
+
+	adc->stats.bytes_per_scan = 5 * n;
+	return 0;
+}
+
+/* hand a scan to the sios core as one, vals indexed by channel */
+static void sios_adc_report(struct sios_adc *adc, u8 mask, ktime_t stamp,
+			    const u16 *vals)
+{
+	struct sios_source *src[AD799X_MAX_CHANNELS];
+	u16 v[AD799X_MAX_CHANNELS];
+	int ch, n = 0;
+
+	for (ch=0; ch<adc->info->nr_channels; ch++) {
+		if (!(mask & (1 << ch)))
+			continue;
+		adc->value[ch] = vals[ch];
+		src[n] = &adc->source[ch];
+		v[n++] = vals[ch];
+	}
+
+	sios_event_report_scan(src, n, stamp, v);
+}
+
+/**
+ *	sios_adc_scan - convert all enabled channels
+ *	@adc: adc instance
+ *	@vals: AD799X_MAX_CHANNELS results, disabled channels are left alone
+ */
+int sios_adc_scan(struct sios_adc *adc, u16 *vals)
+{
+	ktime_t start, stamp;
+	int error;
+
+	mutex_lock(&adc->lock);
+	error = sios_adc_power_get(adc);
+	if (error)
+		goto out;
+
+	start = ktime_get();
+	/* in command mode the conversion starts with the command byte */
+	stamp = sios_event_stamp();
+
+	if (adc->mode == SIOS_ADC_BURST)
+		error = ad799x_scan_burst(adc, vals);
+	else
+		error = ad799x_scan_single(adc, vals);
+	sios_adc_power_put(adc);
+
+	if (error) {
+		adc->stats.errors++;
+		goto out;
+	}
+
+	adc->stats.scans++;
+	adc->stats.last_us = ktime_to_us(ktime_sub(ktime_get(), start));
+	adc->stats.total_us += adc->stats.last_us;
+
+	sios_adc_report(adc, adc->channels, stamp, vals);
+out:
+	mutex_unlock(&adc->lock);
+	return error;
+}
+EXPORT_SYMBOL_GPL(sios_adc_scan);
+
+/*
+ * A staged profile goes out ahead of the next conversion, in the same
+ * transfer, so that no period is lost. Called between two periods.
+ */
+static void sios_adc_switch(struct sios_adc *adc, struct sios_i2c_req *req)
+{
+	int n = adc->setup_num;
+
+	adc->sample_mask = adc->switch_mask;
+	adc->sample_cmd = adc->info->cmd_seq(adc->switch_mask);
+	adc->sample_msg[1].len = 2 * hweight8(adc->switch_mask);
+	memcpy(&adc->switch_msg[n], adc->sample_msg, sizeof(adc->sample_msg));
+
+	req->msgs = adc->switch_msg;
+	req->num = n + 2;
+	req->period_us = adc->switch_period_us;
+	req->deadline_us = req->period_us;
+}
+
+/*
+ * Channels with a min_rate make sampling adaptive. The highest max_rate
+ * (or rate) is the base tick; they start at their max_rate, the others
+ * convert at rate throughout. Called with adc->lock held, before the
+ * sampling request is submitted.
+ */
+static void sios_adc_adapt_setup(struct sios_adc *adc)
+{
+	struct sios_adc_adapt *a;
+	unsigned int tick = adc->rate, max_rate;
+	int ch;
+
+	adc->adaptive = 0;
+	for (ch=0; ch<adc->info->nr_channels; ch++) {
+		if ((adc->channels & (1 << ch)) && adc->adapt[ch].min_rate) {
+			adc->adaptive = 1;
+			tick = max(tick, adc->adapt[ch].max_rate);
+		}
+	}
+	adc->tick_us = USEC_PER_SEC / tick;
+
+	for (ch=0; ch<adc->info->nr_channels; ch++) {
+		a = &adc->adapt[ch];
+		a->shift = 0;
+		a->max_shift = 0;
+		a->left = 0;
+		a->stable = 0;
+		a->primed = 0;
+		max_rate = 0;
+
+		if (adc->adaptive && a->min_rate) {
+			a->div = DIV_ROUND_UP(tick, a->max_rate);
+			/* the rate in effect is exactly max_rate >> shift */
+			max_rate = tick / a->div;
+			while (a->max_shift < AD799X_ADAPT_MAX_SHIFT &&
+			       (max_rate >> (a->max_shift + 1)) >= a->min_rate)
+				a->max_shift++;
+		} else {
+			a->div = DIV_ROUND_UP(tick, adc->rate);
+		}
+
+		adc->source[ch].rate_shift = 0;
+		if (adc->source[ch].max_rate != max_rate)
+			sios_source_set_rate(&adc->source[ch], max_rate);
+	}
+}
+
+/*
+ * After each adaptive conversion: a change beyond the threshold puts a
+ * channel back at its max_rate, adapt_hold samples within it halve the
+ * rate, down to min_rate. Then the channels due next make up the next
+ * conversion, ticks on which none is due are skipped altogether.
+ */
+static void sios_adc_adapt_next(struct sios_adc *adc, struct sios_i2c_req *req,
+				const u16 *vals, int ok)
+{
+	struct sios_adc_adapt *a;
+	unsigned int gap = UINT_MAX;
+	u8 mask = 0;
+	int ch, n;
+
+	for (ch=0; ch<adc->info->nr_channels; ch++) {
+		if (!(adc->sample_mask & (1 << ch)))
+			continue;
+		a = &adc->adapt[ch];
+		if (ok && a->min_rate) {
+			if (a->primed && abs(vals[ch] - a->last) > a->threshold) {
+				a->shift = 0;
+				a->stable = 0;
+			} else if (a->shift < a->max_shift &&
+				   ++a->stable >= adc->adapt_hold) {
+				a->shift++;
+				a->stable = 0;
+			}
+			a->last = vals[ch];
+			a->primed = 1;
+			adc->source[ch].rate_shift = a->shift;
+		}
+		a->left = a->div << a->shift;
+	}
+
+	for (ch=0; ch<adc->info->nr_channels; ch++) {
+		if (adc->channels & (1 << ch))
+			gap = min(gap, adc->adapt[ch].left);
+	}
+	for (ch=0; ch<adc->info->nr_channels; ch++) {
+		if (!(adc->channels & (1 << ch)))
+			continue;
+		adc->adapt[ch].left -= gap;
+		if (!adc->adapt[ch].left)
+			mask |= 1 << ch;
+	}
+
+	adc->sample_mask = mask;
+	adc->sample_cmd = adc->info->cmd_seq(mask);
+	adc->sample_msg[1].len = 2 * hweight8(mask);
+
+	/* on the AD7998 the sequence is whatever the config register holds */
+	n = 0;
+	if (adc->info->seq_in_config && mask != adc->config_mask) {
+		ad799x_reg_msg(adc, &adc->adapt_msg[0], adc->adapt_cfg,
+			       AD799X_REG_CONFIG, ad799x_config(adc, mask));
+		n = 1;
+	}
+	memcpy(&adc->adapt_msg[n], adc->sample_msg, sizeof(adc->sample_msg));
+	req->msgs = adc->adapt_msg;
+	req->num = n + 2;
+	adc->adapt_config_mask = mask;
+
+	req->period_us = gap * adc->tick_us;
+	adc->adapt_stats.ticks += gap;
+}
+
+static void sios_adc_sample_done(struct sios_i2c_req *req, int status)
+{
+	struct sios_adc *adc = req->context;
+	struct sios_adc_adapt_stats *st = &adc->adapt_stats;
+	u16 vals[AD799X_MAX_CHANNELS];
+	ktime_t start = ktime_get();
+	int n = hweight8(adc->sample_mask), ok = 0;
+
+	if (status || ad799x_parse(adc, adc->sample_mask, adc->sample_buf, vals)) {
+		adc->stats.sample_errors++;
+	} else {
+		adc->stats.samples++;
+		sios_adc_report(adc, adc->sample_mask, req->stamp, vals);
+		ok = 1;
+	}
+
+	st->transfers++;
+	st->conversions += n;
+	st->bytes += 3 + 2 * n;
+	if (adc->adaptive) {
+		/* unknown after a failure, written again with the next one */
+		if (req->num > 2) {
+			st->bytes += 4;
+			adc->config_mask = status ? 0 : adc->adapt_config_mask;
+		}
+		sios_adc_adapt_next(adc, req,
+				    adc->adapt_replay ? adc->adapt_value : vals, ok);
+		st->cpu_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+		return;
+	}
+	st->ticks++;
+	st->cpu_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	spin_lock(&adc->switch_lock);
+	if (adc->switch_state == SIOS_ADC_SWITCH_RUNNING && !status) {
+		/* the setup is in, a failed one is sent again */
+		req->msgs = adc->sample_msg;
+		req->num = 2;
+		adc->switch_state = SIOS_ADC_SWITCH_IDLE;
+	} else if (adc->switch_state == SIOS_ADC_SWITCH_PENDING) {
+		sios_adc_switch(adc, req);
+		adc->switch_state = SIOS_ADC_SWITCH_RUNNING;
+	}
+	spin_unlock(&adc->switch_lock);
+}
+
+/* called with adc->lock held, the configuration must match channels */
+static int sios_adc_start_sampling(struct sios_adc *adc)
+{
+	struct sios_i2c_req *req = &adc->sample;
+	int error;
+
+	if (!adc->rate)
+		return 0;
+
+	/* held as long as we sample */
+	error = sios_adc_power_get(adc);
+	if (error)
+		return error;
+
+	adc->sample_mask = adc->channels;
+	adc->sample_cmd = adc->info->cmd_seq(adc->channels);
+
+	adc->sample_msg[0].addr = adc->addr;
+	adc->sample_msg[0].flags = 0;
+	adc->sample_msg[0].len = 1;
+	adc->sample_msg[0].buf = &adc->sample_cmd;
+	adc->sample_msg[1].addr = adc->addr;
+	adc->sample_msg[1].flags = I2C_M_RD;
+	adc->sample_msg[1].len = 2 * hweight8(adc->channels);
+	adc->sample_msg[1].buf = adc->sample_buf;
+
+	req->name = adc->name;
+	req->msgs = adc->sample_msg;
+	req->num = 2;
+	req->prio = SIOS_I2C_PRIO_RT;
+	req->period_us = USEC_PER_SEC / adc->rate;
+	req->deadline_us = req->period_us;
+	req->complete = sios_adc_sample_done;
+	req->context = adc;
+
+	sios_adc_adapt_setup(adc);
+	if (adc->adaptive) {
+		req->period_us = adc->tick_us;
+		req->deadline_us = adc->tick_us;
+	}
+
+	error = sios_i2c_submit(adc->i2c, req);
+	if (error)
+		sios_adc_power_put(adc);
+	return error;
+}
+
+static void sios_adc_stop_sampling(struct sios_adc *adc)
+{
+	if (!adc->rate)
+		return;
+	sios_i2c_cancel(&adc->sample);
+	/* scans expect the whole channel set in the config register */
+	if (adc->adaptive && adc->info->seq_in_config &&
+	    adc->config_mask != adc->channels && ad799x_write_config(adc))
+		printk(KERN_WARNING "%s: channel setup not restored\n", adc->name);
+	sios_adc_power_put(adc);
+
+	spin_lock(&adc->switch_lock);
+	adc->switch_state = SIOS_ADC_SWITCH_IDLE;
+	spin_unlock(&adc->switch_lock);
+}
+
+/*
+ * replay backend: a recorded result is reported as a conversion of now,
+ * or with adapt_replay set only drives the rate of the channel
+ */
+static void sios_adc_inject(struct sios_source *src, u16 value)
+{
+	struct sios_adc *adc;
+	u16 vals[AD799X_MAX_CHANNELS];
+	int ch;
+
+	mutex_lock(&adc_list_lock);
+	list_for_each_entry(adc, &adc_list, list) {
+		if (src < adc->source || src >= adc->source + adc->info->nr_channels)
+			continue;
+		ch = src - adc->source;
+		vals[ch] = value & AD799X_RESULT_MASK;
+		if (adc->adapt_replay)
+			adc->adapt_value[ch] = vals[ch];
+		else
+			sios_adc_report(adc, 1 << ch, sios_event_stamp(), vals);
+		break;
+	}
+	mutex_unlock(&adc_list_lock);
+}
+
+/*
+ * Rail telemetry in sios_power reads its taps through us. A single
+ * conversion does not depend on the configuration register, so it
+ * works whatever state the chip is in. adc_list_lock is held across
+ * the transfer: a hot-swap removes the chip under it, so the adc
+ * cannot be freed while its conversion is in flight.
+ */
+static int sios_adc_meter_read(struct sios_board *board, int chip, int ch, u16 *raw)
+{
+	struct sios_adc *adc;
+	u8 buf[2];
+	u16 w;
+	int error;
+
+	mutex_lock(&adc_list_lock);
+	adc = sios_adc_find(board, chip);
+	if (!adc || ch >= adc->info->nr_channels) {
+		error = -ENODEV;
+		goto out;
+	}
+
+	error = ad799x_xfer(adc, adc->info->cmd_single(ch), buf, 2, SIOS_I2C_PRIO_LOW);
+	if (error)
+		goto out;
+
+	w = (buf[0] << 8) | buf[1];
+	if (AD799X_CHAN_ID(w) != ch)
+		error = -EIO;
+	else
+		*raw = w & AD799X_RESULT_MASK;
+out:
+	mutex_unlock(&adc_list_lock);
+	return error;
+}
+
+static const struct sios_power_meter adc_meter = {
+	.read = sios_adc_meter_read,
+};
+
+static ssize_t show_adc_channels(struct device *dev, struct device_attribute *attr,
+				 char *buf)
+{
+	return snprintf(buf, PAGE_SIZE, "0x%02x\n", to_sios_adc(dev)->channels);
+}
+
+static ssize_t store_adc_channels(struct device *dev, struct device_attribute *attr,
+				  const char *buf, size_t count)
+{
+	struct sios_adc *adc = to_sios_adc(dev);
+	unsigned long mask = simple_strtoul(buf, NULL, 0);
+	int error;
+
+	if (!mask || mask >= (1 << adc->info->nr_channels))
+		return -EINVAL;
+
+	mutex_lock(&adc->lock);
+	sios_adc_stop_sampling(adc);
+	adc->channels = mask;
+	error = sios_adc_power_get(adc);
+	if (!error) {
+		error = ad799x_write_config(adc);
+		sios_adc_power_put(adc);
+	}
+	if (!error)
+		error = sios_adc_start_sampling(adc);
+	mutex_unlock(&adc->lock);
+
+	return error ? error : count;
+}
+
+static ssize_t show_adc_mode(struct device *dev, struct device_attribute *attr,
+			     char *buf)
+{
+	return snprintf(buf, PAGE_SIZE, "%s\n",
+			to_sios_adc(dev)->mode == SIOS_ADC_BURST ? "burst" : "single");
+}
+
+static ssize_t store_adc_mode(struct device *dev, struct device_attribute *attr,
+			      const char *buf, size_t count)
+{
+	struct sios_adc *adc = to_sios_adc(dev);
+	enum sios_adc_mode mode;
+	int error;
+
+	if (!strncmp(buf, "burst", 5))
+		mode = SIOS_ADC_BURST;
+	else if (!strncmp(buf, "single", 6))
+		mode = SIOS_ADC_SINGLE;
+	else
+		return -EINVAL;
+
+	mutex_lock(&adc->lock);
+	sios_adc_stop_sampling(adc);
+	adc->mode = mode;
+	error = sios_adc_start_sampling(adc);
+	mutex_unlock(&adc->lock);
+
+	return error ? error : count;
+}
+
+static ssize_t show_adc_rate(struct device *dev, struct device_attribute *attr,
+			     char *buf)
+{
+	return snprintf(buf, PAGE_SIZE, "%u\n", to_sios_adc(dev)->rate);
+}
+
+static ssize_t store_adc_rate(struct device *dev, struct device_attribute *attr,
+			      const char *buf, size_t count)
+{
+	struct sios_adc *adc = to_sios_adc(dev);
+	unsigned long rate = simple_strtoul(buf, NULL, 0);
+	int error;
+
+	if (rate > USEC_PER_SEC)
+		return -EINVAL;
+
+	mutex_lock(&adc->lock);
+	sios_adc_stop_sampling(adc);
+	adc->rate = rate;
+	error = sios_adc_start_sampling(adc);
+	if (error)
+		adc->rate = 0;
+	mutex_unlock(&adc->lock);
+
+	return error ? error : count;
+}
+
+static ssize_t show_adc_scan(struct device *dev, struct device_attribute *attr,
+			     char *buf)
+{
+	struct sios_adc *adc = to_sios_adc(dev);
+	u16 vals[AD799X_MAX_CHANNELS];
+	ssize_t len = 0;
+	int ch, error;
+
+	error = sios_adc_scan(adc, vals);
+	if (error)
+		return error;
+
+	for (ch=0; ch<adc->info->nr_channels; ch++) {
+		if (adc->channels & (1 << ch))
+			len += scnprintf(buf + len, PAGE_SIZE - len, "%d\t%d\n",
+					 ch + 1, vals[ch]);
+	}
+	return len;
+}
+
+static ssize_t show_adc_stats(struct device *dev, struct device_attribute *attr,
+			      char *buf)
+{
+	struct sios_adc *adc = to_sios_adc(dev);
+	struct sios_adc_stats st;
+	u64 avg;
+
+	mutex_lock(&adc->lock);
+	st = adc->stats;
+	mutex_unlock(&adc->lock);
+
+	avg = st.total_us;
+	if (st.scans)
+		do_div(avg, st.scans);
+
+	return snprintf(buf, PAGE_SIZE,
+			"scans\t%u\nerrors\t%u\norder_errors\t%u\n"
+			"bytes_per_scan\t%u\nlast_us\t%u\navg_us\t%llu\n"
+			"samples\t%u\nsample_errors\t%u\nswitches\t%u\n",
+			st.scans, st.errors, st.order_errors,
+			st.bytes_per_scan, st.last_us, avg,
+			st.samples, st.sample_errors, st.switches);
+}
+
+static ssize_t show_adc_adapt(struct device *dev, struct device_attribute *attr,
+			      char *buf)
+{
+	struct sios_adc *adc = to_sios_adc(dev);
+	struct sios_adc_adapt *a;
+	unsigned int rate;
+	ssize_t len;
+	int ch;
+
+	mutex_lock(&adc->lock);
+	len = snprintf(buf, PAGE_SIZE, "hold\t%u\nreplay\t%d\n"
+		       "ch\tmin\tmax\tthreshold\trate\n",
+		       adc->adapt_hold, adc->adapt_replay);
+	for (ch=0; ch<adc->info->nr_channels; ch++) {
+		a = &adc->adapt[ch];
+		if (!a->min_rate)
+			continue;
+		rate = adc->rate ? adc->source[ch].max_rate >> a->shift : 0;
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%d\t%u\t%u\t%u\t%u\n",
+				 ch + 1, a->min_rate, a->max_rate, a->threshold, rate);
+	}
+	mutex_unlock(&adc->lock);
+
+	return len;
+}
+
+/*
+ * "<ch> <min_rate> <max_rate> <threshold>" samples channel ch (1 based)
+ * by its activity, "<ch> off" at rate again. "hold <n>" is the number
+ * of samples within the threshold before a rate halves, "replay 1"
+ * makes replayed values (see sios_adc_inject) drive the rates instead
+ * of the conversions, which are still what is reported, and "reset"
+ * clears adapt_stats.
+ */
+static ssize_t store_adc_adapt(struct device *dev, struct device_attribute *attr,
+			       const char *buf, size_t count)
+{
+	struct sios_adc *adc = to_sios_adc(dev);
+	struct sios_adc_adapt *a;
+	unsigned int ch, min_rate, max_rate, threshold, n;
+	char word[8];
+	int error = 0;
+
+	mutex_lock(&adc->lock);
+	if (sscanf(buf, "hold %u", &n) == 1 && n) {
+		adc->adapt_hold = n;
+	} else if (sscanf(buf, "replay %u", &n) == 1) {
+		adc->adapt_replay = !!n;
+	} else if (!strncmp(buf, "reset", 5)) {
+		memset(&adc->adapt_stats, 0, sizeof(adc->adapt_stats));
+	} else if (sscanf(buf, "%u %u %u %u", &ch, &min_rate, &max_rate, &threshold) == 4) {
+		if (!ch || ch > adc->info->nr_channels || !min_rate ||
+		    min_rate > max_rate || max_rate > 0xffff ||
+		    threshold > AD799X_RESULT_MASK) {
+			error = -EINVAL;
+			goto out;
+		}
+		sios_adc_stop_sampling(adc);
+		a = &adc->adapt[ch - 1];
+		a->min_rate = min_rate;
+		a->max_rate = max_rate;
+		a->threshold = threshold;
+		error = sios_adc_start_sampling(adc);
+		if (error)
+			adc->rate = 0;
+	} else if (sscanf(buf, "%u %7s", &ch, word) == 2 && !strcmp(word, "off") &&
+		   ch && ch <= adc->info->nr_channels) {
+		sios_adc_stop_sampling(adc);
+		adc->adapt[ch - 1].min_rate = 0;
+		if (adc->source[ch - 1].max_rate)
+			sios_source_set_rate(&adc->source[ch - 1], 0);
+		error = sios_adc_start_sampling(adc);
+		if (error)
+			adc->rate = 0;
+	} else {
+		error = -EINVAL;
+	}
+out:
+	mutex_unlock(&adc->lock);
+
+	return error ? error : count;
+}
+
+/*
+ * Cost of periodic sampling, fixed or adaptive alike, for comparing
+ * the two over the same (replayed) signal; full_conversions is what
+ * every channel at its highest rate would have taken.
+ */
+static ssize_t show_adc_adapt_stats(struct device *dev, struct device_attribute *attr,
+				    char *buf)
+{
+	struct sios_adc *adc = to_sios_adc(dev);
+	struct sios_adc_adapt_stats st;
+	u64 full = 0, t, per_transfer;
+	int ch;
+
+	mutex_lock(&adc->lock);
+	st = adc->adapt_stats;
+	for (ch=0; ch<adc->info->nr_channels; ch++) {
+		if (!adc->adaptive || !(adc->channels & (1 << ch)))
+			continue;
+		t = st.ticks;
+		do_div(t, adc->adapt[ch].div);
+		full += t;
+	}
+	mutex_unlock(&adc->lock);
+
+	if (!full)
+		full = st.conversions;
+	per_transfer = st.cpu_ns;
+	if (st.transfers)
+		do_div(per_transfer, st.transfers);
+
+	return snprintf(buf, PAGE_SIZE,
+			"ticks\t%llu\ntransfers\t%u\nconversions\t%llu\n"
+			"full_conversions\t%llu\nbytes\t%llu\ncpu_ns\t%llu\n"
+			"cpu_ns_per_transfer\t%llu\n",
+			st.ticks, st.transfers, st.conversions, full,
+			st.bytes, st.cpu_ns, per_transfer);
+}
+
+static DEVICE_ATTR(channels, S_IRUGO | S_IWUSR, show_adc_channels, store_adc_channels);
+static DEVICE_ATTR(mode, S_IRUGO | S_IWUSR, show_adc_mode, store_adc_mode);
+static DEVICE_ATTR(rate, S_IRUGO | S_IWUSR, show_adc_rate, store_adc_rate);
+static DEVICE_ATTR(scan, S_IRUGO, show_adc_scan, NULL);
+static DEVICE_ATTR(stats, S_IRUGO, show_adc_stats, NULL);
+static DEVICE_ATTR(adapt, S_IRUGO | S_IWUSR, show_adc_adapt, store_adc_adapt);
+static DEVICE_ATTR(adapt_stats, S_IRUGO, show_adc_adapt_stats, NULL);
+
+static struct attribute *sios_adc_attrs[] = {
+	&dev_attr_channels.attr,
+	&dev_attr_mode.attr,
+	&dev_attr_rate.attr,
+	&dev_attr_scan.attr,
+	&dev_attr_stats.attr,
+	&dev_attr_adapt.attr,
+	&dev_attr_adapt_stats.attr,
+	NULL,
+};
+
+static struct attribute_group sios_adc_group = {
+	.attrs = sios_adc_attrs,
+};
+
+/* acquisition profiles, see sios/profile.h */
+static int sios_adc_prepare(struct sios_profile_target *t,
+			    const struct sios_acq_settings *s)
+{
+	struct sios_adc *adc = container_of(t, struct sios_adc, target);
+	struct sios_adc_setup *st = &adc->staged;
+	int ch;
+
+	mutex_lock(&adc->lock);
+	st->channels = adc->channels;
+	st->mode = adc->mode;
+	st->rate = adc->rate;
+	st->filter = adc->filter;
+	memcpy(st->alert_low, adc->alert_low, sizeof(st->alert_low));
+	memcpy(st->alert_high, adc->alert_high, sizeof(st->alert_high));
+	mutex_unlock(&adc->lock);
+
+	if (s->set & SIOS_ACQ_CHANNELS) {
+		if (!s->channels || s->channels >= (1 << adc->info->nr_channels))
+			return -EINVAL;
+		st->channels = s->channels;
+	}
+	if (s->set & SIOS_ACQ_RATE) {
+		if (s->rate > USEC_PER_SEC)
+			return -EINVAL;
+		st->rate = s->rate;
+	}
+	if (s->set & SIOS_ACQ_MODE) {
+		if (!strcmp(s->mode, "burst"))
+			st->mode = SIOS_ADC_BURST;
+		else if (!strcmp(s->mode, "single"))
+			st->mode = SIOS_ADC_SINGLE;
+		else
+			return -EINVAL;
+	}
+	if (s->set & SIOS_ACQ_FILTER)
+		st->filter = s->filter;
+	for (ch=0; ch<AD799X_LIMIT_CHANNELS; ch++) {
+		if (s->set & SIOS_ACQ_ALERT_LOW)
+			st->alert_low[ch] = s->alert_low[ch];
+		if (s->set & SIOS_ACQ_ALERT_HIGH)
+			st->alert_high[ch] = s->alert_high[ch];
+		if (st->alert_high[ch] > AD799X_RESULT_MASK ||
+		    st->alert_low[ch] > st->alert_high[ch])
+			return -EINVAL;
+	}
+
+	return 0;
+}
+
+/*
+ * While fixed rate sampling goes on at a new rate the switch is left
+ * to the sampling request, see sios_adc_switch. Anything else, such as
+ * sampling that is or becomes adaptive, has to stop and restart.
+ */
+static void sios_adc_commit(struct sios_profile_target *t)
+{
+	struct sios_adc *adc = container_of(t, struct sios_adc, target);
+	struct sios_adc_setup *st = &adc->staged;
+	int ch, adaptive = 0, seamless, error = 0;
+
+	mutex_lock(&adc->lock);
+	for (ch=0; ch<adc->info->nr_channels; ch++) {
+		if ((st->channels & (1 << ch)) && adc->adapt[ch].min_rate)
+			adaptive = 1;
+	}
+
+	spin_lock(&adc->switch_lock);
+	seamless = adc->rate && st->rate && !adc->adaptive && !adaptive &&
+		adc->switch_state == SIOS_ADC_SWITCH_IDLE;
+	spin_unlock(&adc->switch_lock);
+
+	if (!seamless)
+		sios_adc_stop_sampling(adc);
+
+	adc->channels = st->channels;
+	adc->mode = st->mode;
+	adc->rate = st->rate;
+	adc->filter = st->filter;
+	memcpy(adc->alert_low, st->alert_low, sizeof(adc->alert_low));
+	memcpy(adc->alert_high, st->alert_high, sizeof(adc->alert_high));
+	adc->stats.switches++;
+
+	if (seamless) {
+		adc->setup_num = ad799x_setup_msgs(adc, adc->setup_buf, adc->switch_msg);
+		adc->switch_mask = adc->channels;
+		adc->switch_period_us = USEC_PER_SEC / adc->rate;
+		adc->config_mask = 0;
+		spin_lock(&adc->switch_lock);
+		adc->switch_state = SIOS_ADC_SWITCH_PENDING;
+		spin_unlock(&adc->switch_lock);
+		goto out;
+	}
+
+	error = sios_adc_power_get(adc);
+	if (!error) {
+		error = ad799x_write_config(adc);
+		sios_adc_power_put(adc);
+	}
+	if (!error)
+		error = sios_adc_start_sampling(adc);
+	if (error) {
+		adc->rate = 0;
+		printk(KERN_WARNING "%s: profile setup failed (%d)\n", adc->name, error);
+	}
+out:
+	mutex_unlock(&adc->lock);
+}
+
+static int sios_adc_probe(struct sios_device *sdev)
+{
+	struct sios_chip *chip = to_sios_chip(sdev);
+	struct sios_board *board = sdev->board;
+	const struct sios_adc_info *info;
+	struct sios_adc *adc;
+	char base[BUS_ID_SIZE];
+	int ch, error;
+
+	switch (chip->type) {
+	case SIOS_CHIP_AD7998:
+		info = &adc_info[SIOS_ADC_AD7998];
+		break;
+	case SIOS_CHIP_AD7994:
+		info = &adc_info[SIOS_ADC_AD7994];
+		break;
+	default:
+		return -ENODEV;
+	}
+
+	adc = kzalloc(sizeof(*adc), GFP_KERNEL);
+	if (!adc)
+		return -ENOMEM;
+
+	adc->i2c = sios_i2c_sched_get(board);
+	if (!adc->i2c) {
+		kfree(adc);
+		return -ENODEV;
+	}
+
+	mutex_init(&adc->lock);
+	spin_lock_init(&adc->switch_lock);
+	adc->info = info;
+	adc->board = board;
+	adc->chip = chip;
+	adc->addr = chip->addr;
+	adc->channels = (1 << info->nr_channels) - 1;
+	adc->mode = SIOS_ADC_BURST;
+	adc->filter = 1;
+	adc->adapt_hold = 8;
+	for (ch=0; ch<AD799X_LIMIT_CHANNELS; ch++)
+		adc->alert_high[ch] = AD799X_RESULT_MASK;
+	strlcpy(adc->name, chip->name, sizeof(adc->name));
+
+	error = sios_board_claim(board, info->cnv_claim, &adc->res[0]);
+	if (!error)
+		error = sios_request_resource(sdev, &adc->res[0]);
+	if (error)
+		goto err_free;
+
+	/* CONVST is unused in command mode and must be held low */
+	gpio_direction_output(adc->res[0].start, 0);
+
+	error = sios_adc_power_get(adc);
+	if (!error) {
+		error = ad799x_write_config(adc);
+		sios_adc_power_put(adc);
+	}
+	if (error) {
+		printk(KERN_WARNING "%s: no response at 0x%02x\n",
+		       adc->name, adc->addr);
+		goto err_res;
+	}
+
+	dev_set_drvdata(&sdev->dev, adc);
+	error = sysfs_create_group(&sdev->dev.kobj, &sios_adc_group);
+	if (error)
+		goto err_res;
+
+	for (ch=0; ch<info->nr_channels; ch++) {
+		snprintf(base, sizeof(base), "%s.ch%d", info->name, ch + 1);
+		sios_board_devname(board, base, adc->src_name[ch], BUS_ID_SIZE);
+		adc->source[ch].name = adc->src_name[ch];
+		adc->source[ch].type = SIOS_EV_ADC;
+		adc->source[ch].inject = sios_adc_inject;
+		error = sios_source_register(&adc->source[ch]);
+		if (error)
+			goto err_sources;
+	}
+
+	adc->reinit.reinit = sios_adc_reinit;
+	sios_i2c_add_reinit(adc->i2c, &adc->reinit);
+
+	mutex_lock(&adc_list_lock);
+	list_add_tail(&adc->list, &adc_list);
+	mutex_unlock(&adc_list_lock);
+
+	adc->target.name = adc->name;
+	adc->target.prepare = sios_adc_prepare;
+	adc->target.commit = sios_adc_commit;
+	sios_profile_add_target(&adc->target);
+	return 0;
+
+err_sources:
+	while (--ch >= 0)
+		sios_source_unregister(&adc->source[ch]);
+	sysfs_remove_group(&sdev->dev.kobj, &sios_adc_group);
+err_res:
+	dev_set_drvdata(&sdev->dev, NULL);
+	sios_release_resource(&adc->res[0]);
+err_free:
+	sios_i2c_sched_put(adc->i2c);
+	kfree(adc);
+	return error;
+}
+
+/* the chip went away or the driver is unloaded */
+static int sios_adc_remove(struct sios_device *sdev)
+{
+	struct sios_adc *adc = dev_get_drvdata(&sdev->dev);
+	int ch;
+
+	sios_profile_del_target(&adc->target);
+
+	/* the source mutex nests outside adc_list_lock (see inject) */
+	mutex_lock(&adc_list_lock);
+	list_del(&adc->list);
+	mutex_unlock(&adc_list_lock);
+
+	mutex_lock(&adc->lock);
+	sios_adc_stop_sampling(adc);
+	mutex_unlock(&adc->lock);
+
+	for (ch=0; ch<adc->info->nr_channels; ch++)
+		sios_source_unregister(&adc->source[ch]);
+	sysfs_remove_group(&sdev->dev.kobj, &sios_adc_group);
+	dev_set_drvdata(&sdev->dev, NULL);
+	sios_i2c_del_reinit(adc->i2c, &adc->reinit);
+	sios_release_resource(&adc->res[0]);
+	sios_i2c_sched_put(adc->i2c);
+	kfree(adc);
+	return 0;
+}
+
+static struct sios_driver adc_drv = {
+	.version = "$Revision: 1.0 $",
+	.module = THIS_MODULE,
+	.driver = {
+		/* binds sios:ad7998 and sios:ad7994 */
+		.name = "sios:ad799",
+	},
+	.probe = sios_adc_probe,
+	.remove = sios_adc_remove,
+};
+
+/* binds to the chips the bus enumerated, see chips.c */
+static int __init sios_adc_init(void)
+{
+	int error;
+
+	error = sios_driver_register(&adc_drv);
+	if (error)
+		return error;
+
+	sios_power_set_meter(&adc_meter);
+	return 0;
+}
+
+static void __exit sios_adc_exit(void)
+{
+	sios_power_set_meter(NULL);
+	sios_driver_unregister(&adc_drv);
+}
+
+MODULE_DESCRIPTION("SIOS AD7998/AD7994 ADC driver");
+MODULE_AUTHOR("Simon de Bakker <simon@v2.nl>");
+MODULE_LICENSE("GPL");
+
+module_init(sios_adc_init);
+module_exit(sios_adc_exit);
@@ -0,0 +1,272 @@
+/* -*-linux-c-*-
+ * board.c - SIOS board instances
+ *
+ * Copyright (C) 2008 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA, or http://www.gnu.org/licenses/gpl.html
+ */
+
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/kernel.h>
+#include <linux/irq.h>
+
+#include "sios/sios.h"
+#include "sios/board.h"
+#include "sios/sios-gpio.h"
+
+static LIST_HEAD(board_list);
+static DEFINE_MUTEX(board_mutex);
+
+/*
+ * Tables generated from the board 0 description, see sios/board0.h.
+ * Checking a pin is an index into sios_board0_desc; boards with the
+ * same layout may share it.
+ */
+#define SIOS_PIN_DESC(gpio, c, sig) \
+	[(gpio)] = { .caps = (c), .bank = (gpio) >> 5, .bit = (gpio) & 0x1f, .signal = (sig) },
+
+const struct sios_pin_desc sios_board0_desc[2][SIOS_NR_GPIO] = {
+	[0] = {
+#define SIOS_SIGNAL(name, gpio, caps)	SIOS_PIN_DESC(gpio, caps, SIOS_PIN_##name + 1)
+#define SIOS_GPIO(name, gpio, caps)	SIOS_PIN_DESC(gpio, caps, 0)
+#include "sios/board0.h"
+	},
+	[1] = {
+#define SIOS_XGPIO(pin, caps)		SIOS_PIN_DESC(pin, caps, 0)
+#include "sios/board0.h"
+	},
+};
+EXPORT_SYMBOL_GPL(sios_board0_desc);
+
+static const char *board0_names[SIOS_NR_GPIO] = {
+#define SIOS_SIGNAL(name, gpio, caps)	[(gpio)] = #name,
+#define SIOS_GPIO(name, gpio, caps)	[(gpio)] = #name,
+#include "sios/board0.h"
+};
+
+static const struct {
+	const char *driver;
+	int signal;
+	const char *name;
+	sios_restype_t type;
+	unsigned int trigger;
+} board0_claims[SIOS_NR_CLAIMS] = {
+#define SIOS_CLAIM(drv, id, sig, rname, rtype, trig) \
+	[SIOS_CLAIM_##id] = { drv, SIOS_PIN_##sig, rname, rtype, trig },
+#include "sios/board0.h"
+};
+
+enum {
+#define SIOS_SIGNAL(name, gpio, caps)	SIOS_CAPS_##name = (caps),
+#include "sios/board0.h"
+};
+
+/*
+ * Never called, it only has to build: a duplicate case value means a
+ * GPIO or expander pin is listed twice or a signal claimed twice, and
+ * a claim must be a resource the pin can be, interrupts included.
+ */
+static inline void sios_board0_check(void)
+{
+	switch (0) {
+#define SIOS_SIGNAL(name, gpio, caps)	case (gpio):
+#define SIOS_GPIO(name, gpio, caps)	case (gpio):
+#include "sios/board0.h"
+		break;
+	}
+
+	switch (0) {
+#define SIOS_XGPIO(pin, caps)		case (pin):
+#include "sios/board0.h"
+		break;
+	}
+
+	switch (0) {
+#define SIOS_CLAIM(drv, id, sig, rname, rtype, trig) \
+	case SIOS_PIN_##sig: \
+		BUILD_BUG_ON(!(SIOS_CAPS_##sig & SIOS_PIN_CAP_RES)); \
+		BUILD_BUG_ON(((__force int)(rtype) & (__force int)(SIOS_IRQ|SIOS_FIRQ)) && \
+			     !(SIOS_CAPS_##sig & SIOS_PIN_CAP_IRQ));
+#include "sios/board0.h"
+		break;
+	}
+}
+
+struct sios_board sios_default_board = {
+	.id = 0,
+	.i2c_adapter = 0,
+	.pins = {
+#define SIOS_SIGNAL(name, gpio, caps)	[SIOS_PIN_##name] = (gpio),
+#include "sios/board0.h"
+	},
+	.desc = sios_board0_desc,
+};
+EXPORT_SYMBOL_GPL(sios_default_board);
+
+/**
+ *	sios_board_claim - set up a resource the board description lists
+ *	@board: board the resource is on
+ *	@claim: SIOS_CLAIM_*
+ *	@res: filled in except for the handler
+ *
+ *	Only the module the claim is listed for in sios/board0.h gets it,
+ *	so what the drivers request is what the build checked.
+ */
+int __sios_board_claim(struct sios_board *board, int claim,
+		       struct sios_resource *res, const char *driver)
+{
+	if (claim < 0 || claim >= SIOS_NR_CLAIMS ||
+	    strcmp(board0_claims[claim].driver, driver)) {
+		printk(KERN_ERR "sios: %s is not listed for board claim %d\n",
+		       driver, claim);
+		return -EINVAL;
+	}
+
+	res->name = board0_claims[claim].name;
+	res->start = sios_board_pin(board, board0_claims[claim].signal);
+	res->end = res->start;
+	res->type = board0_claims[claim].type;
+	res->trigger = board0_claims[claim].trigger;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(__sios_board_claim);
+
+/* e.g. point board 0 at an i2c-stub adapter */
+module_param_named(i2c_bus, sios_default_board.i2c_adapter, int, 0444);
+MODULE_PARM_DESC(i2c_bus, "I2C adapter number of board 0");
+
+/**
+ *	sios_board_register - add a board instance
+ *	@board: board with id, i2c_adapter, pins and desc filled in
+ */
+int sios_board_register(struct sios_board *board)
+{
+	struct sios_board *pos;
+	int error = 0;
+
+	if (!board->desc)
+		return -EINVAL;
+
+	rwlock_init(&board->res_lock);
+	memset(board->res_owner, 0, sizeof(board->res_owner));
+
+	mutex_lock(&board_mutex);
+	list_for_each_entry(pos, &board_list, list) {
+		if (pos->id == board->id) {
+			error = -EEXIST;
+			goto out;
+		}
+	}
+	list_add_tail(&board->list, &board_list);
+out:
+	mutex_unlock(&board_mutex);
+	return error;
+}
+EXPORT_SYMBOL_GPL(sios_board_register);
+
+/* all function driver instances on the board must be gone */
+void sios_board_unregister(struct sios_board *board)
+{
+	mutex_lock(&board_mutex);
+	list_del(&board->list);
+	mutex_unlock(&board_mutex);
+}
+EXPORT_SYMBOL_GPL(sios_board_unregister);
+
+/**
+ *	sios_for_each_board - call fn for every registered board
+ *	@data: passed to fn
+ *	@fn: stops the walk by returning non-zero
+ */
+int sios_for_each_board(void *data, int (*fn)(struct sios_board *, void *))
+{
+	struct sios_board *board;
+	int error = 0;
+
+	mutex_lock(&board_mutex);
+	list_for_each_entry(board, &board_list, list) {
+		error = fn(board, data);
+		if (error)
+			break;
+	}
+	mutex_unlock(&board_mutex);
+
+	return error;
+}
+EXPORT_SYMBOL_GPL(sios_for_each_board);
+
+/* device names keep their historic form on board 0: base, base.1, ... */
+void sios_board_devname(struct sios_board *board, const char *base,
+			char *buf, size_t len)
+{
+	if (board->id)
+		snprintf(buf, len, "%s.%d", base, board->id);
+	else
+		strlcpy(buf, base, len);
+}
+EXPORT_SYMBOL_GPL(sios_board_devname);
+
+/* board 0 pins, their static claims and who holds them now */
+ssize_t sios_board_show_pins(char *buf)
+{
+	struct sios_board *board = &sios_default_board;
+	const struct sios_pin_desc *d;
+	struct sios_resource *owner;
+	char name[BUS_ID_SIZE + 8];
+	const char *claim;
+	ssize_t len;
+	int idx, pin, i;
+
+	len = snprintf(buf, PAGE_SIZE, "type\tpin\tname\tcaps\tclaim\towner\n");
+	for (idx=0; idx<2; idx++) {
+		for (pin=0; pin<SIOS_NR_GPIO; pin++) {
+			d = sios_board_pin_desc(board, idx, pin);
+			if (!d->caps)
+				continue;
+
+			claim = "-";
+			for (i=0; d->signal && i<ARRAY_SIZE(board0_claims); i++) {
+				if (board0_claims[i].signal == d->signal - 1)
+					claim = board0_claims[i].driver;
+			}
+
+			strlcpy(name, "-", sizeof(name));
+			read_lock(&board->res_lock);
+			owner = board->res_owner[idx][pin];
+			if (owner)
+				sios_resource_name(owner, name, sizeof(name));
+			read_unlock(&board->res_lock);
+
+			len += scnprintf(buf + len, PAGE_SIZE - len,
+					 "%s\t%d\t%s\t%s%s%s%s\t%s\t%s\n",
+					 idx ? "XGPIO" : "GPIO", pin,
+					 (!idx && board0_names[pin]) ? board0_names[pin] : "-",
+					 (d->caps & SIOS_PIN_CAP_RES) ? "r" : "-",
+					 (d->caps & SIOS_PIN_CAP_IN) ? "i" : "-",
+					 (d->caps & SIOS_PIN_CAP_OUT) ? "o" : "-",
+					 (d->caps & SIOS_PIN_CAP_IRQ) ? "q" : "-",
+					 claim, name);
+		}
+	}
+
+	return len;
+}
+
+int sios_board_init(void)
+{
+	return sios_board_register(&sios_default_board);
+}
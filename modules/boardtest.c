@@ -0,0 +1,288 @@
+/* -*-linux-c-*-
+ * boardtest.c - SIOS simulated boards, event throughput over N boards
+ *
+ * Copyright (C) 2008 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA, or http://www.gnu.org/licenses/gpl.html
+ */
+
+/*
+ * Loading this module adds a "board_test" attribute to the sios bus.
+ * Writing "boards events" runs that many simulated boards at once,
+ * each producing that many events; reading it shows the last run.
+ *
+ * A simulated board is a struct sios_board of its own with board 0's
+ * pin map, left unregistered so that the function drivers do not bind
+ * to it. On it sits a device claiming the PBST pin in the board's own
+ * namespace, which every board can do at the same time, and an event
+ * source. A thread per board then does per event what an input pin
+ * instance does: stamp the edge and update the state under the
+ * instance lock, then report to the source. Nothing but the event
+ * path itself is shared between the boards, so on an SMP host the
+ * total rate should grow with the boards and on the Gumstix it should
+ * stay flat.
+ */
+
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <asm/atomic.h>
+#include <asm/div64.h>
+
+#include "sios/sios.h"
+#include "sios/resource.h"
+#include "sios/board.h"
+#include "sios/event.h"
+
+#define SIM_MAX_BOARDS	16
+#define SIM_MAX_EVENTS	10000000
+#define SIM_BOARD_BASE	100	/* board ids, clear of real boards */
+
+struct sim_board {
+	struct sios_board board;
+	struct sios_device dev;
+	struct sios_resource res;
+	struct sios_source source;
+	char name[BUS_ID_SIZE];
+	char src_name[BUS_ID_SIZE];
+
+	spinlock_t lock;
+	int state;
+	ktime_t edge;
+
+	struct task_struct *task;
+	u64 ns;			/* from the common start to its last event */
+};
+
+static struct {
+	struct mutex lock;
+	struct completion start;
+	atomic_t running;
+	wait_queue_head_t done;
+	ktime_t t0;
+	unsigned int events;
+
+	/* last run */
+	int boards;
+	u64 ns;
+	u64 board_ns[SIM_MAX_BOARDS];
+	int error;
+} sim;
+
+static void sim_board_release(struct sios_device *sdev)
+{
+	return;
+}
+
+static int sim_board_thread(void *data)
+{
+	struct sim_board *sb = data;
+	unsigned long flags;
+	unsigned int i;
+	ktime_t edge;
+	int state;
+
+	wait_for_completion(&sim.start);
+
+	for (i=0; i<sim.events; i++) {
+		edge = sios_event_stamp();
+		spin_lock_irqsave(&sb->lock, flags);
+		sb->state = !sb->state;
+		sb->edge = edge;
+		state = sb->state;
+		spin_unlock_irqrestore(&sb->lock, flags);
+
+		sios_event_report_ts(&sb->source, edge, state);
+		if (!(i & 0xff))
+			cond_resched();
+	}
+
+	sb->ns = ktime_to_ns(ktime_sub(ktime_get(), sim.t0));
+	if (atomic_dec_and_test(&sim.running))
+		wake_up(&sim.done);
+
+	/* wait to be reaped */
+	for (;;) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (kthread_should_stop())
+			break;
+		schedule();
+	}
+	__set_current_state(TASK_RUNNING);
+
+	return 0;
+}
+
+static int sim_board_add(struct sim_board *sb, int idx)
+{
+	struct sios_board *board = &sb->board;
+	int error;
+
+	board->id = SIM_BOARD_BASE + idx;
+	board->i2c_adapter = -1;
+	memcpy(board->pins, sios_default_board.pins, sizeof(board->pins));
+	board->desc = sios_default_board.desc;
+	rwlock_init(&board->res_lock);
+	spin_lock_init(&sb->lock);
+
+	sios_board_devname(board, "sios:simboard", sb->name, sizeof(sb->name));
+	sios_board_devname(board, "SimBoard", sb->src_name, sizeof(sb->src_name));
+
+	sb->res.type = SIOS_IO_GPIO;
+	sb->res.start = sb->res.end = sios_board_pin(board, SIOS_PIN_PBST);
+
+	sb->dev.name = sb->name;
+	sb->dev.release = sim_board_release;
+	sb->dev.board = board;
+	sb->dev.resource = &sb->res;
+	sb->dev.num_resource = 1;
+	error = sios_device_register(&sb->dev);
+	if (error)
+		return error;
+
+	sb->source.name = sb->src_name;
+	sb->source.type = SIOS_EV_GPIO;
+	error = sios_source_register(&sb->source);
+	if (error)
+		goto err_dev;
+
+	sb->task = kthread_run(sim_board_thread, sb, "sios-sim/%d", idx);
+	if (IS_ERR(sb->task)) {
+		error = PTR_ERR(sb->task);
+		sb->task = NULL;
+		goto err_src;
+	}
+
+	return 0;
+
+err_src:
+	sios_source_unregister(&sb->source);
+err_dev:
+	sios_device_unregister(&sb->dev);
+	return error;
+}
+
+static void sim_board_del(struct sim_board *sb)
+{
+	kthread_stop(sb->task);
+	sios_source_unregister(&sb->source);
+	sios_device_unregister(&sb->dev);
+}
+
+static int sim_run(int boards, unsigned int events)
+{
+	struct sim_board *sb;
+	int i, added, error = 0;
+
+	sb = kcalloc(boards, sizeof(*sb), GFP_KERNEL);
+	if (!sb)
+		return -ENOMEM;
+
+	init_completion(&sim.start);
+	atomic_set(&sim.running, boards);
+	sim.events = events;
+
+	for (added=0; added<boards; added++) {
+		error = sim_board_add(&sb[added], added);
+		if (error)
+			break;
+	}
+
+	/* threads that never started still count, let the others go */
+	atomic_sub(boards - added, &sim.running);
+	sim.t0 = ktime_get();
+	complete_all(&sim.start);
+	wait_event(sim.done, !atomic_read(&sim.running));
+	sim.ns = ktime_to_ns(ktime_sub(ktime_get(), sim.t0));
+
+	sim.boards = added;
+	sim.error = error;
+	for (i=0; i<added; i++) {
+		sim.board_ns[i] = sb[i].ns;
+		sim_board_del(&sb[i]);
+	}
+
+	kfree(sb);
+	return error;
+}
+
+static ssize_t show_board_test(struct bus_type *bus, char *buf)
+{
+	u64 rate;
+	ssize_t len;
+	int i;
+
+	mutex_lock(&sim.lock);
+	rate = (u64)sim.boards * sim.events * NSEC_PER_SEC;
+	if (sim.ns)
+		do_div(rate, sim.ns);
+	else
+		rate = 0;
+
+	len = scnprintf(buf, PAGE_SIZE,
+			"boards\t%d\nevents\t%u\nerror\t%d\nns\t%llu\nevents_per_sec\t%llu\n",
+			sim.boards, sim.events, sim.error, sim.ns, rate);
+	for (i=0; i<sim.boards; i++)
+		len += scnprintf(buf + len, PAGE_SIZE - len, "board%d_ns\t%llu\n",
+				 SIM_BOARD_BASE + i, sim.board_ns[i]);
+	mutex_unlock(&sim.lock);
+
+	return len;
+}
+
+/* "boards events", runs to completion before returning */
+static ssize_t store_board_test(struct bus_type *bus, const char *buf, size_t count)
+{
+	unsigned int events;
+	int boards, error;
+
+	if (sscanf(buf, "%d %u", &boards, &events) != 2)
+		return -EINVAL;
+	if (boards < 1 || boards > SIM_MAX_BOARDS || !events || events > SIM_MAX_EVENTS)
+		return -EINVAL;
+
+	mutex_lock(&sim.lock);
+	error = sim_run(boards, events);
+	mutex_unlock(&sim.lock);
+
+	return error ? error : count;
+}
+
+static BUS_ATTR(board_test, S_IRUGO | S_IWUSR, show_board_test, store_board_test);
+
+static int __init sios_boardtest_init(void)
+{
+	mutex_init(&sim.lock);
+	init_waitqueue_head(&sim.done);
+	return bus_create_file(&sios_bus_type, &bus_attr_board_test);
+}
+
+static void __exit sios_boardtest_exit(void)
+{
+	bus_remove_file(&sios_bus_type, &bus_attr_board_test);
+}
+
+MODULE_DESCRIPTION("SIOS simulated boards test");
+MODULE_AUTHOR("Simon de Bakker <simon@v2.nl>");
+MODULE_LICENSE("GPL");
+
+module_init(sios_boardtest_init);
+module_exit(sios_boardtest_exit);
@@ -21,8 +21,21 @@
 
 #include <linux/module.h>
 #include <linux/init.h>
+#include <linux/kthread.h>
+#include <linux/wait.h>
+#include <linux/ktime.h>
+#include <linux/fs.h>
+#include <linux/cdev.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <asm/div64.h>
 
 #include "sios/sios.h"
+#include "sios/event.h"
+#include "sios/board.h"
+#include "sios/hardware.h"
+#include "sios/chip.h"
+#include "sios/profile.h"
 
 static void sios_dev_release(struct device *dev)
 {
@@ -40,13 +53,18 @@ EXPORT_SYMBOL_GPL(sios_device_put);
 int sios_device_add(struct sios_device *sdev)
 {
 	int error;
-	int rcnt;
 
 	if (!sdev)
 		return -EINVAL;
 
 	if (!sdev->dev.parent)
 		sdev->dev.parent = &sios_bus;
+	if (!sdev->board)
+		sdev->board = &sios_default_board;
+
+	sdev->pm.state = 0;
+	init_completion(&sdev->pm.done);
+	INIT_LIST_HEAD(&sdev->pm.deferred);
 
 	if (sdev->release)
 		sdev->dev.release = sios_dev_release;
@@ -58,36 +76,25 @@ int sios_device_add(struct sios_device *sdev)
 	if (error)
 		goto err;
 
-	for (rcnt=0; rcnt<sdev->num_resource; rcnt++) {
-		struct sios_resource *r = &sdev->resource[rcnt];
-		r->dev = sdev;
-		if (!r->name) {
-			snprintf(r->s_name, BUS_ID_SIZE, "%s:%02d-%02d", sdev->dev.bus_id, r->start, r->end);
-			r->name = r->s_name;
-		}
-		error = sios_request_resource(sdev, r);
-		if (error) {
-			printk(KERN_WARNING "bus resource request failed: name=%s, res=%d-%d\n", 
-			       r->name, r->start, r->end);
-			goto release;
-		}
-		error = sios_resource_create_file(sdev, r);
-		if (error) {
-		        printk(KERN_WARNING "bus resource create file failed: name=%s, res=%d-%d\n",
-			    r->name, r->start, r->end);
-			sios_release_resource(r);
-			goto release;
-		}
-	}
+	error = sios_request_resources(sdev);
+	if (error)
+		goto del;
+
+	error = sios_request_irqs(sdev);
+	if (error)
+		goto release;
+
+	error = sios_resource_create_table(sdev);
+	if (error)
+		goto free_irqs;
 
 	return 0;
 
+free_irqs:
+	sios_free_irqs(sdev);
 release:
-	for (rcnt--; rcnt>=0; --rcnt) {
-		struct sios_resource *r = &sdev->resource[rcnt];
-		sios_resource_remove_file(r);
-		sios_release_resource(r);
-	}
+	sios_release_resources(sdev);
+del:
 	device_del(&sdev->dev);
 err:	
 	return error;
@@ -96,16 +103,12 @@ EXPORT_SYMBOL_GPL(sios_device_add);
 
 void sios_device_del(struct sios_device *sdev)
 {
-	int i;
-
 	if (!sdev)
 		return;
 
-	for (i=0; i<sdev->num_resource; i++) {
-		struct sios_resource *r = &sdev->resource[i];
-		sios_resource_remove_file(r);
-		sios_release_resource(r);
-	}
+	sios_resource_remove_table(sdev);
+	sios_free_irqs(sdev);
+	sios_release_resources(sdev);
 	device_del(&sdev->dev);
 }
 EXPORT_SYMBOL_GPL(sios_device_del);
@@ -225,16 +228,6 @@ void sios_driver_unregister(struct sios_driver *drv)
 EXPORT_SYMBOL_GPL(sios_driver_unregister);
 
 
-static void sios_release(struct device *dev)
-{
-	printk(KERN_INFO "sios_bus release: %s\n", dev->bus_id);
-}
-
-struct device sios_bus = {
-	.bus_id = "sios",
-	.release = sios_release,
-};
-EXPORT_SYMBOL_GPL(sios_bus);
 
 static int sios_match(struct device *dev, struct device_driver *drv)
 {
@@ -255,54 +248,591 @@ static int sios_uevent(struct device *dev, char **envp,
 	return 0;
 }
 
-static int sios_suspend(struct device *dev, pm_message_t mesg)
+/*
+ * Power management
+ *
+ * The PM core calls the sios devices one after the other, so without
+ * help the suspend latency of the bus is the sum of all device latencies.
+ * Devices with async_pm set get their suspend and resume callbacks run
+ * from a kernel thread of their own. The sios_bus parent is suspended
+ * after, and resumed before, all of its children and is used as the
+ * barrier that waits for the async callbacks.
+ *
+ * Devices with pm_supplier set (the power device) are skipped by the
+ * per device callbacks and handled from the parent instead: they are
+ * suspended once all async suspends completed and resumed before any
+ * async resume is started.
+ *
+ * suspend_late and resume_early run with interrupts disabled and are
+ * always synchronous.
+ */
+enum {
+	SIOS_PM_ON = 0,
+	SIOS_PM_DEFERRED,
+	SIOS_PM_ASYNC,
+	SIOS_PM_SUSPENDED,
+	SIOS_PM_RESUMED,
+};
+
+static LIST_HEAD(sios_pm_deferred);
+static atomic_t sios_pm_pending = ATOMIC_INIT(0);
+static DECLARE_WAIT_QUEUE_HEAD(sios_pm_wait);
+
+static int sios_pm_call(struct sios_device *sdev, int stage, pm_message_t mesg)
 {
+	struct sios_driver *drv = to_sios_driver(sdev->dev.driver);
+	ktime_t start = ktime_get();
 	int ret = 0;
 
-	if (dev->driver && dev->driver->suspend)
-		ret = dev->driver->suspend(dev, mesg);
+	switch (stage) {
+	case SIOS_PM_SUSPEND:
+		if (drv->suspend)
+			ret = drv->suspend(sdev, mesg);
+		break;
+	case SIOS_PM_SUSPEND_LATE:
+		if (drv->suspend_late)
+			ret = drv->suspend_late(sdev, mesg);
+		break;
+	case SIOS_PM_RESUME_EARLY:
+		if (drv->resume_early)
+			ret = drv->resume_early(sdev);
+		break;
+	case SIOS_PM_RESUME:
+		if (drv->resume)
+			ret = drv->resume(sdev);
+		break;
+	}
 
+	sdev->pm.time_us[stage] = ktime_to_us(ktime_sub(ktime_get(), start));
 	return ret;
 }
 
-static int sios_suspend_late(struct device *dev, pm_message_t mesg)
+static int sios_pm_thread(void *data)
+{
+	struct sios_device *sdev = data;
+
+	sdev->pm.error = sios_pm_call(sdev, sdev->pm.stage, sdev->pm.mesg);
+	complete_all(&sdev->pm.done);
+
+	if (atomic_dec_and_test(&sios_pm_pending))
+		wake_up(&sios_pm_wait);
+	return 0;
+}
+
+static int sios_pm_async(struct sios_device *sdev, int stage, pm_message_t mesg)
+{
+	struct task_struct *task;
+
+	sdev->pm.stage = stage;
+	sdev->pm.mesg = mesg;
+	sdev->pm.error = 0;
+	INIT_COMPLETION(sdev->pm.done);
+	atomic_inc(&sios_pm_pending);
+
+	task = kthread_run(sios_pm_thread, sdev, "sios-pm/%s", sdev->dev.bus_id);
+	if (IS_ERR(task)) {
+		atomic_dec(&sios_pm_pending);
+		return PTR_ERR(task);
+	}
+
+	sdev->pm.state = SIOS_PM_ASYNC;
+	return 0;
+}
+
+static int sios_suspend(struct device *dev, pm_message_t mesg)
 {
-	struct sios_driver *drv = to_sios_driver(dev->driver);
 	struct sios_device *sdev = to_sios_device(dev);
-	int ret = 0;
+	int ret;
+
+	if (!dev->driver)
+		return 0;
+
+	if (sdev->pm_supplier) {
+		sdev->pm.state = SIOS_PM_DEFERRED;
+		sdev->pm.mesg = mesg;
+		list_add_tail(&sdev->pm.deferred, &sios_pm_deferred);
+		return 0;
+	}
+
+	if (sdev->async_pm && to_sios_driver(dev->driver)->suspend &&
+	    !sios_pm_async(sdev, SIOS_PM_SUSPEND, mesg))
+		return 0;
 
-	if (dev->driver && drv->suspend_late)
-		ret = drv->suspend_late(sdev, mesg);
+	ret = sios_pm_call(sdev, SIOS_PM_SUSPEND, mesg);
+	if (!ret)
+		sdev->pm.state = SIOS_PM_SUSPENDED;
 
 	return ret;
 }
 
+static int sios_suspend_late(struct device *dev, pm_message_t mesg)
+{
+	struct sios_device *sdev = to_sios_device(dev);
+
+	if (!dev->driver)
+		return 0;
+
+	return sios_pm_call(sdev, SIOS_PM_SUSPEND_LATE, mesg);
+}
+
 static int sios_resume_early(struct device *dev)
 {
-	struct sios_driver *drv = to_sios_driver(dev->driver);
 	struct sios_device *sdev = to_sios_device(dev);
-	int ret = 0;
 
-	if (dev->driver && drv->resume_early)
-		ret = drv->resume_early(sdev);
+	if (!dev->driver)
+		return 0;
 
-	return ret;
+	return sios_pm_call(sdev, SIOS_PM_RESUME_EARLY, PMSG_ON);
 }
 
-static int sios_resume(struct device * dev)
+static int sios_resume(struct device *dev)
 {
+	struct sios_device *sdev = to_sios_device(dev);
 	int ret = 0;
 
-	if (dev->driver && dev->driver->resume)
-		ret = dev->driver->resume(dev);
+	if (!dev->driver)
+		return 0;
+
+	switch (sdev->pm.state) {
+	case SIOS_PM_ASYNC:
+		wait_for_completion(&sdev->pm.done);
+		ret = sdev->pm.error;
+		/* suspend got aborted while our async suspend was running */
+		if (sdev->pm.stage == SIOS_PM_SUSPEND)
+			ret = ret ? 0 : sios_pm_call(sdev, SIOS_PM_RESUME, PMSG_ON);
+		break;
+	case SIOS_PM_SUSPENDED:
+		list_del_init(&sdev->pm.deferred);
+		ret = sios_pm_call(sdev, SIOS_PM_RESUME, PMSG_ON);
+		break;
+	case SIOS_PM_DEFERRED:
+		list_del_init(&sdev->pm.deferred);
+		break;
+	case SIOS_PM_RESUMED:
+		ret = sdev->pm.error;
+		break;
+	}
 
+	sdev->pm.state = SIOS_PM_ON;
 	return ret;
 }
 
+static int sios_pm_collect(struct device *dev, void *data)
+{
+	struct sios_device *sdev = to_sios_device(dev);
+
+	if (sdev->pm.state != SIOS_PM_ASYNC)
+		return 0;
+
+	if (sdev->pm.error) {
+		printk(KERN_ERR "sios %s: async suspend failed: %d\n",
+		       dev->bus_id, sdev->pm.error);
+		sdev->pm.state = SIOS_PM_ON;
+		return sdev->pm.error;
+	}
+
+	sdev->pm.state = SIOS_PM_SUSPENDED;
+	return 0;
+}
+
+static int sios_pm_kick_resume(struct device *dev, void *data)
+{
+	struct sios_device *sdev = to_sios_device(dev);
+
+	if (!dev->driver || !to_sios_driver(dev->driver)->resume)
+		return 0;
+
+	if (sdev->async_pm && sdev->pm.state == SIOS_PM_SUSPENDED)
+		sios_pm_async(sdev, SIOS_PM_RESUME, PMSG_ON);
+	return 0;
+}
+
+static int sios_bus_suspend(struct device *dev, pm_message_t mesg)
+{
+	struct sios_device *sdev;
+	int error;
+
+	wait_event(sios_pm_wait, !atomic_read(&sios_pm_pending));
+
+	error = bus_for_each_dev(&sios_bus_type, NULL, NULL, sios_pm_collect);
+	if (error)
+		return error;
+
+	list_for_each_entry(sdev, &sios_pm_deferred, pm.deferred) {
+		error = sios_pm_call(sdev, SIOS_PM_SUSPEND, sdev->pm.mesg);
+		if (error)
+			break;
+		sdev->pm.state = SIOS_PM_SUSPENDED;
+	}
+
+	return error;
+}
+
+static int sios_bus_resume(struct device *dev)
+{
+	struct sios_device *sdev, *n;
+
+	list_for_each_entry_safe_reverse(sdev, n, &sios_pm_deferred, pm.deferred) {
+		list_del_init(&sdev->pm.deferred);
+		if (sdev->pm.state != SIOS_PM_SUSPENDED)
+			continue;
+		sdev->pm.error = sios_pm_call(sdev, SIOS_PM_RESUME, PMSG_ON);
+		sdev->pm.state = SIOS_PM_RESUMED;
+	}
+
+	return bus_for_each_dev(&sios_bus_type, NULL, NULL, sios_pm_kick_resume);
+}
+
+static ssize_t show_sios_pm_times(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	static const char *stages[SIOS_PM_NR_STAGES] = {
+		"suspend", "suspend_late", "resume_early", "resume",
+	};
+	struct sios_device *sdev = to_sios_device(dev);
+	ssize_t len = 0;
+	int i;
+
+	for (i=0; i<SIOS_PM_NR_STAGES; i++)
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%s\t%lld\n",
+				 stages[i], sdev->pm.time_us[i]);
+	return len;
+}
+
+static ssize_t show_sios_pm_async(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	return snprintf(buf, PAGE_SIZE, "%d\n", to_sios_device(dev)->async_pm);
+}
+
+static ssize_t store_sios_pm_async(struct device *dev,
+				   struct device_attribute *attr,
+				   const char *buf, size_t count)
+{
+	to_sios_device(dev)->async_pm = simple_strtoul(buf, NULL, 0) ? 1 : 0;
+	return count;
+}
+
+static ssize_t show_sios_board(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	return snprintf(buf, PAGE_SIZE, "%d\n", to_sios_device(dev)->board->id);
+}
+
+static struct device_attribute sios_dev_attrs[] = {
+	__ATTR(board, S_IRUGO, show_sios_board, NULL),
+	__ATTR(pm_times, S_IRUGO, show_sios_pm_times, NULL),
+	__ATTR(pm_async, S_IRUGO | S_IWUSR, show_sios_pm_async, store_sios_pm_async),
+	__ATTR_NULL,
+};
+
+static void sios_release(struct device *dev)
+{
+	printk(KERN_INFO "sios_bus release: %s\n", dev->bus_id);
+}
+
+static struct device_type sios_bus_devtype = {
+	.name = "sios_bus",
+	.suspend = sios_bus_suspend,
+	.resume = sios_bus_resume,
+};
+
+struct device sios_bus = {
+	.bus_id = "sios",
+	.type = &sios_bus_devtype,
+	.release = sios_release,
+};
+EXPORT_SYMBOL_GPL(sios_bus);
+
+static ssize_t show_sios_sources(struct bus_type *bus, char *buf)
+{
+	return sios_source_show_stats(buf);
+}
+
+static ssize_t show_sios_chips(struct bus_type *bus, char *buf)
+{
+	return sios_chip_show(buf);
+}
+
+static ssize_t show_sios_chip_scans(struct bus_type *bus, char *buf)
+{
+	return sios_chip_show_stats(buf);
+}
+
+/* any write forgets the known chip addresses and scans all boards */
+static ssize_t store_sios_rescan(struct bus_type *bus, const char *buf, size_t count)
+{
+	sios_chip_rescan();
+	return count;
+}
+
+static ssize_t show_sios_irqs(struct bus_type *bus, char *buf)
+{
+	return sios_irq_show_stats(buf);
+}
+
+/* write a resource name to run its interrupt as if the pin had an edge */
+static ssize_t store_sios_irq_simulate(struct bus_type *bus, const char *buf,
+				       size_t count)
+{
+	char name[BUS_ID_SIZE + 8];
+	int error;
+
+	if (count >= sizeof(name))
+		return -EINVAL;
+	memcpy(name, buf, count);
+	name[count] = '\0';
+	if (count && name[count - 1] == '\n')
+		name[count - 1] = '\0';
+
+	error = sios_irq_simulate(name);
+	return error ? error : count;
+}
+
+static ssize_t show_sios_latency(struct bus_type *bus, char *buf)
+{
+	return sios_latency_show(buf);
+}
+
+/* 0 stops recording, 1 starts it, both clear the histograms */
+static ssize_t store_sios_latency(struct bus_type *bus, const char *buf,
+				  size_t count)
+{
+	sios_latency_on = 0;
+	sios_latency_reset();
+	sios_latency_on = simple_strtoul(buf, NULL, 0) ? 1 : 0;
+	return count;
+}
+
+static ssize_t show_sios_latency_hist(struct bus_type *bus, char *buf)
+{
+	return sios_latency_show_hist(buf);
+}
+
+static ssize_t show_sios_latency_bench(struct bus_type *bus, char *buf)
+{
+	return sios_bench_show(buf);
+}
+
+/* "resource rate_hz count [load_pct]" starts a run, "stop" ends it */
+static ssize_t store_sios_latency_bench(struct bus_type *bus, const char *buf,
+					size_t count)
+{
+	int error;
+
+	if (!strncmp(buf, "stop", 4)) {
+		sios_bench_stop();
+		return count;
+	}
+
+	error = sios_bench_start(buf);
+	return error ? error : count;
+}
+
+static ssize_t show_sios_pins(struct bus_type *bus, char *buf)
+{
+	return sios_board_show_pins(buf);
+}
+
+/*
+ * Cost of validating one pin, every pin of board 0 as GPIO and XGPIO
+ * in turn. The check is in resource.c, so the loop is not folded.
+ */
+#define PIN_CHECK_LOOPS	1000
+
+static ssize_t show_sios_pin_check(struct bus_type *bus, char *buf)
+{
+	unsigned int checks = PIN_CHECK_LOOPS * 2 * SIOS_NR_GPIO;
+	ktime_t start;
+	u64 ps;
+	int i, pin, valid = 0;
+
+	start = ktime_get();
+	for (i=0; i<PIN_CHECK_LOOPS; i++) {
+		for (pin=0; pin<SIOS_NR_GPIO; pin++) {
+			valid += !!check_sios_gpio(pin);
+			valid += !!check_sios_xgpio(pin);
+		}
+	}
+	ps = ktime_to_ns(ktime_sub(ktime_get(), start)) * 1000;
+	do_div(ps, checks);
+
+	return snprintf(buf, PAGE_SIZE, "checks\t%u\nvalid_pins\t%d\nps_per_check\t%llu\n",
+			checks, valid / PIN_CHECK_LOOPS, ps);
+}
+
+/*
+ * Cost of registering a device with many resources: a scratch device
+ * with one resource on every GPIO and XGPIO pin of a scratch board on
+ * which every pin may be claimed, registered and unregistered
+ * RES_CHECK_LOOPS times. The "files" rows register the same resources
+ * the way they were before the resource table: a sysfs file each and
+ * a conflict check walking every resource claimed so far.
+ */
+#define RES_CHECK_NR	(2 * SIOS_NR_GPIO)
+#define RES_CHECK_LOOPS	20
+
+struct res_check {
+	struct sios_resource res[RES_CHECK_NR];
+	struct device_attribute attr[RES_CHECK_NR];
+	char name[RES_CHECK_NR][8];
+};
+
+static struct sios_pin_desc res_check_desc[2][SIOS_NR_GPIO];
+static struct sios_board res_check_board = {
+	.desc = res_check_desc,
+};
+static DEFINE_MUTEX(res_check_mutex);
+
+static void res_check_release(struct sios_device *sdev)
+{
+	kfree(sdev);
+}
+
+static ssize_t show_res_check_file(struct device *dev, struct device_attribute *attr,
+				   char *buf)
+{
+	return snprintf(buf, PAGE_SIZE, "%s\n", attr->attr.name);
+}
+
+/* the resources one by one, a list walk and a sysfs file each */
+static int res_check_add_files(struct sios_device *sdev, struct res_check *rc)
+{
+	struct sios_resource *r;
+	int i, j, error;
+
+	for (i=0; i<RES_CHECK_NR; i++) {
+		r = &rc->res[i];
+		for (j=0; j<i; j++) {
+			if (rc->res[j].type == r->type && r->start <= rc->res[j].end &&
+			    r->end >= rc->res[j].start)
+				break;
+		}
+		error = (j < i) ? -EBUSY : device_create_file(&sdev->dev, &rc->attr[i]);
+		if (error)
+			goto err;
+	}
+	return 0;
+
+err:
+	while (--i >= 0)
+		device_remove_file(&sdev->dev, &rc->attr[i]);
+	return error;
+}
+
+/* mean ns to register and to unregister the scratch device */
+static int res_check_run(struct res_check *rc, int nr, int files,
+			 u64 *reg_ns, u64 *unreg_ns)
+{
+	struct sios_device *sdev;
+	ktime_t start;
+	int i, j, error;
+
+	*reg_ns = *unreg_ns = 0;
+	for (i=0; i<RES_CHECK_LOOPS; i++) {
+		sdev = kzalloc(sizeof(*sdev), GFP_KERNEL);
+		if (!sdev)
+			return -ENOMEM;
+		sdev->name = "res_check";
+		sdev->release = res_check_release;
+		sdev->board = &res_check_board;
+		sdev->resource = rc->res;
+		sdev->num_resource = files ? 0 : nr;
+
+		start = ktime_get();
+		error = sios_device_register(sdev);
+		if (error) {
+			sios_device_put(sdev);
+			return error;
+		}
+		if (files) {
+			error = res_check_add_files(sdev, rc);
+			if (error) {
+				sios_device_unregister(sdev);
+				return error;
+			}
+		}
+		*reg_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+
+		start = ktime_get();
+		for (j=0; files && j<RES_CHECK_NR; j++)
+			device_remove_file(&sdev->dev, &rc->attr[j]);
+		sios_device_unregister(sdev);
+		*unreg_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+	}
+
+	do_div(*reg_ns, RES_CHECK_LOOPS);
+	do_div(*unreg_ns, RES_CHECK_LOOPS);
+	return 0;
+}
+
+static ssize_t show_sios_res_check(struct bus_type *bus, char *buf)
+{
+	u64 none_reg, none_unreg, tbl_reg, tbl_unreg, files_reg, files_unreg;
+	struct res_check *rc;
+	int i, idx, error;
+
+	rc = kzalloc(sizeof(*rc), GFP_KERNEL);
+	if (!rc)
+		return -ENOMEM;
+
+	for (i=0; i<RES_CHECK_NR; i++) {
+		idx = i / SIOS_NR_GPIO;
+		rc->res[i].type = idx ? SIOS_IO_XGPIO : SIOS_IO_GPIO;
+		rc->res[i].start = rc->res[i].end = i % SIOS_NR_GPIO;
+		res_check_desc[idx][i % SIOS_NR_GPIO].caps = SIOS_PIN_CAP_RES;
+
+		snprintf(rc->name[i], sizeof(rc->name[i]), "r%d", i);
+		rc->attr[i].attr.name = rc->name[i];
+		rc->attr[i].attr.mode = S_IRUGO;
+		rc->attr[i].show = show_res_check_file;
+	}
+
+	mutex_lock(&res_check_mutex);
+	rwlock_init(&res_check_board.res_lock);
+	error = res_check_run(rc, 0, 0, &none_reg, &none_unreg);
+	if (!error)
+		error = res_check_run(rc, RES_CHECK_NR, 0, &tbl_reg, &tbl_unreg);
+	if (!error)
+		error = res_check_run(rc, RES_CHECK_NR, 1, &files_reg, &files_unreg);
+	mutex_unlock(&res_check_mutex);
+	kfree(rc);
+
+	if (error)
+		return error;
+
+	return snprintf(buf, PAGE_SIZE,
+			"resources\t%d\nloops\t%d\n"
+			"ns_register_none\t%llu\nns_unregister_none\t%llu\n"
+			"ns_register_table\t%llu\nns_unregister_table\t%llu\n"
+			"ns_register_files\t%llu\nns_unregister_files\t%llu\n",
+			RES_CHECK_NR, RES_CHECK_LOOPS, none_reg, none_unreg,
+			tbl_reg, tbl_unreg, files_reg, files_unreg);
+}
+
+static struct bus_attribute sios_bus_attrs[] = {
+	__ATTR(sources, S_IRUGO, show_sios_sources, NULL),
+	__ATTR(chips, S_IRUGO, show_sios_chips, NULL),
+	__ATTR(chip_scans, S_IRUGO, show_sios_chip_scans, NULL),
+	__ATTR(rescan, S_IWUSR, NULL, store_sios_rescan),
+	__ATTR(irqs, S_IRUGO, show_sios_irqs, NULL),
+	__ATTR(irq_simulate, S_IWUSR, NULL, store_sios_irq_simulate),
+	__ATTR(latency, S_IRUGO | S_IWUSR, show_sios_latency, store_sios_latency),
+	__ATTR(latency_hist, S_IRUGO, show_sios_latency_hist, NULL),
+	__ATTR(latency_bench, S_IRUGO | S_IWUSR, show_sios_latency_bench,
+	       store_sios_latency_bench),
+	__ATTR(pins, S_IRUGO, show_sios_pins, NULL),
+	__ATTR(pin_check, S_IRUGO, show_sios_pin_check, NULL),
+	__ATTR(res_check, S_IRUGO, show_sios_res_check, NULL),
+	__ATTR_NULL,
+};
+
 struct bus_type sios_bus_type = {
 	.name = "sios",
 	.match = sios_match,
 	.uevent = sios_uevent,
+	.bus_attrs = sios_bus_attrs,
+	.dev_attrs = sios_dev_attrs,
 	.suspend = sios_suspend,
 	.suspend_late = sios_suspend_late,
 	.resume_early = sios_resume_early,
@@ -310,6 +840,46 @@ struct bus_type sios_bus_type = {
 };
 EXPORT_SYMBOL_GPL(sios_bus_type);
 
+static dev_t sios_devt;
+static struct class *sios_class;
+
+/**
+ *	sios_chrdev_add - add a sios character device
+ *	@cdev: cdev to initialize and add
+ *	@fops: file operations
+ *	@minor: minor number within the sios region
+ *	@name: device node name, prefixed with SIOS_DEVICE_PREFIX
+ */
+int sios_chrdev_add(struct cdev *cdev, const struct file_operations *fops,
+		    int minor, const char *name)
+{
+	dev_t devt = MKDEV(MAJOR(sios_devt), minor);
+	struct device *dev;
+	int error;
+
+	cdev_init(cdev, fops);
+	cdev->owner = fops->owner;
+	error = cdev_add(cdev, devt, 1);
+	if (error)
+		return error;
+
+	dev = device_create(sios_class, &sios_bus, devt, SIOS_DEVICE_PREFIX "%s", name);
+	if (IS_ERR(dev)) {
+		cdev_del(cdev);
+		return PTR_ERR(dev);
+	}
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(sios_chrdev_add);
+
+void sios_chrdev_del(struct cdev *cdev, int minor)
+{
+	device_destroy(sios_class, MKDEV(MAJOR(sios_devt), minor));
+	cdev_del(cdev);
+}
+EXPORT_SYMBOL_GPL(sios_chrdev_del);
+
 static int __init sios_bus_init(void)
 {
 	int error;
@@ -319,12 +889,66 @@ static int __init sios_bus_init(void)
 		return error;
 	error = bus_register(&sios_bus_type);
 	if (error)
-		device_unregister(&sios_bus);
+		goto err_dev;
+
+	error = alloc_chrdev_region(&sios_devt, SIOS_BASE_MINOR,
+				    SIOS_MAX_MINOR - SIOS_BASE_MINOR + 1,
+				    SIOS_DEVICE_CLASS_NAME);
+	if (error)
+		goto err_bus;
+
+	sios_class = class_create(THIS_MODULE, SIOS_DEVICE_CLASS_NAME);
+	if (IS_ERR(sios_class)) {
+		error = PTR_ERR(sios_class);
+		goto err_region;
+	}
+
+	error = sios_board_init();
+	if (error)
+		goto err_class;
+
+	sios_latency_init();
+	error = sios_capture_init();
+	if (error)
+		goto err_board;
+
+	error = sios_profile_init();
+	if (error)
+		goto err_capture;
+
+	error = sios_snapshot_init();
+	if (error)
+		goto err_profile;
+
+	return 0;
+
+err_profile:
+	sios_profile_exit();
+err_capture:
+	sios_capture_exit();
+err_board:
+	sios_board_unregister(&sios_default_board);
+err_class:
+	class_destroy(sios_class);
+err_region:
+	unregister_chrdev_region(sios_devt, SIOS_MAX_MINOR - SIOS_BASE_MINOR + 1);
+err_bus:
+	bus_unregister(&sios_bus_type);
+err_dev:
+	device_unregister(&sios_bus);
 	return error;
 }
 
 static void __exit sios_bus_exit(void)
 {
+	sios_bench_stop();
+	sios_snapshot_exit();
+	sios_profile_exit();
+	sios_capture_exit();
+	sios_chip_exit();
+	sios_board_unregister(&sios_default_board);
+	class_destroy(sios_class);
+	unregister_chrdev_region(sios_devt, SIOS_MAX_MINOR - SIOS_BASE_MINOR + 1);
 	device_unregister(&sios_bus);
 	bus_unregister(&sios_bus_type);
 }
@@ -8,45 +8,65 @@
 #include <linux/spinlock.h>
 #include <linux/irq.h>
 #include <linux/workqueue.h>
+#include <linux/slab.h>
 #include <asm/arch/gpio.h>
 
 #include "sios/resource.h"
-#include "sios/sios-gpio.h"
+#include "sios/event.h"
+
+#include "sios/board.h"
 
 #define BTN_RELEASED 0
 #define BTN_PRESSED 1
 #define BTN_LONG 0
 #define BTN_SHORT 1
 
+/* last thing that happened, shown by the pollable state attribute */
+enum {
+	BTN_EV_RELEASED = 0,
+	BTN_EV_PRESSED,
+	BTN_EV_SHORT,
+	BTN_EV_LONG,
+};
+
+static const char *btn_event_names[] = {
+	[BTN_EV_RELEASED]	= "released",
+	[BTN_EV_PRESSED]	= "pressed",
+	[BTN_EV_SHORT]		= "short",
+	[BTN_EV_LONG]		= "long",
+};
+
 static int btn_short_timeout = 2000;
 static int btn_long_timeout = 4000;
-static spinlock_t btn_state_lock = SPIN_LOCK_UNLOCKED;
-
-static void pwr_button_work(struct work_struct *work);
-static DECLARE_WORK(button_pressed_counter, pwr_button_work);
 
 module_param_named(timeout_short, btn_short_timeout, int, 0700);
 module_param_named(timeout_long, btn_long_timeout, int, 0700);
 
-static struct pwr_button_state {
+/* one per board */
+struct pwr_button_state {
+	spinlock_t lock;
+	struct work_struct work;
 	int volatile state;
 	int pressed_ms;
 	int short_fired;
 	int long_fired;
 	int flushed;
-	unsigned long start;
-	struct sios_device *dev;
-} pwr_bs;
- 
-struct sios_resource button_res[] = {
-	[0] = {
-		.name = "PwrButton",
-		.start = GPIO_SIOS_PBST,
-		.end = GPIO_SIOS_PBST,
-		.type = SIOS_IO_GPIO|SIOS_IRQ,
-	},
+	int event;
+	ktime_t edge;		/* of the last state change */
+	int pin;
+
+	struct sios_board *board;
+	struct sios_resource res[1];
+	struct sios_device dev;
+	struct sios_source source;
+	char name[BUS_ID_SIZE];
+	char src_name[BUS_ID_SIZE];
+	struct list_head list;
 };
-#define PWRBTN_IRQ gpio_to_irq(GPIO_SIOS_PBST)
+
+#define to_pwr_button(x) container_of((x), struct pwr_button_state, dev)
+
+static LIST_HEAD(button_list);
 
 static void pwr_button_uevent(struct sios_device *sdev, int state)
 {
@@ -62,69 +82,110 @@ static void pwr_button_uevent(struct sios_device *sdev, int state)
 	kobject_uevent_env(&sdev->dev.kobj, KOBJ_CHANGE, envp);
 }
 
-static inline void pwr_button_work_reschedule(struct work_struct *work)
+static void pwr_button_event(struct pwr_button_state *bs, int event)
+{
+	if (bs->event == event)
+		return;
+	bs->event = event;
+	sysfs_notify(&bs->dev.dev.kobj, NULL, "state");
+}
+
+static inline void pwr_button_work_reschedule(struct pwr_button_state *bs)
 {
 	unsigned long flags;
 
-	spin_lock_irqsave(&btn_state_lock, flags);
-	if (pwr_bs.flushed)
+	spin_lock_irqsave(&bs->lock, flags);
+	if (bs->flushed)
 		goto out;
-	schedule_work(work);	
+	schedule_work(&bs->work);	
 out:
-	spin_unlock_irqrestore(&btn_state_lock, flags);
+	spin_unlock_irqrestore(&bs->lock, flags);
 }
 
 static void pwr_button_work(struct work_struct *work)
 {
+	struct pwr_button_state *bs = container_of(work, struct pwr_button_state, work);
 	unsigned long flags;
+	ktime_t edge;
 	int state;
 
-	spin_lock_irqsave(&btn_state_lock, flags);
-	state = pwr_bs.state;
-	spin_unlock_irqrestore(&btn_state_lock, flags);
+	spin_lock_irqsave(&bs->lock, flags);
+	state = bs->state;
+	edge = bs->edge;
+	spin_unlock_irqrestore(&bs->lock, flags);
 
 	if (state == BTN_PRESSED) {
-		if (pwr_bs.start)
-			pwr_bs.pressed_ms = (jiffies - pwr_bs.start) * 1000 / HZ;
-		else
-			pwr_bs.start = jiffies;
+		/* measured from the interrupt, not from when we got to run */
+		bs->pressed_ms = (long)ktime_us_delta(sios_event_stamp(), edge) / USEC_PER_MSEC;
+		if (!bs->short_fired)
+			pwr_button_event(bs, BTN_EV_PRESSED);
 	} else {
-		pwr_bs.start = 0L;
-		pwr_bs.pressed_ms = 0;
-		pwr_bs.short_fired = 0;
-		pwr_bs.long_fired = 0;
+		bs->pressed_ms = 0;
+		bs->short_fired = 0;
+		bs->long_fired = 0;
+		pwr_button_event(bs, BTN_EV_RELEASED);
 		return;
 	}
 
-	if (pwr_bs.pressed_ms < btn_short_timeout) {
-		pwr_button_work_reschedule(work);
-	} else if (!pwr_bs.short_fired) {
-		pwr_bs.short_fired = 1;
-		pwr_button_work_reschedule(work);	
-		pwr_button_uevent(pwr_bs.dev, BTN_SHORT);
-	} else if (pwr_bs.pressed_ms >= btn_long_timeout && !pwr_bs.long_fired) {
-		pwr_bs.long_fired = 1;
-		pwr_button_uevent(pwr_bs.dev, BTN_LONG);
+	if (bs->pressed_ms < btn_short_timeout) {
+		pwr_button_work_reschedule(bs);
+	} else if (!bs->short_fired) {
+		bs->short_fired = 1;
+		pwr_button_work_reschedule(bs);	
+		pwr_button_uevent(&bs->dev, BTN_SHORT);
+		pwr_button_event(bs, BTN_EV_SHORT);
+	} else if (bs->pressed_ms >= btn_long_timeout && !bs->long_fired) {
+		bs->long_fired = 1;
+		pwr_button_uevent(&bs->dev, BTN_LONG);
+		pwr_button_event(bs, BTN_EV_LONG);
 	} else {
-		pwr_button_work_reschedule(work);
+		pwr_button_work_reschedule(bs);
 	}
 }
 
-static irqreturn_t pbst_interrupt_handler(int irq, void *dev_id)
+static void pwr_button_set_state(struct pwr_button_state *bs, int level,
+				 ktime_t edge)
 {
 	unsigned long flags;
 
-	spin_lock_irqsave(&btn_state_lock, flags);
-	pwr_bs.state = (gpio_get_value(GPIO_SIOS_PBST)) ? BTN_RELEASED : BTN_PRESSED;
-	schedule_work(&button_pressed_counter);
-	spin_unlock_irqrestore(&btn_state_lock, flags);
+	spin_lock_irqsave(&bs->lock, flags);
+	bs->state = (level) ? BTN_RELEASED : BTN_PRESSED;
+	bs->edge = edge;
+	if (!bs->flushed)
+		schedule_work(&bs->work);
+	spin_unlock_irqrestore(&bs->lock, flags);
+}
 
-  	return IRQ_HANDLED;
+/* replay backend: a recorded PBST level takes the same path as the IRQ */
+static void pwr_button_inject(struct sios_source *src, u16 value)
+{
+	pwr_button_set_state(container_of(src, struct pwr_button_state, source),
+			     value, sios_event_stamp());
 }
 
+/* PBST is a SIOS_IRQ resource: runs in the pin's thread, see irq.c */
+static void pbst_irq_handler(struct sios_resource *res,
+			     const struct sios_irq_rec *rec)
+{
+	struct pwr_button_state *bs = to_pwr_button(res->dev);
+
+	sios_event_report_ts(&bs->source, rec->stamp, rec->level);
+	pwr_button_set_state(bs, rec->level, rec->stamp);
+}
+
+static ssize_t show_button_state(struct device *dev, struct device_attribute *attr,
+				 char *buf)
+{
+	struct pwr_button_state *bs = to_pwr_button(to_sios_device(dev));
+
+	return snprintf(buf, PAGE_SIZE, "%s\n", btn_event_names[bs->event]);
+}
+
+static DEVICE_ATTR(state, S_IRUGO, show_button_state, NULL);
+
 static void sios_button_release(struct sios_device *sdev)
 {
-	return;
+	kfree(to_pwr_button(sdev));
 }
 
 struct sios_driver button_drv = {
@@ -135,56 +196,114 @@ struct sios_driver button_drv = {
 	},
 };
 
-struct sios_device button_dev = {
-	.name = "sios:button",
-	.release = sios_button_release,
-	.num_resource = 1,
-	.resource = button_res,
-};
-
-int __init sios_button_init(void)
+static int sios_button_add(struct sios_board *board, void *data)
 {
+	struct pwr_button_state *bs;
 	int error;
- 
-      	error = sios_driver_register(&button_drv);
-	if (error)
+
+	bs = kzalloc(sizeof(*bs), GFP_KERNEL);
+	if (!bs)
+		return -ENOMEM;
+
+	spin_lock_init(&bs->lock);
+	INIT_WORK(&bs->work, pwr_button_work);
+	bs->board = board;
+	bs->pin = sios_board_pin(board, SIOS_PIN_PBST);
+
+	/* the source is fed by the interrupt, which starts with the device */
+	sios_board_devname(board, "PwrButton", bs->src_name, sizeof(bs->src_name));
+	bs->source.name = bs->src_name;
+	bs->source.type = SIOS_EV_GPIO;
+	bs->source.inject = pwr_button_inject;
+	error = sios_source_register(&bs->source);
+	if (error) {
+		kfree(bs);
 		return error;
+	}
 
-	error = sios_device_register(&button_dev);
+	error = sios_board_claim(board, SIOS_CLAIM_BUTTON, &bs->res[0]);
 	if (error) {
-		sios_driver_unregister(&button_drv);
+		sios_source_unregister(&bs->source);
+		kfree(bs);
 		return error;
 	}
+	bs->res[0].name = bs->src_name;
+	bs->res[0].handler = pbst_irq_handler;
 
-	pwr_bs.dev = &button_dev;
-	gpio_direction_input(GPIO_SIOS_PBST);
+	sios_board_devname(board, "sios:button", bs->name, sizeof(bs->name));
+	bs->dev.name = bs->name;
+	bs->dev.release = sios_button_release;
+	bs->dev.num_resource = ARRAY_SIZE(bs->res);
+	bs->dev.resource = bs->res;
+	bs->dev.board = board;
 
-	set_irq_type(PWRBTN_IRQ, IRQT_BOTHEDGE);
-	if (request_irq(PWRBTN_IRQ, pbst_interrupt_handler, SA_INTERRUPT,
-			"sios-button-pbst", NULL) != 0) {
-		printk(KERN_ERR "Unable to register IRQ %d\n",
-		       GPIO_SIOS_PBST);
-		goto err;
+	error = sios_device_register(&bs->dev);
+	if (error) {
+		sios_source_unregister(&bs->source);
+		kfree(bs);
+		return error;
 	}
 
-       return 0;
-err:
-	sios_device_unregister(&button_dev);
-	sios_driver_unregister(&button_drv);
+	error = device_create_file(&bs->dev.dev, &dev_attr_state);
+	if (error)
+		goto err;
 
+	list_add_tail(&bs->list, &button_list);
+	return 0;
+
+err:
+	sios_free_irqs(&bs->dev);
+	sios_source_unregister(&bs->source);
+	spin_lock_irq(&bs->lock);
+	bs->flushed = 1;
+	spin_unlock_irq(&bs->lock);
+	flush_scheduled_work();
+	sios_device_unregister(&bs->dev);
 	return error;
 }
 
-static void __exit sios_button_exit(void)
+static void sios_button_remove_all(void)
 {
-	free_irq(PWRBTN_IRQ, NULL);
+	struct pwr_button_state *bs, *n;
 
-	spin_lock(&btn_state_lock);
-	pwr_bs.flushed = 1;
-	spin_unlock(&btn_state_lock);
+	list_for_each_entry(bs, &button_list, list) {
+		sios_free_irqs(&bs->dev);
+		sios_source_unregister(&bs->source);
+
+		spin_lock_irq(&bs->lock);
+		bs->flushed = 1;
+		spin_unlock_irq(&bs->lock);
+	}
 
 	flush_scheduled_work();
-	sios_device_unregister(&button_dev);
+
+	list_for_each_entry_safe(bs, n, &button_list, list) {
+		list_del(&bs->list);
+		device_remove_file(&bs->dev.dev, &dev_attr_state);
+		sios_device_unregister(&bs->dev);
+	}
+}
+
+int __init sios_button_init(void)
+{
+	int error;
+ 
+      	error = sios_driver_register(&button_drv);
+	if (error)
+		return error;
+
+	error = sios_for_each_board(NULL, sios_button_add);
+	if (error) {
+		sios_button_remove_all();
+		sios_driver_unregister(&button_drv);
+	}
+
+	return error;
+}
+
+static void __exit sios_button_exit(void)
+{
+	sios_button_remove_all();
 	sios_driver_unregister(&button_drv);
 }
 
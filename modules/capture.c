@@ -0,0 +1,945 @@
+/* -*-linux-c-*-
+ * capture.c - SIOS raw event capture and replay
+ *
+ * Copyright (C) 2008 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA, or http://www.gnu.org/licenses/gpl.html
+ */
+
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/cdev.h>
+#include <linux/poll.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/mm.h>
+#include <linux/delay.h>
+#include <linux/workqueue.h>
+#include <linux/ktime.h>
+#include <asm/uaccess.h>
+#include <asm/div64.h>
+#include <asm/unaligned.h>
+
+#include "sios/sios.h"
+#include "sios/event.h"
+#include "sios/capture.h"
+#include "sios/hardware.h"
+
+static int capture_blocks = 16;
+module_param(capture_blocks, int, 0444);
+MODULE_PARM_DESC(capture_blocks, "capture ring size in blocks of 4 KiB");
+
+static int capture_flush_ms = 1000;
+module_param(capture_flush_ms, int, 0644);
+MODULE_PARM_DESC(capture_flush_ms, "hand out a partially filled block after this many ms");
+
+static int replay_realtime = 1;
+module_param(replay_realtime, bool, 0644);
+MODULE_PARM_DESC(replay_realtime, "replay at original speed instead of as fast as possible");
+
+static int capture_packed;
+module_param(capture_packed, bool, 0644);
+MODULE_PARM_DESC(capture_packed, "store converter scans packed, 12 bits per sample");
+
+#define CAP_WRITER	1
+
+#define CAP_INDEX_ENTRIES	(SIOS_CAP_INDEX_STRIDE - 1)
+
+/*
+ * Capture ring, shared by all readers. The block at head is being
+ * filled while open is set, the capture_blocks - 1 blocks before it
+ * are sealed. head is free running. The producer never waits for
+ * readers: it takes the oldest slot for the next block whether or not
+ * everybody is done with it, and its cost does not depend on how many
+ * readers there are.
+ *
+ * Every reader has its own cursor. Sealed blocks are copied out, or
+ * read in place through mmap, without holding the lock; whether the
+ * producer came round in the meantime is checked against head after,
+ * see cap_intact.
+ */
+static struct sios_capture {
+	spinlock_t lock;
+	wait_queue_head_t wait;
+	unsigned long flags;
+	int active;
+	struct mutex readers_lock;
+	int readers;
+
+	char *ring;
+	unsigned int head;
+	int open;		/* block type at head, 0 if none */
+	int fill;		/* entries */
+	size_t bytes;		/* of a SCAN block */
+	int packed;		/* capture_packed when the capture started */
+	u64 base_ns;
+	unsigned long opened;	/* jiffies */
+	struct delayed_work flush;
+
+	u32 seq;
+	u32 dropped;
+	int pending_index;
+	struct sios_cap_block *pending_sources;
+	struct sios_cap_index index[CAP_INDEX_ENTRIES];
+	int nr_index;
+
+	struct cdev cdev;
+} cap;
+
+static struct sios_replay {
+	struct sios_cap_block *block;
+	size_t fill;
+	u8 map[SIOS_MAX_SOURCES + 1];
+	int started;
+	u64 first_ns;
+	ktime_t start;
+	u32 events;
+	u32 unmatched;
+} rp;
+
+static inline struct sios_cap_block *cap_slot(unsigned int n)
+{
+	return (struct sios_cap_block *)
+		(cap.ring + (n % capture_blocks) * SIOS_CAP_BLOCK_SIZE);
+}
+
+/* per open file for reading */
+struct sios_cap_reader {
+	unsigned int pos;	/* next block to hand out */
+	u32 lost;		/* blocks overwritten before we got to them */
+};
+
+/* block n was not reused since it was sealed, caller holds cap.lock */
+static inline int cap_intact(unsigned int n)
+{
+	return cap.head - n < capture_blocks;
+}
+
+/* a reader that fell behind continues at the oldest sealed block */
+static void cap_catch_up(struct sios_cap_reader *rd)
+{
+	if (cap.head - rd->pos > capture_blocks - 1) {
+		rd->lost += cap.head - (capture_blocks - 1) - rd->pos;
+		rd->pos = cap.head - (capture_blocks - 1);
+	}
+}
+
+static void cap_block_init(struct sios_cap_block *blk, int type, u64 base_ns)
+{
+	memset(blk, 0, sizeof(*blk));
+	blk->magic = cpu_to_le32(SIOS_CAP_MAGIC);
+	blk->version = cpu_to_le16(SIOS_CAP_VERSION);
+	blk->type = cpu_to_le16(type);
+	blk->seq = cpu_to_le32(cap.seq);
+	blk->base_ns = cpu_to_le64(base_ns);
+	blk->dropped = cpu_to_le32(cap.dropped);
+	blk->clock = cpu_to_le32(sios_event_clock());
+	cap.dropped = 0;
+}
+
+/* latency of every event in a sealed block, caller holds cap.lock */
+static void cap_account(struct sios_cap_block *blk, int stage)
+{
+	u64 now = ktime_to_ns(sios_event_stamp());
+	u64 base = le64_to_cpu(blk->base_ns);
+	u32 i, count = le32_to_cpu(blk->count);
+	struct sios_cap_event *ev;
+	struct sios_cap_scan_set *sets;
+	size_t off;
+	u8 *rec;
+
+	switch (le16_to_cpu(blk->type)) {
+	case SIOS_CAP_BLK_DATA:
+		ev = (struct sios_cap_event *)(blk + 1);
+		for (i=0; i<count && i<SIOS_CAP_EVENTS_PER_BLOCK; i++)
+			sios_latency_add(stage, now - base - le32_to_cpu(ev[i].delta_ns));
+		break;
+	case SIOS_CAP_BLK_SCAN:
+		sets = (struct sios_cap_scan_set *)(blk + 1);
+		off = SIOS_CAP_SCAN_DATA;
+		for (i=0; i<count; i++) {
+			rec = (u8 *)blk + off;
+			if (off + 5 > SIOS_CAP_BLOCK_SIZE)
+				break;
+			if (rec[4] == SIOS_CAP_SCAN_EVENT)
+				off += SIOS_CAP_SCAN_EV_LEN;
+			else if (rec[4] < SIOS_CAP_SCAN_SETS)
+				off += SIOS_CAP_SCAN_REC_LEN(sets[rec[4]].nr);
+			else
+				break;
+			sios_latency_add(stage, now - base -
+					 le32_to_cpu(get_unaligned((__le32 *)rec)));
+		}
+		break;
+	}
+}
+
+/* seal the block at head, caller holds cap.lock */
+static void cap_commit(struct sios_cap_block *blk)
+{
+	if (sios_latency_on)
+		cap_account(blk, SIOS_LAT_QUEUE);
+
+	if (blk->type != cpu_to_le16(SIOS_CAP_BLK_INDEX) &&
+	    cap.nr_index < CAP_INDEX_ENTRIES) {
+		struct sios_cap_index *idx = &cap.index[cap.nr_index++];
+		idx->base_ns = blk->base_ns;
+		idx->seq = blk->seq;
+		idx->type = blk->type;
+		idx->count = cpu_to_le16(le32_to_cpu(blk->count));
+	}
+
+	cap.head++;
+	cap.seq++;
+	if (cap.seq % SIOS_CAP_INDEX_STRIDE == SIOS_CAP_INDEX_STRIDE - 1)
+		cap.pending_index = 1;
+
+	wake_up_interruptible(&cap.wait);
+}
+
+/* emit queued index and source blocks, caller holds cap.lock */
+static void cap_emit_pending(u64 now)
+{
+	struct sios_cap_block *blk;
+	__le32 count;
+
+	if (cap.pending_index) {
+		blk = cap_slot(cap.head);
+		cap_block_init(blk, SIOS_CAP_BLK_INDEX,
+			       cap.nr_index ? le64_to_cpu(cap.index[0].base_ns) : now);
+		blk->count = cpu_to_le32(cap.nr_index);
+		memcpy(blk + 1, cap.index, cap.nr_index * sizeof(cap.index[0]));
+		cap.nr_index = 0;
+		cap.pending_index = 0;
+		cap_commit(blk);
+	}
+
+	if (cap.pending_sources && !cap.pending_index) {
+		blk = cap_slot(cap.head);
+		count = cap.pending_sources->count;
+		memcpy(blk, cap.pending_sources, SIOS_CAP_BLOCK_SIZE);
+		cap_block_init(blk, SIOS_CAP_BLK_SOURCES, now);
+		blk->count = count;
+		kfree(cap.pending_sources);
+		cap.pending_sources = NULL;
+		cap_commit(blk);
+	}
+
+	if (cap.pending_index)
+		cap_emit_pending(now);
+}
+
+/* ns is too far past the open block for a delta, one before it is clamped */
+static inline int cap_too_far(u64 ns)
+{
+	return ns > cap.base_ns && ns - cap.base_ns > 0xffffffffULL;
+}
+
+/* a block was opened at head, have it handed out after capture_flush_ms */
+static inline void cap_opened(void)
+{
+	cap.opened = jiffies;
+	schedule_delayed_work(&cap.flush, msecs_to_jiffies(capture_flush_ms));
+}
+
+/*
+ * The only place a partly filled block is sealed: by age, never on
+ * behalf of one reader, so that every reader sees the same blocks
+ * and a reader polling fast does not cut them down for the others.
+ */
+static void cap_flush(struct work_struct *work)
+{
+	unsigned long due;
+
+	spin_lock_irq(&cap.lock);
+	due = cap.opened + msecs_to_jiffies(capture_flush_ms);
+	if (cap.open && cap.fill) {
+		if (time_after_eq(jiffies, due)) {
+			cap_commit(cap_slot(cap.head));
+			cap.open = 0;
+		} else {
+			schedule_delayed_work(&cap.flush, due - jiffies);
+		}
+	}
+	spin_unlock_irq(&cap.lock);
+}
+
+/*
+ * Room for a len byte record in the open SCAN block, a new block is
+ * opened if it does not fit. Returns the record with its delta filled
+ * in, caller holds cap.lock.
+ */
+static u8 *cap_scan_room(u64 ns, size_t len)
+{
+	struct sios_cap_block *blk;
+	u8 *rec;
+
+	if (cap.open && (cap.bytes + len > SIOS_CAP_BLOCK_SIZE || cap_too_far(ns))) {
+		cap_commit(cap_slot(cap.head));
+		cap.open = 0;
+	}
+
+	blk = cap_slot(cap.head);
+	if (!cap.open) {
+		cap_emit_pending(ns);
+		blk = cap_slot(cap.head);
+		cap_block_init(blk, SIOS_CAP_BLK_SCAN, ns);
+		memset(blk + 1, 0, SIOS_CAP_SCAN_DATA - sizeof(*blk));
+		cap.base_ns = ns;
+		cap.fill = 0;
+		cap.bytes = SIOS_CAP_SCAN_DATA;
+		cap.open = SIOS_CAP_BLK_SCAN;
+		cap_opened();
+	}
+
+	rec = (u8 *)blk + cap.bytes;
+	put_unaligned(cpu_to_le32(ns > cap.base_ns ? (u32)(ns - cap.base_ns) : 0),
+		      (__le32 *)rec);
+	cap.bytes += len;
+	blk->count = cpu_to_le32(++cap.fill);
+	return rec;
+}
+
+void sios_capture_event(struct sios_source *src, ktime_t ts, u16 value)
+{
+	struct sios_cap_block *blk;
+	struct sios_cap_event *ev;
+	unsigned long flags;
+	u64 ns = ktime_to_ns(ts);
+	u8 *rec;
+
+	if (!cap.active)
+		return;
+
+	spin_lock_irqsave(&cap.lock, flags);
+	if (!cap.active)
+		goto out;
+
+	if (cap.packed) {
+		/* between the scans, so that neither seals the other's block */
+		rec = cap_scan_room(ns, SIOS_CAP_SCAN_EV_LEN);
+		rec[4] = SIOS_CAP_SCAN_EVENT;
+		rec[5] = src->id;
+		rec[6] = src->rate_shift;
+		put_unaligned(cpu_to_le16(value), (__le16 *)(rec + 7));
+		goto out;
+	}
+
+	if (cap.open && (cap.open != SIOS_CAP_BLK_DATA ||
+			 cap.fill == SIOS_CAP_EVENTS_PER_BLOCK ||
+			 cap_too_far(ns))) {
+		cap_commit(cap_slot(cap.head));
+		cap.open = 0;
+	}
+
+	if (!cap.open) {
+		cap_emit_pending(ns);
+		cap_block_init(cap_slot(cap.head), SIOS_CAP_BLK_DATA, ns);
+		cap.base_ns = ns;
+		cap.fill = 0;
+		cap.open = SIOS_CAP_BLK_DATA;
+		cap_opened();
+	}
+
+	blk = cap_slot(cap.head);
+	ev = (struct sios_cap_event *)(blk + 1) + cap.fill++;
+	/* sources may report slightly out of order */
+	ev->delta_ns = cpu_to_le32(ns > cap.base_ns ? (u32)(ns - cap.base_ns) : 0);
+	ev->source = src->id;
+	ev->flags = src->rate_shift;
+	ev->value = cpu_to_le16(value);
+	blk->count = cpu_to_le32(cap.fill);
+out:
+	spin_unlock_irqrestore(&cap.lock, flags);
+}
+
+/* the layout entry of the open SCAN block for src, or -1 if full */
+static int cap_scan_set(struct sios_cap_block *blk, struct sios_source **src, int n)
+{
+	struct sios_cap_scan_set *set = (struct sios_cap_scan_set *)(blk + 1);
+	int i, k;
+
+	for (i=0; i<SIOS_CAP_SCAN_SETS && set[i].nr; i++) {
+		if (set[i].nr != n)
+			continue;
+		for (k=0; k<n && set[i].source[k] == src[k]->id; k++)
+			;
+		if (k == n)
+			return i;
+	}
+	if (i == SIOS_CAP_SCAN_SETS)
+		return -1;
+
+	set[i].nr = n;
+	for (k=0; k<n; k++)
+		set[i].source[k] = src[k]->id;
+	return i;
+}
+
+void sios_capture_scan(struct sios_source **src, int n, ktime_t ts,
+		       const u16 *vals)
+{
+	unsigned long flags;
+	u64 ns = ktime_to_ns(ts);
+	size_t len = SIOS_CAP_SCAN_REC_LEN(n);
+	unsigned int head;
+	u8 *rec;
+	int i, set = -1;
+
+	if (!cap.active)
+		return;
+
+	for (i=0; i<n && !src[i]->max_rate; i++)
+		;
+	if (!cap.packed || n > SIOS_CAP_SCAN_MAX || i < n) {
+		/* scan records have no room for a rate */
+		for (i=0; i<n; i++)
+			sios_capture_event(src[i], ts, vals[i]);
+		return;
+	}
+
+	spin_lock_irqsave(&cap.lock, flags);
+	if (!cap.active)
+		goto out;
+
+	if (cap.open == SIOS_CAP_BLK_SCAN)
+		set = cap_scan_set(cap_slot(cap.head), src, n);
+	if (cap.open && set < 0) {
+		cap_commit(cap_slot(cap.head));
+		cap.open = 0;
+	}
+
+	head = cap.head;
+	rec = cap_scan_room(ns, len);
+	if (set < 0 || cap.head != head)
+		set = cap_scan_set(cap_slot(cap.head), src, n);
+	rec[4] = set;
+	sios_cap_pack12(rec + 5, vals, n);
+out:
+	spin_unlock_irqrestore(&cap.lock, flags);
+}
+
+static struct sios_cap_block *cap_sources_block(void)
+{
+	struct sios_cap_block *blk;
+	int n;
+
+	blk = kzalloc(SIOS_CAP_BLOCK_SIZE, GFP_KERNEL);
+	if (!blk)
+		return NULL;
+
+	n = sios_source_snapshot((struct sios_cap_source *)(blk + 1),
+				 SIOS_CAP_SOURCES_PER_BLOCK);
+	blk->count = cpu_to_le32(n);
+	return blk;
+}
+
+void sios_capture_sources_changed(void)
+{
+	struct sios_cap_block *blk;
+	unsigned long flags;
+
+	if (!cap.active)
+		return;
+
+	blk = cap_sources_block();
+	if (!blk) {
+		printk(KERN_WARNING "sios capture: lost source table update\n");
+		return;
+	}
+
+	spin_lock_irqsave(&cap.lock, flags);
+	kfree(cap.pending_sources);
+	cap.pending_sources = blk;
+	spin_unlock_irqrestore(&cap.lock, flags);
+}
+
+/* first reader: start a new capture */
+static int sios_capture_start(struct sios_cap_reader *rd)
+{
+	struct sios_cap_block *blk;
+
+	blk = cap_sources_block();
+	if (!blk)
+		return -ENOMEM;
+
+	spin_lock_irq(&cap.lock);
+	cap.head = 0;
+	cap.open = 0;
+	cap.seq = 0;
+	cap.dropped = 0;
+	cap.nr_index = 0;
+	cap.pending_index = 0;
+	cap.pending_sources = blk;
+	cap.packed = capture_packed;
+	cap_emit_pending(ktime_to_ns(sios_event_stamp()));
+	cap.active = 1;
+	rd->pos = 0;
+	spin_unlock_irq(&cap.lock);
+
+	return 0;
+}
+
+/*
+ * Another reader joins a running capture. It starts at a fresh source
+ * table so that what it reads decodes on its own.
+ */
+static int sios_capture_join(struct sios_cap_reader *rd)
+{
+	struct sios_cap_block *blk;
+
+	blk = cap_sources_block();
+	if (!blk)
+		return -ENOMEM;
+
+	spin_lock_irq(&cap.lock);
+	if (cap.open) {
+		if (cap.fill)
+			cap_commit(cap_slot(cap.head));
+		cap.open = 0;
+	}
+	kfree(cap.pending_sources);
+	cap.pending_sources = blk;
+	rd->pos = cap.head;
+	/* the index block comes first if one is due, which is fine */
+	cap_emit_pending(ktime_to_ns(sios_event_stamp()));
+	spin_unlock_irq(&cap.lock);
+
+	return 0;
+}
+
+static void sios_capture_stop(void)
+{
+	spin_lock_irq(&cap.lock);
+	cap.active = 0;
+	kfree(cap.pending_sources);
+	cap.pending_sources = NULL;
+	spin_unlock_irq(&cap.lock);
+
+	cancel_delayed_work_sync(&cap.flush);
+}
+
+/* wait for a sealed block, cap_flush hands out the open one by age */
+static int cap_wait(struct file *file, struct sios_cap_reader *rd)
+{
+	if (ACCESS_ONCE(cap.head) != rd->pos)
+		return 0;
+	if (file->f_flags & O_NONBLOCK)
+		return -EAGAIN;
+	return wait_event_interruptible(cap.wait, ACCESS_ONCE(cap.head) != rd->pos);
+}
+
+static ssize_t sios_capture_read(struct file *file, char __user *buf,
+				 size_t count, loff_t *ppos)
+{
+	struct sios_cap_reader *rd = file->private_data;
+	unsigned int first, avail, i;
+	int error, intact;
+
+	if (count < SIOS_CAP_BLOCK_SIZE)
+		return -EINVAL;
+
+	error = cap_wait(file, rd);
+	if (error)
+		return error;
+
+	/* copied outside the lock, start over if it got overwritten meanwhile */
+	do {
+		spin_lock_irq(&cap.lock);
+		cap_catch_up(rd);
+		first = rd->pos;
+		avail = min_t(unsigned int, cap.head - first, count / SIOS_CAP_BLOCK_SIZE);
+		spin_unlock_irq(&cap.lock);
+
+		for (i=0; i<avail; i++) {
+			if (copy_to_user(buf + i * SIOS_CAP_BLOCK_SIZE, cap_slot(first + i),
+					 SIOS_CAP_BLOCK_SIZE))
+				return -EFAULT;
+		}
+
+		spin_lock_irq(&cap.lock);
+		intact = cap_intact(first);
+		if (intact) {
+			rd->pos = first + avail;
+			for (i=0; i<avail && sios_latency_on; i++)
+				cap_account(cap_slot(first + i), SIOS_LAT_READ);
+		}
+		spin_unlock_irq(&cap.lock);
+	} while (!intact);
+
+	return avail * SIOS_CAP_BLOCK_SIZE;
+}
+
+static unsigned int sios_capture_poll(struct file *file, poll_table *wait)
+{
+	struct sios_cap_reader *rd = file->private_data;
+
+	poll_wait(file, &cap.wait, wait);
+	return (rd && cap.head != rd->pos) ? POLLIN | POLLRDNORM : 0;
+}
+
+/*
+ * Zero-copy readers map the ring read-only and use PEEK and CONSUME
+ * instead of read, see sios/capture.h.
+ */
+static int sios_capture_ioctl(struct inode *inode, struct file *file,
+			      unsigned int cmd, unsigned long arg)
+{
+	struct sios_cap_reader *rd = file->private_data;
+	struct sios_cap_ring ring;
+	u32 n;
+	int error = 0;
+
+	if (!rd)
+		return -EBADF;
+
+	switch (cmd) {
+	case SIOS_CAP_IOC_PEEK:
+		spin_lock_irq(&cap.lock);
+		cap_catch_up(rd);
+		ring.blocks = capture_blocks;
+		ring.first = rd->pos;
+		ring.count = cap.head - rd->pos;
+		ring.lost = rd->lost;
+		spin_unlock_irq(&cap.lock);
+		if (copy_to_user((void __user *)arg, &ring, sizeof(ring)))
+			error = -EFAULT;
+		break;
+	case SIOS_CAP_IOC_CONSUME:
+		if (get_user(n, (u32 __user *)arg))
+			return -EFAULT;
+		spin_lock_irq(&cap.lock);
+		if (!cap_intact(rd->pos)) {
+			/* what the caller just read may be torn */
+			cap_catch_up(rd);
+			error = -EOVERFLOW;
+		} else if (n > cap.head - rd->pos) {
+			error = -EINVAL;
+		} else {
+			while (n--) {
+				if (sios_latency_on)
+					cap_account(cap_slot(rd->pos), SIOS_LAT_READ);
+				rd->pos++;
+			}
+		}
+		spin_unlock_irq(&cap.lock);
+		break;
+	default:
+		error = -ENOTTY;
+	}
+
+	return error;
+}
+
+static int sios_capture_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	unsigned long size = vma->vm_end - vma->vm_start;
+
+	if (!file->private_data)
+		return -EBADF;
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	if (size > capture_blocks * SIOS_CAP_BLOCK_SIZE - (vma->vm_pgoff << PAGE_SHIFT))
+		return -EINVAL;
+
+	vma->vm_flags &= ~VM_MAYWRITE;
+	return remap_vmalloc_range(vma, cap.ring, vma->vm_pgoff);
+}
+
+/* original speed: sleep until ns is due relative to the first event */
+static int sios_replay_wait(u64 ns)
+{
+	s64 ahead;
+	u64 ms;
+
+	if (!rp.started) {
+		rp.started = 1;
+		rp.first_ns = ns;
+		rp.start = ktime_get();
+		return 0;
+	}
+
+	ahead = (s64)(ns - rp.first_ns) - ktime_to_ns(ktime_sub(ktime_get(), rp.start));
+	if (ahead < NSEC_PER_MSEC)
+		return 0;
+
+	ms = ahead;
+	do_div(ms, NSEC_PER_MSEC);
+	if (msleep_interruptible(ms))
+		return -ERESTARTSYS;
+	return 0;
+}
+
+static int sios_replay_block(struct sios_cap_block *blk)
+{
+	u32 i, count = le32_to_cpu(blk->count);
+	u64 base = le64_to_cpu(blk->base_ns);
+	u16 version = le16_to_cpu(blk->version);
+	int error, id;
+
+	if (le32_to_cpu(blk->magic) != SIOS_CAP_MAGIC)
+		return -EINVAL;
+	if (!version || version > SIOS_CAP_VERSION)
+		return -EPROTO;
+
+	switch (le16_to_cpu(blk->type)) {
+	case SIOS_CAP_BLK_SOURCES: {
+		struct sios_cap_source *s = (struct sios_cap_source *)(blk + 1);
+		char name[SIOS_CAP_NAME_LEN + 1];
+
+		if (count > SIOS_CAP_SOURCES_PER_BLOCK)
+			return -EINVAL;
+		for (i=0; i<count; i++) {
+			strlcpy(name, s[i].name, sizeof(name));
+			id = sios_source_lookup(name);
+			rp.map[s[i].id] = (id < 0) ? SIOS_MAX_SOURCES : id;
+		}
+		break;
+	}
+	case SIOS_CAP_BLK_DATA: {
+		struct sios_cap_event *ev = (struct sios_cap_event *)(blk + 1);
+
+		if (count > SIOS_CAP_EVENTS_PER_BLOCK)
+			return -EINVAL;
+		for (i=0; i<count; i++) {
+			if (replay_realtime) {
+				error = sios_replay_wait(base + le32_to_cpu(ev[i].delta_ns));
+				if (error)
+					return error;
+			}
+			id = rp.map[ev[i].source];
+			if (id == SIOS_MAX_SOURCES ||
+			    sios_source_inject(id, le16_to_cpu(ev[i].value)))
+				rp.unmatched++;
+			rp.events++;
+		}
+		break;
+	}
+	case SIOS_CAP_BLK_SCAN: {
+		struct sios_cap_scan_set *set = (struct sios_cap_scan_set *)(blk + 1);
+		const u8 *rec = (const u8 *)blk + SIOS_CAP_SCAN_DATA;
+		const u8 *end = (const u8 *)blk + SIOS_CAP_BLOCK_SIZE;
+		u16 vals[SIOS_CAP_SCAN_MAX];
+		int k, s, n;
+
+		if (version < SIOS_CAP_VERSION_SCAN)
+			return -EINVAL;
+		for (i=0; i<count; i++) {
+			if (rec + 5 > end)
+				return -EINVAL;
+			s = rec[4];
+			if (s == SIOS_CAP_SCAN_EVENT) {
+				if (rec + SIOS_CAP_SCAN_EV_LEN > end)
+					return -EINVAL;
+			} else if (s >= SIOS_CAP_SCAN_SETS) {
+				return -EINVAL;
+			} else {
+				n = set[s].nr;
+				if (n > SIOS_CAP_SCAN_MAX ||
+				    rec + SIOS_CAP_SCAN_REC_LEN(n) > end)
+					return -EINVAL;
+			}
+			if (replay_realtime) {
+				error = sios_replay_wait(base + le32_to_cpu(
+					get_unaligned((__le32 *)rec)));
+				if (error)
+					return error;
+			}
+			if (s == SIOS_CAP_SCAN_EVENT) {
+				id = rp.map[rec[5]];
+				if (id == SIOS_MAX_SOURCES || sios_source_inject(id,
+					le16_to_cpu(get_unaligned((__le16 *)(rec + 7)))))
+					rp.unmatched++;
+				rp.events++;
+				rec += SIOS_CAP_SCAN_EV_LEN;
+				continue;
+			}
+			sios_cap_unpack12(vals, rec + 5, n);
+			for (k=0; k<n; k++) {
+				id = rp.map[set[s].source[k]];
+				if (id == SIOS_MAX_SOURCES || sios_source_inject(id, vals[k]))
+					rp.unmatched++;
+				rp.events++;
+			}
+			rec += SIOS_CAP_SCAN_REC_LEN(n);
+		}
+		break;
+	}
+	default:
+		/* index blocks and unknown block types carry no events */
+		break;
+	}
+
+	return 0;
+}
+
+static ssize_t sios_replay_write(struct file *file, const char __user *buf,
+				 size_t count, loff_t *ppos)
+{
+	size_t done = 0;
+	int error;
+
+	while (done < count) {
+		size_t n = min_t(size_t, count - done, SIOS_CAP_BLOCK_SIZE - rp.fill);
+
+		if (copy_from_user((char *)rp.block + rp.fill, buf + done, n))
+			return -EFAULT;
+		rp.fill += n;
+		done += n;
+
+		if (rp.fill < SIOS_CAP_BLOCK_SIZE)
+			continue;
+
+		rp.fill = 0;
+		error = sios_replay_block(rp.block);
+		if (error)
+			return error;
+	}
+
+	return done;
+}
+
+static int sios_replay_start(void)
+{
+	rp.block = kmalloc(SIOS_CAP_BLOCK_SIZE, GFP_KERNEL);
+	if (!rp.block)
+		return -ENOMEM;
+
+	rp.fill = 0;
+	rp.started = 0;
+	rp.events = 0;
+	rp.unmatched = 0;
+	memset(rp.map, SIOS_MAX_SOURCES, sizeof(rp.map));
+	return 0;
+}
+
+static void sios_replay_stop(void)
+{
+	printk(KERN_INFO "sios replay: %u events, %u without source\n",
+	       rp.events, rp.unmatched);
+	kfree(rp.block);
+	rp.block = NULL;
+}
+
+static int sios_capture_open_reader(struct file *file)
+{
+	struct sios_cap_reader *rd;
+	int error;
+
+	rd = kzalloc(sizeof(*rd), GFP_KERNEL);
+	if (!rd)
+		return -ENOMEM;
+
+	mutex_lock(&cap.readers_lock);
+	error = cap.readers ? sios_capture_join(rd) : sios_capture_start(rd);
+	if (!error)
+		cap.readers++;
+	mutex_unlock(&cap.readers_lock);
+
+	if (error) {
+		kfree(rd);
+		return error;
+	}
+
+	file->private_data = rd;
+	return 0;
+}
+
+static int sios_capture_open(struct inode *inode, struct file *file)
+{
+	int error;
+
+	switch (file->f_flags & O_ACCMODE) {
+	case O_RDONLY:
+		return sios_capture_open_reader(file);
+	case O_WRONLY:
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (test_and_set_bit(CAP_WRITER, &cap.flags))
+		return -EBUSY;
+
+	error = sios_replay_start();
+	if (error)
+		clear_bit(CAP_WRITER, &cap.flags);
+
+	return error;
+}
+
+static int sios_capture_release(struct inode *inode, struct file *file)
+{
+	struct sios_cap_reader *rd = file->private_data;
+
+	if (rd) {
+		mutex_lock(&cap.readers_lock);
+		if (!--cap.readers)
+			sios_capture_stop();
+		mutex_unlock(&cap.readers_lock);
+		kfree(rd);
+	} else {
+		sios_replay_stop();
+		clear_bit(CAP_WRITER, &cap.flags);
+	}
+	return 0;
+}
+
+static const struct file_operations sios_capture_fops = {
+	.owner = THIS_MODULE,
+	.open = sios_capture_open,
+	.release = sios_capture_release,
+	.read = sios_capture_read,
+	.write = sios_replay_write,
+	.poll = sios_capture_poll,
+	.ioctl = sios_capture_ioctl,
+	.mmap = sios_capture_mmap,
+	.llseek = no_llseek,
+};
+
+int sios_capture_init(void)
+{
+	int error;
+
+	if (capture_blocks < 2)
+		capture_blocks = 2;
+
+	spin_lock_init(&cap.lock);
+	init_waitqueue_head(&cap.wait);
+	mutex_init(&cap.readers_lock);
+	INIT_DELAYED_WORK(&cap.flush, cap_flush);
+
+	/* zeroed, so mapping it never shows stale kernel memory */
+	cap.ring = vmalloc_user(capture_blocks * SIOS_CAP_BLOCK_SIZE);
+	if (!cap.ring)
+		return -ENOMEM;
+
+	error = sios_chrdev_add(&cap.cdev, &sios_capture_fops,
+				SIOS_CAPTURE_MINOR, "capture");
+	if (error)
+		vfree(cap.ring);
+
+	return error;
+}
+
+void sios_capture_exit(void)
+{
+	sios_chrdev_del(&cap.cdev, SIOS_CAPTURE_MINOR);
+	vfree(cap.ring);
+}
@@ -0,0 +1,411 @@
+/* -*-linux-c-*-
+ * chips.c - SIOS I2C chip enumeration
+ *
+ * Copyright (C) 2008 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA, or http://www.gnu.org/licenses/gpl.html
+ */
+
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+#include <linux/bitops.h>
+#include <linux/bitmap.h>
+#include <linux/ktime.h>
+
+#include "sios/sios.h"
+#include "sios/board.h"
+#include "sios/hardware.h"
+#include "sios/i2csched.h"
+#include "sios/chip.h"
+
+/*
+ * The chips sit at strap selected addresses, the candidates of each
+ * type are listed in hardware.h with the default first. A board is
+ * enumerated after power-up and after every hot-swap enable, when a
+ * module may have been plugged in. The addresses found last time are
+ * kept, so a rescan first verifies those with one probe per chip and
+ * only walks the candidates of types not present. Candidate ranges of
+ * some types overlap; an address belongs to the first type it answers
+ * for, in table order, so populations on default addresses are always
+ * told apart. The AD7998 and AD7994 share all their addresses and are
+ * identified by how they convert, see sios_chip_ad799x.
+ *
+ * Chips that stop answering are removed. A rail going down is not taken
+ * as a removal, unpowered chips look the same as unplugged ones; that
+ * is sorted out by the verification at the next enable.
+ */
+struct sios_chip_bus;
+
+struct sios_chip_info {
+	const char *name;
+	const int *addrs;
+	int nr_addrs;
+	/* the type of what answered at an address, for types that look alike */
+	int (*identify)(struct sios_chip_bus *cb, int addr);
+};
+
+static int sios_chip_ad799x(struct sios_chip_bus *cb, int addr);
+
+static const int ad7998_addrs[] = { SIOS_AD7998_ADDRS };
+static const int ad7994_addrs[] = { SIOS_AD7994_ADDRS };
+static const int ad5254_addrs[] = { SIOS_AD5254_ADDRS };
+static const int pca9557_addrs[] = { SIOS_PCA9557_ADDRS };
+static const int ds2482_addrs[] = { SIOS_DS2482_ADDRS };
+
+#define CHIP(n, a)	{ .name = (n), .addrs = (a), .nr_addrs = ARRAY_SIZE(a) }
+#define CHIP_ID(n, a, id) \
+	{ .name = (n), .addrs = (a), .nr_addrs = ARRAY_SIZE(a), .identify = (id) }
+
+static const struct sios_chip_info chip_info[SIOS_NR_CHIP_TYPES] = {
+	[SIOS_CHIP_AD7998]	= CHIP_ID("ad7998", ad7998_addrs, sios_chip_ad799x),
+	[SIOS_CHIP_AD7994]	= CHIP_ID("ad7994", ad7994_addrs, sios_chip_ad799x),
+	[SIOS_CHIP_AD5254]	= CHIP("ad5254", ad5254_addrs),
+	[SIOS_CHIP_PCA9557]	= CHIP("pca9557", pca9557_addrs),
+	[SIOS_CHIP_DS2482]	= CHIP("ds2482", ds2482_addrs),
+};
+
+/* one per board, created on its first scan */
+struct sios_chip_bus {
+	struct sios_board *board;
+	struct sios_i2c_sched *i2c;
+	struct mutex lock;		/* serialises scans */
+	struct work_struct work;
+
+	/*
+	 * Scans are requested with sios_power locks held and bind drivers
+	 * that take them, so readers of the population only take this.
+	 */
+	spinlock_t slock;
+	int pending;
+	ktime_t since;			/* oldest power-up not served yet */
+	struct sios_chip *chip[SIOS_NR_CHIP_TYPES];
+
+	int known[SIOS_NR_CHIP_TYPES];	/* address last found at, 0 for none */
+
+	u32 scans;
+	u32 probes;
+	u32 found;
+	u32 lost;
+	u32 last_us;			/* power-up to all chips registered */
+	u32 max_us;
+
+	struct list_head list;
+};
+
+static LIST_HEAD(chip_bus_list);
+static DEFINE_MUTEX(chip_bus_mutex);
+
+static void sios_chip_release(struct sios_device *sdev)
+{
+	kfree(to_sios_chip(sdev));
+}
+
+static int sios_chip_add(struct sios_chip_bus *cb, int type, int addr)
+{
+	struct sios_chip *chip;
+	char base[BUS_ID_SIZE];
+	int error;
+
+	chip = kzalloc(sizeof(*chip), GFP_KERNEL);
+	if (!chip)
+		return -ENOMEM;
+
+	chip->type = type;
+	chip->type_name = chip_info[type].name;
+	chip->addr = addr;
+
+	snprintf(base, sizeof(base), "sios:%s", chip->type_name);
+	sios_board_devname(cb->board, base, chip->name, sizeof(chip->name));
+	chip->dev.name = chip->name;
+	chip->dev.release = sios_chip_release;
+	chip->dev.board = cb->board;
+
+	/* binds the function driver, if loaded */
+	error = sios_device_register(&chip->dev);
+	if (error) {
+		kfree(chip);
+		return error;
+	}
+
+	spin_lock_irq(&cb->slock);
+	cb->chip[type] = chip;
+	spin_unlock_irq(&cb->slock);
+	cb->known[type] = addr;
+	cb->found++;
+	return 0;
+}
+
+static void sios_chip_remove(struct sios_chip_bus *cb, int type)
+{
+	struct sios_chip *chip = cb->chip[type];
+
+	spin_lock_irq(&cb->slock);
+	cb->chip[type] = NULL;
+	spin_unlock_irq(&cb->slock);
+
+	printk(KERN_INFO "%s: gone from 0x%02x\n", chip->name, chip->addr);
+	sios_device_unregister(&chip->dev);
+	cb->lost++;
+}
+
+static int sios_chip_probe(struct sios_chip_bus *cb, int addr)
+{
+	cb->probes++;
+	return sios_i2c_probe(cb->i2c, addr);
+}
+
+/*
+ * Command 0xf0 converts VIN8 on an AD7998, the result carries channel
+ * ID 7. On an AD7994 it converts VIN1 to VIN4, and the first result has
+ * at most ID 3, in the two ID bits under a zero.
+ */
+static int sios_chip_ad799x(struct sios_chip_bus *cb, int addr)
+{
+	u8 cmd = 0xf0, res[2];
+	struct i2c_msg msgs[2] = {
+		{ .addr = addr, .flags = 0, .len = 1, .buf = &cmd },
+		{ .addr = addr, .flags = I2C_M_RD, .len = 2, .buf = res },
+	};
+
+	cb->probes++;
+	if (sios_i2c_transfer(cb->i2c, msgs, 2, SIOS_I2C_PRIO_LOW) != 2)
+		return -EIO;
+	return ((res[0] >> 4) & 0x7) == 7 ? SIOS_CHIP_AD7998 : SIOS_CHIP_AD7994;
+}
+
+/* a chip of this type answers at addr */
+static int sios_chip_found(struct sios_chip_bus *cb, int type, int addr)
+{
+	const struct sios_chip_info *info = &chip_info[type];
+
+	if (!sios_chip_probe(cb, addr))
+		return 0;
+	return !info->identify || info->identify(cb, addr) == type;
+}
+
+static void sios_chip_work(struct work_struct *work)
+{
+	struct sios_chip_bus *cb = container_of(work, struct sios_chip_bus, work);
+	DECLARE_BITMAP(taken, 128);
+	ktime_t since;
+	int type, i, addr;
+	u32 us;
+
+	spin_lock_irq(&cb->slock);
+	since = cb->since;
+	cb->pending = 0;
+	spin_unlock_irq(&cb->slock);
+
+	mutex_lock(&cb->lock);
+	bitmap_zero(taken, 128);
+
+	/* verify the known population, one probe per chip */
+	for (type=0; type<SIOS_NR_CHIP_TYPES; type++) {
+		addr = cb->chip[type] ? cb->chip[type]->addr : cb->known[type];
+		if (!addr || test_bit(addr, taken))
+			continue;
+
+		/* a bound chip is only probed, identifying may disturb its driver */
+		if (cb->chip[type] ? sios_chip_probe(cb, addr) :
+		    sios_chip_found(cb, type, addr)) {
+			set_bit(addr, taken);
+			if (!cb->chip[type])
+				sios_chip_add(cb, type, addr);
+		} else if (cb->chip[type]) {
+			sios_chip_remove(cb, type);
+		}
+	}
+
+	/* and look for what is missing */
+	for (type=0; type<SIOS_NR_CHIP_TYPES; type++) {
+		const struct sios_chip_info *info = &chip_info[type];
+
+		if (cb->chip[type])
+			continue;
+
+		for (i=0; i<info->nr_addrs; i++) {
+			addr = info->addrs[i];
+			if (test_bit(addr, taken) || addr == cb->known[type])
+				continue;
+			/* left for the type it is, if it is another */
+			if (!sios_chip_found(cb, type, addr))
+				continue;
+
+			set_bit(addr, taken);
+			sios_chip_add(cb, type, addr);
+			break;
+		}
+	}
+
+	cb->scans++;
+	us = ktime_us_delta(ktime_get(), since);
+	cb->last_us = us;
+	if (us > cb->max_us)
+		cb->max_us = us;
+	mutex_unlock(&cb->lock);
+}
+
+/* caller holds chip_bus_mutex */
+static struct sios_chip_bus *sios_chip_bus_get(struct sios_board *board)
+{
+	struct sios_chip_bus *cb;
+
+	list_for_each_entry(cb, &chip_bus_list, list) {
+		if (cb->board == board)
+			return cb;
+	}
+
+	cb = kzalloc(sizeof(*cb), GFP_KERNEL);
+	if (!cb)
+		return NULL;
+
+	cb->i2c = sios_i2c_sched_get(board);
+	if (!cb->i2c) {
+		kfree(cb);
+		return NULL;
+	}
+
+	cb->board = board;
+	mutex_init(&cb->lock);
+	INIT_WORK(&cb->work, sios_chip_work);
+	spin_lock_init(&cb->slock);
+	list_add_tail(&cb->list, &chip_bus_list);
+	return cb;
+}
+
+/**
+ *	sios_chip_scan - enumerate the chips of a board
+ *	@board: sios board
+ *	@since: when the bus got powered
+ *
+ *	The scan runs from a work item; it may be requested with locks
+ *	held that the function drivers take when binding.
+ */
+void sios_chip_scan(struct sios_board *board, ktime_t since)
+{
+	struct sios_chip_bus *cb;
+	unsigned long flags;
+
+	mutex_lock(&chip_bus_mutex);
+	cb = sios_chip_bus_get(board);
+	mutex_unlock(&chip_bus_mutex);
+	if (!cb)
+		return;
+
+	spin_lock_irqsave(&cb->slock, flags);
+	if (!cb->pending) {
+		cb->pending = 1;
+		cb->since = since;
+	}
+	spin_unlock_irqrestore(&cb->slock, flags);
+
+	schedule_work(&cb->work);
+}
+EXPORT_SYMBOL_GPL(sios_chip_scan);
+
+/* forget the known addresses and scan every board */
+static int sios_chip_rescan_board(struct sios_board *board, void *data)
+{
+	struct sios_chip_bus *cb;
+
+	mutex_lock(&chip_bus_mutex);
+	cb = sios_chip_bus_get(board);
+	mutex_unlock(&chip_bus_mutex);
+	if (!cb)
+		return 0;
+
+	mutex_lock(&cb->lock);
+	memset(cb->known, 0, sizeof(cb->known));
+	mutex_unlock(&cb->lock);
+
+	sios_chip_scan(board, ktime_get());
+	return 0;
+}
+
+void sios_chip_rescan(void)
+{
+	sios_for_each_board(NULL, sios_chip_rescan_board);
+}
+
+ssize_t sios_chip_show(char *buf)
+{
+	struct sios_chip_bus *cb;
+	ssize_t len;
+	int type;
+
+	len = snprintf(buf, PAGE_SIZE, "board\tchip\taddr\n");
+
+	mutex_lock(&chip_bus_mutex);
+	list_for_each_entry(cb, &chip_bus_list, list) {
+		spin_lock_irq(&cb->slock);
+		for (type=0; type<SIOS_NR_CHIP_TYPES && len < PAGE_SIZE; type++) {
+			if (!cb->chip[type])
+				continue;
+			len += scnprintf(buf + len, PAGE_SIZE - len, "%d\t%s\t0x%02x\n",
+					 cb->board->id, chip_info[type].name,
+					 cb->chip[type]->addr);
+		}
+		spin_unlock_irq(&cb->slock);
+	}
+	mutex_unlock(&chip_bus_mutex);
+
+	return min_t(ssize_t, len, PAGE_SIZE);
+}
+
+ssize_t sios_chip_show_stats(char *buf)
+{
+	struct sios_chip_bus *cb;
+	ssize_t len;
+
+	len = snprintf(buf, PAGE_SIZE, "board\tscans\tprobes\tfound\tlost\t"
+		       "last_us\tmax_us\n");
+
+	mutex_lock(&chip_bus_mutex);
+	list_for_each_entry(cb, &chip_bus_list, list) {
+		if (len >= PAGE_SIZE)
+			break;
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+				 "%d\t%u\t%u\t%u\t%u\t%u\t%u\n",
+				 cb->board->id, cb->scans, cb->probes, cb->found,
+				 cb->lost, cb->last_us, cb->max_us);
+	}
+	mutex_unlock(&chip_bus_mutex);
+
+	return min_t(ssize_t, len, PAGE_SIZE);
+}
+
+void sios_chip_exit(void)
+{
+	struct sios_chip_bus *cb, *n;
+	int type;
+
+	flush_scheduled_work();
+
+	mutex_lock(&chip_bus_mutex);
+	list_for_each_entry_safe(cb, n, &chip_bus_list, list) {
+		list_del(&cb->list);
+		for (type=0; type<SIOS_NR_CHIP_TYPES; type++) {
+			if (cb->chip[type])
+				sios_device_unregister(&cb->chip[type]->dev);
+		}
+		sios_i2c_sched_put(cb->i2c);
+		kfree(cb);
+	}
+	mutex_unlock(&chip_bus_mutex);
+}
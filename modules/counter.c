@@ -0,0 +1,449 @@
+/* -*-linux-c-*-
+ * counter.c - SIOS pulse counters
+ *
+ * Copyright (C) 2008 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA, or http://www.gnu.org/licenses/gpl.html
+ */
+
+#include <linux/device.h>
+#include <linux/module.h>
+#include <linux/interrupt.h>
+#include <linux/irq.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <asm/div64.h>
+#include <asm/arch/gpio.h>
+
+#include "sios/sios.h"
+#include "sios/resource.h"
+#include "sios/event.h"
+#include "sios/board.h"
+
+/*
+ * Anemometers, flow meters and the like on spare input pins of board 0.
+ *
+ * The hard handler only counts. When a gate has elapsed the next edge
+ * also stamps itself and closes the gate, so frequency and period are
+ * measured between two edges (reciprocal counting) and stay exact down
+ * to signals slower than the gate. Everything else happens once per
+ * gate: the pulses of the gate are reported as one event of the
+ * counter's source and the sysfs attributes are updated.
+ */
+
+#define SIOS_COUNTER_MAX	8
+#define SIOS_GATE_MIN_MS	10
+#define SIOS_GATE_MAX_MS	60000
+#define SIOS_SIM_MAX		1000000
+
+static int pins[SIOS_COUNTER_MAX];
+static int nr_pins;
+module_param_array(pins, int, &nr_pins, 0444);
+MODULE_PARM_DESC(pins, "input GPIOs to count edges on");
+
+static unsigned int gate_ms = 1000;
+module_param(gate_ms, uint, 0644);
+MODULE_PARM_DESC(gate_ms, "initial gate time of new counters");
+
+struct sios_counter {
+	spinlock_t lock;
+	int pin;
+	int irq;
+	u32 volatile count;	/* edges, written by the hard handler only */
+
+	/* gate closing edge, under lock */
+	int volatile armed;
+	int closed;
+	u32 close_count;
+	ktime_t close_stamp;
+
+	/* gate work only */
+	int have_prev;
+	u32 prev_count;
+	ktime_t prev_stamp;
+	int stopping;
+
+	unsigned int gate_ms;
+	u32 gates;
+	u32 pulses;		/* in the last closed gate */
+	u32 freq_mhz;
+	u32 period_us;
+
+	/* simulated edges, see store_counter_simulate */
+	u32 sim_edges;
+	u32 sim_ns;		/* per edge, last run */
+
+	struct delayed_work work;
+	struct sios_resource res[1];
+	struct sios_device dev;
+	struct sios_source source;
+	char name[BUS_ID_SIZE];
+	char src_name[BUS_ID_SIZE];
+	struct list_head list;
+};
+
+#define to_sios_counter(x) container_of((x), struct sios_counter, dev)
+
+static LIST_HEAD(counter_list);
+
+static irqreturn_t sios_counter_irq(int irq, void *dev_id)
+{
+	struct sios_counter *c = dev_id;
+
+	c->count++;
+	if (unlikely(c->armed)) {
+		spin_lock(&c->lock);
+		if (c->armed) {
+			c->close_stamp = sios_event_stamp();
+			c->close_count = c->count;
+			c->closed = 1;
+			c->armed = 0;
+		}
+		spin_unlock(&c->lock);
+	}
+
+	return IRQ_HANDLED;
+}
+
+static void sios_counter_update(struct sios_counter *c, u32 n, ktime_t stamp)
+{
+	s64 dt_us = ktime_us_delta(stamp, c->prev_stamp);
+	u32 dn = n - c->prev_count;
+	u64 f;
+
+	c->prev_count = n;
+	c->prev_stamp = stamp;
+
+	/* a first edge after more than an hour of silence starts over */
+	if (dt_us <= 0 || dt_us > 0xffffffffLL || !dn) {
+		c->pulses = dn;
+		c->freq_mhz = 0;
+		c->period_us = 0;
+		return;
+	}
+
+	f = (u64)dn * 1000000000ULL;
+	do_div(f, (u32)dt_us);
+	c->pulses = dn;
+	c->freq_mhz = (f > 0xffffffffULL) ? 0xffffffff : (u32)f;
+	c->period_us = (u32)dt_us / dn;
+
+	sios_event_report_ts(&c->source, stamp, min_t(u32, dn, 0xffff));
+}
+
+static void sios_counter_gate(struct work_struct *work)
+{
+	struct sios_counter *c = container_of(work, struct sios_counter, work.work);
+	u32 n, freq = c->freq_mhz;
+	ktime_t stamp;
+	int closed;
+
+	spin_lock_irq(&c->lock);
+	closed = c->closed;
+	n = c->close_count;
+	stamp = c->close_stamp;
+	c->closed = 0;
+	c->armed = 1;
+	spin_unlock_irq(&c->lock);
+
+	if (closed && c->have_prev) {
+		sios_counter_update(c, n, stamp);
+	} else if (closed) {
+		c->prev_count = n;
+		c->prev_stamp = stamp;
+		c->have_prev = 1;
+	} else if (c->have_prev) {
+		/* no edge for a whole gate: gone once overdue by two periods */
+		s64 idle_us = ktime_us_delta(sios_event_stamp(), c->prev_stamp);
+
+		if (idle_us > 2LL * c->period_us) {
+			c->pulses = 0;
+			c->freq_mhz = 0;
+			c->period_us = 0;
+		}
+	}
+	c->gates++;
+
+	if (c->freq_mhz != freq)
+		sysfs_notify(&c->dev.dev.kobj, NULL, "frequency");
+
+	if (!c->stopping)
+		schedule_delayed_work(&c->work, msecs_to_jiffies(c->gate_ms));
+}
+
+/* replay backend: a recorded gate count as if the last gate had closed */
+static void sios_counter_inject(struct sios_source *src, u16 value)
+{
+	struct sios_counter *c = container_of(src, struct sios_counter, source);
+	u64 f = (u64)value * 1000000;
+
+	do_div(f, c->gate_ms);
+	c->pulses = value;
+	c->freq_mhz = (u32)f;
+	c->period_us = value ? c->gate_ms * 1000 / value : 0;
+	sysfs_notify(&c->dev.dev.kobj, NULL, "frequency");
+}
+
+static ssize_t show_counter_count(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	return snprintf(buf, PAGE_SIZE, "%u\n", to_sios_counter(to_sios_device(dev))->count);
+}
+
+static ssize_t show_counter_frequency(struct device *dev,
+				      struct device_attribute *attr, char *buf)
+{
+	u32 f = to_sios_counter(to_sios_device(dev))->freq_mhz;
+
+	return snprintf(buf, PAGE_SIZE, "%u.%03u\n", f / 1000, f % 1000);
+}
+
+static ssize_t show_counter_period(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	return snprintf(buf, PAGE_SIZE, "%u\n",
+			to_sios_counter(to_sios_device(dev))->period_us);
+}
+
+static ssize_t show_counter_gate(struct device *dev,
+				 struct device_attribute *attr, char *buf)
+{
+	return snprintf(buf, PAGE_SIZE, "%u\n",
+			to_sios_counter(to_sios_device(dev))->gate_ms);
+}
+
+/* takes effect with the next gate */
+static ssize_t store_counter_gate(struct device *dev,
+				  struct device_attribute *attr,
+				  const char *buf, size_t count)
+{
+	unsigned long ms = simple_strtoul(buf, NULL, 0);
+
+	if (ms < SIOS_GATE_MIN_MS || ms > SIOS_GATE_MAX_MS)
+		return -EINVAL;
+	to_sios_counter(to_sios_device(dev))->gate_ms = ms;
+	return count;
+}
+
+static ssize_t show_counter_stats(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct sios_counter *c = to_sios_counter(to_sios_device(dev));
+
+	return snprintf(buf, PAGE_SIZE, "edges\t%u\ngates\t%u\npulses\t%u\n"
+			"sim_edges\t%u\nsim_ns_per_edge\t%u\n",
+			c->count, c->gates, c->pulses, c->sim_edges, c->sim_ns);
+}
+
+/*
+ * Runs the given number of edges through the interrupt's flow handler
+ * back to back, interrupts off in bursts of 256, and keeps the cost of
+ * one edge in sim_ns_per_edge. The counter sees them as real edges.
+ */
+static ssize_t store_counter_simulate(struct device *dev,
+				      struct device_attribute *attr,
+				      const char *buf, size_t count)
+{
+	struct sios_counter *c = to_sios_counter(to_sios_device(dev));
+	unsigned long n = simple_strtoul(buf, NULL, 0);
+	unsigned long done, chunk, i, flags;
+	ktime_t t0;
+	u64 ns = 0;
+
+	if (!n || n > SIOS_SIM_MAX)
+		return -EINVAL;
+
+	for (done = 0; done < n; done += chunk) {
+		chunk = min_t(unsigned long, n - done, 256);
+		local_irq_save(flags);
+		t0 = sios_event_stamp();
+		for (i=0; i<chunk; i++)
+			generic_handle_irq(c->irq);
+		ns += ktime_to_ns(ktime_sub(sios_event_stamp(), t0));
+		local_irq_restore(flags);
+		cond_resched();
+	}
+
+	do_div(ns, n);
+	c->sim_edges += n;
+	c->sim_ns = (u32)ns;
+	return count;
+}
+
+static DEVICE_ATTR(count, S_IRUGO, show_counter_count, NULL);
+static DEVICE_ATTR(frequency, S_IRUGO, show_counter_frequency, NULL);
+static DEVICE_ATTR(period_us, S_IRUGO, show_counter_period, NULL);
+static DEVICE_ATTR(gate_ms, S_IRUGO | S_IWUSR, show_counter_gate, store_counter_gate);
+static DEVICE_ATTR(stats, S_IRUGO, show_counter_stats, NULL);
+static DEVICE_ATTR(simulate, S_IWUSR, NULL, store_counter_simulate);
+
+static struct attribute *sios_counter_attrs[] = {
+	&dev_attr_count.attr,
+	&dev_attr_frequency.attr,
+	&dev_attr_period_us.attr,
+	&dev_attr_gate_ms.attr,
+	&dev_attr_stats.attr,
+	&dev_attr_simulate.attr,
+	NULL,
+};
+
+static struct attribute_group sios_counter_group = {
+	.attrs = sios_counter_attrs,
+};
+
+static void sios_counter_release(struct sios_device *sdev)
+{
+	kfree(to_sios_counter(sdev));
+}
+
+static struct sios_driver counter_drv = {
+	.version = "$Revision: 1.0 $",
+	.module = THIS_MODULE,
+	.driver = {
+		.name = "sios:counter",
+	},
+};
+
+static int sios_counter_add(int pin)
+{
+	struct sios_counter *c;
+	char base[BUS_ID_SIZE];
+	int error;
+
+	c = kzalloc(sizeof(*c), GFP_KERNEL);
+	if (!c)
+		return -ENOMEM;
+
+	spin_lock_init(&c->lock);
+	INIT_DELAYED_WORK(&c->work, sios_counter_gate);
+	c->pin = pin;
+	c->irq = gpio_to_irq(pin);
+	c->gate_ms = clamp_t(unsigned int, gate_ms, SIOS_GATE_MIN_MS, SIOS_GATE_MAX_MS);
+
+	snprintf(c->name, sizeof(c->name), "sios:counter%d", pin);
+	snprintf(c->src_name, sizeof(c->src_name), "Counter%d", pin);
+
+	/*
+	 * A fast pin, but not one the bus services: a queued record per
+	 * edge is too much at tens of kHz, the handler below only counts.
+	 */
+	c->res[0].name = c->src_name;
+	c->res[0].start = pin;
+	c->res[0].end = pin;
+	c->res[0].type = SIOS_IO_GPIO|SIOS_FIRQ;
+
+	c->dev.name = c->name;
+	c->dev.release = sios_counter_release;
+	c->dev.num_resource = ARRAY_SIZE(c->res);
+	c->dev.resource = c->res;
+	c->dev.board = &sios_default_board;
+
+	error = sios_device_register(&c->dev);
+	if (error) {
+		kfree(c);
+		return error;
+	}
+
+	c->source.name = c->src_name;
+	c->source.type = SIOS_EV_GPIO;
+	c->source.inject = sios_counter_inject;
+	error = sios_source_register(&c->source);
+	if (error)
+		goto err;
+
+	error = sysfs_create_group(&c->dev.dev.kobj, &sios_counter_group);
+	if (error)
+		goto err_source;
+
+	gpio_direction_input(pin);
+	set_irq_type(c->irq, IRQT_RISING);
+	error = request_irq(c->irq, sios_counter_irq, SA_INTERRUPT, c->name, c);
+	if (error) {
+		printk(KERN_ERR "sios: unable to get IRQ %d for %s\n", c->irq, c->name);
+		goto err_group;
+	}
+
+	schedule_delayed_work(&c->work, msecs_to_jiffies(c->gate_ms));
+	list_add_tail(&c->list, &counter_list);
+	return 0;
+
+err_group:
+	sysfs_remove_group(&c->dev.dev.kobj, &sios_counter_group);
+err_source:
+	sios_source_unregister(&c->source);
+err:
+	sios_device_unregister(&c->dev);
+	return error;
+}
+
+static void sios_counter_remove_all(void)
+{
+	struct sios_counter *c, *n;
+
+	list_for_each_entry(c, &counter_list, list) {
+		free_irq(c->irq, c);
+		c->stopping = 1;
+		cancel_delayed_work(&c->work);
+	}
+	flush_scheduled_work();
+
+	/* a gate that was running rearmed itself once more */
+	list_for_each_entry(c, &counter_list, list)
+		cancel_delayed_work(&c->work);
+	flush_scheduled_work();
+
+	list_for_each_entry_safe(c, n, &counter_list, list) {
+		list_del(&c->list);
+		sysfs_remove_group(&c->dev.dev.kobj, &sios_counter_group);
+		sios_source_unregister(&c->source);
+		sios_device_unregister(&c->dev);
+	}
+}
+
+static int __init sios_counter_init(void)
+{
+	int i, error;
+
+	error = sios_driver_register(&counter_drv);
+	if (error)
+		return error;
+
+	for (i=0; i<nr_pins; i++) {
+		error = sios_counter_add(pins[i]);
+		if (error) {
+			sios_counter_remove_all();
+			sios_driver_unregister(&counter_drv);
+			return error;
+		}
+	}
+
+	return 0;
+}
+
+static void __exit sios_counter_exit(void)
+{
+	sios_counter_remove_all();
+	sios_driver_unregister(&counter_drv);
+}
+
+MODULE_DESCRIPTION("SIOS pulse counter driver");
+MODULE_AUTHOR("Simon de Bakker <simon@v2.nl>");
+MODULE_LICENSE("GPL");
+
+module_init(sios_counter_init);
+module_exit(sios_counter_exit);
@@ -0,0 +1,272 @@
+/* -*-linux-c-*-
+ * event.c - SIOS event sources
+ *
+ * Copyright (C) 2008 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA, or http://www.gnu.org/licenses/gpl.html
+ */
+
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/string.h>
+#include <linux/ktime.h>
+
+#include "sios/sios.h"
+#include "sios/event.h"
+#include "sios/capture.h"
+
+static struct sios_source *sios_sources[SIOS_MAX_SOURCES];
+static DEFINE_MUTEX(sios_source_mutex);
+
+static int event_clock = SIOS_CLOCK_MONOTONIC;
+module_param(event_clock, int, 0444);
+MODULE_PARM_DESC(event_clock, "timestamp base: 0 monotonic, 1 realtime");
+
+int sios_event_clock(void)
+{
+	return event_clock;
+}
+
+int sios_source_register(struct sios_source *src)
+{
+	int i;
+
+	mutex_lock(&sios_source_mutex);
+	for (i=0; i<SIOS_MAX_SOURCES; i++) {
+		if (!sios_sources[i])
+			break;
+	}
+	if (i == SIOS_MAX_SOURCES) {
+		mutex_unlock(&sios_source_mutex);
+		return -ENOSPC;
+	}
+	src->id = i;
+	memset(&src->stats, 0, sizeof(src->stats));
+	sios_sources[i] = src;
+	mutex_unlock(&sios_source_mutex);
+
+	sios_capture_sources_changed();
+	return 0;
+}
+EXPORT_SYMBOL_GPL(sios_source_register);
+
+void sios_source_unregister(struct sios_source *src)
+{
+	mutex_lock(&sios_source_mutex);
+	if (sios_sources[src->id] == src)
+		sios_sources[src->id] = NULL;
+	mutex_unlock(&sios_source_mutex);
+}
+EXPORT_SYMBOL_GPL(sios_source_unregister);
+
+/**
+ *	sios_event_stamp - current time in the event clock base
+ *
+ *	Cheap enough for hard interrupt context.
+ */
+ktime_t sios_event_stamp(void)
+{
+	if (event_clock == SIOS_CLOCK_REALTIME)
+		return ktime_get_real();
+	return ktime_get();
+}
+EXPORT_SYMBOL_GPL(sios_event_stamp);
+
+static inline s64 sios_abs64(s64 v)
+{
+	return v < 0 ? -v : v;
+}
+
+static void sios_source_account(struct sios_source *src, ktime_t ts)
+{
+	struct sios_source_stats *st = &src->stats;
+	s64 interval;
+
+	if (st->events++) {
+		interval = ktime_to_ns(ktime_sub(ts, st->last));
+		if (st->events == 2) {
+			st->avg_interval_ns = interval;
+			st->min_interval_ns = interval;
+			st->max_interval_ns = interval;
+		} else {
+			st->jitter_ns += (sios_abs64(interval - st->interval_ns) -
+					  st->jitter_ns) >> 4;
+			st->avg_interval_ns += (interval - st->avg_interval_ns) >> 4;
+			if (interval < st->min_interval_ns)
+				st->min_interval_ns = interval;
+			if (interval > st->max_interval_ns)
+				st->max_interval_ns = interval;
+		}
+		st->interval_ns = interval;
+	}
+	st->last = ts;
+}
+
+/**
+ *	sios_event_report_ts - hand a timestamped raw value to the sios core
+ *	@src: registered source
+ *	@ts: sios_event_stamp() taken when the value was sampled
+ *	@value: raw sample or pin level
+ *
+ *	May be called from hard interrupt context.
+ */
+void sios_event_report_ts(struct sios_source *src, ktime_t ts, u16 value)
+{
+	sios_source_account(src, ts);
+	sios_snapshot_event(src, ts, value);
+	sios_capture_event(src, ts, value);
+}
+EXPORT_SYMBOL_GPL(sios_event_report_ts);
+
+/**
+ *	sios_event_report - hand a raw value to the sios core
+ *	@src: registered source
+ *	@value: raw sample or pin level
+ *
+ *	May be called from hard interrupt context.
+ */
+void sios_event_report(struct sios_source *src, u16 value)
+{
+	sios_event_report_ts(src, sios_event_stamp(), value);
+}
+EXPORT_SYMBOL_GPL(sios_event_report);
+
+/**
+ *	sios_event_report_scan - report the samples of one converter scan
+ *	@src: source of each sample
+ *	@n: number of samples, at most SIOS_CAP_SCAN_MAX
+ *	@ts: sios_event_stamp() of the scan
+ *	@vals: 12 bit samples
+ *
+ *	Same as sios_event_report_ts for every sample, but lets a packed
+ *	capture store the scan as one record.
+ */
+void sios_event_report_scan(struct sios_source **src, int n, ktime_t ts,
+			    const u16 *vals)
+{
+	int i;
+
+	for (i=0; i<n; i++) {
+		sios_source_account(src[i], ts);
+		sios_snapshot_event(src[i], ts, vals[i]);
+	}
+	sios_capture_scan(src, n, ts, vals);
+}
+EXPORT_SYMBOL_GPL(sios_event_report_scan);
+
+/**
+ *	sios_source_set_rate - announce activity dependent sampling
+ *	@src: registered source
+ *	@max_rate: highest rate in Hz, at most 65535, 0 for a fixed rate
+ *
+ *	A capture in progress gets a new SOURCES block. Process context.
+ */
+void sios_source_set_rate(struct sios_source *src, unsigned int max_rate)
+{
+	src->max_rate = min(max_rate, 0xffffU);
+	src->rate_shift = 0;
+	sios_capture_sources_changed();
+}
+EXPORT_SYMBOL_GPL(sios_source_set_rate);
+
+int sios_source_lookup(const char *name)
+{
+	int i, id = -ENOENT;
+
+	mutex_lock(&sios_source_mutex);
+	for (i=0; i<SIOS_MAX_SOURCES; i++) {
+		struct sios_source *src = sios_sources[i];
+		if (src && !strncmp(src->name, name, SIOS_CAP_NAME_LEN)) {
+			id = i;
+			break;
+		}
+	}
+	mutex_unlock(&sios_source_mutex);
+
+	return id;
+}
+
+int sios_source_inject(int id, u16 value)
+{
+	struct sios_source *src;
+	int ret = -ENOENT;
+
+	mutex_lock(&sios_source_mutex);
+	src = sios_sources[id];
+	if (src && src->inject) {
+		src->inject(src, value);
+		ret = 0;
+	}
+	mutex_unlock(&sios_source_mutex);
+
+	return ret;
+}
+
+int sios_source_snapshot(struct sios_cap_source *tbl, int max)
+{
+	int i, n = 0;
+
+	mutex_lock(&sios_source_mutex);
+	for (i=0; i<SIOS_MAX_SOURCES && n<max; i++) {
+		struct sios_source *src = sios_sources[i];
+		if (!src)
+			continue;
+		memset(&tbl[n], 0, sizeof(tbl[n]));
+		tbl[n].id = i;
+		tbl[n].type = src->type;
+		tbl[n].max_rate = cpu_to_le16(src->max_rate);
+		strncpy(tbl[n].name, src->name, SIOS_CAP_NAME_LEN);
+		n++;
+	}
+	mutex_unlock(&sios_source_mutex);
+
+	return n;
+}
+
+static long ns_to_us(s64 ns)
+{
+	return ktime_to_us(ns_to_ktime(ns));
+}
+
+ssize_t sios_source_show_stats(char *buf)
+{
+	ssize_t len;
+	int i;
+
+	len = snprintf(buf, PAGE_SIZE, "id\tname\tevents\tinterval_us\t"
+		       "avg_us\tjitter_us\tmin_us\tmax_us\n");
+
+	mutex_lock(&sios_source_mutex);
+	for (i=0; i<SIOS_MAX_SOURCES && len < PAGE_SIZE; i++) {
+		struct sios_source *src = sios_sources[i];
+		struct sios_source_stats st;
+
+		if (!src)
+			continue;
+		st = src->stats;
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+				 "%d\t%s\t%u\t%ld\t%ld\t%ld\t%ld\t%ld\n",
+				 i, src->name, st.events,
+				 ns_to_us(st.interval_ns),
+				 ns_to_us(st.avg_interval_ns),
+				 ns_to_us(st.jitter_ns),
+				 ns_to_us(st.min_interval_ns),
+				 ns_to_us(st.max_interval_ns));
+	}
+	mutex_unlock(&sios_source_mutex);
+
+	return min_t(ssize_t, len, PAGE_SIZE);
+}
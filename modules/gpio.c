@@ -0,0 +1,428 @@
+/* -*-linux-c-*- */
+
+#include <linux/device.h>
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/cdev.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/mutex.h>
+#include <linux/delay.h>
+#include <asm/uaccess.h>
+#include <asm/arch/gpio.h>
+
+#include "sios/sios.h"
+#include "sios/resource.h"
+#include "sios/board.h"
+#include "sios/hardware.h"
+#include "sios/gpiodev.h"
+
+static int gpio_mmap;
+module_param(gpio_mmap, bool, 0644);
+MODULE_PARM_DESC(gpio_mmap, "allow mapping the GPIO registers into userspace");
+
+struct sios_gpio_claim_res {
+	struct sios_resource res;
+	struct list_head list;
+};
+
+/* per open file */
+struct sios_gpio_file {
+	struct mutex lock;
+	u32 claimed[SIOS_GPIO_BANKS];
+	struct list_head claims;
+	int mappings;		/* vmas of the register page, see sios_gpio_vm_ops */
+};
+
+static struct cdev gpio_cdev;
+
+/* owner of all userspace claims */
+static void sios_gpio_release(struct sios_device *sdev)
+{
+	return;
+}
+
+static struct sios_device gpio_dev = {
+	.name = "sios:gpio",
+	.release = sios_gpio_release,
+};
+
+static struct sios_driver gpio_drv = {
+	.version = "$Revision: 1.0 $",
+	.module = THIS_MODULE,
+	.driver = {
+		.name = "sios:gpio",
+	},
+};
+
+static void sios_gpio_mask(u32 *mask, int start, int end, int set)
+{
+	int i;
+
+	for (i=start; i<=end; i++) {
+		if (set)
+			mask[i >> 5] |= 1u << (i & 0x1f);
+		else
+			mask[i >> 5] &= ~(1u << (i & 0x1f));
+	}
+}
+
+/* outputs only on pins the board lets drive, PBST or I2C_ALERT are inputs */
+static int sios_gpio_check_output(struct sios_gpio_claim *c)
+{
+	struct sios_board *board = gpio_dev.board ? gpio_dev.board : &sios_default_board;
+	int idx = (c->flags & SIOS_GPIO_XGPIO) ? 1 : 0;
+	int i;
+
+	if (!(c->flags & SIOS_GPIO_OUTPUT))
+		return 0;
+
+	for (i=c->start; i<=c->end; i++) {
+		if (!(sios_board_pin_desc(board, idx, i)->caps & SIOS_PIN_CAP_OUT))
+			return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int sios_gpio_claim(struct sios_gpio_file *gf, struct sios_gpio_claim *c)
+{
+	struct sios_gpio_claim_res *cr;
+	int i, error;
+
+	if (c->start > c->end || c->end >= SIOS_GPIO_BANKS * 32)
+		return -EINVAL;
+
+	error = sios_gpio_check_output(c);
+	if (error)
+		return error;
+
+	cr = kzalloc(sizeof(*cr), GFP_KERNEL);
+	if (!cr)
+		return -ENOMEM;
+
+	/* no name: listed as sios:gpio:<start>-<end> */
+	cr->res.start = c->start;
+	cr->res.end = c->end;
+	cr->res.type = (c->flags & SIOS_GPIO_XGPIO) ? SIOS_IO_XGPIO : SIOS_IO_GPIO;
+
+	error = sios_request_resource(&gpio_dev, &cr->res);
+	if (error) {
+		kfree(cr);
+		return error;
+	}
+	list_add_tail(&cr->list, &gf->claims);
+
+	/* expander pins are only reserved, the on-chip GPIO of that number is not ours */
+	if (cr->res.type == SIOS_IO_XGPIO)
+		return 0;
+
+	for (i=c->start; i<=c->end; i++) {
+		if (c->flags & SIOS_GPIO_OUTPUT)
+			gpio_direction_output(i, 0);
+		else
+			gpio_direction_input(i);
+	}
+	sios_gpio_mask(gf->claimed, c->start, c->end, 1);
+	return 0;
+}
+
+static int sios_gpio_unclaim(struct sios_gpio_file *gf, struct sios_gpio_claim *c)
+{
+	sios_restype_t type = (c->flags & SIOS_GPIO_XGPIO) ? SIOS_IO_XGPIO : SIOS_IO_GPIO;
+	struct sios_gpio_claim_res *cr;
+
+	/* a mapping reaches every pin of the page, claims stay while it exists */
+	if (gf->mappings)
+		return -EBUSY;
+
+	list_for_each_entry(cr, &gf->claims, list) {
+		if (cr->res.start != c->start || cr->res.end != c->end ||
+		    cr->res.type != type)
+			continue;
+		sios_release_resource(&cr->res);
+		if (type == SIOS_IO_GPIO)
+			sios_gpio_mask(gf->claimed, c->start, c->end, 0);
+		list_del(&cr->list);
+		kfree(cr);
+		return 0;
+	}
+
+	return -ENOENT;
+}
+
+static int sios_gpio_check_op(struct sios_gpio_file *gf, struct sios_gpio_op *op)
+{
+	int b;
+
+	if (op->delay_ns > NSEC_PER_MSEC)
+		return -EINVAL;
+
+	for (b=0; b<SIOS_GPIO_BANKS; b++) {
+		if ((op->set[b] | op->clear[b]) & ~gf->claimed[b])
+			return -EPERM;
+	}
+
+	return 0;
+}
+
+static void sios_gpio_run_op(struct sios_gpio_op *op)
+{
+	int b;
+
+	for (b=0; b<SIOS_GPIO_BANKS; b++) {
+		if (op->set[b])
+			GPSR(b << 5) = op->set[b];
+		if (op->clear[b])
+			GPCR(b << 5) = op->clear[b];
+	}
+
+	if (op->delay_ns)
+		ndelay(op->delay_ns);
+}
+
+/* the whole batch is copied and checked before the first op runs */
+static int sios_gpio_batch(struct sios_gpio_file *gf, struct sios_gpio_batch *batch)
+{
+	struct sios_gpio_op *ops;
+	struct sios_gpio_op __user *uops;
+	u64 delay_ns = 0;
+	size_t len;
+	int i, error = 0;
+
+	if (batch->count > SIOS_GPIO_MAX_BATCH)
+		return -E2BIG;
+	if (!batch->count)
+		return 0;
+
+	len = batch->count * sizeof(*ops);
+	ops = (len > PAGE_SIZE) ? vmalloc(len) : kmalloc(len, GFP_KERNEL);
+	if (!ops)
+		return -ENOMEM;
+
+	uops = (struct sios_gpio_op __user *)(unsigned long)batch->ops;
+	if (copy_from_user(ops, uops, len)) {
+		error = -EFAULT;
+		goto out;
+	}
+
+	for (i=0; i<batch->count; i++) {
+		error = sios_gpio_check_op(gf, &ops[i]);
+		if (error)
+			goto out;
+		delay_ns += ops[i].delay_ns;
+	}
+	if (delay_ns > SIOS_GPIO_MAX_BATCH_NS) {
+		error = -EINVAL;
+		goto out;
+	}
+
+	for (i=0; i<batch->count; i++)
+		sios_gpio_run_op(&ops[i]);
+out:
+	if (len > PAGE_SIZE)
+		vfree(ops);
+	else
+		kfree(ops);
+	return error;
+}
+
+static void sios_gpio_read(struct sios_gpio_file *gf, struct sios_gpio_levels *lv)
+{
+	int b;
+
+	for (b=0; b<SIOS_GPIO_BANKS; b++)
+		lv->level[b] = gf->claimed[b] ? GPLR(b << 5) & gf->claimed[b] : 0;
+}
+
+static int sios_gpio_ioctl(struct inode *inode, struct file *file,
+			   unsigned int cmd, unsigned long arg)
+{
+	struct sios_gpio_file *gf = file->private_data;
+	void __user *argp = (void __user *)arg;
+	struct sios_gpio_claim claim;
+	struct sios_gpio_batch batch;
+	struct sios_gpio_levels levels;
+	int error;
+
+	mutex_lock(&gf->lock);
+	switch (cmd) {
+	case SIOS_GPIO_IOC_CLAIM:
+	case SIOS_GPIO_IOC_RELEASE:
+		error = -EFAULT;
+		if (copy_from_user(&claim, argp, sizeof(claim)))
+			break;
+		if (cmd == SIOS_GPIO_IOC_CLAIM)
+			error = sios_gpio_claim(gf, &claim);
+		else
+			error = sios_gpio_unclaim(gf, &claim);
+		break;
+	case SIOS_GPIO_IOC_BATCH:
+		error = -EFAULT;
+		if (copy_from_user(&batch, argp, sizeof(batch)))
+			break;
+		error = sios_gpio_batch(gf, &batch);
+		break;
+	case SIOS_GPIO_IOC_READ:
+		sios_gpio_read(gf, &levels);
+		error = copy_to_user(argp, &levels, sizeof(levels)) ? -EFAULT : 0;
+		break;
+	default:
+		error = -ENOTTY;
+	}
+	mutex_unlock(&gf->lock);
+
+	return error;
+}
+
+static int sios_gpio_has_claims(struct sios_gpio_file *gf)
+{
+	int b;
+
+	for (b=0; b<SIOS_GPIO_BANKS; b++) {
+		if (gf->claimed[b])
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Mappings of the register page are counted per file, forks included,
+ * so that the claims can be held for as long as any of them exists.
+ */
+static void sios_gpio_vm_open(struct vm_area_struct *vma)
+{
+	struct sios_gpio_file *gf = vma->vm_private_data;
+
+	mutex_lock(&gf->lock);
+	gf->mappings++;
+	mutex_unlock(&gf->lock);
+}
+
+static void sios_gpio_vm_close(struct vm_area_struct *vma)
+{
+	struct sios_gpio_file *gf = vma->vm_private_data;
+
+	mutex_lock(&gf->lock);
+	gf->mappings--;
+	mutex_unlock(&gf->lock);
+}
+
+static struct vm_operations_struct sios_gpio_vm_ops = {
+	.open = sios_gpio_vm_open,
+	.close = sios_gpio_vm_close,
+};
+
+static int sios_gpio_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct sios_gpio_file *gf = file->private_data;
+	int error = 0;
+
+	if (!gpio_mmap)
+		return -ENODEV;
+	if (!capable(CAP_SYS_RAWIO))
+		return -EPERM;
+	if (vma->vm_pgoff || vma->vm_end - vma->vm_start != PAGE_SIZE)
+		return -EINVAL;
+
+	mutex_lock(&gf->lock);
+	if (!sios_gpio_has_claims(gf)) {
+		error = -EACCES;
+		goto out;
+	}
+
+	vma->vm_flags |= VM_IO | VM_RESERVED;
+	vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
+	error = io_remap_pfn_range(vma, vma->vm_start, __PREG(GPLR0) >> PAGE_SHIFT,
+				   PAGE_SIZE, vma->vm_page_prot);
+	if (error)
+		goto out;
+
+	/* the first vma is not opened through vm_ops */
+	vma->vm_ops = &sios_gpio_vm_ops;
+	vma->vm_private_data = gf;
+	gf->mappings++;
+out:
+	mutex_unlock(&gf->lock);
+	return error;
+}
+
+static int sios_gpio_open(struct inode *inode, struct file *file)
+{
+	struct sios_gpio_file *gf;
+
+	gf = kzalloc(sizeof(*gf), GFP_KERNEL);
+	if (!gf)
+		return -ENOMEM;
+
+	mutex_init(&gf->lock);
+	INIT_LIST_HEAD(&gf->claims);
+	file->private_data = gf;
+	return 0;
+}
+
+/*
+ * Every vma holds the file, so the last close only comes once all
+ * mappings are gone and no process can reach the registers any more.
+ */
+static int sios_gpio_close(struct inode *inode, struct file *file)
+{
+	struct sios_gpio_file *gf = file->private_data;
+	struct sios_gpio_claim_res *cr, *n;
+
+	WARN_ON(gf->mappings);
+	list_for_each_entry_safe(cr, n, &gf->claims, list) {
+		sios_release_resource(&cr->res);
+		kfree(cr);
+	}
+	kfree(gf);
+	return 0;
+}
+
+static const struct file_operations sios_gpio_fops = {
+	.owner = THIS_MODULE,
+	.open = sios_gpio_open,
+	.release = sios_gpio_close,
+	.ioctl = sios_gpio_ioctl,
+	.mmap = sios_gpio_mmap,
+};
+
+static int __init sios_gpio_init(void)
+{
+	int error;
+
+	error = sios_driver_register(&gpio_drv);
+	if (error)
+		return error;
+
+	error = sios_device_register(&gpio_dev);
+	if (error)
+		goto err_drv;
+
+	error = sios_chrdev_add(&gpio_cdev, &sios_gpio_fops, SIOS_GPIO_MINOR, "gpio");
+	if (error)
+		goto err_dev;
+
+	return 0;
+
+err_dev:
+	sios_device_unregister(&gpio_dev);
+err_drv:
+	sios_driver_unregister(&gpio_drv);
+	return error;
+}
+
+static void __exit sios_gpio_exit(void)
+{
+	sios_chrdev_del(&gpio_cdev, SIOS_GPIO_MINOR);
+	sios_device_unregister(&gpio_dev);
+	sios_driver_unregister(&gpio_drv);
+}
+
+MODULE_DESCRIPTION("SIOS userspace GPIO driver");
+MODULE_AUTHOR("Simon de Bakker <simon@v2.nl>");
+MODULE_LICENSE("GPL");
+
+module_init(sios_gpio_init);
+module_exit(sios_gpio_exit);
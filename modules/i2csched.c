@@ -0,0 +1,870 @@
+/* -*-linux-c-*-
+ * i2csched.c - SIOS I2C transaction scheduler
+ *
+ * Copyright (C) 2008 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA, or http://www.gnu.org/licenses/gpl.html
+ */
+
+/*
+ * All chips of a board hang off one I2C bus. Instead of letting every
+ * driver call i2c_transfer() whenever it likes, drivers hand their
+ * transactions to the board's scheduler, which runs them from a single
+ * thread: earliest release first within the most urgent priority,
+ * earliest deadline breaking ties. Ready requests of the same priority
+ * are merged into one multi-message transfer, which saves the bus
+ * arbitration and the thread wakeup per request.
+ *
+ * Because every transfer goes through the thread, it is also where a
+ * stuck bus is noticed and recovered, see sios_i2c_recover.
+ */
+
+#include <linux/module.h>
+#include <linux/kthread.h>
+#include <linux/hrtimer.h>
+#include <linux/kref.h>
+#include <linux/wait.h>
+#include <linux/sched.h>
+#include <linux/delay.h>
+#include <linux/workqueue.h>
+#include <asm/arch/pxa-regs.h>
+#include <asm/arch/gpio.h>
+
+#include "sios/sios.h"
+#include "sios/board.h"
+#include "sios/event.h"
+#include "sios/i2csched.h"
+
+struct sios_i2c_sched {
+	struct sios_board *board;
+	struct i2c_adapter *adap;
+	struct kref kref;
+
+	spinlock_t lock;
+	struct list_head queue;		/* waiting for release or the bus */
+	struct list_head clients;	/* named requests, for sysfs */
+	struct task_struct *task;
+	struct hrtimer timer;
+	wait_queue_head_t idle;
+	struct i2c_msg msgs[SIOS_I2C_MAX_MSGS];
+
+	ktime_t since;
+	u64 busy_ns;
+	u32 transfers;
+	u32 coalesced;			/* transfers carrying several requests */
+	u32 messages;
+	u32 errors;
+
+	/* bus recovery */
+	int consec_errors;
+	ktime_t first_error;
+	u32 stuck;
+	u32 recovered[3];		/* by bus clear, expander reset, rail cycle */
+	u32 unrecovered;
+	unsigned int backoff_ms;	/* no recovery before recover_after */
+	unsigned long recover_after;
+	u32 last_recover_us;
+	u32 max_recover_us;
+	int inject;			/* transfers left to fail on purpose */
+	struct list_head reinit;
+	struct work_struct reinit_work;
+	struct mutex reinit_lock;
+
+	struct sios_device dev;
+	char name[BUS_ID_SIZE];
+	struct list_head list;
+};
+
+#define to_sios_i2c_sched(d) container_of(to_sios_device(d), struct sios_i2c_sched, dev)
+
+static LIST_HEAD(sched_list);
+static DEFINE_MUTEX(sched_mutex);
+
+static s64 sios_i2c_due(struct sios_i2c_req *req)
+{
+	if (!req->deadline_us)
+		return KTIME_MAX;
+	return req->release.tv64 + (s64)req->deadline_us * NSEC_PER_USEC;
+}
+
+static int sios_i2c_before(struct sios_i2c_req *a, struct sios_i2c_req *b)
+{
+	if (a->prio != b->prio)
+		return a->prio < b->prio;
+	return sios_i2c_due(a) < sios_i2c_due(b);
+}
+
+/*
+ * Move the next transfer's requests from the queue to @batch. Only
+ * requests of the first one's priority are merged: lower priority work
+ * would stretch an urgent transfer. Returns the number of messages and
+ * the earliest pending release in @next.
+ */
+static int sios_i2c_collect(struct sios_i2c_sched *sched, ktime_t now,
+			    struct list_head *batch, ktime_t *next)
+{
+	struct sios_i2c_req *req, *best;
+	int nmsgs = 0;
+
+	for (;;) {
+		best = NULL;
+		list_for_each_entry(req, &sched->queue, queue) {
+			if (req->release.tv64 > now.tv64)
+				continue;
+			if (nmsgs) {
+				struct sios_i2c_req *first;
+
+				first = list_entry(batch->next, struct sios_i2c_req, batch);
+				if (req->prio != first->prio ||
+				    (req->flags & SIOS_I2C_EXCLUSIVE) ||
+				    nmsgs + req->num > SIOS_I2C_MAX_MSGS)
+					continue;
+			}
+			if (!best || sios_i2c_before(req, best))
+				best = req;
+		}
+		if (!best)
+			break;
+
+		list_del(&best->queue);
+		best->queued = 0;
+		best->running = 1;
+		list_add_tail(&best->batch, batch);
+		nmsgs += best->num;
+
+		if (best->flags & SIOS_I2C_EXCLUSIVE)
+			break;
+	}
+
+	next->tv64 = KTIME_MAX;
+	list_for_each_entry(req, &sched->queue, queue) {
+		if (req->release.tv64 < next->tv64)
+			*next = req->release;
+	}
+
+	return nmsgs;
+}
+
+static void sios_i2c_account(struct sios_i2c_req *req, ktime_t end, int status)
+{
+	struct sios_i2c_req_stats *st = &req->stats;
+	s64 lat = ktime_us_delta(end, req->release);
+
+	if (!st->runs++)
+		st->first = end;
+	if (status)
+		st->errors++;
+	st->last_us = lat;
+	if (lat > st->max_us)
+		st->max_us = lat;
+	if (req->deadline_us && lat > req->deadline_us)
+		st->misses++;
+}
+
+/* next release of a periodic request, whole periods already gone are lost */
+static void sios_i2c_advance(struct sios_i2c_req *req, ktime_t now)
+{
+	s64 period = (s64)req->period_us * NSEC_PER_USEC;
+
+	req->release.tv64 += period;
+	while (req->release.tv64 + period <= now.tv64) {
+		req->release.tv64 += period;
+		req->stats.skipped++;
+	}
+}
+
+/*
+ * Bus recovery. A transfer error with SDA held low, or a run of
+ * SIOS_I2C_STUCK_ERRORS failed transfers, counts as a stuck bus. The
+ * thread then escalates until SDA is released: clock out the slave
+ * holding SDA and issue a STOP by bit-banging the bus pins, reset the
+ * PCA9557 through RST and clear again, and finally power cycle the
+ * hot-swap rail and clear again. Chips that may have lost their setup
+ * are reinitialised from a work item afterwards. When all of that fails
+ * the bus is left alone for a while, twice as long after every failed
+ * recovery, so that a dead module does not keep the rail cycling.
+ */
+#define SIOS_I2C_STUCK_ERRORS	3
+#define SIOS_I2C_BACKOFF_MIN_MS	100
+#define SIOS_I2C_BACKOFF_MAX_MS	60000
+#define SIOS_I2C_HALF_CLK_US	5	/* 100 kHz */
+
+static int (*sios_i2c_rail_cycler)(struct sios_board *board);
+
+void sios_i2c_set_rail_cycler(int (*cycle)(struct sios_board *board))
+{
+	sios_i2c_rail_cycler = cycle;
+}
+EXPORT_SYMBOL_GPL(sios_i2c_set_rail_cycler);
+
+/* the present pin function, in pxa_gpio_mode() form */
+static int sios_i2c_pin_mode(int gpio)
+{
+	int fn = (GAFR(gpio) >> ((gpio & 0xf) * 2)) & 0x3;
+
+	return gpio | (fn << 8) | ((GPDR(gpio) & GPIO_bit(gpio)) ? GPIO_OUT : GPIO_IN);
+}
+
+/* open drain: drive low, or let the pull-up take the line high */
+static void sios_i2c_line(int gpio, int high)
+{
+	if (high)
+		gpio_direction_input(gpio);
+	else
+		gpio_direction_output(gpio, 0);
+	udelay(SIOS_I2C_HALF_CLK_US);
+}
+
+static int sios_i2c_sda_stuck(struct sios_i2c_sched *sched)
+{
+	return !gpio_get_value(sios_board_pin(sched->board, SIOS_PIN_I2C_SDA));
+}
+
+static int sios_i2c_bus_clear(struct sios_i2c_sched *sched)
+{
+	int scl = sios_board_pin(sched->board, SIOS_PIN_I2C_SCL);
+	int sda = sios_board_pin(sched->board, SIOS_PIN_I2C_SDA);
+	int scl_mode = sios_i2c_pin_mode(scl);
+	int sda_mode = sios_i2c_pin_mode(sda);
+	int i, ok;
+
+	pxa_gpio_mode(scl | GPIO_IN);
+	pxa_gpio_mode(sda | GPIO_IN);
+	udelay(SIOS_I2C_HALF_CLK_US);
+
+	/* a slave in the middle of a byte lets go after at most 9 clocks */
+	for (i=0; i<9 && !gpio_get_value(sda); i++) {
+		sios_i2c_line(scl, 0);
+		sios_i2c_line(scl, 1);
+	}
+
+	/* STOP: SDA rising while SCL is high */
+	sios_i2c_line(scl, 0);
+	sios_i2c_line(sda, 0);
+	sios_i2c_line(scl, 1);
+	sios_i2c_line(sda, 1);
+
+	ok = gpio_get_value(sda) && gpio_get_value(scl);
+
+	pxa_gpio_mode(sda_mode);
+	pxa_gpio_mode(scl_mode);
+
+	return ok ? 0 : -EBUSY;
+}
+
+static void sios_i2c_expander_reset(struct sios_i2c_sched *sched)
+{
+	int rst = sios_board_pin(sched->board, SIOS_PIN_RST);
+	int level = gpio_get_value(rst);
+
+	gpio_set_value(rst, !level);
+	udelay(10);
+	gpio_set_value(rst, level);
+	udelay(10);
+}
+
+static void sios_i2c_recover(struct sios_i2c_sched *sched)
+{
+	int level, error;
+	u32 us;
+
+	sched->stuck++;
+
+	level = 0;
+	error = sios_i2c_bus_clear(sched);
+	if (error) {
+		level = 1;
+		sios_i2c_expander_reset(sched);
+		error = sios_i2c_bus_clear(sched);
+	}
+	if (error && sios_i2c_rail_cycler) {
+		level = 2;
+		sios_i2c_rail_cycler(sched->board);
+		error = sios_i2c_bus_clear(sched);
+	}
+
+	if (error) {
+		sched->unrecovered++;
+		sched->consec_errors = 0;
+		sched->backoff_ms = sched->backoff_ms ?
+			min_t(unsigned int, 2 * sched->backoff_ms,
+			      SIOS_I2C_BACKOFF_MAX_MS) :
+			SIOS_I2C_BACKOFF_MIN_MS;
+		sched->recover_after = jiffies + msecs_to_jiffies(sched->backoff_ms);
+		printk(KERN_ERR "%s: bus stuck, recovery failed, next try in %u ms\n",
+		       sched->name, sched->backoff_ms);
+		return;
+	}
+
+	sched->recovered[level]++;
+	us = ktime_us_delta(ktime_get(), sched->first_error);
+	sched->last_recover_us = us;
+	if (us > sched->max_recover_us)
+		sched->max_recover_us = us;
+	sched->consec_errors = 0;
+	sched->backoff_ms = 0;
+
+	if (level)
+		printk(KERN_WARNING "%s: bus recovered by %s\n", sched->name,
+		       level == 1 ? "expander reset" : "rail cycle");
+	schedule_work(&sched->reinit_work);
+}
+
+/*
+ * called by the thread after every transfer; a probe going unanswered
+ * is not an error unless it left SDA low
+ */
+static void sios_i2c_check_bus(struct sios_i2c_sched *sched, int status,
+			       int probe)
+{
+	if (!status || (probe && !sios_i2c_sda_stuck(sched))) {
+		sched->consec_errors = 0;
+		if (!status)
+			sched->backoff_ms = 0;
+		return;
+	}
+
+	if (sched->backoff_ms && time_before(jiffies, sched->recover_after))
+		return;
+
+	if (!sched->consec_errors++)
+		sched->first_error = ktime_get();
+
+	if (sios_i2c_sda_stuck(sched) ||
+	    sched->consec_errors >= SIOS_I2C_STUCK_ERRORS)
+		sios_i2c_recover(sched);
+}
+
+static void sios_i2c_reinit_work(struct work_struct *work)
+{
+	struct sios_i2c_sched *sched = container_of(work, struct sios_i2c_sched, reinit_work);
+	struct sios_i2c_reinit *r;
+
+	mutex_lock(&sched->reinit_lock);
+	list_for_each_entry(r, &sched->reinit, list)
+		r->reinit(r);
+	mutex_unlock(&sched->reinit_lock);
+}
+
+void sios_i2c_add_reinit(struct sios_i2c_sched *sched, struct sios_i2c_reinit *r)
+{
+	mutex_lock(&sched->reinit_lock);
+	list_add_tail(&r->list, &sched->reinit);
+	mutex_unlock(&sched->reinit_lock);
+}
+EXPORT_SYMBOL_GPL(sios_i2c_add_reinit);
+
+void sios_i2c_del_reinit(struct sios_i2c_sched *sched, struct sios_i2c_reinit *r)
+{
+	mutex_lock(&sched->reinit_lock);
+	list_del(&r->list);
+	mutex_unlock(&sched->reinit_lock);
+}
+EXPORT_SYMBOL_GPL(sios_i2c_del_reinit);
+
+static void sios_i2c_run(struct sios_i2c_sched *sched, struct list_head *batch,
+			 int nmsgs)
+{
+	struct sios_i2c_req *req, *n;
+	unsigned long flags;
+	ktime_t start, end, stamp;
+	int i = 0, nreq = 0, ret, status;
+
+	stamp = sios_event_stamp();
+	list_for_each_entry(req, batch, batch) {
+		req->stamp = stamp;
+		memcpy(&sched->msgs[i], req->msgs, req->num * sizeof(struct i2c_msg));
+		i += req->num;
+		nreq++;
+	}
+
+	start = ktime_get();
+	if (sched->inject > 0) {
+		/* fault injection, see the inject attribute */
+		sched->inject--;
+		ret = -ETIMEDOUT;
+	} else {
+		ret = i2c_transfer(sched->adap, sched->msgs, nmsgs);
+	}
+	end = ktime_get();
+	status = (ret == nmsgs) ? 0 : (ret < 0) ? ret : -EIO;
+
+	sched->busy_ns += ktime_to_ns(ktime_sub(end, start));
+	sched->transfers++;
+	sched->messages += nmsgs;
+	if (nreq > 1)
+		sched->coalesced++;
+	if (status)
+		sched->errors++;
+	req = list_entry(batch->next, struct sios_i2c_req, batch);
+	sios_i2c_check_bus(sched, status, req->flags & SIOS_I2C_PROBE);
+
+	list_for_each_entry_safe(req, n, batch, batch) {
+		list_del(&req->batch);
+		sios_i2c_account(req, end, status);
+
+		if (!req->period_us) {
+			/* the owner may free a one-shot request from complete() */
+			spin_lock_irqsave(&sched->lock, flags);
+			if (req->listed) {
+				list_del(&req->client);
+				req->listed = 0;
+			}
+			req->running = 0;
+			spin_unlock_irqrestore(&sched->lock, flags);
+			if (req->complete)
+				req->complete(req, status);
+			continue;
+		}
+
+		if (req->complete)
+			req->complete(req, status);
+
+		spin_lock_irqsave(&sched->lock, flags);
+		req->running = 0;
+		if (!req->cancelled) {
+			sios_i2c_advance(req, end);
+			list_add_tail(&req->queue, &sched->queue);
+			req->queued = 1;
+		}
+		spin_unlock_irqrestore(&sched->lock, flags);
+	}
+
+	wake_up_all(&sched->idle);
+}
+
+static enum hrtimer_restart sios_i2c_timer(struct hrtimer *timer)
+{
+	struct sios_i2c_sched *sched = container_of(timer, struct sios_i2c_sched, timer);
+
+	wake_up_process(sched->task);
+	return HRTIMER_NORESTART;
+}
+
+static int sios_i2c_thread(void *data)
+{
+	struct sios_i2c_sched *sched = data;
+	struct sched_param param = { .sched_priority = MAX_RT_PRIO / 2 };
+	unsigned long flags;
+	LIST_HEAD(batch);
+	ktime_t next;
+	int nmsgs;
+
+	sched_setscheduler(current, SCHED_FIFO, &param);
+
+	for (;;) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (kthread_should_stop())
+			break;
+
+		spin_lock_irqsave(&sched->lock, flags);
+		nmsgs = sios_i2c_collect(sched, ktime_get(), &batch, &next);
+		spin_unlock_irqrestore(&sched->lock, flags);
+
+		if (!nmsgs) {
+			if (next.tv64 != KTIME_MAX)
+				hrtimer_start(&sched->timer, next, HRTIMER_MODE_ABS);
+			schedule();
+			continue;
+		}
+
+		__set_current_state(TASK_RUNNING);
+		sios_i2c_run(sched, &batch, nmsgs);
+	}
+	__set_current_state(TASK_RUNNING);
+	hrtimer_cancel(&sched->timer);
+
+	return 0;
+}
+
+/**
+ *	sios_i2c_submit - queue a transaction request
+ *	@sched: scheduler of the board the chip sits on
+ *	@req: request, released immediately
+ *
+ *	Periodic requests stay queued until sios_i2c_cancel().
+ */
+int sios_i2c_submit(struct sios_i2c_sched *sched, struct sios_i2c_req *req)
+{
+	unsigned long flags;
+	int error = 0;
+
+	if (req->num < 1 || req->num > SIOS_I2C_MAX_MSGS)
+		return -EINVAL;
+
+	spin_lock_irqsave(&sched->lock, flags);
+	if (req->queued || req->running) {
+		error = -EBUSY;
+		goto out;
+	}
+
+	req->sched = sched;
+	req->cancelled = 0;
+	req->release = ktime_get();
+	if (req->name && !req->listed) {
+		memset(&req->stats, 0, sizeof(req->stats));
+		list_add_tail(&req->client, &sched->clients);
+		req->listed = 1;
+	}
+	list_add_tail(&req->queue, &sched->queue);
+	req->queued = 1;
+out:
+	spin_unlock_irqrestore(&sched->lock, flags);
+
+	if (!error)
+		wake_up_process(sched->task);
+	return error;
+}
+EXPORT_SYMBOL_GPL(sios_i2c_submit);
+
+/**
+ *	sios_i2c_cancel - withdraw a request
+ *	@req: submitted request
+ *
+ *	Waits for a transfer carrying the request to finish, complete()
+ *	is not called afterwards.
+ */
+void sios_i2c_cancel(struct sios_i2c_req *req)
+{
+	struct sios_i2c_sched *sched = req->sched;
+	unsigned long flags;
+
+	if (!sched)
+		return;
+
+	spin_lock_irqsave(&sched->lock, flags);
+	req->cancelled = 1;
+	if (req->queued) {
+		list_del(&req->queue);
+		req->queued = 0;
+	}
+	spin_unlock_irqrestore(&sched->lock, flags);
+
+	wait_event(sched->idle, !req->running);
+
+	spin_lock_irqsave(&sched->lock, flags);
+	if (req->listed) {
+		list_del(&req->client);
+		req->listed = 0;
+	}
+	spin_unlock_irqrestore(&sched->lock, flags);
+}
+EXPORT_SYMBOL_GPL(sios_i2c_cancel);
+
+struct sios_i2c_sync {
+	struct completion done;
+	int status;
+};
+
+static void sios_i2c_sync_complete(struct sios_i2c_req *req, int status)
+{
+	struct sios_i2c_sync *sync = req->context;
+
+	sync->status = status;
+	complete(&sync->done);
+}
+
+static int sios_i2c_sync(struct sios_i2c_sched *sched, struct i2c_msg *msgs,
+			 int num, int prio, unsigned int flags)
+{
+	struct sios_i2c_sync sync;
+	struct sios_i2c_req req = {
+		.msgs = msgs,
+		.num = num,
+		.prio = prio,
+		.flags = flags,
+		.complete = sios_i2c_sync_complete,
+		.context = &sync,
+	};
+	int error;
+
+	init_completion(&sync.done);
+	error = sios_i2c_submit(sched, &req);
+	if (error)
+		return error;
+
+	wait_for_completion(&sync.done);
+	return sync.status ? sync.status : num;
+}
+
+/**
+ *	sios_i2c_transfer - scheduled replacement for i2c_transfer()
+ *	@sched: board scheduler
+ *	@msgs: messages, at most SIOS_I2C_MAX_MSGS
+ *	@num: number of messages
+ *	@prio: SIOS_I2C_PRIO_*
+ *
+ *	Sleeps until the transfer is done, returns @num or an error.
+ */
+int sios_i2c_transfer(struct sios_i2c_sched *sched, struct i2c_msg *msgs,
+		      int num, int prio)
+{
+	return sios_i2c_sync(sched, msgs, num, prio, 0);
+}
+EXPORT_SYMBOL_GPL(sios_i2c_transfer);
+
+/**
+ *	sios_i2c_probe - test for a chip at an address
+ *	@sched: board scheduler
+ *	@addr: 7 bit address
+ *
+ *	Reads one byte at low priority, which every SIOS chip answers from
+ *	its current register. Returns 1 if the chip acknowledged, else 0.
+ */
+int sios_i2c_probe(struct sios_i2c_sched *sched, int addr)
+{
+	u8 byte;
+	struct i2c_msg msg = {
+		.addr = addr,
+		.flags = I2C_M_RD,
+		.len = 1,
+		.buf = &byte,
+	};
+
+	return sios_i2c_sync(sched, &msg, 1, SIOS_I2C_PRIO_LOW,
+			     SIOS_I2C_EXCLUSIVE | SIOS_I2C_PROBE) == 1;
+}
+EXPORT_SYMBOL_GPL(sios_i2c_probe);
+
+struct i2c_adapter *sios_i2c_adapter(struct sios_i2c_sched *sched)
+{
+	return sched->adap;
+}
+EXPORT_SYMBOL_GPL(sios_i2c_adapter);
+
+static ssize_t show_i2c_stats(struct device *dev, struct device_attribute *attr,
+			      char *buf)
+{
+	struct sios_i2c_sched *sched = to_sios_i2c_sched(dev);
+	u64 elapsed_ms = ktime_to_ns(ktime_sub(ktime_get(), sched->since));
+	u64 busy_us = sched->busy_ns;
+	u64 permille;
+
+	do_div(elapsed_ms, NSEC_PER_MSEC);
+	do_div(busy_us, NSEC_PER_USEC);
+
+	/* of wall time the bus spent in transfers */
+	permille = busy_us;
+	if (elapsed_ms)
+		do_div(permille, (u32)elapsed_ms);
+
+	return snprintf(buf, PAGE_SIZE,
+			"transfers\t%u\ncoalesced\t%u\nmessages\t%u\n"
+			"errors\t%u\nbusy_us\t%llu\nutilisation\t%u.%u%%\n"
+			"stuck\t%u\nrecovered_clear\t%u\nrecovered_reset\t%u\n"
+			"recovered_cycle\t%u\nunrecovered\t%u\n"
+			"recover_last_us\t%u\nrecover_max_us\t%u\n"
+			"recover_backoff_ms\t%u\n",
+			sched->transfers, sched->coalesced, sched->messages,
+			sched->errors, busy_us,
+			(u32)permille / 10, (u32)permille % 10,
+			sched->stuck, sched->recovered[0], sched->recovered[1],
+			sched->recovered[2], sched->unrecovered,
+			sched->last_recover_us, sched->max_recover_us,
+			sched->backoff_ms);
+}
+
+static ssize_t show_i2c_inject(struct device *dev, struct device_attribute *attr,
+			       char *buf)
+{
+	return snprintf(buf, PAGE_SIZE, "%d\n", to_sios_i2c_sched(dev)->inject);
+}
+
+/* fail the next n transfers with -ETIMEDOUT without touching the bus */
+static ssize_t store_i2c_inject(struct device *dev, struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	to_sios_i2c_sched(dev)->inject = simple_strtol(buf, NULL, 0);
+	return count;
+}
+
+/* achieved rate in mHz since the first run */
+static u32 sios_i2c_rate(struct sios_i2c_req_stats *st)
+{
+	u64 rate = (u64)st->runs * 1000000;
+	u64 ms;
+
+	if (!st->runs)
+		return 0;
+	ms = ktime_to_ns(ktime_sub(ktime_get(), st->first));
+	do_div(ms, NSEC_PER_MSEC);
+	if (!ms)
+		return 0;
+	do_div(rate, (u32)ms);
+	return rate;
+}
+
+static ssize_t show_i2c_clients(struct device *dev, struct device_attribute *attr,
+				char *buf)
+{
+	struct sios_i2c_sched *sched = to_sios_i2c_sched(dev);
+	struct sios_i2c_req *req;
+	unsigned long flags;
+	ssize_t len;
+
+	len = snprintf(buf, PAGE_SIZE, "name\tprio\tperiod_us\tdeadline_us\truns\t"
+		       "rate_mhz\tmisses\tskipped\terrors\tlast_us\tmax_us\n");
+
+	spin_lock_irqsave(&sched->lock, flags);
+	list_for_each_entry(req, &sched->clients, client) {
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+				 "%s\t%d\t%u\t%u\t%u\t%u\t%u\t%u\t%u\t%u\t%u\n",
+				 req->name, req->prio, req->period_us,
+				 req->deadline_us, req->stats.runs,
+				 sios_i2c_rate(&req->stats), req->stats.misses,
+				 req->stats.skipped, req->stats.errors,
+				 req->stats.last_us, req->stats.max_us);
+		if (len >= PAGE_SIZE)
+			break;
+	}
+	spin_unlock_irqrestore(&sched->lock, flags);
+
+	return min_t(ssize_t, len, PAGE_SIZE);
+}
+
+static DEVICE_ATTR(stats, S_IRUGO, show_i2c_stats, NULL);
+static DEVICE_ATTR(clients, S_IRUGO, show_i2c_clients, NULL);
+static DEVICE_ATTR(inject, S_IRUGO | S_IWUSR, show_i2c_inject, store_i2c_inject);
+
+static struct attribute *sios_i2c_attrs[] = {
+	&dev_attr_stats.attr,
+	&dev_attr_clients.attr,
+	&dev_attr_inject.attr,
+	NULL,
+};
+
+static struct attribute_group sios_i2c_group = {
+	.attrs = sios_i2c_attrs,
+};
+
+static void sios_i2c_sched_release(struct sios_device *sdev)
+{
+	kfree(container_of(sdev, struct sios_i2c_sched, dev));
+}
+
+static struct sios_i2c_sched *sios_i2c_sched_create(struct sios_board *board)
+{
+	struct sios_i2c_sched *sched;
+	int error;
+
+	sched = kzalloc(sizeof(*sched), GFP_KERNEL);
+	if (!sched)
+		return NULL;
+
+	sched->adap = i2c_get_adapter(board->i2c_adapter);
+	if (!sched->adap) {
+		kfree(sched);
+		return NULL;
+	}
+
+	sched->board = board;
+	kref_init(&sched->kref);
+	spin_lock_init(&sched->lock);
+	INIT_LIST_HEAD(&sched->queue);
+	INIT_LIST_HEAD(&sched->clients);
+	init_waitqueue_head(&sched->idle);
+	INIT_LIST_HEAD(&sched->reinit);
+	INIT_WORK(&sched->reinit_work, sios_i2c_reinit_work);
+	mutex_init(&sched->reinit_lock);
+	hrtimer_init(&sched->timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	sched->timer.function = sios_i2c_timer;
+	sched->since = ktime_get();
+
+	sios_board_devname(board, "sios:i2c", sched->name, sizeof(sched->name));
+	sched->dev.name = sched->name;
+	sched->dev.release = sios_i2c_sched_release;
+	sched->dev.board = board;
+
+	error = sios_device_register(&sched->dev);
+	if (error) {
+		i2c_put_adapter(sched->adap);
+		kfree(sched);
+		return NULL;
+	}
+
+	error = sysfs_create_group(&sched->dev.dev.kobj, &sios_i2c_group);
+	if (error)
+		goto err;
+
+	sched->task = kthread_run(sios_i2c_thread, sched, "sios-i2c/%d", board->id);
+	if (IS_ERR(sched->task)) {
+		sysfs_remove_group(&sched->dev.dev.kobj, &sios_i2c_group);
+		goto err;
+	}
+
+	list_add_tail(&sched->list, &sched_list);
+	return sched;
+
+err:
+	i2c_put_adapter(sched->adap);
+	sios_device_unregister(&sched->dev);
+	return NULL;
+}
+
+/**
+ *	sios_i2c_sched_get - get the scheduler of a board's bus
+ *	@board: board instance
+ *
+ *	Started on first use, returns NULL if the adapter is not there.
+ */
+struct sios_i2c_sched *sios_i2c_sched_get(struct sios_board *board)
+{
+	struct sios_i2c_sched *sched;
+
+	mutex_lock(&sched_mutex);
+	list_for_each_entry(sched, &sched_list, list) {
+		if (sched->board == board) {
+			kref_get(&sched->kref);
+			goto out;
+		}
+	}
+	sched = sios_i2c_sched_create(board);
+out:
+	mutex_unlock(&sched_mutex);
+	return sched;
+}
+EXPORT_SYMBOL_GPL(sios_i2c_sched_get);
+
+static void sios_i2c_sched_unlist(struct kref *kref)
+{
+	list_del(&container_of(kref, struct sios_i2c_sched, kref)->list);
+}
+
+/* all requests must be cancelled by now, called without sched_mutex */
+static void sios_i2c_sched_destroy(struct sios_i2c_sched *sched)
+{
+	kthread_stop(sched->task);
+	cancel_work_sync(&sched->reinit_work);
+	sysfs_remove_group(&sched->dev.dev.kobj, &sios_i2c_group);
+	i2c_put_adapter(sched->adap);
+	sios_device_unregister(&sched->dev);
+}
+
+void sios_i2c_sched_put(struct sios_i2c_sched *sched)
+{
+	int released;
+
+	if (!sched)
+		return;
+
+	mutex_lock(&sched_mutex);
+	released = kref_put(&sched->kref, sios_i2c_sched_unlist);
+	mutex_unlock(&sched_mutex);
+
+	if (released)
+		sios_i2c_sched_destroy(sched);
+}
+EXPORT_SYMBOL_GPL(sios_i2c_sched_put);
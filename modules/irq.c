@@ -0,0 +1,362 @@
+/* -*-linux-c-*-
+ * irq.c - SIOS resource interrupts
+ *
+ * Copyright (C) 2008 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA, or http://www.gnu.org/licenses/gpl.html
+ */
+
+#include <linux/module.h>
+#include <linux/interrupt.h>
+#include <linux/irq.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <asm/arch/gpio.h>
+
+#include "sios/sios.h"
+#include "sios/resource.h"
+#include "sios/event.h"
+
+/*
+ * Interrupt pins of sios devices. The hard handler only stamps the
+ * edge, reads the pin and queues a record; the resource handler runs
+ * later from a tasklet for SIOS_FIRQ pins or from a SCHED_FIFO thread
+ * of its own for SIOS_IRQ pins, where it may sleep.
+ *
+ * Each queue has one producer, the hard handler, and one consumer, so
+ * head and tail need no lock, only ordering against the record.
+ */
+
+#define SIOS_IRQ_QLEN	64	/* records, power of two */
+
+struct sios_irq_stats {
+	u32 events;
+	u32 dropped;
+	u32 simulated;
+	s64 record_ns;		/* simulated edge to queued record */
+	s64 record_max_ns;
+	s64 dispatch_ns;	/* queued record to resource handler */
+	s64 dispatch_max_ns;
+	s64 dispatch_total_ns;
+};
+
+struct sios_irq {
+	struct sios_resource *res;
+	int irq;
+	int fast;		/* SIOS_FIRQ */
+
+	struct sios_irq_rec q[SIOS_IRQ_QLEN];
+	unsigned int head;	/* hard handler only */
+	unsigned int tail;	/* consumer only */
+	u32 seq;
+	u16 lost;
+
+	struct tasklet_struct tasklet;
+	struct task_struct *task;
+
+	struct sios_irq_stats stats;
+	char name[BUS_ID_SIZE];
+	struct list_head list;
+};
+
+static LIST_HEAD(irq_list);
+static DEFINE_MUTEX(irq_mutex);
+
+static irqreturn_t sios_irq_hard(int irq, void *dev_id)
+{
+	struct sios_irq *sirq = dev_id;
+	ktime_t stamp = sios_event_stamp();
+	unsigned int head = sirq->head;
+	struct sios_irq_rec *rec;
+
+	if (head - sirq->tail >= SIOS_IRQ_QLEN) {
+		if (sirq->lost < 0xffff)
+			sirq->lost++;
+		sirq->stats.dropped++;
+		goto kick;
+	}
+
+	rec = &sirq->q[head & (SIOS_IRQ_QLEN - 1)];
+	rec->stamp = stamp;
+	rec->seq = sirq->seq++;
+	rec->level = gpio_get_value(sirq->res->start) ? 1 : 0;
+	rec->lost = sirq->lost;
+	sirq->lost = 0;
+
+	smp_wmb();	/* record before head */
+	sirq->head = head + 1;
+kick:
+	if (sirq->fast)
+		tasklet_schedule(&sirq->tasklet);
+	else
+		wake_up_process(sirq->task);
+
+	return IRQ_HANDLED;
+}
+
+static void sios_irq_drain(struct sios_irq *sirq)
+{
+	struct sios_irq_stats *st = &sirq->stats;
+	unsigned int tail = sirq->tail;
+	struct sios_irq_rec rec;
+	s64 ns;
+
+	while (tail != sirq->head) {
+		smp_rmb();	/* head before record */
+		rec = sirq->q[tail & (SIOS_IRQ_QLEN - 1)];
+		ns = ktime_to_ns(ktime_sub(sios_event_stamp(), rec.stamp));
+
+		smp_mb();	/* record copied before the slot is handed back */
+		sirq->tail = ++tail;
+
+		st->events++;
+		st->dispatch_ns = ns;
+		st->dispatch_total_ns += ns;
+		if (ns > st->dispatch_max_ns)
+			st->dispatch_max_ns = ns;
+		if (sios_latency_on)
+			sios_latency_add(SIOS_LAT_DEFERRED, ns);
+
+		sirq->res->handler(sirq->res, &rec);
+	}
+}
+
+static void sios_irq_tasklet(unsigned long data)
+{
+	sios_irq_drain((struct sios_irq *)data);
+}
+
+static int sios_irq_thread(void *data)
+{
+	struct sios_irq *sirq = data;
+	struct sched_param param = { .sched_priority = MAX_RT_PRIO / 2 };
+
+	sched_setscheduler(current, SCHED_FIFO, &param);
+
+	for (;;) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (kthread_should_stop())
+			break;
+		if (sirq->head == sirq->tail) {
+			schedule();
+			continue;
+		}
+		__set_current_state(TASK_RUNNING);
+		sios_irq_drain(sirq);
+	}
+	__set_current_state(TASK_RUNNING);
+
+	return 0;
+}
+
+static void sios_irq_free(struct sios_irq *sirq)
+{
+	mutex_lock(&irq_mutex);
+	list_del(&sirq->list);
+	mutex_unlock(&irq_mutex);
+
+	free_irq(sirq->irq, sirq);
+	if (sirq->fast)
+		tasklet_kill(&sirq->tasklet);
+	else
+		kthread_stop(sirq->task);
+
+	sirq->res->irq = NULL;
+	kfree(sirq);
+}
+
+static int sios_irq_request(struct sios_resource *res)
+{
+	struct sios_irq *sirq;
+	int pin = res->start;
+	int error;
+
+	/* one line per resource, and expander pins have none of their own */
+	if (!(res->type & SIOS_IO_GPIO) || res->start != res->end)
+		return -EINVAL;
+
+	sirq = kzalloc(sizeof(*sirq), GFP_KERNEL);
+	if (!sirq)
+		return -ENOMEM;
+
+	sirq->res = res;
+	sirq->irq = gpio_to_irq(pin);
+	sirq->fast = (res->type & SIOS_FIRQ) ? 1 : 0;
+	sios_resource_name(res, sirq->name, sizeof(sirq->name));
+
+	if (sirq->fast) {
+		tasklet_init(&sirq->tasklet, sios_irq_tasklet, (unsigned long)sirq);
+	} else {
+		sirq->task = kthread_run(sios_irq_thread, sirq, "sios-irq/%d", sirq->irq);
+		if (IS_ERR(sirq->task)) {
+			error = PTR_ERR(sirq->task);
+			kfree(sirq);
+			return error;
+		}
+	}
+
+	gpio_direction_input(pin);
+	set_irq_type(sirq->irq, res->trigger ? res->trigger : IRQT_BOTHEDGE);
+
+	/* fast pins keep interrupts off for the few instructions they take */
+	error = request_irq(sirq->irq, sios_irq_hard,
+			    sirq->fast ? SA_INTERRUPT : 0, sirq->name, sirq);
+	if (error) {
+		printk(KERN_ERR "sios: unable to get IRQ %d for %s\n",
+		       sirq->irq, sirq->name);
+		if (!sirq->fast)
+			kthread_stop(sirq->task);
+		kfree(sirq);
+		return error;
+	}
+
+	res->irq = sirq;
+
+	mutex_lock(&irq_mutex);
+	list_add_tail(&sirq->list, &irq_list);
+	mutex_unlock(&irq_mutex);
+
+	return 0;
+}
+
+static inline int sios_irq_wanted(struct sios_resource *res)
+{
+	return (res->type & (SIOS_IRQ|SIOS_FIRQ)) && res->handler;
+}
+
+/**
+ *	sios_request_irqs - request the interrupts of a device's resources
+ *	@sdev: sios device, its resources claimed
+ *
+ *	Called by the bus when the device is added; only resources with a
+ *	handler are taken care of.
+ */
+int sios_request_irqs(struct sios_device *sdev)
+{
+	int i, error;
+
+	for (i=0; i<sdev->num_resource; i++) {
+		struct sios_resource *res = &sdev->resource[i];
+
+		if (!sios_irq_wanted(res) || res->irq)
+			continue;
+		error = sios_irq_request(res);
+		if (error) {
+			sios_free_irqs(sdev);
+			return error;
+		}
+	}
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(sios_request_irqs);
+
+/*
+ * Called by the bus when the device goes away. A driver that has to
+ * stop its handler earlier may call it itself.
+ */
+void sios_free_irqs(struct sios_device *sdev)
+{
+	int i;
+
+	for (i=0; i<sdev->num_resource; i++) {
+		if (sdev->resource[i].irq)
+			sios_irq_free(sdev->resource[i].irq);
+	}
+}
+EXPORT_SYMBOL_GPL(sios_free_irqs);
+
+/**
+ *	sios_irq_simulate - raise an interrupt pin's handler by hand
+ *	@name: resource name as in the device's resources table
+ *
+ *	Runs the interrupt through the same flow handler as a real edge,
+ *	with interrupts off and softirqs held back until it is done, as on
+ *	return from an interrupt. The time from the simulated edge to the
+ *	queued record is kept in the record_ns statistics.
+ */
+int sios_irq_simulate(const char *name)
+{
+	struct sios_irq *sirq;
+	struct sios_irq_stats *st;
+	unsigned long flags;
+	unsigned int head;
+	ktime_t edge;
+	s64 ns;
+	int error = -ENODEV;
+
+	mutex_lock(&irq_mutex);
+	list_for_each_entry(sirq, &irq_list, list) {
+		if (strcmp(sirq->name, name))
+			continue;
+
+		st = &sirq->stats;
+		local_bh_disable();
+		local_irq_save(flags);
+		head = sirq->head;
+		edge = sios_event_stamp();
+		generic_handle_irq(sirq->irq);
+		if (sirq->head != head) {
+			ns = ktime_to_ns(ktime_sub(sirq->q[head & (SIOS_IRQ_QLEN - 1)].stamp, edge));
+			st->simulated++;
+			st->record_ns = ns;
+			if (ns > st->record_max_ns)
+				st->record_max_ns = ns;
+			if (sios_latency_on)
+				sios_latency_add(SIOS_LAT_IRQ, ns);
+		}
+		local_irq_restore(flags);
+		local_bh_enable();
+
+		error = 0;
+		break;
+	}
+	mutex_unlock(&irq_mutex);
+
+	return error;
+}
+
+ssize_t sios_irq_show_stats(char *buf)
+{
+	struct sios_irq *sirq;
+	ssize_t len;
+
+	len = snprintf(buf, PAGE_SIZE, "name\tclass\tirq\tevents\tdropped\t"
+		       "simulated\trecord_ns\trecord_max_ns\tdispatch_ns\t"
+		       "dispatch_avg_ns\tdispatch_max_ns\n");
+
+	mutex_lock(&irq_mutex);
+	list_for_each_entry(sirq, &irq_list, list) {
+		struct sios_irq_stats st = sirq->stats;
+		u64 avg = st.dispatch_total_ns;
+
+		if (len >= PAGE_SIZE)
+			break;
+		if (st.events)
+			do_div(avg, st.events);
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+				 "%s\t%s\t%d\t%u\t%u\t%u\t%lld\t%lld\t%lld\t%lld\t%lld\n",
+				 sirq->name, sirq->fast ? "FIRQ" : "IRQ", sirq->irq,
+				 st.events, st.dropped, st.simulated,
+				 st.record_ns, st.record_max_ns, st.dispatch_ns,
+				 (long long)avg, st.dispatch_max_ns);
+	}
+	mutex_unlock(&irq_mutex);
+
+	return min_t(ssize_t, len, PAGE_SIZE);
+}
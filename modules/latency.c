@@ -0,0 +1,380 @@
+/* -*-linux-c-*-
+ * latency.c - SIOS event latency
+ *
+ * Copyright (C) 2008 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA, or http://www.gnu.org/licenses/gpl.html
+ */
+
+#include <linux/module.h>
+#include <linux/kthread.h>
+#include <linux/hrtimer.h>
+#include <linux/sched.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/bitops.h>
+#include <linux/delay.h>
+#include <asm/div64.h>
+
+#include "sios/sios.h"
+#include "sios/resource.h"
+#include "sios/event.h"
+
+/*
+ * Latency distributions of events on their way from the pin to a
+ * reader of /dev/sios_capture. Every stage is measured from the stamp
+ * the event got in its interrupt handler, so the stages add up to
+ * what a reader sees. Nothing is recorded unless enabled through the
+ * latency_bench or latency bus attributes.
+ *
+ * Histograms keep four buckets per power of two, so percentiles are
+ * good to 25%; they are shown as the upper bound of their bucket.
+ *
+ * The bench injects edges into a SIOS_IRQ or SIOS_FIRQ resource at a
+ * fixed rate through sios_irq_simulate, optionally against a busy
+ * thread taking the given share of the CPU. With a capture reader
+ * running, all four stages fill in.
+ */
+
+#define LAT_BUCKETS	256
+
+struct sios_lat_hist {
+	u32 count;
+	s64 min_ns;
+	s64 max_ns;
+	u64 total_ns;
+	u32 bucket[LAT_BUCKETS];
+};
+
+static const char *lat_stage_names[SIOS_LAT_NR_STAGES] = {
+	[SIOS_LAT_IRQ]		= "irq",
+	[SIOS_LAT_DEFERRED]	= "deferred",
+	[SIOS_LAT_QUEUE]	= "queue",
+	[SIOS_LAT_READ]		= "read",
+};
+
+int sios_latency_on;
+static struct sios_lat_hist lat_hist[SIOS_LAT_NR_STAGES];
+static DEFINE_SPINLOCK(lat_lock);
+
+static struct sios_bench {
+	struct task_struct *task;
+	struct task_struct *load;
+	struct hrtimer timer;
+	char name[BUS_ID_SIZE];
+	unsigned int rate;	/* Hz */
+	unsigned int count;
+	unsigned int sent;
+	unsigned int load_pct;
+	int error;
+} bench;
+static DEFINE_MUTEX(bench_mutex);
+
+/* 0-3 exact, then four per power of two */
+static inline int lat_bucket(u64 ns)
+{
+	int msb;
+
+	if (ns < 4)
+		return ns;
+	msb = fls64(ns) - 1;
+	return (msb - 1) * 4 + ((ns >> (msb - 2)) & 3);
+}
+
+static inline u64 lat_bucket_max(int b)
+{
+	int shift;
+
+	if (b < 4)
+		return b;
+	shift = b / 4 - 1;
+	return ((u64)(4 + (b & 3) + 1) << shift) - 1;
+}
+
+/* may be called from any context */
+void sios_latency_add(int stage, s64 ns)
+{
+	struct sios_lat_hist *h = &lat_hist[stage];
+	unsigned long flags;
+
+	if (ns < 0)
+		ns = 0;
+
+	spin_lock_irqsave(&lat_lock, flags);
+	if (!h->count || ns < h->min_ns)
+		h->min_ns = ns;
+	if (ns > h->max_ns)
+		h->max_ns = ns;
+	h->count++;
+	h->total_ns += ns;
+	h->bucket[lat_bucket(ns)]++;
+	spin_unlock_irqrestore(&lat_lock, flags);
+}
+
+void sios_latency_reset(void)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&lat_lock, flags);
+	memset(lat_hist, 0, sizeof(lat_hist));
+	spin_unlock_irqrestore(&lat_lock, flags);
+}
+
+/* permille: the smallest bucket bound at or above that share of the events */
+static s64 lat_percentile(struct sios_lat_hist *h, unsigned int permille)
+{
+	u64 want = (u64)h->count * permille + 999;
+	u64 seen = 0;
+	int b;
+
+	do_div(want, 1000);
+	for (b=0; b<LAT_BUCKETS; b++) {
+		seen += h->bucket[b];
+		if (seen >= want)
+			return min_t(s64, lat_bucket_max(b), h->max_ns);
+	}
+
+	return h->max_ns;
+}
+
+ssize_t sios_latency_show(char *buf)
+{
+	struct sios_lat_hist *h;
+	ssize_t len;
+	int i;
+
+	h = kmalloc(sizeof(*h), GFP_KERNEL);
+	if (!h)
+		return -ENOMEM;
+
+	len = snprintf(buf, PAGE_SIZE, "stage\tcount\tmin_ns\tavg_ns\tp50_ns\t"
+		       "p90_ns\tp99_ns\tp999_ns\tmax_ns\n");
+
+	for (i=0; i<SIOS_LAT_NR_STAGES; i++) {
+		u64 avg;
+
+		spin_lock_irq(&lat_lock);
+		*h = lat_hist[i];
+		spin_unlock_irq(&lat_lock);
+
+		avg = h->total_ns;
+		if (h->count)
+			do_div(avg, h->count);
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+				 "%s\t%u\t%lld\t%llu\t%lld\t%lld\t%lld\t%lld\t%lld\n",
+				 lat_stage_names[i], h->count, h->min_ns,
+				 (unsigned long long)avg,
+				 lat_percentile(h, 500), lat_percentile(h, 900),
+				 lat_percentile(h, 990), lat_percentile(h, 999),
+				 h->max_ns);
+	}
+
+	kfree(h);
+	return min_t(ssize_t, len, PAGE_SIZE);
+}
+
+/* the non-empty buckets: stage, upper bound, events */
+ssize_t sios_latency_show_hist(char *buf)
+{
+	struct sios_lat_hist *h;
+	ssize_t len = 0;
+	int i, b;
+
+	h = kmalloc(sizeof(*h), GFP_KERNEL);
+	if (!h)
+		return -ENOMEM;
+
+	for (i=0; i<SIOS_LAT_NR_STAGES && len < PAGE_SIZE; i++) {
+		spin_lock_irq(&lat_lock);
+		*h = lat_hist[i];
+		spin_unlock_irq(&lat_lock);
+
+		for (b=0; b<LAT_BUCKETS && len < PAGE_SIZE; b++) {
+			if (!h->bucket[b])
+				continue;
+			len += scnprintf(buf + len, PAGE_SIZE - len, "%s\t%llu\t%u\n",
+					 lat_stage_names[i],
+					 (unsigned long long)lat_bucket_max(b),
+					 h->bucket[b]);
+		}
+	}
+
+	kfree(h);
+	return min_t(ssize_t, len, PAGE_SIZE);
+}
+
+static enum hrtimer_restart sios_bench_timer(struct hrtimer *timer)
+{
+	wake_up_process(bench.task);
+	return HRTIMER_NORESTART;
+}
+
+static int sios_bench_thread(void *data)
+{
+	struct sched_param param = { .sched_priority = MAX_RT_PRIO - 1 };
+	ktime_t period = ktime_set(0, NSEC_PER_SEC / bench.rate);
+	ktime_t next = ktime_get();
+
+	/* above everything it measures, so that the rate holds under load */
+	sched_setscheduler(current, SCHED_FIFO, &param);
+
+	while (bench.sent < bench.count) {
+		next = ktime_add(next, period);
+		set_current_state(TASK_INTERRUPTIBLE);
+		hrtimer_start(&bench.timer, next, HRTIMER_MODE_ABS);
+		if (kthread_should_stop())
+			break;
+		schedule();
+		__set_current_state(TASK_RUNNING);
+
+		bench.error = sios_irq_simulate(bench.name);
+		if (bench.error)
+			break;
+		bench.sent++;
+	}
+	__set_current_state(TASK_RUNNING);
+	hrtimer_cancel(&bench.timer);
+
+	/* done, wait to be reaped */
+	for (;;) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (kthread_should_stop())
+			break;
+		schedule();
+	}
+	__set_current_state(TASK_RUNNING);
+
+	return 0;
+}
+
+/* roughly load_pct of the CPU in 100us slices, the rest asleep */
+static int sios_load_thread(void *data)
+{
+	unsigned int busy_us = bench.load_pct * 100;
+	unsigned int idle_ms = (100 - bench.load_pct) / 10;
+	unsigned int i;
+
+	while (!kthread_should_stop()) {
+		for (i=0; i<busy_us; i+=100) {
+			udelay(100);
+			cond_resched();
+		}
+		schedule_timeout_interruptible(max_t(unsigned long, 1,
+					       msecs_to_jiffies(idle_ms)));
+	}
+
+	return 0;
+}
+
+static void __sios_bench_stop(void)
+{
+	if (bench.load) {
+		kthread_stop(bench.load);
+		bench.load = NULL;
+	}
+	if (bench.task) {
+		kthread_stop(bench.task);
+		bench.task = NULL;
+	}
+}
+
+/**
+ *	sios_bench_start - inject simulated edges at a fixed rate
+ *	@args: "resource rate_hz count [load_pct]"
+ *
+ *	Clears the latency histograms and turns recording on. Whatever
+ *	bench was running is stopped first.
+ */
+int sios_bench_start(const char *args)
+{
+	char name[BUS_ID_SIZE];
+	unsigned int rate, count, load = 0;
+	int error = 0;
+
+	if (sscanf(args, "%19s %u %u %u", name, &rate, &count, &load) < 3)
+		return -EINVAL;
+	if (!rate || rate > 100000 || !count || load > 90)
+		return -EINVAL;
+
+	mutex_lock(&bench_mutex);
+	__sios_bench_stop();
+
+	strlcpy(bench.name, name, sizeof(bench.name));
+	bench.rate = rate;
+	bench.count = count;
+	bench.sent = 0;
+	bench.load_pct = load;
+	bench.error = 0;
+
+	sios_latency_reset();
+	sios_latency_on = 1;
+
+	if (load) {
+		bench.load = kthread_run(sios_load_thread, NULL, "sios-load");
+		if (IS_ERR(bench.load)) {
+			error = PTR_ERR(bench.load);
+			bench.load = NULL;
+			goto out;
+		}
+	}
+
+	bench.task = kthread_run(sios_bench_thread, NULL, "sios-bench");
+	if (IS_ERR(bench.task)) {
+		error = PTR_ERR(bench.task);
+		bench.task = NULL;
+		__sios_bench_stop();
+	}
+out:
+	mutex_unlock(&bench_mutex);
+	return error;
+}
+
+/* the histograms are kept, and so is recording */
+void sios_bench_stop(void)
+{
+	mutex_lock(&bench_mutex);
+	__sios_bench_stop();
+	mutex_unlock(&bench_mutex);
+}
+
+ssize_t sios_bench_show(char *buf)
+{
+	const char *state;
+
+	mutex_lock(&bench_mutex);
+	if (!bench.rate)
+		state = "idle";
+	else if (bench.error)
+		state = "failed";
+	else if (bench.sent < bench.count && bench.task)
+		state = "running";
+	else if (bench.sent < bench.count)
+		state = "stopped";
+	else
+		state = "done";
+	mutex_unlock(&bench_mutex);
+
+	return snprintf(buf, PAGE_SIZE, "resource\trate_hz\tcount\tsent\t"
+			"load_pct\tstate\n%s\t%u\t%u\t%u\t%u\t%s\n",
+			bench.rate ? bench.name : "-", bench.rate, bench.count,
+			bench.sent, bench.load_pct, state);
+}
+
+void sios_latency_init(void)
+{
+	hrtimer_init(&bench.timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	bench.timer.function = sios_bench_timer;
+}
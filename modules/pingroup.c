@@ -0,0 +1,72 @@
+/* -*-linux-c-*-
+ * pingroup.c - SIOS pin groups
+ *
+ * Copyright (C) 2008 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA, or http://www.gnu.org/licenses/gpl.html
+ */
+
+#include <linux/module.h>
+
+#include "sios/sios.h"
+#include "sios/resource.h"
+#include "sios/pingroup.h"
+
+/**
+ *	sios_pin_group_init - set up a pin group
+ *	@grp: group to fill in
+ *	@sdev: device that claimed the pins
+ *	@pins: on-chip GPIO numbers, group bit i is pins[i]
+ *	@nr_pins: at most SIOS_PG_MAX_PINS
+ *
+ *	Every pin must be part of a SIOS_IO_GPIO resource held by @sdev.
+ *	The group stays valid as long as those resources are held.
+ */
+int sios_pin_group_init(struct sios_pin_group *grp, struct sios_device *sdev,
+			const int *pins, int nr_pins)
+{
+	int i;
+
+	if (nr_pins < 1 || nr_pins > SIOS_PG_MAX_PINS)
+		return -EINVAL;
+
+	memset(grp, 0, sizeof(*grp));
+	grp->owner = sdev;
+	grp->nr_pins = nr_pins;
+	grp->all = (nr_pins == 32) ? ~0U : (1U << nr_pins) - 1;
+
+	for (i=0; i<nr_pins; i++) {
+		if (pins[i] < 0 || pins[i] >= SIOS_NR_GPIO)
+			return -EINVAL;
+		if (!sios_resource_owned(sdev, SIOS_IO_GPIO, pins[i]))
+			return -EPERM;
+		grp->pin[i] = pins[i];
+		grp->bank[i] = pins[i] >> 5;
+		grp->banks |= 1 << grp->bank[i];
+	}
+
+	grp->fast_bank = grp->bank[0];
+	grp->fast_shift = pins[0] & 0x1f;
+	for (i=1; i<nr_pins; i++) {
+		if (pins[i] != pins[0] + i || grp->bank[i] != grp->bank[0]) {
+			grp->fast_bank = -1;
+			break;
+		}
+	}
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(sios_pin_group_init);
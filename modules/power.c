@@ -4,23 +4,102 @@
 #include <linux/module.h>
 #include <linux/ctype.h>
 #include <linux/delay.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/ktime.h>
+#include <linux/workqueue.h>
+#include <linux/fs.h>
+#include <linux/cdev.h>
+#include <linux/poll.h>
+#include <asm/uaccess.h>
 
 #include <asm/arch/gpio.h>
 
 #include "sios/sios.h"
 #include "sios/resource.h"
 #include "sios/hardware.h"
+#include "sios/board.h"
+#include "sios/pingroup.h"
+#include "sios/event.h"
+#include "sios/adc.h"
+#include "sios/powerdev.h"
+#include "sios/i2csched.h"
+#include "sios/chip.h"
 
 #define POWER_OFF_ON_RELEASE 0
 
-static struct sios_resource power_res[] = {
-	[0] = {
-		.start = GPIO_SIOS_HS,
-		.end = GPIO_SIOS_USBHP,
-		.type = SIOS_IO_GPIO,
-	},
+static int autosuspend_ms = 2000;
+module_param(autosuspend_ms, int, 0644);
+MODULE_PARM_DESC(autosuspend_ms, "default rail autosuspend delay, -1 keeps rails on");
+
+static int telemetry_ms = 1000;
+module_param(telemetry_ms, int, 0644);
+MODULE_PARM_DESC(telemetry_ms, "default rail telemetry period");
+
+#define NR_RAILS	4	/* HS, PWR, VDD2, USBHP */
+
+struct sios_rail_stats {
+	u32 transitions;
+	u64 on_us;
+	ktime_t on_since;
+};
+
+/* an ADC channel, chip -1 when not configured */
+struct sios_rail_tap {
+	int chip;
+	int ch;
+	u32 scale;		/* nA or uV per LSB */
 };
 
+struct sios_rail_meter {
+	struct sios_rail_tap cur;
+	struct sios_rail_tap volt;
+	u32 nominal_mv;		/* when there is no voltage tap */
+
+	u32 power_uw;
+	u64 energy_nj;
+	u32 samples;
+	u32 gap_ms;		/* on, but the ADCs were unpowered */
+};
+
+/* one per board */
+struct sios_power {
+	struct sios_board *board;
+	struct sios_resource res[4];
+	struct sios_pin_group rails;
+
+	/* sequencing, see sios_power_apply */
+	struct mutex lock;
+	u32 transitions;
+	u32 last_us;
+	u32 max_us;
+	char last[24];
+
+	/* rail references, see sios_power_rail_get */
+	int refs[NR_RAILS];
+	u32 on_gen[NR_RAILS];	/* times switched on */
+	u32 idle;		/* unreferenced rails due for autosuspend */
+	int autosuspend_ms;
+	struct delayed_work autosuspend;
+	struct sios_rail_stats rstat[NR_RAILS];
+
+	/* telemetry, see sios_power_telemetry */
+	struct sios_rail_meter meter[NR_RAILS];
+	int telemetry_ms;
+	int meter_busy;		/* holds off autosuspend during conversions */
+	ktime_t tick;
+	struct delayed_work telemetry;
+
+	struct sios_device dev;
+	char name[BUS_ID_SIZE];
+	struct list_head list;
+};
+
+#define to_sios_power(x) container_of(to_sios_device(x), struct sios_power, dev)
+
+static LIST_HEAD(power_list);
+static DEFINE_MUTEX(power_list_mutex);
+
 static int to_bool(const char *buf, size_t count)
 {
 	int on = 1;
@@ -49,100 +128,942 @@ static int to_bool(const char *buf, size_t count)
 	return on;
 }
 
-static ssize_t show_sios_hs(struct device *dev, struct device_attribute *attr,
-			      char * buf)
+/*
+ * The rail pins form one pin group; the group bit of a rail is its
+ * enum sios_pin value, HS, PWR, VDD2 and USBHP being the first four.
+ */
+#define RAIL(p)	(1 << (p))
+
+static inline void sios_rail_set(struct sios_power *pw, int rail, int on)
 {
-	return snprintf(buf, PAGE_SIZE, "%s\n", 
-			gpio_get_value(GPIO_SIOS_HS) ? "on" : "off");
+	sios_pin_group_write(&pw->rails, on ? RAIL(rail) : 0, on ? 0 : RAIL(rail));
 }
 
-static ssize_t store_sios_hs(struct device *dev, struct device_attribute *attr,
-			       const char *buf, size_t count)
+static inline int sios_rail_get(struct sios_power *pw, int rail)
 {
-	gpio_set_value(GPIO_SIOS_HS, to_bool(buf, count));
-	return count;
+	return !!(sios_pin_group_get(&pw->rails) & RAIL(rail));
 }
-DEVICE_ATTR(HotSwap, S_IRUGO | S_IWUSR, show_sios_hs, store_sios_hs);
 
-static ssize_t show_sios_vdd2(struct device *dev, struct device_attribute *attr,
-			      char * buf)
+/*
+ * Rails under sequencer control. A rail may only come up after every
+ * rail of a lower level is up, and goes down before them; rails of the
+ * same level have no ordering between them and switch in one write.
+ * settle_us is waited after switching a rail on. PWR feeds the Gumstix
+ * itself and is not sequenced.
+ */
+struct sios_rail_info {
+	int rail;
+	int level;
+	unsigned int settle_us;
+};
+
+static const struct sios_rail_info rail_info[] = {
+	{ SIOS_PIN_VDD2,	0,	5 },
+	{ SIOS_PIN_HS,		1,	0 },
+	{ SIOS_PIN_USBHP,	1,	0 },
+};
+
+#define RAIL_LEVELS	2
+#define SEQ_RAILS	(RAIL(SIOS_PIN_VDD2) | RAIL(SIOS_PIN_HS) | RAIL(SIOS_PIN_USBHP))
+
+/* also the names of the rail attributes */
+static const char *rail_names[NR_RAILS] = {
+	[SIOS_PIN_HS]		= "HotSwap",
+	[SIOS_PIN_PWR]		= "PWR",
+	[SIOS_PIN_VDD2]		= "VDD2",
+	[SIOS_PIN_USBHP]	= "USBHP",
+};
+
+struct sios_power_state {
+	const char *name;
+	u32 rails;
+};
+
+static const struct sios_power_state power_states[] = {
+	{ "off",	0 },
+	{ "standby",	RAIL(SIOS_PIN_VDD2) },
+	{ "sensing",	RAIL(SIOS_PIN_VDD2) | RAIL(SIOS_PIN_HS) },
+	{ "full",	RAIL(SIOS_PIN_VDD2) | RAIL(SIOS_PIN_HS) | RAIL(SIOS_PIN_USBHP) },
+};
+
+#define SIOS_POWER_STANDBY	1
+
+static void sios_power_settle(unsigned int us)
 {
-	return snprintf(buf, PAGE_SIZE, "%s\n", 
-			gpio_get_value(GPIO_SIOS_VDD2) ? "on" : "off");
+	if (us >= 1000)
+		msleep(DIV_ROUND_UP(us, 1000));
+	else if (us)
+		udelay(us);
 }
 
-static ssize_t store_sios_vdd2(struct device *dev, struct device_attribute *attr,
-			       const char *buf, size_t count)
+static u32 sios_rail_level_mask(int level, unsigned int *settle_us)
+{
+	u32 mask = 0;
+	int i;
+
+	*settle_us = 0;
+	for (i=0; i<ARRAY_SIZE(rail_info); i++) {
+		if (rail_info[i].level != level)
+			continue;
+		mask |= RAIL(rail_info[i].rail);
+		*settle_us = max(*settle_us, rail_info[i].settle_us);
+	}
+
+	return mask;
+}
+
+/*
+ * Bring the sequenced rails from their present levels to @target:
+ * rails going down first, highest level first, then rails coming up,
+ * lowest level first, one register write per level.
+ */
+static void sios_power_apply(struct sios_power *pw, u32 target)
+{
+	u32 cur = sios_pin_group_get(&pw->rails) & SEQ_RAILS;
+	u32 down = cur & ~target, up = target & ~cur, mask;
+	unsigned int settle;
+	int level;
+
+	for (level=RAIL_LEVELS-1; level>=0 && down; level--) {
+		mask = sios_rail_level_mask(level, &settle) & down;
+		if (mask)
+			sios_pin_group_clear(&pw->rails, mask);
+	}
+
+	for (level=0; level<RAIL_LEVELS && up; level++) {
+		mask = sios_rail_level_mask(level, &settle) & up;
+		if (mask) {
+			sios_pin_group_set(&pw->rails, mask);
+			sios_power_settle(settle);
+		}
+	}
+}
+
+static const char *sios_power_state_name(u32 rails)
+{
+	int i;
+
+	for (i=0; i<ARRAY_SIZE(power_states); i++) {
+		if (power_states[i].rails == rails)
+			return power_states[i].name;
+	}
+
+	return "custom";
+}
+
+/* timed transition, caller holds pw->lock */
+static void sios_power_transition(struct sios_power *pw, u32 target)
+{
+	u32 cur = sios_pin_group_get(&pw->rails) & SEQ_RAILS;
+	ktime_t start = ktime_get(), end;
+	u32 us;
+	int rail;
+
+	if (cur == target)
+		return;
+
+	sios_power_apply(pw, target);
+	end = ktime_get();
+
+	for (rail=0; rail<NR_RAILS; rail++) {
+		struct sios_rail_stats *rs = &pw->rstat[rail];
+
+		if (!((cur ^ target) & RAIL(rail)))
+			continue;
+		rs->transitions++;
+		if (target & RAIL(rail)) {
+			rs->on_since = end;
+			pw->on_gen[rail]++;
+		} else {
+			rs->on_us += ktime_us_delta(end, rs->on_since);
+		}
+	}
+
+	/* a module may have been plugged in while it was off */
+	if ((target & ~cur) & RAIL(SIOS_PIN_HS))
+		sios_chip_scan(pw->board, start);
+
+	us = ktime_us_delta(end, start);
+	pw->transitions++;
+	pw->last_us = us;
+	if (us > pw->max_us)
+		pw->max_us = us;
+	snprintf(pw->last, sizeof(pw->last), "%s>%s",
+		 sios_power_state_name(cur), sios_power_state_name(target));
+
+	/* wake up poll() on the attributes, userspace need not spin on them */
+	for (rail=0; rail<NR_RAILS; rail++) {
+		if ((cur ^ target) & RAIL(rail))
+			sysfs_notify(&pw->dev.dev.kobj, NULL, rail_names[rail]);
+	}
+	sysfs_notify(&pw->dev.dev.kobj, NULL, "state");
+}
+
+/* requests from sysfs may not take away a referenced rail */
+static int sios_power_transition_user(struct sios_power *pw, u32 target)
+{
+	int rail;
+
+	for (rail=0; rail<NR_RAILS; rail++) {
+		if (pw->refs[rail] && !(target & RAIL(rail)))
+			return -EBUSY;
+	}
+
+	/* switched by hand, no longer ours to suspend */
+	pw->idle &= ~target;
+	sios_power_transition(pw, target);
+	return 0;
+}
+
+static void sios_power_autosuspend(struct work_struct *work)
+{
+	struct sios_power *pw = container_of(work, struct sios_power, autosuspend.work);
+	u32 target;
+
+	mutex_lock(&pw->lock);
+	if (pw->meter_busy) {
+		/* the ADCs are converting, come back right after */
+		schedule_delayed_work(&pw->autosuspend, 1);
+		mutex_unlock(&pw->lock);
+		return;
+	}
+	target = sios_pin_group_get(&pw->rails) & SEQ_RAILS & ~pw->idle;
+	pw->idle = 0;
+	sios_power_transition(pw, target);
+	mutex_unlock(&pw->lock);
+}
+
+/* caller holds pw->lock */
+static void sios_power_schedule_autosuspend(struct sios_power *pw)
+{
+	cancel_delayed_work(&pw->autosuspend);
+	if (pw->idle && pw->autosuspend_ms >= 0)
+		schedule_delayed_work(&pw->autosuspend,
+				      msecs_to_jiffies(pw->autosuspend_ms));
+}
+
+static struct sios_power *sios_power_lookup(struct sios_board *board)
+{
+	struct sios_power *pw, *found = NULL;
+
+	mutex_lock(&power_list_mutex);
+	list_for_each_entry(pw, &power_list, list) {
+		if (pw->board == board) {
+			found = pw;
+			break;
+		}
+	}
+	mutex_unlock(&power_list_mutex);
+
+	return found;
+}
+
+int sios_power_rail_get(struct sios_board *board, int rail, u32 *gen)
+{
+	struct sios_power *pw = sios_power_lookup(board);
+	u32 cur;
+
+	if (!pw)
+		return -ENODEV;
+	if (rail < 0 || rail >= NR_RAILS || !(RAIL(rail) & SEQ_RAILS))
+		return -EINVAL;
+
+	mutex_lock(&pw->lock);
+	pw->refs[rail]++;
+	pw->idle &= ~RAIL(rail);
+	cur = sios_pin_group_get(&pw->rails) & SEQ_RAILS;
+	if (!(cur & RAIL(rail)))
+		sios_power_transition(pw, cur | RAIL(rail));
+	*gen = pw->on_gen[rail];
+	mutex_unlock(&pw->lock);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(sios_power_rail_get);
+
+void sios_power_rail_put(struct sios_board *board, int rail)
+{
+	struct sios_power *pw = sios_power_lookup(board);
+
+	if (!pw || rail < 0 || rail >= NR_RAILS)
+		return;
+
+	mutex_lock(&pw->lock);
+	if (pw->refs[rail] && !--pw->refs[rail]) {
+		pw->idle |= RAIL(rail);
+		sios_power_schedule_autosuspend(pw);
+	}
+	mutex_unlock(&pw->lock);
+}
+EXPORT_SYMBOL_GPL(sios_power_rail_put);
+
+/*
+ * Last step of I2C bus recovery: the sensor chips run off VDD2, so a
+ * slave that still holds SDA after a bus clear and an expander reset
+ * is power cycled with it. The rails sequenced above VDD2 have to go
+ * down first and come back after.
+ */
+#define SIOS_POWER_CYCLE_MS	100
+
+static int sios_power_cycle(struct sios_board *board)
+{
+	struct sios_power *pw = sios_power_lookup(board);
+	u32 cur;
+
+	if (!pw)
+		return -ENODEV;
+
+	mutex_lock(&pw->lock);
+	cur = sios_pin_group_get(&pw->rails) & SEQ_RAILS;
+	if (cur & RAIL(SIOS_PIN_VDD2)) {
+		sios_power_transition(pw, 0);
+		msleep(SIOS_POWER_CYCLE_MS);
+		sios_power_transition(pw, cur);
+	}
+	mutex_unlock(&pw->lock);
+
+	return 0;
+}
+
+/*
+ * Rail telemetry. Every telemetry_ms each rail with a current tap is
+ * converted once (single conversions, no sampling setup needed) and
+ * its power is integrated into energy in fixed point: nA and uV per
+ * LSB give uA and uV, uW from their product, nJ from uW times us. The
+ * converters run off VDD2, so nothing can be measured while it is off;
+ * rails that are on then are accounted as gaps rather than guessed.
+ */
+
+static const struct sios_power_meter *power_meter;
+static DEFINE_MUTEX(meter_mutex);
+
+void sios_power_set_meter(const struct sios_power_meter *meter)
+{
+	mutex_lock(&meter_mutex);
+	power_meter = meter;
+	mutex_unlock(&meter_mutex);
+}
+EXPORT_SYMBOL_GPL(sios_power_set_meter);
+
+#define PWR_RING	256	/* records, power of two */
+
+static struct {
+	spinlock_t lock;
+	struct sios_power_record rec[PWR_RING];
+	u32 head;
+	wait_queue_head_t wait;
+	struct cdev cdev;
+} pwr_stream;
+
+static void sios_power_record(struct sios_power *pw, int rail, ktime_t stamp,
+			      u16 flags)
+{
+	struct sios_rail_meter *m = &pw->meter[rail];
+	struct sios_power_record *rec;
+	unsigned long irqflags;
+	u64 uj = m->energy_nj;
+
+	do_div(uj, 1000);
+
+	spin_lock_irqsave(&pwr_stream.lock, irqflags);
+	rec = &pwr_stream.rec[pwr_stream.head % PWR_RING];
+	rec->time_ns = ktime_to_ns(stamp);
+	rec->board = pw->board->id;
+	rec->rail = rail;
+	rec->flags = flags;
+	rec->power_uw = m->power_uw;
+	rec->energy_uj = uj;
+	pwr_stream.head++;
+	spin_unlock_irqrestore(&pwr_stream.lock, irqflags);
+
+	wake_up_interruptible(&pwr_stream.wait);
+}
+
+static u32 sios_rail_power(struct sios_rail_meter *m, u16 iraw, u16 vraw)
+{
+	u64 ua = (u64)iraw * m->cur.scale;
+	u64 uv, uw;
+
+	do_div(ua, 1000);
+	if (m->volt.chip >= 0)
+		uv = (u64)vraw * m->volt.scale;
+	else
+		uv = (u64)m->nominal_mv * 1000;
+
+	uw = ua * uv;
+	do_div(uw, 1000000);
+	return uw;
+}
+
+/* caller holds pw->lock */
+static void sios_power_schedule_telemetry(struct sios_power *pw)
+{
+	int rail;
+
+	cancel_delayed_work(&pw->telemetry);
+	if (pw->telemetry_ms <= 0)
+		return;
+
+	for (rail=0; rail<NR_RAILS; rail++) {
+		if (pw->meter[rail].cur.chip >= 0) {
+			schedule_delayed_work(&pw->telemetry,
+					      msecs_to_jiffies(pw->telemetry_ms));
+			return;
+		}
+	}
+}
+
+static void sios_power_telemetry(struct work_struct *work)
+{
+	struct sios_power *pw = container_of(work, struct sios_power, telemetry.work);
+	struct sios_rail_meter taps[NR_RAILS];
+	u16 iraw[NR_RAILS], vraw[NR_RAILS];
+	u32 on, measured = 0;
+	ktime_t now, stamp;
+	u64 nj;
+	u32 dt_us;
+	int rail;
+
+	mutex_lock(&pw->lock);
+	on = sios_pin_group_get(&pw->rails);
+	memcpy(taps, pw->meter, sizeof(taps));
+	if (on & RAIL(SIOS_PIN_VDD2))
+		pw->meter_busy = 1;
+	mutex_unlock(&pw->lock);
+
+	/* the conversions go through the I2C scheduler, not under pw->lock */
+	if (on & RAIL(SIOS_PIN_VDD2)) {
+		mutex_lock(&meter_mutex);
+		for (rail=0; rail<NR_RAILS && power_meter; rail++) {
+			struct sios_rail_meter *m = &taps[rail];
+
+			if (!(on & RAIL(rail)) || m->cur.chip < 0)
+				continue;
+			if (power_meter->read(pw->board, m->cur.chip, m->cur.ch, &iraw[rail]))
+				continue;
+			if (m->volt.chip >= 0 &&
+			    power_meter->read(pw->board, m->volt.chip, m->volt.ch, &vraw[rail]))
+				continue;
+			measured |= RAIL(rail);
+		}
+		mutex_unlock(&meter_mutex);
+	}
+
+	mutex_lock(&pw->lock);
+	pw->meter_busy = 0;
+	now = ktime_get();
+	dt_us = ktime_us_delta(now, pw->tick);
+	pw->tick = now;
+	stamp = sios_event_stamp();
+
+	for (rail=0; rail<NR_RAILS; rail++) {
+		struct sios_rail_meter *m = &pw->meter[rail];
+		u16 flags = 0;
+
+		if (m->cur.chip < 0)
+			continue;
+
+		if (measured & RAIL(rail)) {
+			m->power_uw = sios_rail_power(&taps[rail], iraw[rail], vraw[rail]);
+			m->samples++;
+		} else if (on & RAIL(rail)) {
+			m->power_uw = 0;
+			m->gap_ms += dt_us / USEC_PER_MSEC;
+			flags = SIOS_PWR_REC_GAP;
+		} else {
+			m->power_uw = 0;
+		}
+
+		nj = (u64)m->power_uw * dt_us;
+		do_div(nj, 1000);
+		m->energy_nj += nj;
+
+		sios_power_record(pw, rail, stamp, flags);
+	}
+
+	sios_power_schedule_telemetry(pw);
+	mutex_unlock(&pw->lock);
+}
+
+static int sios_parse_tap(const char *s, struct sios_rail_tap *tap)
+{
+	const char *sep = strchr(s, ':');
+	int ch;
+	u32 scale;
+
+	if (!sep || sep - s != 6 || sscanf(sep + 1, "%d:%u", &ch, &scale) != 2)
+		return -EINVAL;
+
+	if (!strncmp(s, "ad7998", 6))
+		tap->chip = SIOS_ADC_AD7998;
+	else if (!strncmp(s, "ad7994", 6))
+		tap->chip = SIOS_ADC_AD7994;
+	else
+		return -EINVAL;
+
+	if (ch < 1 || ch > AD799X_MAX_CHANNELS)
+		return -EINVAL;
+	tap->ch = ch - 1;
+	tap->scale = scale;
+
+	return 0;
+}
+
+static int sios_rail_by_name(const char *name)
+{
+	int rail;
+
+	for (rail=0; rail<NR_RAILS; rail++) {
+		if ((RAIL(rail) & SEQ_RAILS) && !strcmp(rail_names[rail], name))
+			return rail;
+	}
+
+	return -EINVAL;
+}
+
+static const char *adc_names[SIOS_NR_ADC] = {
+	[SIOS_ADC_AD7998]	= "ad7998",
+	[SIOS_ADC_AD7994]	= "ad7994",
+};
+
+static ssize_t show_sios_telemetry(struct device *dev, struct device_attribute *attr,
+				   char *buf)
 {
-	gpio_set_value(GPIO_SIOS_VDD2, to_bool(buf, count));
+	struct sios_power *pw = to_sios_power(dev);
+	ssize_t len = 0;
+	int rail;
+
+	mutex_lock(&pw->lock);
+	for (rail=0; rail<NR_RAILS; rail++) {
+		struct sios_rail_meter *m = &pw->meter[rail];
+
+		if (!(RAIL(rail) & SEQ_RAILS))
+			continue;
+		if (m->cur.chip < 0) {
+			len += scnprintf(buf + len, PAGE_SIZE - len, "%s\toff\n",
+					 rail_names[rail]);
+			continue;
+		}
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%s\t%s:%d:%u\t",
+				 rail_names[rail], adc_names[m->cur.chip],
+				 m->cur.ch + 1, m->cur.scale);
+		if (m->volt.chip >= 0)
+			len += scnprintf(buf + len, PAGE_SIZE - len, "%s:%d:%u\n",
+					 adc_names[m->volt.chip], m->volt.ch + 1,
+					 m->volt.scale);
+		else
+			len += scnprintf(buf + len, PAGE_SIZE - len, "%u\n",
+					 m->nominal_mv);
+	}
+	mutex_unlock(&pw->lock);
+
+	return len;
+}
+
+/*
+ * "<rail> <chip>:<ch>:<nA/LSB> <chip>:<ch>:<uV/LSB>" with a voltage tap,
+ * "<rail> <chip>:<ch>:<nA/LSB> <mV>" with a fixed voltage, or
+ * "<rail> off". Channels count from 1 like the ADC scan attribute.
+ */
+static ssize_t store_sios_telemetry(struct device *dev, struct device_attribute *attr,
+				    const char *buf, size_t count)
+{
+	struct sios_power *pw = to_sios_power(dev);
+	struct sios_rail_meter m;
+	char name[16], itap[24], vtap[24];
+	int rail, n;
+
+	memset(&m, 0, sizeof(m));
+	m.cur.chip = -1;
+	m.volt.chip = -1;
+
+	n = sscanf(buf, "%15s %23s %23s", name, itap, vtap);
+	if (n < 2)
+		return -EINVAL;
+	rail = sios_rail_by_name(name);
+	if (rail < 0)
+		return rail;
+
+	if (strcmp(itap, "off")) {
+		if (n != 3 || sios_parse_tap(itap, &m.cur))
+			return -EINVAL;
+		if (strchr(vtap, ':')) {
+			if (sios_parse_tap(vtap, &m.volt))
+				return -EINVAL;
+		} else {
+			m.nominal_mv = simple_strtoul(vtap, NULL, 0);
+		}
+	}
+
+	mutex_lock(&pw->lock);
+	pw->meter[rail] = m;
+	pw->tick = ktime_get();
+	sios_power_schedule_telemetry(pw);
+	mutex_unlock(&pw->lock);
+
 	return count;
 }
-DEVICE_ATTR(VDD2, S_IRUGO | S_IWUSR, show_sios_vdd2, store_sios_vdd2);
 
-static ssize_t show_sios_usbhp(struct device *dev, struct device_attribute *attr,
-			      char * buf)
+static ssize_t show_sios_telemetry_ms(struct device *dev, struct device_attribute *attr,
+				      char *buf)
 {
-	return snprintf(buf, PAGE_SIZE, "%s\n", 
-			gpio_get_value(GPIO_SIOS_USBHP) ? "on" : "off");
+	return snprintf(buf, PAGE_SIZE, "%d\n", to_sios_power(dev)->telemetry_ms);
 }
 
-static ssize_t store_sios_usbhp(struct device *dev, struct device_attribute *attr,
-			       const char *buf, size_t count)
+static ssize_t store_sios_telemetry_ms(struct device *dev, struct device_attribute *attr,
+				       const char *buf, size_t count)
 {
-	gpio_set_value(GPIO_SIOS_USBHP, to_bool(buf, count));
+	struct sios_power *pw = to_sios_power(dev);
+
+	mutex_lock(&pw->lock);
+	pw->telemetry_ms = simple_strtol(buf, NULL, 0);
+	sios_power_schedule_telemetry(pw);
+	mutex_unlock(&pw->lock);
+
 	return count;
 }
-DEVICE_ATTR(USBHP, S_IRUGO | S_IWUSR, show_sios_usbhp, store_sios_usbhp);
 
-static ssize_t show_sios_pwr(struct device *dev, struct device_attribute *attr,
+static ssize_t show_sios_energy(struct device *dev, struct device_attribute *attr,
+				char *buf)
+{
+	struct sios_power *pw = to_sios_power(dev);
+	ssize_t len;
+	u64 mj;
+	int rail;
+
+	len = snprintf(buf, PAGE_SIZE, "rail\tpower_uw\tenergy_mj\tsamples\tgap_ms\n");
+
+	mutex_lock(&pw->lock);
+	for (rail=0; rail<NR_RAILS; rail++) {
+		struct sios_rail_meter *m = &pw->meter[rail];
+
+		if (m->cur.chip < 0)
+			continue;
+		mj = m->energy_nj;
+		do_div(mj, 1000000);
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%s\t%u\t%llu\t%u\t%u\n",
+				 rail_names[rail], m->power_uw, mj,
+				 m->samples, m->gap_ms);
+	}
+	mutex_unlock(&pw->lock);
+
+	return len;
+}
+
+struct sios_power_file {
+	u32 pos;
+};
+
+static int sios_power_open(struct inode *inode, struct file *file)
+{
+	struct sios_power_file *pf;
+
+	pf = kzalloc(sizeof(*pf), GFP_KERNEL);
+	if (!pf)
+		return -ENOMEM;
+
+	spin_lock_irq(&pwr_stream.lock);
+	pf->pos = pwr_stream.head > PWR_RING ? pwr_stream.head - PWR_RING : 0;
+	spin_unlock_irq(&pwr_stream.lock);
+
+	file->private_data = pf;
+	return 0;
+}
+
+static int sios_power_close(struct inode *inode, struct file *file)
+{
+	kfree(file->private_data);
+	return 0;
+}
+
+static ssize_t sios_power_read(struct file *file, char __user *buf,
+			       size_t count, loff_t *ppos)
+{
+	struct sios_power_file *pf = file->private_data;
+	struct sios_power_record rec;
+	ssize_t done = 0;
+	int lost, error;
+
+	if (count < sizeof(rec))
+		return -EINVAL;
+
+	if (pf->pos == pwr_stream.head) {
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		error = wait_event_interruptible(pwr_stream.wait,
+						 pf->pos != pwr_stream.head);
+		if (error)
+			return error;
+	}
+
+	while (count - done >= sizeof(rec)) {
+		spin_lock_irq(&pwr_stream.lock);
+		if (pf->pos == pwr_stream.head) {
+			spin_unlock_irq(&pwr_stream.lock);
+			break;
+		}
+		lost = pwr_stream.head - pf->pos > PWR_RING;
+		if (lost)
+			pf->pos = pwr_stream.head - PWR_RING;
+		rec = pwr_stream.rec[pf->pos % PWR_RING];
+		pf->pos++;
+		spin_unlock_irq(&pwr_stream.lock);
+
+		if (lost)
+			rec.flags |= SIOS_PWR_REC_LOST;
+		if (copy_to_user(buf + done, &rec, sizeof(rec)))
+			return done ? done : -EFAULT;
+		done += sizeof(rec);
+	}
+
+	return done;
+}
+
+static unsigned int sios_power_poll(struct file *file, poll_table *wait)
+{
+	struct sios_power_file *pf = file->private_data;
+
+	poll_wait(file, &pwr_stream.wait, wait);
+	return pf->pos != pwr_stream.head ? POLLIN | POLLRDNORM : 0;
+}
+
+static const struct file_operations sios_power_fops = {
+	.owner = THIS_MODULE,
+	.open = sios_power_open,
+	.release = sios_power_close,
+	.read = sios_power_read,
+	.poll = sios_power_poll,
+};
+
+struct rail_attribute {
+	struct device_attribute dev_attr;
+	int rail;
+};
+
+#define to_rail_attr(x) container_of((x), struct rail_attribute, dev_attr)
+
+static ssize_t show_sios_rail(struct device *dev, struct device_attribute *attr,
 			      char * buf)
 {
+	struct sios_power *pw = to_sios_power(dev);
 	return snprintf(buf, PAGE_SIZE, "%s\n", 
-			gpio_get_value(GPIO_SIOS_PWR) ? "on" : "off");
+			sios_rail_get(pw, to_rail_attr(attr)->rail) ? "on" : "off");
 }
 
-static ssize_t store_sios_pwr(struct device *dev, struct device_attribute *attr,
+static ssize_t store_sios_rail(struct device *dev, struct device_attribute *attr,
 			       const char *buf, size_t count)
 {
-	gpio_set_value(GPIO_SIOS_PWR, to_bool(buf, count));
+	struct sios_power *pw = to_sios_power(dev);
+	int rail = to_rail_attr(attr)->rail;
+	u32 target;
+	int error;
+
+	if (!(RAIL(rail) & SEQ_RAILS)) {
+		sios_rail_set(pw, rail, to_bool(buf, count));
+		return count;
+	}
+
+	mutex_lock(&pw->lock);
+	target = sios_pin_group_get(&pw->rails) & SEQ_RAILS;
+	if (to_bool(buf, count))
+		target |= RAIL(rail);
+	else
+		target &= ~RAIL(rail);
+	error = sios_power_transition_user(pw, target);
+	mutex_unlock(&pw->lock);
+
+	return error ? error : count;
+}
+
+static ssize_t show_sios_state(struct device *dev, struct device_attribute *attr,
+			       char *buf)
+{
+	struct sios_power *pw = to_sios_power(dev);
+
+	return snprintf(buf, PAGE_SIZE, "%s\n",
+			sios_power_state_name(sios_pin_group_get(&pw->rails) & SEQ_RAILS));
+}
+
+static ssize_t store_sios_state(struct device *dev, struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	struct sios_power *pw = to_sios_power(dev);
+	size_t len = count;
+	int i, error;
+
+	if (len && buf[len - 1] == '\n')
+		len--;
+
+	for (i=0; i<ARRAY_SIZE(power_states); i++) {
+		if (strlen(power_states[i].name) == len &&
+		    !strncmp(power_states[i].name, buf, len))
+			break;
+	}
+	if (i == ARRAY_SIZE(power_states))
+		return -EINVAL;
+
+	mutex_lock(&pw->lock);
+	error = sios_power_transition_user(pw, power_states[i].rails);
+	mutex_unlock(&pw->lock);
+
+	return error ? error : count;
+}
+
+static ssize_t show_sios_state_times(struct device *dev, struct device_attribute *attr,
+				     char *buf)
+{
+	struct sios_power *pw = to_sios_power(dev);
+	ssize_t len;
+
+	mutex_lock(&pw->lock);
+	len = snprintf(buf, PAGE_SIZE, "transitions\t%u\nlast\t%s\nlast_us\t%u\nmax_us\t%u\n",
+		       pw->transitions, pw->transitions ? pw->last : "-",
+		       pw->last_us, pw->max_us);
+	mutex_unlock(&pw->lock);
+
+	return len;
+}
+
+static ssize_t show_sios_autosuspend(struct device *dev, struct device_attribute *attr,
+				     char *buf)
+{
+	return snprintf(buf, PAGE_SIZE, "%d\n", to_sios_power(dev)->autosuspend_ms);
+}
+
+static ssize_t store_sios_autosuspend(struct device *dev, struct device_attribute *attr,
+				      const char *buf, size_t count)
+{
+	struct sios_power *pw = to_sios_power(dev);
+
+	mutex_lock(&pw->lock);
+	pw->autosuspend_ms = simple_strtol(buf, NULL, 0);
+	sios_power_schedule_autosuspend(pw);
+	mutex_unlock(&pw->lock);
+
 	return count;
 }
-DEVICE_ATTR(PWR, S_IRUGO | S_IWUSR, show_sios_pwr, store_sios_pwr);
 
+static ssize_t show_sios_rail_stats(struct device *dev, struct device_attribute *attr,
+				    char *buf)
+{
+	struct sios_power *pw = to_sios_power(dev);
+	u32 cur, on_ms;
+	ssize_t len;
+	u64 on_us;
+	int rail;
+
+	len = snprintf(buf, PAGE_SIZE, "rail\trefs\ton_ms\ttransitions\n");
+
+	mutex_lock(&pw->lock);
+	cur = sios_pin_group_get(&pw->rails);
+	for (rail=0; rail<NR_RAILS; rail++) {
+		struct sios_rail_stats *rs = &pw->rstat[rail];
+
+		if (!(RAIL(rail) & SEQ_RAILS))
+			continue;
+		on_us = rs->on_us;
+		if (cur & RAIL(rail))
+			on_us += ktime_us_delta(ktime_get(), rs->on_since);
+		do_div(on_us, USEC_PER_MSEC);
+		on_ms = on_us;
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%s\t%d\t%u\t%u\n",
+				 rail_names[rail], pw->refs[rail], on_ms,
+				 rs->transitions);
+	}
+	mutex_unlock(&pw->lock);
+
+	return len;
+}
+
+static DEVICE_ATTR(state, S_IRUGO | S_IWUSR, show_sios_state, store_sios_state);
+static DEVICE_ATTR(state_times, S_IRUGO, show_sios_state_times, NULL);
+static DEVICE_ATTR(autosuspend_delay_ms, S_IRUGO | S_IWUSR,
+		   show_sios_autosuspend, store_sios_autosuspend);
+static DEVICE_ATTR(rail_stats, S_IRUGO, show_sios_rail_stats, NULL);
+static DEVICE_ATTR(telemetry, S_IRUGO | S_IWUSR, show_sios_telemetry, store_sios_telemetry);
+static DEVICE_ATTR(telemetry_ms, S_IRUGO | S_IWUSR,
+		   show_sios_telemetry_ms, store_sios_telemetry_ms);
+static DEVICE_ATTR(energy, S_IRUGO, show_sios_energy, NULL);
+
+#define RAIL_ATTR(_name, _rail)						\
+static struct rail_attribute rail_attr_##_name = {			\
+	.dev_attr = __ATTR(_name, S_IRUGO | S_IWUSR,			\
+			   show_sios_rail, store_sios_rail),		\
+	.rail = _rail,							\
+}
+
+RAIL_ATTR(HotSwap, SIOS_PIN_HS);
+RAIL_ATTR(VDD2, SIOS_PIN_VDD2);
+RAIL_ATTR(USBHP, SIOS_PIN_USBHP);
+RAIL_ATTR(PWR, SIOS_PIN_PWR);
+
+static struct attribute *sios_power_attrs[] = {
+	&rail_attr_HotSwap.dev_attr.attr,
+	&rail_attr_VDD2.dev_attr.attr,
+	&rail_attr_USBHP.dev_attr.attr,
+	&rail_attr_PWR.dev_attr.attr,
+	&dev_attr_state.attr,
+	&dev_attr_state_times.attr,
+	&dev_attr_autosuspend_delay_ms.attr,
+	&dev_attr_rail_stats.attr,
+	&dev_attr_telemetry.attr,
+	&dev_attr_telemetry_ms.attr,
+	&dev_attr_energy.attr,
+	NULL,
+};
+
+static struct attribute_group sios_power_group = {
+	.attrs = sios_power_attrs,
+};
+
+/* switches off every board, and the Gumstix itself last */
 void sios_power_off(void)
 {
-	sios_peripheral_off();
-	sios_hotswap_off();
-	sios_usb_hipower_off();
+	struct sios_power *pw;
+
+	/* no locking, this is the last thing that runs */
+	list_for_each_entry(pw, &power_list, list)
+		sios_power_apply(pw, 0);
 
 	/* Shut down ! */
 	gpio_set_value(GPIO_SIOS_PWR, 0);
 }
 EXPORT_SYMBOL_GPL(sios_power_off);
 
-static int sios_power_up(struct sios_device *sdev)
+static int sios_power_up(struct sios_power *pw)
 {
-	gpio_direction_output(GPIO_SIOS_PWR, 1);
-	gpio_direction_output(GPIO_SIOS_HS, 0);
-	gpio_direction_output(GPIO_SIOS_VDD2, 0);
-	gpio_direction_output(GPIO_SIOS_USBHP, 0);
+	struct sios_board *board = pw->board;
+
+	gpio_direction_output(sios_board_pin(board, SIOS_PIN_PWR), 1);
+	gpio_direction_output(sios_board_pin(board, SIOS_PIN_HS), 0);
+	gpio_direction_output(sios_board_pin(board, SIOS_PIN_VDD2), 0);
+	gpio_direction_output(sios_board_pin(board, SIOS_PIN_USBHP), 0);
 
 	/* FIXME: where to go? */
-	gpio_direction_output(GPIO_SIOS_RST, 0);
+	gpio_direction_output(sios_board_pin(board, SIOS_PIN_RST), 0);
+
+	mutex_lock(&pw->lock);
+	sios_power_transition(pw, power_states[SIOS_POWER_STANDBY].rails);
+	/* nobody holds VDD2 yet, drivers take it when they need it */
+	pw->idle = power_states[SIOS_POWER_STANDBY].rails;
+	sios_power_schedule_autosuspend(pw);
+	mutex_unlock(&pw->lock);
 
-	sios_peripheral_on();
-	udelay(5);
+	/* the chips on VDD2 are up now, look for them */
+	sios_chip_scan(board, ktime_get());
 
 	return 0;
 }
 
 static void sios_power_release(struct sios_device *sdev)
 {
+	struct sios_power *pw = container_of(sdev, struct sios_power, dev);
+
 #if POWER_OFF_ON_RELEASE
-	sios_hotswap_off();
-	sios_usb_hipower_off();
-	sios_peripheral_off();
+	sios_pin_group_clear(&pw->rails, RAIL(SIOS_PIN_HS) |
+			     RAIL(SIOS_PIN_USBHP) | RAIL(SIOS_PIN_VDD2));
 #endif
+	kfree(pw);
 }
 
 static int sios_power_probe(struct sios_device *sdev)
@@ -150,16 +1071,9 @@ static int sios_power_probe(struct sios_device *sdev)
 	/* If we could we could check here if we really are a SIOS platform
 	 * before powering up */
 	printk(KERN_INFO "power probe, dev='%s'\n", sdev->name);
-	return sios_power_up(sdev);
+	return sios_power_up(container_of(sdev, struct sios_power, dev));
 }
 
-struct sios_device power_dev = {
-	.name = "sios:power",
-	.release = sios_power_release,
-	.num_resource = 1,
-	.resource = power_res,
-};
-
 struct sios_driver power_drv = {
 	.version = "$Revision: 1.0 $",
 	.module = THIS_MODULE,
@@ -169,6 +1083,110 @@ struct sios_driver power_drv = {
 //	.probe = sios_power_probe,
 };
 
+/* in rail order */
+static const int power_claims[] = {
+	SIOS_CLAIM_POWER_HS, SIOS_CLAIM_POWER_PWR,
+	SIOS_CLAIM_POWER_VDD2, SIOS_CLAIM_POWER_USBHP,
+};
+
+static int sios_power_add(struct sios_board *board, void *data)
+{
+	struct sios_power *pw;
+	int pins[4], i, error;
+
+	pw = kzalloc(sizeof(*pw), GFP_KERNEL);
+	if (!pw)
+		return -ENOMEM;
+
+	pw->board = board;
+	mutex_init(&pw->lock);
+	pw->autosuspend_ms = autosuspend_ms;
+	INIT_DELAYED_WORK(&pw->autosuspend, sios_power_autosuspend);
+	pw->telemetry_ms = telemetry_ms;
+	INIT_DELAYED_WORK(&pw->telemetry, sios_power_telemetry);
+	for (i=0; i<NR_RAILS; i++) {
+		pw->meter[i].cur.chip = -1;
+		pw->meter[i].volt.chip = -1;
+	}
+	for (i=0; i<ARRAY_SIZE(pw->res); i++) {
+		error = sios_board_claim(board, power_claims[i], &pw->res[i]);
+		if (error) {
+			kfree(pw);
+			return error;
+		}
+	}
+
+	sios_board_devname(board, "sios:power", pw->name, sizeof(pw->name));
+	pw->dev.name = pw->name;
+	pw->dev.release = sios_power_release;
+	pw->dev.num_resource = ARRAY_SIZE(pw->res);
+	pw->dev.resource = pw->res;
+	pw->dev.board = board;
+	pw->dev.pm_supplier = 1;
+
+	error = sios_device_register(&pw->dev);
+	if (error) {
+		kfree(pw);
+		return error;
+	}
+
+	for (i=0; i<ARRAY_SIZE(pins); i++)
+		pins[i] = sios_board_pin(board, i);
+	error = sios_pin_group_init(&pw->rails, &pw->dev, pins, ARRAY_SIZE(pins));
+	if (error)
+		goto err;
+
+	error = sysfs_create_group(&pw->dev.dev.kobj, &sios_power_group);
+	if (error)
+		goto err;
+
+	/* listed first: the chip scan of power up binds drivers that take rails */
+	mutex_lock(&power_list_mutex);
+	list_add_tail(&pw->list, &power_list);
+	mutex_unlock(&power_list_mutex);
+
+	error = sios_power_up(pw);
+	if (error)
+		goto err_list;
+	return 0;
+
+err_list:
+	mutex_lock(&power_list_mutex);
+	list_del(&pw->list);
+	mutex_unlock(&power_list_mutex);
+	sysfs_remove_group(&pw->dev.dev.kobj, &sios_power_group);
+err:
+	cancel_delayed_work(&pw->autosuspend);
+	flush_scheduled_work();
+	sios_device_unregister(&pw->dev);
+	return error;
+}
+
+static void sios_power_remove_all(void)
+{
+	struct sios_power *pw, *n;
+	LIST_HEAD(dead);
+
+	mutex_lock(&power_list_mutex);
+	list_splice_init(&power_list, &dead);
+	mutex_unlock(&power_list_mutex);
+
+	list_for_each_entry(pw, &dead, list) {
+		mutex_lock(&pw->lock);
+		pw->telemetry_ms = 0;
+		mutex_unlock(&pw->lock);
+		cancel_delayed_work(&pw->telemetry);
+		cancel_delayed_work(&pw->autosuspend);
+	}
+	flush_scheduled_work();
+
+	list_for_each_entry_safe(pw, n, &dead, list) {
+		list_del(&pw->list);
+		sysfs_remove_group(&pw->dev.dev.kobj, &sios_power_group);
+		sios_device_unregister(&pw->dev);
+	}
+}
+
 static int __init sios_power_init(void)
 {
 	int error;
@@ -177,48 +1195,33 @@ static int __init sios_power_init(void)
 	if (error)
 		return error;
 
-	error = sios_device_register(&power_dev);
-	if (error) {
-		sios_driver_unregister(&power_drv);
-		return error;
-	}
-		
-	error = sios_power_up(&power_dev);
+	spin_lock_init(&pwr_stream.lock);
+	init_waitqueue_head(&pwr_stream.wait);
+	error = sios_chrdev_add(&pwr_stream.cdev, &sios_power_fops,
+				SIOS_POWER_MINOR, "power");
 	if (error)
 		goto err;
 
-	if ((error = device_create_file(&power_dev.dev, &dev_attr_HotSwap)))
+	error = sios_for_each_board(NULL, sios_power_add);
+	if (error) {
+		sios_power_remove_all();
+		sios_chrdev_del(&pwr_stream.cdev, SIOS_POWER_MINOR);
 		goto err;
-	if ((error = device_create_file(&power_dev.dev, &dev_attr_VDD2)))
-		goto err_1;
-	if ((error = device_create_file(&power_dev.dev, &dev_attr_USBHP)))
-		goto err_2;
-	if ((error = device_create_file(&power_dev.dev, &dev_attr_PWR)))
-		goto err_3;
+	}
 
-	return error;
+	sios_i2c_set_rail_cycler(sios_power_cycle);
+	return 0;
 
-err_3:
-	device_remove_file(&power_dev.dev, &dev_attr_USBHP);
-err_2:
-	device_remove_file(&power_dev.dev, &dev_attr_VDD2);
-err_1:
-	device_remove_file(&power_dev.dev, &dev_attr_HotSwap);
 err:
-	sios_device_unregister(&power_dev);
 	sios_driver_unregister(&power_drv);
-
 	return error;
 }
 
 static void __exit sios_power_exit(void)
 {
-	device_remove_file(&power_dev.dev, &dev_attr_USBHP);
-	device_remove_file(&power_dev.dev, &dev_attr_VDD2);
-	device_remove_file(&power_dev.dev, &dev_attr_PWR);
-	device_remove_file(&power_dev.dev, &dev_attr_HotSwap);
-
-	sios_device_unregister(&power_dev);
+	sios_i2c_set_rail_cycler(NULL);
+	sios_power_remove_all();
+	sios_chrdev_del(&pwr_stream.cdev, SIOS_POWER_MINOR);
 	sios_driver_unregister(&power_drv);
 }
 
@@ -0,0 +1,500 @@
+/* -*-linux-c-*-
+ * profile.c - SIOS acquisition profiles
+ *
+ * Copyright (C) 2008 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA, or http://www.gnu.org/licenses/gpl.html
+ */
+
+#include <linux/module.h>
+#include <linux/configfs.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/ktime.h>
+
+#include "sios/sios.h"
+#include "sios/profile.h"
+
+/* the settings of one device in one profile */
+struct sios_acq_item {
+	struct config_item item;
+	struct sios_acq_settings s;
+	struct list_head list;
+};
+
+struct sios_profile {
+	struct config_group group;
+	struct list_head items;
+	struct list_head list;
+};
+
+struct sios_profile_attr {
+	struct configfs_attribute attr;
+	unsigned int field;	/* SIOS_ACQ_* */
+};
+
+static LIST_HEAD(profile_list);
+static LIST_HEAD(target_list);
+static DEFINE_MUTEX(profile_mutex);	/* all of the above and the settings */
+
+static char profile_active[32];
+static u32 profile_switches;
+static u32 profile_failures;
+static u32 profile_last_us;
+static u32 profile_max_us;
+
+static inline struct sios_acq_item *to_acq_item(struct config_item *item)
+{
+	return container_of(item, struct sios_acq_item, item);
+}
+
+static inline struct sios_profile *to_profile(struct config_group *group)
+{
+	return container_of(group, struct sios_profile, group);
+}
+
+static ssize_t sios_acq_show_limits(const u16 *lim, char *buf)
+{
+	ssize_t len = 0;
+	int i;
+
+	for (i=0; i<SIOS_PROFILE_LIMITS; i++)
+		len += sprintf(buf + len, "%u%c", lim[i],
+			       i == SIOS_PROFILE_LIMITS - 1 ? '\n' : ' ');
+	return len;
+}
+
+/* up to SIOS_PROFILE_LIMITS values, the ones not given are left at 0 */
+static int sios_acq_parse_limits(const char *buf, u16 *lim)
+{
+	unsigned int v[SIOS_PROFILE_LIMITS] = { 0, };
+	int i, n;
+
+	n = sscanf(buf, "%u %u %u %u", &v[0], &v[1], &v[2], &v[3]);
+	if (n < 1)
+		return -EINVAL;
+	for (i=0; i<SIOS_PROFILE_LIMITS; i++) {
+		if (v[i] > 0xffff)
+			return -EINVAL;
+		lim[i] = v[i];
+	}
+	return 0;
+}
+
+static ssize_t sios_acq_attr_show(struct config_item *item,
+				  struct configfs_attribute *attr, char *buf)
+{
+	struct sios_profile_attr *pa = container_of(attr, struct sios_profile_attr, attr);
+	struct sios_acq_settings *s = &to_acq_item(item)->s;
+	ssize_t len = 0;
+
+	mutex_lock(&profile_mutex);
+	if (!(s->set & pa->field)) {
+		len = sprintf(buf, "\n");
+		goto out;
+	}
+
+	switch (pa->field) {
+	case SIOS_ACQ_CHANNELS:
+		len = sprintf(buf, "0x%02x\n", s->channels);
+		break;
+	case SIOS_ACQ_RATE:
+		len = sprintf(buf, "%u\n", s->rate);
+		break;
+	case SIOS_ACQ_MODE:
+		len = sprintf(buf, "%s\n", s->mode);
+		break;
+	case SIOS_ACQ_FILTER:
+		len = sprintf(buf, "%d\n", s->filter);
+		break;
+	case SIOS_ACQ_ALERT_LOW:
+		len = sios_acq_show_limits(s->alert_low, buf);
+		break;
+	case SIOS_ACQ_ALERT_HIGH:
+		len = sios_acq_show_limits(s->alert_high, buf);
+		break;
+	}
+out:
+	mutex_unlock(&profile_mutex);
+	return len;
+}
+
+/* an empty write takes the setting out of the profile */
+static ssize_t sios_acq_attr_store(struct config_item *item,
+				   struct configfs_attribute *attr,
+				   const char *buf, size_t count)
+{
+	struct sios_profile_attr *pa = container_of(attr, struct sios_profile_attr, attr);
+	struct sios_acq_settings *s = &to_acq_item(item)->s;
+	char *end;
+	int error = 0;
+
+	mutex_lock(&profile_mutex);
+	if (!count || buf[0] == '\n') {
+		s->set &= ~pa->field;
+		goto out;
+	}
+
+	switch (pa->field) {
+	case SIOS_ACQ_CHANNELS:
+		s->channels = simple_strtoul(buf, NULL, 0);
+		break;
+	case SIOS_ACQ_RATE:
+		s->rate = simple_strtoul(buf, NULL, 0);
+		break;
+	case SIOS_ACQ_MODE:
+		if (count >= sizeof(s->mode)) {
+			error = -EINVAL;
+			break;
+		}
+		memcpy(s->mode, buf, count);
+		s->mode[count] = '\0';
+		end = strchr(s->mode, '\n');
+		if (end)
+			*end = '\0';
+		break;
+	case SIOS_ACQ_FILTER:
+		s->filter = simple_strtoul(buf, NULL, 0) ? 1 : 0;
+		break;
+	case SIOS_ACQ_ALERT_LOW:
+		error = sios_acq_parse_limits(buf, s->alert_low);
+		break;
+	case SIOS_ACQ_ALERT_HIGH:
+		error = sios_acq_parse_limits(buf, s->alert_high);
+		break;
+	}
+	if (!error)
+		s->set |= pa->field;
+out:
+	mutex_unlock(&profile_mutex);
+	return error ? error : count;
+}
+
+#define ACQ_ATTR(_name, _field)						\
+static struct sios_profile_attr acq_attr_##_name = {			\
+	.attr = {							\
+		.ca_owner = THIS_MODULE,				\
+		.ca_name = #_name,					\
+		.ca_mode = S_IRUGO | S_IWUSR,				\
+	},								\
+	.field = _field,						\
+}
+
+ACQ_ATTR(channels, SIOS_ACQ_CHANNELS);
+ACQ_ATTR(rate, SIOS_ACQ_RATE);
+ACQ_ATTR(mode, SIOS_ACQ_MODE);
+ACQ_ATTR(filter, SIOS_ACQ_FILTER);
+ACQ_ATTR(alert_low, SIOS_ACQ_ALERT_LOW);
+ACQ_ATTR(alert_high, SIOS_ACQ_ALERT_HIGH);
+
+static struct configfs_attribute *sios_acq_attrs[] = {
+	&acq_attr_channels.attr,
+	&acq_attr_rate.attr,
+	&acq_attr_mode.attr,
+	&acq_attr_filter.attr,
+	&acq_attr_alert_low.attr,
+	&acq_attr_alert_high.attr,
+	NULL,
+};
+
+static void sios_acq_release(struct config_item *item)
+{
+	kfree(to_acq_item(item));
+}
+
+static struct configfs_item_operations sios_acq_item_ops = {
+	.release = sios_acq_release,
+	.show_attribute = sios_acq_attr_show,
+	.store_attribute = sios_acq_attr_store,
+};
+
+static struct config_item_type sios_acq_type = {
+	.ct_owner = THIS_MODULE,
+	.ct_item_ops = &sios_acq_item_ops,
+	.ct_attrs = sios_acq_attrs,
+};
+
+/* mkdir <profile>/<device> */
+static struct config_item *sios_profile_make_item(struct config_group *group,
+						  const char *name)
+{
+	struct sios_acq_item *it;
+
+	it = kzalloc(sizeof(*it), GFP_KERNEL);
+	if (!it)
+		return NULL;
+
+	config_item_init_type_name(&it->item, name, &sios_acq_type);
+
+	mutex_lock(&profile_mutex);
+	list_add_tail(&it->list, &to_profile(group)->items);
+	mutex_unlock(&profile_mutex);
+
+	return &it->item;
+}
+
+static void sios_profile_drop_item(struct config_group *group,
+				   struct config_item *item)
+{
+	mutex_lock(&profile_mutex);
+	list_del(&to_acq_item(item)->list);
+	mutex_unlock(&profile_mutex);
+
+	config_item_put(item);
+}
+
+static void sios_profile_release(struct config_item *item)
+{
+	kfree(to_profile(container_of(item, struct config_group, cg_item)));
+}
+
+static struct configfs_item_operations sios_profile_item_ops = {
+	.release = sios_profile_release,
+};
+
+static struct configfs_group_operations sios_profile_group_ops = {
+	.make_item = sios_profile_make_item,
+	.drop_item = sios_profile_drop_item,
+};
+
+static struct config_item_type sios_profile_type = {
+	.ct_owner = THIS_MODULE,
+	.ct_item_ops = &sios_profile_item_ops,
+	.ct_group_ops = &sios_profile_group_ops,
+};
+
+/* mkdir <profile> */
+static struct config_group *sios_profile_make_group(struct config_group *group,
+						    const char *name)
+{
+	struct sios_profile *p;
+
+	p = kzalloc(sizeof(*p), GFP_KERNEL);
+	if (!p)
+		return NULL;
+
+	INIT_LIST_HEAD(&p->items);
+	config_group_init_type_name(&p->group, name, &sios_profile_type);
+
+	mutex_lock(&profile_mutex);
+	list_add_tail(&p->list, &profile_list);
+	mutex_unlock(&profile_mutex);
+
+	return &p->group;
+}
+
+static void sios_profile_drop_group(struct config_group *group,
+				    struct config_item *item)
+{
+	mutex_lock(&profile_mutex);
+	list_del(&to_profile(to_config_group(item))->list);
+	mutex_unlock(&profile_mutex);
+
+	config_item_put(item);
+}
+
+/* caller holds profile_mutex */
+static struct sios_acq_item *sios_profile_find_item(struct sios_profile *p,
+						    const char *name)
+{
+	struct sios_acq_item *it;
+
+	list_for_each_entry(it, &p->items, list) {
+		if (!strcmp(config_item_name(&it->item), name))
+			return it;
+	}
+	return NULL;
+}
+
+/*
+ * Devices a profile names that are not there are skipped, a profile
+ * may cover boards that are not plugged in.
+ */
+static int sios_profile_activate(const char *name)
+{
+	struct sios_profile *p, *found = NULL;
+	struct sios_profile_target *t;
+	struct sios_acq_item *it;
+	ktime_t start = ktime_get();
+	u32 us;
+	int error = 0;
+
+	mutex_lock(&profile_mutex);
+	list_for_each_entry(p, &profile_list, list) {
+		if (!strcmp(config_item_name(&p->group.cg_item), name)) {
+			found = p;
+			break;
+		}
+	}
+	if (!found) {
+		error = -ENOENT;
+		goto out;
+	}
+
+	list_for_each_entry(t, &target_list, list) {
+		it = sios_profile_find_item(found, t->name);
+		if (!it || !it->s.set)
+			continue;
+		error = t->prepare(t, &it->s);
+		if (error) {
+			printk(KERN_WARNING "sios: profile %s rejected by %s (%d)\n",
+			       name, t->name, error);
+			break;
+		}
+		t->prepared = 1;
+	}
+
+	list_for_each_entry(t, &target_list, list) {
+		if (!t->prepared)
+			continue;
+		t->prepared = 0;
+		if (!error)
+			t->commit(t);
+		else if (t->abort)
+			t->abort(t);
+	}
+
+	if (error) {
+		profile_failures++;
+		goto out;
+	}
+
+	strlcpy(profile_active, name, sizeof(profile_active));
+	us = ktime_to_us(ktime_sub(ktime_get(), start));
+	profile_switches++;
+	profile_last_us = us;
+	if (us > profile_max_us)
+		profile_max_us = us;
+out:
+	mutex_unlock(&profile_mutex);
+	return error;
+}
+
+/**
+ *	sios_profile_add_target - let a device take acquisition profiles
+ *	@t: name and operations filled in
+ *
+ *	The active profile is not applied to a device added later.
+ */
+void sios_profile_add_target(struct sios_profile_target *t)
+{
+	t->prepared = 0;
+	mutex_lock(&profile_mutex);
+	list_add_tail(&t->list, &target_list);
+	mutex_unlock(&profile_mutex);
+}
+EXPORT_SYMBOL_GPL(sios_profile_add_target);
+
+void sios_profile_del_target(struct sios_profile_target *t)
+{
+	mutex_lock(&profile_mutex);
+	list_del(&t->list);
+	mutex_unlock(&profile_mutex);
+}
+EXPORT_SYMBOL_GPL(sios_profile_del_target);
+
+static struct configfs_attribute sios_profiles_attr_active = {
+	.ca_owner = THIS_MODULE,
+	.ca_name = "active",
+	.ca_mode = S_IRUGO | S_IWUSR,
+};
+
+static struct configfs_attribute sios_profiles_attr_stats = {
+	.ca_owner = THIS_MODULE,
+	.ca_name = "stats",
+	.ca_mode = S_IRUGO,
+};
+
+static struct configfs_attribute *sios_profiles_attrs[] = {
+	&sios_profiles_attr_active,
+	&sios_profiles_attr_stats,
+	NULL,
+};
+
+static ssize_t sios_profiles_show(struct config_item *item,
+				  struct configfs_attribute *attr, char *buf)
+{
+	ssize_t len;
+
+	mutex_lock(&profile_mutex);
+	if (attr == &sios_profiles_attr_active)
+		len = sprintf(buf, "%s\n", profile_active);
+	else
+		len = sprintf(buf, "switches\t%u\nfailures\t%u\n"
+			      "last_us\t%u\nmax_us\t%u\n",
+			      profile_switches, profile_failures,
+			      profile_last_us, profile_max_us);
+	mutex_unlock(&profile_mutex);
+
+	return len;
+}
+
+static ssize_t sios_profiles_store(struct config_item *item,
+				   struct configfs_attribute *attr,
+				   const char *buf, size_t count)
+{
+	char name[sizeof(profile_active)];
+	int error;
+
+	if (attr != &sios_profiles_attr_active || count >= sizeof(name))
+		return -EINVAL;
+
+	memcpy(name, buf, count);
+	name[count] = '\0';
+	if (count && name[count - 1] == '\n')
+		name[count - 1] = '\0';
+
+	error = sios_profile_activate(name);
+	return error ? error : count;
+}
+
+static struct configfs_item_operations sios_profiles_item_ops = {
+	.show_attribute = sios_profiles_show,
+	.store_attribute = sios_profiles_store,
+};
+
+static struct configfs_group_operations sios_profiles_group_ops = {
+	.make_group = sios_profile_make_group,
+	.drop_item = sios_profile_drop_group,
+};
+
+static struct config_item_type sios_profiles_type = {
+	.ct_owner = THIS_MODULE,
+	.ct_item_ops = &sios_profiles_item_ops,
+	.ct_group_ops = &sios_profiles_group_ops,
+	.ct_attrs = sios_profiles_attrs,
+};
+
+static struct configfs_subsystem sios_profiles = {
+	.su_group = {
+		.cg_item = {
+			.ci_namebuf = "sios",
+			.ci_type = &sios_profiles_type,
+		},
+	},
+};
+
+int sios_profile_init(void)
+{
+	config_group_init(&sios_profiles.su_group);
+	mutex_init(&sios_profiles.su_mutex);
+	return configfs_register_subsystem(&sios_profiles);
+}
+
+void sios_profile_exit(void)
+{
+	configfs_unregister_subsystem(&sios_profiles);
+}
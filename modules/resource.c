@@ -4,20 +4,46 @@
 #include <linux/spinlock.h>
 #include <linux/sysfs.h>
 #include <linux/device.h>
+#include <linux/string.h>
 
 #include "sios/resource.h"
 #include "sios/hardware.h"
 #include "sios/sios.h"
+#include "sios/board.h"
 
-static LIST_HEAD(resource_list);
-static DEFINE_RWLOCK(resource_lock);
+/*
+ * Claimed pins live in the board of the device, indexed by resource
+ * type and pin number. Resources themselves carry no list or sysfs
+ * state; a conflict check is a walk over the requested range.
+ */
+static inline struct sios_board *res_board(struct sios_resource *res)
+{
+	return res->dev->board ? res->dev->board : &sios_default_board;
+}
+
+static inline int res_type_idx(struct sios_resource *res)
+{
+	return (res->type & SIOS_IO_XGPIO) ? 1 : 0;
+}
+
+static inline struct sios_resource **res_owner_tbl(struct sios_resource *res)
+{
+	return res_board(res)->res_owner[res_type_idx(res)];
+}
+
+int sios_resource_name(struct sios_resource *res, char *buf, size_t len)
+{
+	if (res->name)
+		return snprintf(buf, len, "%s", res->name);
 
-static
-ssize_t show_dev_resources(struct device *dev, struct device_attribute *attr,
-			   char *buf)
+	return snprintf(buf, len, "%s:%02d-%02d", res->dev->dev.bus_id,
+			res->start, res->end);
+}
+EXPORT_SYMBOL_GPL(sios_resource_name);
+
+static int sios_resource_line(struct sios_resource *res, char *buf, size_t len)
 {
-	struct sios_resource_attribute *sattr = to_sios_res_attr(attr);
-	struct sios_resource *res = sattr->res;
+	char name[BUS_ID_SIZE + 8];
 	char *flags, *type;
 
 	if (res->type & SIOS_IO_GPIO)
@@ -34,77 +60,115 @@ ssize_t show_dev_resources(struct device *dev, struct device_attribute *attr,
 	else
 		flags = "";
 
-	return snprintf(buf, PAGE_SIZE, "%s\t%s%s\t%d\t%d\n", 
-			res->name, type, flags,
-			res->start, res->end);
+	sios_resource_name(res, name, sizeof(name));
+	return scnprintf(buf, len, "%s\t%s%s\t%d\t%d\n",
+			 name, type, flags, res->start, res->end);
 }
 
-int __sios_resource_create_file(struct sios_device *sdev, 
-				struct sios_resource_attribute *sattr)
+/*
+ * One "resources" table per device, generated on read. It is a binary
+ * attribute so that boards with hundreds of resources are not cut off
+ * at PAGE_SIZE.
+ */
+static ssize_t read_dev_resources(struct kobject *kobj,
+				  struct bin_attribute *attr,
+				  char *buf, loff_t off, size_t count)
 {
-	struct device *dev = &sdev->dev;
-	struct device_attribute *attr = &sattr->dev_attr;
-	return device_create_file(dev, attr);
-}
-EXPORT_SYMBOL_GPL(__sios_resource_create_file);
+	struct device *dev = container_of(kobj, struct device, kobj);
+	struct sios_device *sdev = to_sios_device(dev);
+	char line[BUS_ID_SIZE + 40];
+	size_t copied = 0;
+	loff_t pos = 0;
+	int i;
 
-int sios_resource_create_file(struct sios_device *sdev, struct sios_resource *res)
-{
-	struct device_attribute *dev_attr;
-	struct device *dev = &sdev->dev;
+	for (i=0; i<sdev->num_resource && copied < count; i++) {
+		int len = sios_resource_line(&sdev->resource[i], line, sizeof(line));
+		if (pos + len > off) {
+			size_t skip = (off > pos) ? off - pos : 0;
+			size_t n = min_t(size_t, len - skip, count - copied);
+			memcpy(buf + copied, line + skip, n);
+			copied += n;
+		}
+		pos += len;
+	}
 
-	if (!sdev || !res)
-		return -EINVAL;
+	return copied;
+}
 
-	res->res_attr.res = res;
-	dev_attr = &res->res_attr.dev_attr;
-	if (dev->driver)
-		dev_attr->attr.owner = dev->driver->owner;
-	dev_attr->attr.name = res->name;
-	dev_attr->attr.mode = S_IRUGO;
-	dev_attr->show = show_dev_resources;
-	dev_attr->store = NULL;
-	res->res_attr.res = res;
+static struct bin_attribute sios_resources_attr = {
+	.attr = {
+		.name = "resources",
+		.mode = S_IRUGO,
+	},
+	.read = read_dev_resources,
+};
 
-	return __sios_resource_create_file(sdev, &res->res_attr);
+int sios_resource_create_table(struct sios_device *sdev)
+{
+	if (!sdev->num_resource)
+		return 0;
+	return device_create_bin_file(&sdev->dev, &sios_resources_attr);
 }
-EXPORT_SYMBOL_GPL(sios_resource_create_file);
+EXPORT_SYMBOL_GPL(sios_resource_create_table);
 
-void __sios_resource_remove_file(struct sios_device *sdev,
-				 struct sios_resource_attribute *sattr)
+void sios_resource_remove_table(struct sios_device *sdev)
 {
-	struct device *dev = &sdev->dev;
-	struct device_attribute *attr = &sattr->dev_attr;
-	device_remove_file(dev, attr);
+	if (sdev->num_resource)
+		device_remove_bin_file(&sdev->dev, &sios_resources_attr);
 }
-EXPORT_SYMBOL_GPL(__sios_resource_remove_file);
+EXPORT_SYMBOL_GPL(sios_resource_remove_table);
 
-void sios_resource_remove_file(struct sios_resource *res)
+/* every pin must be one the board lets out, able to interrupt if flagged so */
+static int sios_check_resource(struct sios_resource *res)
 {
-	struct sios_device *sdev = res->dev;
-	struct sios_resource_attribute *attr = &res->res_attr;
-	__sios_resource_remove_file(sdev, attr);
+	struct sios_board *board = res_board(res);
+	int idx = res_type_idx(res);
+	u8 need = SIOS_PIN_CAP_RES;
+	int i;
+
+	if (res->start > res->end || res->end >= SIOS_NR_GPIO)
+		return -EINVAL;
+
+	if (res->type & (SIOS_IRQ|SIOS_FIRQ))
+		need |= SIOS_PIN_CAP_IRQ;
+
+	if (res->type & (SIOS_IO_GPIO|SIOS_IO_XGPIO)) {
+		for (i=res->start; i<=res->end; i++) {
+			if ((sios_board_pin_desc(board, idx, i)->caps & need) != need)
+				return -EINVAL;
+		}
+	}
+
+	return 0;
 }
-EXPORT_SYMBOL_GPL(sios_resource_remove_file);
 
+/* caller holds resource_lock */
 static struct sios_resource *__sios_request_resource(struct sios_resource *res)
 {
-	struct sios_resource *pos = NULL;
-	struct sios_resource *conflict = NULL;
-	
-	list_for_each_entry(pos, &resource_list, list) {
-		if ((pos->type & ~(SIOS_IRQ|SIOS_FIRQ)) != 
-		    (res->type & ~(SIOS_IRQ|SIOS_FIRQ)))
-			continue;
-		if (res->end < pos->start)
-			continue;
-		if (res->start > pos->end)
-			continue;
-		conflict = pos;
-		break;
+	struct sios_resource **owner = res_owner_tbl(res);
+	int i;
+
+	for (i=res->start; i<=res->end; i++) {
+		if (owner[i])
+			return owner[i];
 	}
 
-	return conflict;
+	for (i=res->start; i<=res->end; i++)
+		owner[i] = res;
+
+	return NULL;
+}
+
+/* caller holds resource_lock */
+static void __sios_release_resource(struct sios_resource *res)
+{
+	struct sios_resource **owner = res_owner_tbl(res);
+	int i;
+
+	for (i=res->start; i<=res->end; i++) {
+		if (owner[i] == res)
+			owner[i] = NULL;
+	}
 }
 
 int sios_init_resource(struct sios_device *sdev, struct sios_resource *res)
@@ -112,7 +176,6 @@ int sios_init_resource(struct sios_device *sdev, struct sios_resource *res)
 	if (!res || !sdev)
 		return -EINVAL;
 
-	INIT_LIST_HEAD(&res->list);
 	res->dev = sdev;
 	return 0;
 }
@@ -121,55 +184,130 @@ EXPORT_SYMBOL_GPL(sios_init_resource);
 int sios_request_resource(struct sios_device *sdev, struct sios_resource *res)
 {
 	struct sios_resource *conflict;
+	struct sios_board *board;
 	int error;
 
 	error = sios_init_resource(sdev, res);
 	if (error)
 		return error; 
 
-	if (res->type & (SIOS_IO_GPIO|SIOS_IO_XGPIO)) {
-		int i = res->start;
-		for (; i<=res->end; i++) {
-			if (!__check_sios_gpio(res->start, res->type & SIOS_RESTYPE_MASK))
-				return -EINVAL;
-		}
-	}
+	error = sios_check_resource(res);
+	if (error)
+		return error;
 
-	write_lock(&resource_lock);
+	board = res_board(res);
+	write_lock(&board->res_lock);
 	conflict = __sios_request_resource(res);
-	if (conflict)
-		goto _conflict;
-	list_add(&res->list, &resource_list);
-_conflict:
-	write_unlock(&resource_lock);
+	write_unlock(&board->res_lock);
+
 	return conflict ? -EBUSY : 0;
 }
 EXPORT_SYMBOL_GPL(sios_request_resource);
 
 void sios_release_resource(struct sios_resource *res)
 {
+	struct sios_board *board;
+
 	if (!res)
 		return;
 
-	write_lock(&resource_lock);
-	list_del_init(&res->list);
-	write_unlock(&resource_lock);
+	board = res_board(res);
+	write_lock(&board->res_lock);
+	__sios_release_resource(res);
+	write_unlock(&board->res_lock);
 }
 EXPORT_SYMBOL_GPL(sios_release_resource);
 
-int __check_sios_gpio(int pin, sios_restype_t type)
+/**
+ *	sios_request_resources - claim all resources of a device at once
+ *	@sdev: sios device
+ *
+ *	Either every resource in sdev->resource is claimed or none is.
+ */
+int sios_request_resources(struct sios_device *sdev)
 {
-#define SGPIO(x) case x: return 1;
-	if (type == SIOS_IO_GPIO) {
-		switch(pin) {
-#include "sios/gpio_res.h"
-		}
-	} else if (type == SIOS_IO_XGPIO) {
-		switch(pin) {
-#include "sios/xgpio_res.h"
+	struct sios_board *board = sdev->board;
+	struct sios_resource *conflict = NULL;
+	int i, error;
+
+	for (i=0; i<sdev->num_resource; i++) {
+		struct sios_resource *r = &sdev->resource[i];
+		r->dev = sdev;
+		error = sios_check_resource(r);
+		if (error) {
+			printk(KERN_WARNING "bus resource invalid: dev=%s, res=%d-%d\n",
+			       sdev->dev.bus_id, r->start, r->end);
+			return error;
 		}
 	}
-#undef SGPIO
+
+	write_lock(&board->res_lock);
+	for (i=0; i<sdev->num_resource; i++) {
+		conflict = __sios_request_resource(&sdev->resource[i]);
+		if (conflict)
+			break;
+	}
+	if (conflict) {
+		while (--i >= 0)
+			__sios_release_resource(&sdev->resource[i]);
+	}
+	write_unlock(&board->res_lock);
+
+	if (conflict) {
+		printk(KERN_WARNING "bus resource request failed: dev=%s, busy by %s\n",
+		       sdev->dev.bus_id, conflict->dev->dev.bus_id);
+		return -EBUSY;
+	}
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(sios_request_resources);
+
+void sios_release_resources(struct sios_device *sdev)
+{
+	struct sios_board *board = sdev->board;
+	int i;
+
+	write_lock(&board->res_lock);
+	for (i=0; i<sdev->num_resource; i++)
+		__sios_release_resource(&sdev->resource[i]);
+	write_unlock(&board->res_lock);
+}
+EXPORT_SYMBOL_GPL(sios_release_resources);
+
+/**
+ *	sios_resource_owned - test whether a pin belongs to a device
+ *	@sdev: sios device
+ *	@type: SIOS_IO_GPIO or SIOS_IO_XGPIO
+ *	@pin: pin number on the device's board
+ */
+int sios_resource_owned(struct sios_device *sdev, sios_restype_t type, int pin)
+{
+	struct sios_board *board = sdev->board ? sdev->board : &sios_default_board;
+	struct sios_resource *owner;
+
+	if (pin < 0 || pin >= SIOS_NR_GPIO)
+		return 0;
+
+	read_lock(&board->res_lock);
+	owner = board->res_owner[(type & SIOS_IO_XGPIO) ? 1 : 0][pin];
+	read_unlock(&board->res_lock);
+
+	return owner && owner->dev == sdev;
+}
+EXPORT_SYMBOL_GPL(sios_resource_owned);
+
+/* pin check against board 0 */
+int __check_sios_gpio(int pin, sios_restype_t type)
+{
+	struct sios_board *board = &sios_default_board;
+
+	if (pin < 0 || pin >= SIOS_NR_GPIO)
+		return 0;
+	if (type == SIOS_IO_GPIO)
+		return sios_board_pin_desc(board, 0, pin)->caps & SIOS_PIN_CAP_RES;
+	if (type == SIOS_IO_XGPIO)
+		return sios_board_pin_desc(board, 1, pin)->caps & SIOS_PIN_CAP_RES;
 	return 0;
 }
 EXPORT_SYMBOL_GPL(__check_sios_gpio);
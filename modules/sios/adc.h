@@ -0,0 +1,193 @@
+/* -*-linux-c-*-
+ * adc.h - SIOS AD7998/AD7994 ADCs
+ *
+ * Copyright (C) 2008 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA, or http://www.gnu.org/licenses/gpl.html
+ */
+
+#ifndef _SIOS_ADC_H_
+#define _SIOS_ADC_H_
+
+#include <linux/types.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/i2c.h>
+
+#include "sios.h"
+#include "event.h"
+#include "i2csched.h"
+#include "chip.h"
+#include "profile.h"
+
+#define AD799X_MAX_CHANNELS	8
+#define AD799X_RESULT_MASK	0x0fff
+
+/* address pointer register */
+#define AD799X_REG_RESULT	0x00
+#define AD799X_REG_ALERT	0x01
+#define AD799X_REG_CONFIG	0x02
+#define AD799X_REG_CYCLE	0x03
+#define AD799X_REG_DATA_LOW(ch)	(0x04 + 3 * (ch))
+#define AD799X_REG_DATA_HIGH(ch) (0x05 + 3 * (ch))
+
+/* CH1-CH4 have alert limits */
+#define AD799X_LIMIT_CHANNELS	4
+
+/* result word */
+#define AD799X_ALERT_FLAG	0x8000
+#define AD799X_CHAN_ID(w)	(((w) >> 12) & 0x7)
+
+/* configuration register */
+#define AD799X_CFG_CHAN(ch)	(1 << ((ch) + 4))
+#define AD799X_CFG_FLTR		0x0008
+#define AD799X_CFG_ALERT_EN	0x0004
+
+/* rate steps below max_rate, as many as the capture flags can tell */
+#define AD799X_ADAPT_MAX_SHIFT	15
+
+/* configuration and limit registers, the most written in one go */
+#define AD799X_SETUP_MSGS	(1 + 2 * AD799X_LIMIT_CHANNELS)
+
+enum sios_adc_chip {
+	SIOS_ADC_AD7998 = 0,
+	SIOS_ADC_AD7994,
+	SIOS_NR_ADC,
+};
+
+enum sios_adc_mode {
+	SIOS_ADC_BURST = 0,	/* one transfer for the whole sequence */
+	SIOS_ADC_SINGLE,	/* one transfer per channel */
+};
+
+struct sios_adc_stats {
+	u32 scans;
+	u32 errors;
+	u32 order_errors;	/* channel id bits out of sequence */
+	u32 bytes_per_scan;	/* on the wire, address bytes included */
+	u32 last_us;
+	u64 total_us;
+	u32 samples;		/* periodic, see rate */
+	u32 sample_errors;
+	u32 switches;		/* profiles taken */
+};
+
+/* what an acquisition profile sets, staged until the switch */
+struct sios_adc_setup {
+	u8 channels;
+	int mode;
+	unsigned int rate;
+	int filter;
+	u16 alert_low[AD799X_LIMIT_CHANNELS];
+	u16 alert_high[AD799X_LIMIT_CHANNELS];
+};
+
+/*
+ * Activity adaptive sampling of one channel. Every channel converts on
+ * a multiple of the base tick, the highest rate of them all: div ticks
+ * apart at its max_rate, div << shift at the rate in effect.
+ */
+struct sios_adc_adapt {
+	unsigned int min_rate;		/* Hz, 0 for the fixed rate */
+	unsigned int max_rate;
+	u16 threshold;			/* change between samples that raises the rate */
+	u16 last;
+	int primed;			/* last is valid */
+	u8 shift;
+	u8 max_shift;			/* rate at min_rate or just above */
+	unsigned int div;
+	unsigned int left;		/* ticks to the next conversion */
+	unsigned int stable;		/* samples within threshold at this rate */
+};
+
+struct sios_adc_adapt_stats {
+	u64 ticks;
+	u32 transfers;
+	u64 conversions;
+	u64 bytes;			/* on the wire, address bytes included */
+	u64 cpu_ns;			/* in the completion, adapting included */
+};
+
+enum sios_adc_switch {
+	SIOS_ADC_SWITCH_IDLE = 0,
+	SIOS_ADC_SWITCH_PENDING,	/* taken after the current period */
+	SIOS_ADC_SWITCH_RUNNING,	/* setup goes out with the next conversion */
+};
+
+struct sios_adc {
+	const struct sios_adc_info *info;
+	struct sios_board *board;
+	struct sios_chip *chip;		/* our device, see chip.h */
+	int addr;
+	struct sios_i2c_sched *i2c;
+	struct mutex lock;
+
+	u8 channels;		/* enabled channel mask */
+	int mode;
+	int filter;
+	u16 alert_low[AD799X_LIMIT_CHANNELS];
+	u16 alert_high[AD799X_LIMIT_CHANNELS];
+	u16 value[AD799X_MAX_CHANNELS];
+	struct sios_adc_stats stats;
+
+	/* periodic burst sampling, run by the board's I2C scheduler */
+	unsigned int rate;	/* Hz, 0 when off */
+	u8 sample_mask;
+	u8 sample_cmd;
+	u8 sample_buf[2 * AD799X_MAX_CHANNELS];
+	struct i2c_msg sample_msg[2];
+	struct sios_i2c_req sample;
+	struct sios_i2c_reinit reinit;	/* after a bus recovery */
+	u32 power_gen;		/* VDD2 power-on count the setup was written at */
+	int power_valid;
+
+	/* activity adaptive sampling, see sios_adc_adapt_next */
+	struct sios_adc_adapt adapt[AD799X_MAX_CHANNELS];
+	int adaptive;			/* any enabled channel has a min_rate */
+	unsigned int adapt_hold;	/* stable samples before the rate halves */
+	int adapt_replay;		/* decide on replayed values, see inject */
+	u16 adapt_value[AD799X_MAX_CHANNELS];	/* the last replayed ones */
+	unsigned int tick_us;
+	struct sios_adc_adapt_stats adapt_stats;
+	u8 config_mask;			/* channels in the config register, 0 unknown */
+	u8 adapt_config_mask;		/* written by the transfer in flight */
+	u8 adapt_cfg[3];
+	struct i2c_msg adapt_msg[3];	/* config write if needed, command, results */
+
+	/* profile switch while sampling, see sios_adc_commit */
+	struct sios_profile_target target;
+	struct sios_adc_setup staged;
+	spinlock_t switch_lock;
+	int switch_state;
+	u8 switch_mask;
+	unsigned int switch_period_us;
+	u8 setup_buf[AD799X_SETUP_MSGS][3];
+	int setup_num;
+	struct i2c_msg switch_msg[AD799X_SETUP_MSGS + 2];
+
+	struct sios_resource res[1];
+	struct sios_source source[AD799X_MAX_CHANNELS];
+	char name[BUS_ID_SIZE];
+	char src_name[AD799X_MAX_CHANNELS][BUS_ID_SIZE];
+	struct list_head list;
+};
+
+#define to_sios_adc(x) ((struct sios_adc *)dev_get_drvdata(x))
+
+extern struct sios_adc *sios_adc_get(struct sios_board *board, int chip);
+extern int sios_adc_scan(struct sios_adc *adc, u16 *vals);
+
+#endif /* _SIOS_ADC_H_ */
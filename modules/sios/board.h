@@ -0,0 +1,104 @@
+/* -*-linux-c-*-
+ * board.h - SIOS board instances
+ *
+ * Copyright (C) 2008 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA, or http://www.gnu.org/licenses/gpl.html
+ */
+
+#ifndef _SIOS_BOARD_H_
+#define _SIOS_BOARD_H_
+
+#include <linux/list.h>
+#include <linux/spinlock.h>
+
+#include "resource.h"
+
+/* board signals the sios drivers use, as board 0 has them (board0.h) */
+enum sios_pin {
+#define SIOS_SIGNAL(name, gpio, caps)	SIOS_PIN_##name,
+#include "board0.h"
+	SIOS_NR_PINS,
+};
+
+/* resources the drivers always claim, see sios_board_claim */
+enum sios_claim {
+#define SIOS_CLAIM(drv, id, sig, rname, rtype, trig)	SIOS_CLAIM_##id,
+#include "board0.h"
+	SIOS_NR_CLAIMS,
+};
+
+/* what a pin can be used for */
+#define SIOS_PIN_CAP_RES	0x01	/* requested as a resource */
+#define SIOS_PIN_CAP_IN		0x02
+#define SIOS_PIN_CAP_OUT	0x04
+#define SIOS_PIN_CAP_IRQ	0x08
+
+#define SIOS_PIN_OUTPUT	(SIOS_PIN_CAP_RES | SIOS_PIN_CAP_OUT)
+#define SIOS_PIN_INPUT	(SIOS_PIN_CAP_RES | SIOS_PIN_CAP_IN | SIOS_PIN_CAP_IRQ)
+#define SIOS_PIN_ANY	(SIOS_PIN_INPUT | SIOS_PIN_CAP_OUT)
+#define SIOS_PIN_XIO	(SIOS_PIN_CAP_RES | SIOS_PIN_CAP_IN | SIOS_PIN_CAP_OUT)
+
+struct sios_pin_desc {
+	u8 caps;		/* SIOS_PIN_CAP_*, 0 for a pin the board lacks */
+	u8 bank;		/* GPIO register bank and bit of the pin */
+	u8 bit;
+	u8 signal;		/* enum sios_pin + 1, 0 for none */
+};
+
+/*
+ * One SIOS board. Board 0 is the board on the Gumstix itself and is
+ * always present; platform code registers additional boards with their
+ * own I2C adapter and pin map before loading the function drivers.
+ * Every board has its own resource namespace and lock, so drivers of
+ * different boards never contend.
+ */
+struct sios_board {
+	int id;
+	int i2c_adapter;
+	int pins[SIOS_NR_PINS];
+	/* SIOS_IO_GPIO and SIOS_IO_XGPIO pins, constant tables */
+	const struct sios_pin_desc (*desc)[SIOS_NR_GPIO];
+
+	/* resource namespace, see resource.c */
+	rwlock_t res_lock;
+	struct sios_resource *res_owner[2][SIOS_NR_GPIO];
+
+	struct list_head list;
+};
+
+#define sios_board_pin(b, p)	((b)->pins[(p)])
+
+/* pin of resource type idx (0 GPIO, 1 XGPIO), pin < SIOS_NR_GPIO */
+#define sios_board_pin_desc(b, idx, pin)	(&(b)->desc[(idx)][(pin)])
+
+extern struct sios_board sios_default_board;
+extern const struct sios_pin_desc sios_board0_desc[2][SIOS_NR_GPIO];
+
+extern int __must_check sios_board_register(struct sios_board *board);
+extern void sios_board_unregister(struct sios_board *board);
+extern int sios_for_each_board(void *data, int (*fn)(struct sios_board *, void *));
+extern void sios_board_devname(struct sios_board *board, const char *base,
+			       char *buf, size_t len);
+
+extern int __sios_board_claim(struct sios_board *board, int claim,
+			      struct sios_resource *res, const char *driver);
+#define sios_board_claim(b, c, r)	__sios_board_claim((b), (c), (r), KBUILD_MODNAME)
+
+extern int sios_board_init(void);
+extern ssize_t sios_board_show_pins(char *buf);
+
+#endif /* _SIOS_BOARD_H_ */
@@ -0,0 +1,88 @@
+/* -*-linux-c-*- */
+
+/*
+ * Board 0, the board on the Gumstix. Everything the drivers know about
+ * its pins is generated from this list by the preprocessor: the
+ * GPIO_SIOS_* numbers (sios-gpio.h), enum sios_pin (board.h), and the
+ * signal map, pin descriptor tables and build-time checks of board.c.
+ * Include it with the kinds of entry needed defined, the others expand
+ * to nothing:
+ *
+ *	SIOS_SIGNAL(name, gpio, caps)	a signal the drivers use, SIOS_PIN_name
+ *	SIOS_GPIO(name, gpio, caps)	any other PXA GPIO the board brings out
+ *	SIOS_XGPIO(pin, caps)		a SIOS_IO_XGPIO pin
+ *	SIOS_CLAIM(driver, id, name, res, type, trigger)
+ *		the resource res of signal name that the module driver
+ *		always claims, SIOS_CLAIM_id (board.h)
+ *
+ * caps are SIOS_PIN_CAP_* (board.h); a pin without SIOS_PIN_CAP_RES can
+ * not be requested as a resource. The drivers build their resources of
+ * these signals with sios_board_claim, which only hands a claim to the
+ * module it is listed for. Pins a driver is told at run time, such as
+ * the counter inputs, are not listed.
+ *
+ * A GPIO listed twice, a signal claimed twice or a claim the pin is not
+ * capable of fails the build of board.c; "make board" rebuilds and
+ * lists the tables.
+ */
+
+#ifndef SIOS_SIGNAL
+#define SIOS_SIGNAL(name, gpio, caps)
+#endif
+#ifndef SIOS_GPIO
+#define SIOS_GPIO(name, gpio, caps)
+#endif
+#ifndef SIOS_XGPIO
+#define SIOS_XGPIO(pin, caps)
+#endif
+#ifndef SIOS_CLAIM
+#define SIOS_CLAIM(drv, id, sig, rname, rtype, trig)
+#endif
+
+SIOS_GPIO(RS_STROBE,	28,	SIOS_PIN_ANY)		/* row select strobe, temporarily on GPIO28 */
+SIOS_GPIO(SPI_CSA0,	66,	SIOS_PIN_OUTPUT)	/* SPI-bus chip select address bits */
+SIOS_GPIO(SPI_CSA1,	67,	SIOS_PIN_OUTPUT)
+SIOS_GPIO(SPI_CSA2,	68,	SIOS_PIN_OUTPUT)
+SIOS_SIGNAL(HS,		69,	SIOS_PIN_OUTPUT)	/* hot-swap power enable */
+SIOS_SIGNAL(PWR,	70,	SIOS_PIN_OUTPUT)	/* Gumstix power enable */
+SIOS_SIGNAL(VDD2,	71,	SIOS_PIN_OUTPUT)	/* peripheral power enable */
+SIOS_SIGNAL(USBHP,	72,	SIOS_PIN_OUTPUT)	/* USB high power enable */
+SIOS_SIGNAL(RST,	73,	SIOS_PIN_OUTPUT)	/* reset of the PCA9557 */
+SIOS_SIGNAL(PBST,	74,	SIOS_PIN_INPUT)		/* power button state */
+SIOS_SIGNAL(I2C_ALERT,	75,	SIOS_PIN_INPUT)		/* I2C-bus interrupt/alert */
+SIOS_SIGNAL(I2C_CNVT,	76,	SIOS_PIN_OUTPUT)	/* AD7998 conversion start */
+SIOS_SIGNAL(I2C_CNVG,	77,	SIOS_PIN_OUTPUT)	/* AD7994 conversion start */
+SIOS_GPIO(SPI_CLK,	81,	SIOS_PIN_OUTPUT)
+SIOS_GPIO(SPI_CS,	82,	SIOS_PIN_OUTPUT)
+SIOS_GPIO(SPI_MOSI,	83,	SIOS_PIN_OUTPUT)
+SIOS_GPIO(SPI_MISO,	84,	SIOS_PIN_INPUT)
+/* PXA I2C, bit-banged by bus recovery only */
+SIOS_SIGNAL(I2C_SCL,	117,	SIOS_PIN_CAP_IN | SIOS_PIN_CAP_OUT)
+SIOS_SIGNAL(I2C_SDA,	118,	SIOS_PIN_CAP_IN | SIOS_PIN_CAP_OUT)
+
+SIOS_XGPIO(16,	SIOS_PIN_XIO)
+SIOS_XGPIO(17,	SIOS_PIN_XIO)
+SIOS_XGPIO(29,	SIOS_PIN_XIO)
+SIOS_XGPIO(30,	SIOS_PIN_XIO)
+SIOS_XGPIO(31,	SIOS_PIN_XIO)
+SIOS_XGPIO(32,	SIOS_PIN_XIO)
+SIOS_XGPIO(46,	SIOS_PIN_XIO)
+SIOS_XGPIO(47,	SIOS_PIN_XIO)
+SIOS_XGPIO(48,	SIOS_PIN_XIO)
+SIOS_XGPIO(49,	SIOS_PIN_XIO)
+SIOS_XGPIO(50,	SIOS_PIN_XIO)
+SIOS_XGPIO(51,	SIOS_PIN_XIO)
+
+SIOS_CLAIM("sios_power",	POWER_HS,	HS,		"HotSwap",	SIOS_IO_GPIO,		0)
+SIOS_CLAIM("sios_power",	POWER_PWR,	PWR,		"PWR",		SIOS_IO_GPIO,		0)
+SIOS_CLAIM("sios_power",	POWER_VDD2,	VDD2,		"VDD2",		SIOS_IO_GPIO,		0)
+SIOS_CLAIM("sios_power",	POWER_USBHP,	USBHP,		"USBHP",	SIOS_IO_GPIO,		0)
+SIOS_CLAIM("sios_pwr_button",	BUTTON,		PBST,		"PwrButton",	SIOS_IO_GPIO|SIOS_IRQ,	IRQT_BOTHEDGE)
+SIOS_CLAIM("sios_bus",		SNAPSHOT,	I2C_ALERT,	"ALERT",	SIOS_IO_GPIO|SIOS_FIRQ,	IRQT_FALLING)
+SIOS_CLAIM("sios_adc",		AD7998_CNVST,	I2C_CNVT,	"CNVST",	SIOS_IO_GPIO,		0)
+SIOS_CLAIM("sios_adc",		AD7994_CNVST,	I2C_CNVG,	"CNVST",	SIOS_IO_GPIO,		0)
+
+#undef SIOS_SIGNAL
+#undef SIOS_GPIO
+#undef SIOS_XGPIO
+#undef SIOS_CLAIM
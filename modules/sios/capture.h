@@ -0,0 +1,200 @@
+/* -*-linux-c-*-
+ * capture.h - SIOS capture file format
+ *
+ * Copyright (C) 2008 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA, or http://www.gnu.org/licenses/gpl.html
+ */
+
+#ifndef _SIOS_CAPTURE_H_
+#define _SIOS_CAPTURE_H_
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * A capture is a sequence of SIOS_CAP_BLOCK_SIZE blocks, each starting
+ * with a struct sios_cap_block. The format is append only: a capture
+ * file is exactly what was read from /dev/sios_capture and it is
+ * replayed by writing it back to the same device. All fields are
+ * little endian.
+ *
+ * Block 0 is a SIOS_CAP_BLK_SOURCES block naming the event sources;
+ * another one follows whenever a source is added during the capture.
+ * Every block with seq % SIOS_CAP_INDEX_STRIDE == SIOS_CAP_INDEX_STRIDE - 1
+ * is a SIOS_CAP_BLK_INDEX block listing the blocks since the previous
+ * index, so seeking by time only has to look at every STRIDE'th block.
+ *
+ * Any number of processes may read the capture at once, each open
+ * file has its own position. The ring does not wait for slow readers;
+ * one that falls behind by the whole ring continues at the oldest
+ * block, and the blocks it lost show as a gap in seq. A reader that
+ * joins a running capture starts with a fresh SOURCES block.
+ *
+ * Readers can avoid the copy: mmap the ring read-only (capture_blocks
+ * blocks, module parameter), SIOS_CAP_IOC_PEEK for the blocks pending,
+ * block first + i being at ((first + i) % blocks) * SIOS_CAP_BLOCK_SIZE,
+ * then SIOS_CAP_IOC_CONSUME how many were used. CONSUME fails with
+ * EOVERFLOW when the ring came round over them meanwhile, the data
+ * just read must then be dropped. poll works for both kinds of reader.
+ * A partly filled block is sealed and handed out once it is
+ * capture_flush_ms (module parameter) old; reads and PEEK never seal
+ * it, so all readers see the same blocks however often they poll.
+ *
+ * With the capture_packed module parameter set, converter scans are
+ * stored in SIOS_CAP_BLK_SCAN blocks instead of one DATA entry per
+ * sample: a table of up to SIOS_CAP_SCAN_SETS scan layouts (the sources
+ * converted together) follows the header, then count records of
+ * __le32 delta_ns, __u8 set and the samples of the set packed 12 bits
+ * each, two in three bytes, see sios_cap_unpack12. A full 8 channel
+ * scan takes 17 bytes instead of 64. All other events of a packed
+ * capture are records in the same blocks, with set SIOS_CAP_SCAN_EVENT
+ * followed by the source, flags and __le16 value of a DATA entry.
+ *
+ * A source sampled at an activity dependent rate has its highest rate
+ * in the max_rate of its SOURCES entry, and each of its events carries
+ * the rate the sample was taken at as max_rate >> shift in its flags,
+ * see SIOS_CAP_EV_SHIFT. Such sources are never packed into scans.
+ *
+ * SIOS_CAP_VERSION goes up with every change to the format. A reader
+ * takes blocks of any version up to its own, replay included:
+ *
+ *	1	SOURCES, DATA and INDEX blocks
+ *	2	SCAN blocks, with single event records
+ *	3	max_rate in SOURCES entries, the rate shift in event flags
+ *
+ * In older blocks readers take both as zero, a fixed rate.
+ */
+
+#define SIOS_CAP_MAGIC		0x50414353	/* "SCAP" */
+#define SIOS_CAP_VERSION_SCAN	2
+#define SIOS_CAP_VERSION_RATE	3
+#define SIOS_CAP_VERSION	3
+#define SIOS_CAP_BLOCK_SIZE	4096
+#define SIOS_CAP_INDEX_STRIDE	64
+#define SIOS_CAP_NAME_LEN	20
+
+enum sios_cap_block_type {
+	SIOS_CAP_BLK_SOURCES = 1,
+	SIOS_CAP_BLK_DATA,
+	SIOS_CAP_BLK_INDEX,
+	SIOS_CAP_BLK_SCAN,
+};
+
+struct sios_cap_block {
+	__le32 magic;
+	__le16 version;
+	__le16 type;
+	__le32 seq;		/* block number within the capture */
+	__le32 count;		/* entries following the header */
+	__le64 base_ns;		/* event clock time of the first entry */
+	__le32 dropped;		/* events lost since the previous block */
+	__le32 clock;		/* SIOS_CLOCK_* base_ns is in */
+};
+
+/* SIOS_CAP_BLK_DATA entry */
+struct sios_cap_event {
+	__le32 delta_ns;	/* relative to base_ns of the block */
+	__u8 source;
+	__u8 flags;
+	__le16 value;
+};
+
+#define SIOS_CAP_EV_SHIFT(flags)	((flags) & 0x0f)
+
+/* SIOS_CAP_BLK_SOURCES entry */
+struct sios_cap_source {
+	__u8 id;
+	__u8 type;
+	__le16 max_rate;	/* Hz, 0 for a fixed or unknown rate */
+	char name[SIOS_CAP_NAME_LEN];
+};
+
+/* SIOS_CAP_BLK_INDEX entry */
+struct sios_cap_index {
+	__le64 base_ns;
+	__le32 seq;
+	__le16 type;
+	__le16 count;
+};
+
+#define SIOS_CAP_SCAN_MAX	8	/* samples in one scan */
+#define SIOS_CAP_SCAN_SETS	4
+
+/* SIOS_CAP_BLK_SCAN layout table entry */
+struct sios_cap_scan_set {
+	__u8 nr;		/* samples per scan, 0 for an unused entry */
+	__u8 reserved;
+	__u8 source[SIOS_CAP_SCAN_MAX];	/* source id of each sample */
+};
+
+#define SIOS_CAP_SCAN_DATA \
+	(sizeof(struct sios_cap_block) + \
+	 SIOS_CAP_SCAN_SETS * sizeof(struct sios_cap_scan_set))
+#define SIOS_CAP_PACKED_LEN(n)	(3 * (((n) + 1) / 2))
+#define SIOS_CAP_SCAN_REC_LEN(n)	(5 + SIOS_CAP_PACKED_LEN(n))
+#define SIOS_CAP_SCAN_EVENT	0xff	/* set of a single event record */
+#define SIOS_CAP_SCAN_EV_LEN	9
+
+/* a, b -> a[7:0], b[3:0] a[11:8], b[11:4] */
+static __inline void sios_cap_pack12(__u8 *dst, const __u16 *src, unsigned int n)
+{
+	unsigned int i;
+
+	for (i=0; i<n; i+=2) {
+		__u16 a = src[i] & 0x0fff;
+		__u16 b = (i + 1 < n) ? src[i + 1] & 0x0fff : 0;
+
+		*dst++ = a;
+		*dst++ = (a >> 8) | (b << 4);
+		*dst++ = b >> 4;
+	}
+}
+
+/*
+ * Branch free over whole pairs so that the compiler can vectorize it;
+ * dst must have room for n samples.
+ */
+static __inline void sios_cap_unpack12(__u16 *dst, const __u8 *src, unsigned int n)
+{
+	unsigned int i, pairs = n / 2;
+
+	for (i=0; i<pairs; i++) {
+		dst[2 * i] = src[3 * i] | (src[3 * i + 1] & 0x0f) << 8;
+		dst[2 * i + 1] = (src[3 * i + 1] >> 4) | src[3 * i + 2] << 4;
+	}
+	if (n & 1)
+		dst[n - 1] = src[3 * pairs] | (src[3 * pairs + 1] & 0x0f) << 8;
+}
+
+/* SIOS_CAP_IOC_PEEK */
+struct sios_cap_ring {
+	__u32 blocks;		/* ring size */
+	__u32 first;		/* free running number of the next block */
+	__u32 count;		/* sealed blocks from first on */
+	__u32 lost;		/* blocks overwritten before this reader got them */
+};
+
+#define SIOS_CAP_IOC_MAGIC	'S'
+#define SIOS_CAP_IOC_PEEK	_IOR(SIOS_CAP_IOC_MAGIC, 0x10, struct sios_cap_ring)
+#define SIOS_CAP_IOC_CONSUME	_IOW(SIOS_CAP_IOC_MAGIC, 0x11, __u32)
+
+#define SIOS_CAP_EVENTS_PER_BLOCK \
+	((SIOS_CAP_BLOCK_SIZE - sizeof(struct sios_cap_block)) / sizeof(struct sios_cap_event))
+#define SIOS_CAP_SOURCES_PER_BLOCK \
+	((SIOS_CAP_BLOCK_SIZE - sizeof(struct sios_cap_block)) / sizeof(struct sios_cap_source))
+
+#endif /* _SIOS_CAPTURE_H_ */
@@ -0,0 +1,68 @@
+/* -*-linux-c-*-
+ * chip.h - SIOS I2C chip enumeration
+ *
+ * Copyright (C) 2008 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA, or http://www.gnu.org/licenses/gpl.html
+ */
+
+#ifndef _SIOS_CHIP_H_
+#define _SIOS_CHIP_H_
+
+#include <linux/ktime.h>
+
+#include "sios.h"
+
+struct sios_board;
+
+enum sios_chip_type {
+	SIOS_CHIP_AD7998 = 0,
+	SIOS_CHIP_AD7994,
+	SIOS_CHIP_AD5254,
+	SIOS_CHIP_PCA9557,
+	SIOS_CHIP_DS2482,
+	SIOS_NR_CHIP_TYPES,
+};
+
+/*
+ * A chip found on a board's I2C bus. The bus registers one sios device
+ * per chip, named sios:<type> (sios:<type>.<board> off board 0), for
+ * the function drivers to bind to. At most one chip of each type is
+ * used per board.
+ */
+struct sios_chip {
+	int type;
+	const char *type_name;
+	int addr;
+	struct sios_device dev;
+	char name[BUS_ID_SIZE];
+};
+
+#define to_sios_chip(x) container_of((x), struct sios_chip, dev)
+
+/*
+ * Enumerate the board's chips from process context; since is when the
+ * bus got powered, for the time-to-available statistics.
+ */
+extern void sios_chip_scan(struct sios_board *board, ktime_t since);
+
+/* bus internal, see chips.c */
+extern void sios_chip_rescan(void);
+extern ssize_t sios_chip_show(char *buf);
+extern ssize_t sios_chip_show_stats(char *buf);
+extern void sios_chip_exit(void);
+
+#endif /* _SIOS_CHIP_H_ */
@@ -0,0 +1,132 @@
+/* -*-linux-c-*-
+ * event.h - SIOS event sources
+ *
+ * Copyright (C) 2008 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA, or http://www.gnu.org/licenses/gpl.html
+ */
+
+#ifndef _SIOS_EVENT_H_
+#define _SIOS_EVENT_H_
+
+#include <linux/types.h>
+#include <linux/ktime.h>
+
+/* source classes, stored in capture files */
+#define SIOS_EV_ADC	1
+#define SIOS_EV_GPIO	2
+#define SIOS_EV_W1	3
+
+#define SIOS_MAX_SOURCES	255
+
+/* clock base of event timestamps, sios_bus event_clock parameter */
+#define SIOS_CLOCK_MONOTONIC	0
+#define SIOS_CLOCK_REALTIME	1
+
+/*
+ * Inter-event timing of a source. Intervals and jitter are running
+ * averages with a gain of 1/16; jitter is the mean deviation between
+ * consecutive intervals.
+ */
+struct sios_source_stats {
+	u32 events;
+	ktime_t last;
+	s64 interval_ns;
+	s64 avg_interval_ns;
+	s64 jitter_ns;
+	s64 min_interval_ns;
+	s64 max_interval_ns;
+};
+
+/*
+ * Anything that produces raw samples or events (an ADC channel, an
+ * input pin, a 1-Wire sensor) registers a source and reports every
+ * value through sios_event_report. inject is the replay backend: it
+ * must feed a recorded value into the driver exactly as if the
+ * hardware had produced it.
+ *
+ * Drivers that know better when a sample was taken than the moment
+ * they get to report it (an edge interrupt, the start of a conversion)
+ * take a sios_event_stamp() there and report with sios_event_report_ts.
+ * A source has a single reporting context, stats are not locked.
+ *
+ * A driver that varies the sampling rate of a source with its activity
+ * announces the highest rate through sios_source_set_rate and keeps
+ * rate_shift at the rate of the samples it reports, max_rate >> shift.
+ */
+struct sios_source {
+	const char *name;
+	int type;
+	int id;
+	void (*inject)(struct sios_source *src, u16 value);
+	struct sios_source_stats stats;
+	unsigned int max_rate;		/* Hz, 0 for a fixed rate */
+	u8 rate_shift;
+};
+
+extern int __must_check sios_source_register(struct sios_source *src);
+extern void sios_source_unregister(struct sios_source *src);
+extern ktime_t sios_event_stamp(void);
+extern void sios_event_report_ts(struct sios_source *src, ktime_t ts, u16 value);
+extern void sios_event_report(struct sios_source *src, u16 value);
+extern void sios_event_report_scan(struct sios_source **src, int n, ktime_t ts,
+				   const u16 *vals);
+extern void sios_source_set_rate(struct sios_source *src, unsigned int max_rate);
+
+/* sios_bus internal */
+struct sios_cap_source;
+
+extern int sios_source_lookup(const char *name);
+extern int sios_source_inject(int id, u16 value);
+extern int sios_source_snapshot(struct sios_cap_source *tbl, int max);
+extern ssize_t sios_source_show_stats(char *buf);
+extern int sios_event_clock(void);
+
+extern void sios_capture_event(struct sios_source *src, ktime_t ts, u16 value);
+extern void sios_capture_scan(struct sios_source **src, int n, ktime_t ts,
+			      const u16 *vals);
+extern void sios_capture_sources_changed(void);
+extern int sios_capture_init(void);
+extern void sios_capture_exit(void);
+
+/*
+ * Latency of an event at each stage on its way to a reader, always
+ * measured from the event's own stamp, see latency.c.
+ */
+enum sios_lat_stage {
+	SIOS_LAT_IRQ = 0,	/* simulated edge to queued interrupt record */
+	SIOS_LAT_DEFERRED,	/* to the resource handler */
+	SIOS_LAT_QUEUE,		/* to its capture block being sealed */
+	SIOS_LAT_READ,		/* to its block being handed to a reader */
+	SIOS_LAT_NR_STAGES,
+};
+
+extern int sios_latency_on;
+extern void sios_latency_init(void);
+extern void sios_latency_add(int stage, s64 ns);
+extern void sios_latency_reset(void);
+extern ssize_t sios_latency_show(char *buf);
+extern ssize_t sios_latency_show_hist(char *buf);
+extern ssize_t sios_bench_show(char *buf);
+extern int sios_bench_start(const char *args);
+extern void sios_bench_stop(void);
+
+/* pre-trigger history, see snapshot.c */
+extern void sios_snapshot_event(struct sios_source *src, ktime_t ts, u16 value);
+extern int sios_snapshot_init(void);
+extern void sios_snapshot_exit(void);
+
+#endif /* _SIOS_EVENT_H_ */
@@ -1,19 +0,0 @@
-#include "sios-gpio.h"
-
-SGPIO(GPIO_SIOS_RS_STROBE)
-SGPIO(GPIO_SIOS_SPI_CSA0)
-SGPIO(GPIO_SIOS_SPI_CSA1)
-SGPIO(GPIO_SIOS_SPI_CSA2)
-SGPIO(GPIO_SIOS_HS)
-SGPIO(GPIO_SIOS_PWR)
-SGPIO(GPIO_SIOS_VDD2)
-SGPIO(GPIO_SIOS_USBHP)
-SGPIO(GPIO_SIOS_RST)
-SGPIO(GPIO_SIOS_PBST)
-SGPIO(GPIO_SIOS_I2C_ALERT)
-SGPIO(GPIO_SIOS_I2C_CNVT)
-SGPIO(GPIO_SIOS_I2C_CNVG)
-SGPIO(GPIO_SIOS_SPI_CLK)
-SGPIO(GPIO_SIOS_SPI_CS)
-SGPIO(GPIO_SIOS_SPI_MOSI)
-SGPIO(GPIO_SIOS_SPI_MISO)
@@ -0,0 +1,107 @@
+/* -*-linux-c-*-
+ * gpiodev.h - SIOS userspace GPIO access
+ *
+ * Copyright (C) 2008 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA, or http://www.gnu.org/licenses/gpl.html
+ */
+
+#ifndef _SIOS_GPIODEV_H_
+#define _SIOS_GPIODEV_H_
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * /dev/sios_gpio gives userspace direct access to the pins it claimed
+ * through the sios resource allocator. Claims last until release or
+ * close; they belong to the sios:gpio device and show in the bus's
+ * "pins" table as sios:gpio:<start>-<end>. SIOS_GPIO_OUTPUT fails with
+ * EINVAL on a pin the board only has as an input. An SIOS_GPIO_XGPIO
+ * claim only reserves the expander pins: batches, reads and the
+ * mapping cover on-chip pins alone. Release takes the same flags.
+ *
+ * SIOS_GPIO_IOC_BATCH runs a list of set/clear operations, one GPSR
+ * and one GPCR write per bank each. A batch with any bit that was not
+ * claimed through this file, or with more than SIOS_GPIO_MAX_BATCH_NS
+ * of delays, fails before anything is written.
+ *
+ * Where the gpio_mmap module parameter allows it, a process holding
+ * CAP_SYS_RAWIO and at least one claim can mmap the GPIO register page
+ * at offset 0. The MMU cannot protect single pins, so the kernel only
+ * checks the claim; the process must restrict itself to its own bits
+ * of the write-one set/clear registers below and leave GPDR and the
+ * alternate function registers alone. While any mapping exists, also
+ * in a child, release fails with EBUSY and close keeps the claims, so
+ * the pins cannot be handed to a driver under it.
+ */
+
+#define SIOS_GPIO_BANKS		4
+
+/* claim flags */
+#define SIOS_GPIO_XGPIO		0x01	/* claim as SIOS_IO_XGPIO */
+#define SIOS_GPIO_OUTPUT	0x02	/* make the pins outputs, low */
+
+struct sios_gpio_claim {
+	__u32 start;
+	__u32 end;
+	__u32 flags;
+	__u32 reserved;
+};
+
+struct sios_gpio_op {
+	__u32 set[SIOS_GPIO_BANKS];
+	__u32 clear[SIOS_GPIO_BANKS];
+	__u32 delay_ns;		/* wait after this op, at most 1 ms */
+	__u32 reserved;
+};
+
+struct sios_gpio_batch {
+	__u32 count;
+	__u32 reserved;
+	__u64 ops;		/* user pointer to count struct sios_gpio_op */
+};
+
+struct sios_gpio_levels {
+	__u32 level[SIOS_GPIO_BANKS];	/* claimed pins only, others read 0 */
+};
+
+#define SIOS_GPIO_IOC_MAGIC	'S'
+#define SIOS_GPIO_IOC_CLAIM	_IOW(SIOS_GPIO_IOC_MAGIC, 0x00, struct sios_gpio_claim)
+#define SIOS_GPIO_IOC_RELEASE	_IOW(SIOS_GPIO_IOC_MAGIC, 0x01, struct sios_gpio_claim)
+#define SIOS_GPIO_IOC_BATCH	_IOW(SIOS_GPIO_IOC_MAGIC, 0x02, struct sios_gpio_batch)
+#define SIOS_GPIO_IOC_READ	_IOR(SIOS_GPIO_IOC_MAGIC, 0x03, struct sios_gpio_levels)
+
+#define SIOS_GPIO_MAX_BATCH	1024
+#define SIOS_GPIO_MAX_BATCH_NS	10000000	/* delay_ns of a whole batch */
+
+/* PXA27x register offsets within the mapped page */
+static __inline unsigned int sios_gpio_gplr(int bank)
+{
+	return (bank < 3) ? bank * 4 : 0x100;
+}
+
+static __inline unsigned int sios_gpio_gpsr(int bank)
+{
+	return (bank < 3) ? 0x18 + bank * 4 : 0x118;
+}
+
+static __inline unsigned int sios_gpio_gpcr(int bank)
+{
+	return (bank < 3) ? 0x24 + bank * 4 : 0x124;
+}
+
+#endif /* _SIOS_GPIODEV_H_ */
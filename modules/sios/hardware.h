@@ -35,6 +35,12 @@
 #define SIOS_BASE_MINOR		0
 #define SIOS_MAX_MINOR		255
 
+/* fixed character device minors */
+#define SIOS_CAPTURE_MINOR	(SIOS_BASE_MINOR + 0)
+#define SIOS_GPIO_MINOR		(SIOS_BASE_MINOR + 1)
+#define SIOS_POWER_MINOR	(SIOS_BASE_MINOR + 2)
+#define SIOS_SNAPSHOT_MINOR	(SIOS_BASE_MINOR + 3)
+
 #define SENSORS_CLASS_NAME	"sensors"
 
 /* AD7998 ADC 
@@ -45,24 +51,32 @@
  */
 #define SIOS_AD7998_ADDR		0x21	/* 0x24 */
 #define SIOS_AD7994_ADDR		0x22	/* 0x22 */
+/* candidates for enumeration, default first */
+#define SIOS_AD7998_ADDRS		SIOS_AD7998_ADDR, 0x22, 0x23, 0x24, 0x20
+#define SIOS_AD7994_ADDRS		SIOS_AD7994_ADDR, 0x21, 0x23, 0x24, 0x20
 
 /* AD5254 digipot 
  * possible addresses:
  * 0x2c 0x2d 0x2e 0x2f
  */
 #define SIOS_AD5254_ADDR		0x2c
+#define SIOS_AD5254_ADDRS		SIOS_AD5254_ADDR, 0x2d, 0x2e, 0x2f
 
 /* PCA9557 8-GPIO 
  * possible address:
  * 0x18 0x19 0x1a 0x1b 0x1c 0x1d 0x1e 0x1f 
  */
 #define SIOS_PCA9557_ADDR		0x18
+#define SIOS_PCA9557_ADDRS		SIOS_PCA9557_ADDR, 0x1a, 0x1b, 0x1c, 0x1d, \
+					0x1e, 0x1f, 0x19
 
 /* DS2482-800 8-chan 1-Wire master 
  * possible address:
  * 0x18 0x19 0x1a 0x1b 0x1c 0x1d 0x1e 0x1f 
  */
 #define SIOS_DS2482_ADDR		0x19
+#define SIOS_DS2482_ADDRS		SIOS_DS2482_ADDR, 0x1a, 0x1b, 0x1c, 0x1d, \
+					0x1e, 0x1f, 0x18
 
 #define GPIO_SIOS_ST(x) 	(GPSR(x) = GPIO_bit(x))
 #define GPIO_SIOS_GST(x)	((GPLR(x) & GPIO_bit(x)) >> ((x) & 0x1F))
@@ -100,6 +114,29 @@ static __inline void sios_power_on(void) { gpio_set_value(GPIO_SIOS_PWR, 1); }
  */ 
 extern void sios_power_off(void);
 
+/*
+ * Rail references for sios drivers, rail is SIOS_PIN_VDD2, _HS or
+ * _USBHP of the board. A rail is on while referenced and goes off
+ * autosuspend_delay_ms after its last reference is dropped. get sleeps
+ * for the rail to settle and stores in *gen how many times the rail
+ * was switched on so far, by anyone; a caller that set up its chips
+ * under another count has to set them up again.
+ */
+struct sios_board;
+extern int sios_power_rail_get(struct sios_board *board, int rail, u32 *gen);
+extern void sios_power_rail_put(struct sios_board *board, int rail);
+
+/*
+ * Rail telemetry reads its current and voltage taps through a meter,
+ * which the ADC driver registers. read does a single conversion of
+ * channel ch of chip (enum sios_adc_chip) and must not touch the rails.
+ */
+struct sios_power_meter {
+	int (*read)(struct sios_board *board, int chip, int ch, u16 *raw);
+};
+
+extern void sios_power_set_meter(const struct sios_power_meter *meter);
+
 /* auxiliary functions */
 static __inline void sios_hotswap_on(void) { gpio_set_value(GPIO_SIOS_HS, 1); }
 static __inline void sios_hotswap_off(void) { gpio_set_value(GPIO_SIOS_HS, 0); }
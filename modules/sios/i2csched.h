@@ -0,0 +1,116 @@
+/* -*-linux-c-*-
+ * i2csched.h - SIOS I2C transaction scheduler
+ *
+ * Copyright (C) 2008 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA, or http://www.gnu.org/licenses/gpl.html
+ */
+
+#ifndef _SIOS_I2CSCHED_H_
+#define _SIOS_I2CSCHED_H_
+
+#include <linux/types.h>
+#include <linux/list.h>
+#include <linux/ktime.h>
+#include <linux/i2c.h>
+
+struct sios_board;
+struct sios_i2c_sched;
+
+/* lower runs first */
+enum sios_i2c_prio {
+	SIOS_I2C_PRIO_RT = 0,	/* sampling */
+	SIOS_I2C_PRIO_HIGH,
+	SIOS_I2C_PRIO_NORMAL,
+	SIOS_I2C_PRIO_LOW,	/* housekeeping, eeprom */
+};
+
+/* never merged with other requests into one transfer */
+#define SIOS_I2C_EXCLUSIVE	0x0001
+/* a NACK is an answer, not a bus fault, see sios_i2c_probe */
+#define SIOS_I2C_PROBE		0x0002
+
+/* upper bound on messages in one coalesced transfer */
+#define SIOS_I2C_MAX_MSGS	16
+
+struct sios_i2c_req_stats {
+	u32 runs;
+	u32 misses;		/* completed after the deadline */
+	u32 errors;
+	u32 skipped;		/* periods lost to overruns */
+	u32 last_us;		/* release to completion */
+	u32 max_us;
+	ktime_t first;
+};
+
+/*
+ * A transaction request. The owner fills in the public part and keeps
+ * the structure (and msgs) alive until it completed or was cancelled.
+ * A period of 0 makes it a one-shot request. complete() runs in the
+ * scheduler thread and must not block.
+ */
+struct sios_i2c_req {
+	const char *name;
+	struct i2c_msg *msgs;
+	int num;
+	int prio;
+	unsigned int flags;
+	unsigned int period_us;
+	unsigned int deadline_us;	/* after release, 0 for none */
+	void (*complete)(struct sios_i2c_req *req, int status);
+	void *context;
+
+	/* private */
+	struct sios_i2c_sched *sched;
+	ktime_t release;
+	ktime_t stamp;			/* sios_event_stamp() at transfer start */
+	struct list_head queue;
+	struct list_head client;
+	struct list_head batch;
+	unsigned queued:1;
+	unsigned running:1;
+	unsigned cancelled:1;
+	unsigned listed:1;
+	struct sios_i2c_req_stats stats;
+};
+
+/*
+ * Called from process context after the scheduler recovered a stuck
+ * bus, to set up chips that may have lost their state. Transfers are
+ * allowed.
+ */
+struct sios_i2c_reinit {
+	void (*reinit)(struct sios_i2c_reinit *r);
+	struct list_head list;
+};
+
+extern struct sios_i2c_sched *sios_i2c_sched_get(struct sios_board *board);
+extern void sios_i2c_sched_put(struct sios_i2c_sched *sched);
+extern struct i2c_adapter *sios_i2c_adapter(struct sios_i2c_sched *sched);
+
+extern int sios_i2c_submit(struct sios_i2c_sched *sched, struct sios_i2c_req *req);
+extern void sios_i2c_cancel(struct sios_i2c_req *req);
+extern int sios_i2c_transfer(struct sios_i2c_sched *sched, struct i2c_msg *msgs,
+			     int num, int prio);
+extern int sios_i2c_probe(struct sios_i2c_sched *sched, int addr);
+
+extern void sios_i2c_add_reinit(struct sios_i2c_sched *sched, struct sios_i2c_reinit *r);
+extern void sios_i2c_del_reinit(struct sios_i2c_sched *sched, struct sios_i2c_reinit *r);
+
+/* last resort of bus recovery, power cycles the board's sensor rail */
+extern void sios_i2c_set_rail_cycler(int (*cycle)(struct sios_board *board));
+
+#endif /* _SIOS_I2CSCHED_H_ */
@@ -0,0 +1,132 @@
+/* -*-linux-c-*-
+ * pingroup.h - SIOS pin groups
+ *
+ * Copyright (C) 2008 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA, or http://www.gnu.org/licenses/gpl.html
+ */
+
+#ifndef _SIOS_PINGROUP_H_
+#define _SIOS_PINGROUP_H_
+
+#include <linux/types.h>
+#include <linux/bitops.h>
+
+#include "sios.h"
+#include "resource.h"
+#include "hardware.h"
+
+#define SIOS_PG_BANKS		(SIOS_NR_GPIO / 32)
+#define SIOS_PG_MAX_PINS	32
+
+/*
+ * A group of on-chip GPIOs a driver claimed as SIOS_IO_GPIO resources,
+ * addressed by group bit: bit i is pins[i] given at init. Ownership is
+ * checked once in sios_pin_group_init, so the accessors below do no
+ * checking at all. Updates are one GPSR and one GPCR write per bank
+ * involved, so all pins of a bank change at the same instant; a read
+ * is one GPLR read per bank. Groups whose pins are consecutive within
+ * one bank skip the bit gathering altogether.
+ *
+ * The pins must already be set up as outputs (or inputs for reading).
+ */
+struct sios_pin_group {
+	struct sios_device *owner;
+	int nr_pins;
+	u32 all;			/* every group bit */
+	int fast_bank;			/* consecutive pins in one bank, or -1 */
+	int fast_shift;
+	u8 pin[SIOS_PG_MAX_PINS];
+	u8 bank[SIOS_PG_MAX_PINS];
+	u32 banks;			/* banks with group pins */
+};
+
+extern int __must_check sios_pin_group_init(struct sios_pin_group *grp,
+					    struct sios_device *sdev,
+					    const int *pins, int nr_pins);
+
+static inline void sios_pin_group_write(struct sios_pin_group *grp,
+					u32 set, u32 clear)
+{
+	u32 s[SIOS_PG_BANKS] = { 0, }, c[SIOS_PG_BANKS] = { 0, };
+	int b, i;
+
+	set &= grp->all;
+	clear &= grp->all & ~set;
+
+	if (grp->fast_bank >= 0) {
+		b = grp->fast_bank << 5;
+		if (set)
+			GPSR(b) = set << grp->fast_shift;
+		if (clear)
+			GPCR(b) = clear << grp->fast_shift;
+		return;
+	}
+
+	for (; set; set &= set - 1) {
+		i = __ffs(set);
+		s[grp->bank[i]] |= GPIO_bit(grp->pin[i]);
+	}
+	for (; clear; clear &= clear - 1) {
+		i = __ffs(clear);
+		c[grp->bank[i]] |= GPIO_bit(grp->pin[i]);
+	}
+
+	for (b=0; b<SIOS_PG_BANKS; b++) {
+		if (s[b])
+			GPSR(b << 5) = s[b];
+		if (c[b])
+			GPCR(b << 5) = c[b];
+	}
+}
+
+static inline void sios_pin_group_set(struct sios_pin_group *grp, u32 mask)
+{
+	sios_pin_group_write(grp, mask, 0);
+}
+
+static inline void sios_pin_group_clear(struct sios_pin_group *grp, u32 mask)
+{
+	sios_pin_group_write(grp, 0, mask);
+}
+
+/* drive every pin of the group to its bit in value */
+static inline void sios_pin_group_assign(struct sios_pin_group *grp, u32 value)
+{
+	sios_pin_group_write(grp, value, ~value);
+}
+
+static inline u32 sios_pin_group_get(struct sios_pin_group *grp)
+{
+	u32 lv[SIOS_PG_BANKS];
+	u32 value = 0;
+	int b, i;
+
+	if (grp->fast_bank >= 0)
+		return (GPLR(grp->fast_bank << 5) >> grp->fast_shift) & grp->all;
+
+	for (b=0; b<SIOS_PG_BANKS; b++)
+		lv[b] = (grp->banks & (1 << b)) ? GPLR(b << 5) : 0;
+
+	for (i=0; i<grp->nr_pins; i++) {
+		if (lv[grp->bank[i]] & GPIO_bit(grp->pin[i]))
+			value |= 1 << i;
+	}
+
+	return value;
+}
+
+#endif /* _SIOS_PINGROUP_H_ */
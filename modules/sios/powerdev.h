@@ -0,0 +1,47 @@
+/* -*-linux-c-*-
+ * powerdev.h - SIOS rail telemetry stream
+ *
+ * Copyright (C) 2008 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA, or http://www.gnu.org/licenses/gpl.html
+ */
+
+#ifndef _SIOS_POWERDEV_H_
+#define _SIOS_POWERDEV_H_
+
+#include <linux/types.h>
+
+/*
+ * /dev/sios_power delivers one record per metered rail and telemetry
+ * period, for every board. Each open file starts at the oldest record
+ * still buffered; a reader that falls behind loses the oldest records
+ * and sees SIOS_PWR_REC_LOST on the next one it gets. Reads return
+ * whole records only, poll reports POLLIN when one is pending.
+ */
+
+#define SIOS_PWR_REC_LOST	0x0001	/* records were dropped before this one */
+#define SIOS_PWR_REC_GAP	0x0002	/* rail on but not measurable, see energy */
+
+struct sios_power_record {
+	__u64 time_ns;		/* event clock, see sios_bus event_clock */
+	__u8 board;
+	__u8 rail;		/* enum sios_pin */
+	__u16 flags;
+	__u32 power_uw;
+	__u64 energy_uj;	/* since the rail was configured */
+};
+
+#endif /* _SIOS_POWERDEV_H_ */
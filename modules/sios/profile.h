@@ -0,0 +1,85 @@
+/* -*-linux-c-*-
+ * profile.h - SIOS acquisition profiles
+ *
+ * Copyright (C) 2008 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA, or http://www.gnu.org/licenses/gpl.html
+ */
+
+#ifndef _SIOS_PROFILE_H_
+#define _SIOS_PROFILE_H_
+
+#include <linux/types.h>
+#include <linux/list.h>
+
+/*
+ * Acquisition profiles are staged in configfs, one directory per
+ * profile and in it one per device, named like the device:
+ *
+ *	/config/sios/<profile>/<device>/{channels,rate,mode,filter,
+ *					 alert_low,alert_high}
+ *
+ * Writing a profile name to /config/sios/active switches every device
+ * the profile names at once: all of them check their settings first
+ * and nothing changes unless all accept. A setting left empty keeps
+ * what the device has.
+ */
+
+#define SIOS_PROFILE_LIMITS	4	/* channels with alert limits */
+#define SIOS_PROFILE_MODE_LEN	16
+
+/* sios_acq_settings.set */
+#define SIOS_ACQ_CHANNELS	0x0001
+#define SIOS_ACQ_RATE		0x0002
+#define SIOS_ACQ_MODE		0x0004
+#define SIOS_ACQ_FILTER		0x0008
+#define SIOS_ACQ_ALERT_LOW	0x0010
+#define SIOS_ACQ_ALERT_HIGH	0x0020
+
+struct sios_acq_settings {
+	unsigned int set;
+	u32 channels;		/* mask */
+	unsigned int rate;	/* Hz, 0 for off */
+	char mode[SIOS_PROFILE_MODE_LEN];
+	int filter;
+	u16 alert_low[SIOS_PROFILE_LIMITS];
+	u16 alert_high[SIOS_PROFILE_LIMITS];
+};
+
+/*
+ * A device that takes profiles. prepare checks the settings and stages
+ * them, then either commit or abort follows; commit must not fail.
+ * All three run in process context, serialized.
+ */
+struct sios_profile_target {
+	const char *name;	/* bus id of the device */
+	int (*prepare)(struct sios_profile_target *t, const struct sios_acq_settings *s);
+	void (*commit)(struct sios_profile_target *t);
+	void (*abort)(struct sios_profile_target *t);
+
+	/* private */
+	int prepared;
+	struct list_head list;
+};
+
+extern void sios_profile_add_target(struct sios_profile_target *t);
+extern void sios_profile_del_target(struct sios_profile_target *t);
+
+/* sios_bus internal */
+extern int sios_profile_init(void);
+extern void sios_profile_exit(void);
+
+#endif /* _SIOS_PROFILE_H_ */
@@ -4,6 +4,7 @@
 #define _SIOS_RESOURCE_
 
 #include <linux/device.h>
+#include <linux/ktime.h>
 #include "sios.h"
 
 typedef int __bitwise sios_restype_t;
@@ -15,40 +16,58 @@ typedef int __bitwise sios_restype_t;
 #define SIOS_RESTYPE_MASK 0x00ff
 #define SIOS_RESFLAG_MASK 0xff00
 
-struct sios_resource;
+#define SIOS_NR_GPIO 128
 
-struct sios_resource_attribute {
-	struct device_attribute dev_attr;
-	struct sios_resource *res;
+/*
+ * What the hard handler of a SIOS_IRQ/SIOS_FIRQ pin records; the
+ * resource handler gets these later, in order, from a tasklet (FIRQ)
+ * or from the pin's own thread (IRQ).
+ */
+struct sios_irq_rec {
+	ktime_t stamp;		/* sios_event_stamp() in the hard handler */
+	u32 seq;
+	u16 level;		/* pin level right after the edge */
+	u16 lost;		/* records dropped on a full queue before this one */
 };
 
-#define to_sios_res_attr(x) container_of((x), struct sios_resource_attribute, dev_attr)
+struct sios_irq;
 
 struct sios_resource {
-	const char *name;
-	char s_name[BUS_ID_SIZE];
+	const char *name;	/* NULL: generated from device and range */
 	struct sios_device *dev;
 	sios_restype_t type;
-	ssize_t start;
-	ssize_t end;
-	struct sios_resource_attribute res_attr;
-	struct list_head list;
+	u8 start;
+	u8 end;
+
+	/*
+	 * A GPIO pin flagged SIOS_IRQ or SIOS_FIRQ that has a handler gets
+	 * its interrupt requested by the bus, see irq.c. Without a handler
+	 * the driver requests it itself.
+	 */
+	unsigned int trigger;	/* IRQT_*, 0 for both edges */
+	void (*handler)(struct sios_resource *res, const struct sios_irq_rec *rec);
+	struct sios_irq *irq;
 };
 
 extern int sios_init_resource(struct sios_device *sdev, struct sios_resource *res);
 extern int __must_check sios_request_resource(struct sios_device *sdev, struct sios_resource *res);
 extern void sios_release_resource(struct sios_resource *res);
 
-extern int __sios_resource_create_file(struct sios_device *sdev,
-				       struct sios_resource_attribute *sattr);
-extern int __must_check sios_resource_create_file(struct sios_device *sdev,
-						 struct sios_resource *res);
-extern void __sios_resource_remove_file(struct sios_device *sdev,
-					struct sios_resource_attribute *sattr);
-extern void sios_resource_remove_file(struct sios_resource *res);
+extern int __must_check sios_request_resources(struct sios_device *sdev);
+extern void sios_release_resources(struct sios_device *sdev);
+extern int sios_resource_name(struct sios_resource *res, char *buf, size_t len);
+
+extern int sios_resource_create_table(struct sios_device *sdev);
+extern void sios_resource_remove_table(struct sios_device *sdev);
+
+extern int __must_check sios_request_irqs(struct sios_device *sdev);
+extern void sios_free_irqs(struct sios_device *sdev);
+extern ssize_t sios_irq_show_stats(char *buf);
+extern int sios_irq_simulate(const char *name);
 
+extern int sios_resource_owned(struct sios_device *sdev, sios_restype_t type, int pin);
 extern int __must_check __check_sios_gpio(int pin, sios_restype_t type);
 #define check_sios_gpio(x) __check_sios_gpio((x), SIOS_IO_GPIO)
-#define check_sios_xgpio(x) __check_sios_gpipo((x), SIOS_IO_XGPIO);
+#define check_sios_xgpio(x) __check_sios_gpio((x), SIOS_IO_XGPIO)
 
 #endif /* _SIOS_RESOURCE_ */
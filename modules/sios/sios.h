@@ -25,15 +25,46 @@
 #include <linux/module.h>
 #include <linux/device.h>
 #include <linux/sysfs.h>
+#include <linux/completion.h>
+#include <linux/list.h>
 
 #include "resource.h"
 
+struct sios_board;
+
+enum sios_pm_stage {
+	SIOS_PM_SUSPEND = 0,
+	SIOS_PM_SUSPEND_LATE,
+	SIOS_PM_RESUME_EARLY,
+	SIOS_PM_RESUME,
+	SIOS_PM_NR_STAGES,
+};
+
+/* bus private power management bookkeeping, see bus.c */
+struct sios_dev_pm {
+	int state;
+	int stage;
+	int error;
+	pm_message_t mesg;
+	struct completion done;
+	struct list_head deferred;
+	s64 time_us[SIOS_PM_NR_STAGES];
+};
+
 struct sios_device {
 	const char *name;
 	void (*release)(struct sios_device *sdev);
 	struct device dev;
 	int num_resource;
 	struct sios_resource *resource;
+	/* board instance, board 0 if left NULL */
+	struct sios_board *board;
+
+	/* run suspend/resume in parallel with other async devices */
+	unsigned int async_pm:1;
+	/* suspend after, and resume before, all other sios devices */
+	unsigned int pm_supplier:1;
+	struct sios_dev_pm pm;
 };
 
 #define to_sios_device(x) container_of((x), struct sios_device, dev)
@@ -69,4 +100,12 @@ struct sios_driver {
 extern int __must_check sios_driver_register(struct sios_driver *sdrv);
 extern void sios_driver_unregister(struct sios_driver *sdrv);
 
+struct cdev;
+struct file_operations;
+
+extern int __must_check sios_chrdev_add(struct cdev *cdev,
+					const struct file_operations *fops,
+					int minor, const char *name);
+extern void sios_chrdev_del(struct cdev *cdev, int minor);
+
 #endif /* _SIOS_H_ */
@@ -1,12 +0,0 @@
-SGPIO(16)
-SGPIO(17)
-SGPIO(29)
-SGPIO(30)
-SGPIO(31)
-SGPIO(32)
-SGPIO(46)
-SGPIO(47)
-SGPIO(48)
-SGPIO(49)
-SGPIO(50)
-SGPIO(51)
@@ -0,0 +1,700 @@
+/* -*-linux-c-*-
+ * snapshot.c - SIOS pre-trigger snapshots
+ *
+ * Copyright (C) 2008 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA, or http://www.gnu.org/licenses/gpl.html
+ */
+
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/cdev.h>
+#include <linux/poll.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/kref.h>
+#include <linux/irq.h>
+#include <linux/log2.h>
+#include <asm/uaccess.h>
+#include <asm/div64.h>
+
+#include "sios/sios.h"
+#include "sios/event.h"
+#include "sios/capture.h"
+#include "sios/hardware.h"
+#include "sios/board.h"
+
+/*
+ * Pre-trigger capture. While armed, every reported event also goes
+ * into a fixed history ring. A trigger (the I2C ALERT line, any event
+ * of a chosen source, or a write to the state attribute) starts the
+ * post-trigger window; when it has passed, the events from pre_ms
+ * before to post_ms after the trigger are frozen into a snapshot and
+ * the ring is armed again.
+ *
+ * A snapshot is a capture file of its own, a SOURCES block followed by
+ * DATA blocks, see sios/capture.h, so it decodes and replays like any
+ * other. The base_ns of its SOURCES block is the trigger time and its
+ * dropped field counts the events the history missed while the
+ * previous snapshot was being taken. /dev/sios_snapshot hands out
+ * each new snapshot once per open file; a read of the snapshot's size
+ * gets all of it.
+ */
+
+static int snapshot_events = 16384;
+module_param(snapshot_events, int, 0444);
+MODULE_PARM_DESC(snapshot_events, "pre-trigger history in events, rounded up to a power of two");
+
+#define SNAP_MAX_MS	60000
+
+struct sios_snap_ev {
+	u64 ns;
+	u16 value;
+	u8 source;
+	u8 flags;		/* as in struct sios_cap_event */
+	u8 reserved[4];
+};
+
+enum {
+	SNAP_OFF = 0,
+	SNAP_ARMED,
+	SNAP_TRIGGERED,		/* waiting for the post-trigger window */
+	SNAP_FREEZING,		/* history is being copied out */
+};
+
+static const char *snap_state_names[] = {
+	[SNAP_OFF]		= "off",
+	[SNAP_ARMED]		= "armed",
+	[SNAP_TRIGGERED]	= "triggered",
+	[SNAP_FREEZING]		= "freezing",
+};
+
+struct sios_snapshot {
+	struct kref kref;
+	u32 seq;
+	size_t size;
+	char *data;
+};
+
+/* per open file */
+struct sios_snap_reader {
+	struct sios_snapshot *s;	/* being read */
+	size_t off;
+	u32 seen;			/* seq of the last one handed out */
+};
+
+static struct sios_snap {
+	spinlock_t lock;		/* state and the history ring */
+	struct mutex mutex;		/* configuration and latest */
+	wait_queue_head_t wait;
+	int state;
+
+	struct sios_snap_ev *hist;
+	unsigned int mask;
+	unsigned int head;		/* free running */
+	unsigned int count;		/* valid entries behind head */
+
+	unsigned int pre_ms;
+	unsigned int post_ms;
+	int trigger_src;		/* source id, -1 for none */
+	int trigger_alert;
+	char trigger_name[SIOS_CAP_NAME_LEN + 1];
+	u64 trigger_ns;
+
+	u32 triggers;
+	u32 ignored;			/* while a snapshot was being taken */
+	u32 lost;			/* events not recorded while freezing */
+	u32 last_events;
+	u32 last_pre_ms;		/* history the last snapshot really had */
+
+	struct delayed_work work;
+	struct sios_snapshot *latest;
+	u32 seq;
+
+	struct cdev cdev;
+	struct sios_resource res[1];
+	struct sios_device dev;
+} snap;
+
+static void sios_snapshot_free(struct kref *kref)
+{
+	struct sios_snapshot *s = container_of(kref, struct sios_snapshot, kref);
+
+	vfree(s->data);
+	kfree(s);
+}
+
+/* from any context */
+static void sios_snapshot_trigger(ktime_t ts)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&snap.lock, flags);
+	if (snap.state != SNAP_ARMED) {
+		if (snap.state != SNAP_OFF)
+			snap.ignored++;
+		goto out;
+	}
+	snap.state = SNAP_TRIGGERED;
+	snap.trigger_ns = ktime_to_ns(ts);
+	snap.triggers++;
+	schedule_delayed_work(&snap.work, msecs_to_jiffies(snap.post_ms) + 1);
+out:
+	spin_unlock_irqrestore(&snap.lock, flags);
+}
+
+/* called for every reported event, see event.c */
+void sios_snapshot_event(struct sios_source *src, ktime_t ts, u16 value)
+{
+	struct sios_snap_ev *ev;
+	unsigned long flags;
+	int trigger = 0;
+
+	if (snap.state == SNAP_OFF)
+		return;
+
+	spin_lock_irqsave(&snap.lock, flags);
+	switch (snap.state) {
+	case SNAP_ARMED:
+	case SNAP_TRIGGERED:
+		ev = &snap.hist[snap.head++ & snap.mask];
+		if (snap.count <= snap.mask)
+			snap.count++;
+		ev->ns = ktime_to_ns(ts);
+		ev->value = value;
+		ev->source = src->id;
+		ev->flags = src->rate_shift;
+		trigger = (src->id == snap.trigger_src);
+		break;
+	case SNAP_FREEZING:
+		snap.lost++;
+		break;
+	}
+	spin_unlock_irqrestore(&snap.lock, flags);
+
+	if (trigger)
+		sios_snapshot_trigger(ts);
+}
+
+static void snap_block_init(struct sios_cap_block *blk, int type, u32 seq,
+			    u64 base_ns)
+{
+	blk->magic = cpu_to_le32(SIOS_CAP_MAGIC);
+	blk->version = cpu_to_le16(SIOS_CAP_VERSION);
+	blk->type = cpu_to_le16(type);
+	blk->seq = cpu_to_le32(seq);
+	blk->base_ns = cpu_to_le64(base_ns);
+	blk->clock = cpu_to_le32(sios_event_clock());
+}
+
+/* a new DATA block when the last one is full or too far back */
+static inline int snap_new_block(int fill, u64 base, u64 ns)
+{
+	return !fill || fill == SIOS_CAP_EVENTS_PER_BLOCK ||
+		(ns > base && ns - base > 0xffffffffULL);
+}
+
+/* the ring from first to head is not written to meanwhile */
+static struct sios_snapshot *sios_snapshot_build(unsigned int first,
+						 unsigned int head,
+						 u64 from, u64 to, u64 t, u32 lost)
+{
+	struct sios_snapshot *s;
+	struct sios_cap_block *blk = NULL;
+	struct sios_cap_event *cev;
+	struct sios_snap_ev *ev;
+	unsigned int i, blocks = 1, events = 0;
+	u64 base = 0;
+	int fill = 0;
+
+	for (i=first; i!=head; i++) {
+		ev = &snap.hist[i & snap.mask];
+		if (ev->ns < from || ev->ns > to)
+			continue;
+		if (snap_new_block(fill, base, ev->ns)) {
+			blocks++;
+			base = ev->ns;
+			fill = 0;
+		}
+		fill++;
+		events++;
+	}
+
+	s = kzalloc(sizeof(*s), GFP_KERNEL);
+	if (!s)
+		return NULL;
+	s->size = blocks * SIOS_CAP_BLOCK_SIZE;
+	s->data = vmalloc(s->size);
+	if (!s->data) {
+		kfree(s);
+		return NULL;
+	}
+	memset(s->data, 0, s->size);
+	kref_init(&s->kref);
+
+	blk = (struct sios_cap_block *)s->data;
+	snap_block_init(blk, SIOS_CAP_BLK_SOURCES, 0, t);
+	blk->count = cpu_to_le32(sios_source_snapshot((struct sios_cap_source *)(blk + 1),
+						      SIOS_CAP_SOURCES_PER_BLOCK));
+	blk->dropped = cpu_to_le32(lost);
+
+	blocks = 0;
+	fill = 0;
+	for (i=first; i!=head; i++) {
+		ev = &snap.hist[i & snap.mask];
+		if (ev->ns < from || ev->ns > to)
+			continue;
+		if (snap_new_block(fill, base, ev->ns)) {
+			blocks++;
+			blk = (struct sios_cap_block *)(s->data + blocks * SIOS_CAP_BLOCK_SIZE);
+			snap_block_init(blk, SIOS_CAP_BLK_DATA, blocks, ev->ns);
+			base = ev->ns;
+			fill = 0;
+		}
+		cev = (struct sios_cap_event *)(blk + 1) + fill++;
+		cev->delta_ns = cpu_to_le32(ev->ns > base ? (u32)(ev->ns - base) : 0);
+		cev->source = ev->source;
+		cev->flags = ev->flags;
+		cev->value = cpu_to_le16(ev->value);
+		blk->count = cpu_to_le32(fill);
+	}
+
+	snap.last_events = events;
+	return s;
+}
+
+static void sios_snapshot_freeze(struct work_struct *work)
+{
+	struct sios_snapshot *s, *old;
+	unsigned int first, head;
+	u64 t, from, to, oldest;
+	u32 lost;
+
+	spin_lock_irq(&snap.lock);
+	if (snap.state != SNAP_TRIGGERED) {
+		spin_unlock_irq(&snap.lock);
+		return;
+	}
+	snap.state = SNAP_FREEZING;
+	head = snap.head;
+	first = head - snap.count;
+	t = snap.trigger_ns;
+	lost = snap.lost;
+	snap.lost = 0;
+	spin_unlock_irq(&snap.lock);
+
+	from = t - min_t(u64, t, (u64)snap.pre_ms * NSEC_PER_MSEC);
+	to = t + (u64)snap.post_ms * NSEC_PER_MSEC;
+
+	/* the ring may not reach back as far as asked */
+	oldest = (head != first) ? snap.hist[first & snap.mask].ns : t;
+	oldest = t - max(oldest, from);
+	if ((s64)oldest < 0)
+		oldest = 0;
+	do_div(oldest, NSEC_PER_MSEC);
+	snap.last_pre_ms = oldest;
+
+	s = sios_snapshot_build(first, head, from, to, t, lost);
+
+	spin_lock_irq(&snap.lock);
+	if (snap.state == SNAP_FREEZING)
+		snap.state = SNAP_ARMED;
+	spin_unlock_irq(&snap.lock);
+
+	if (!s) {
+		printk(KERN_WARNING "sios snapshot: out of memory, trigger lost\n");
+		return;
+	}
+
+	mutex_lock(&snap.mutex);
+	old = snap.latest;
+	s->seq = ++snap.seq;
+	snap.latest = s;
+	mutex_unlock(&snap.mutex);
+
+	if (old)
+		kref_put(&old->kref, sios_snapshot_free);
+	wake_up_interruptible(&snap.wait);
+}
+
+/* caller holds snap.mutex */
+static int sios_snapshot_arm(void)
+{
+	if (!snap.hist) {
+		snap.hist = vmalloc(snapshot_events * sizeof(*snap.hist));
+		if (!snap.hist)
+			return -ENOMEM;
+		snap.mask = snapshot_events - 1;
+	}
+
+	spin_lock_irq(&snap.lock);
+	if (snap.state == SNAP_OFF) {
+		snap.head = 0;
+		snap.count = 0;
+		snap.lost = 0;
+		snap.state = SNAP_ARMED;
+	}
+	spin_unlock_irq(&snap.lock);
+
+	return 0;
+}
+
+/* caller holds snap.mutex */
+static void sios_snapshot_disarm(void)
+{
+	spin_lock_irq(&snap.lock);
+	snap.state = SNAP_OFF;
+	spin_unlock_irq(&snap.lock);
+
+	cancel_delayed_work(&snap.work);
+	flush_scheduled_work();
+}
+
+/* the I2C ALERT line, open drain and active low */
+static void sios_snapshot_alert(struct sios_resource *res,
+				const struct sios_irq_rec *rec)
+{
+	if (snap.trigger_alert)
+		sios_snapshot_trigger(rec->stamp);
+}
+
+static ssize_t show_snap_state(struct device *dev, struct device_attribute *attr,
+			       char *buf)
+{
+	return snprintf(buf, PAGE_SIZE, "%s\n", snap_state_names[snap.state]);
+}
+
+/* "arm", "disarm" or "trigger" */
+static ssize_t store_snap_state(struct device *dev, struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	int error = 0;
+
+	mutex_lock(&snap.mutex);
+	if (!strncmp(buf, "arm", 3))
+		error = sios_snapshot_arm();
+	else if (!strncmp(buf, "disarm", 6))
+		sios_snapshot_disarm();
+	else if (!strncmp(buf, "trigger", 7))
+		sios_snapshot_trigger(sios_event_stamp());
+	else
+		error = -EINVAL;
+	mutex_unlock(&snap.mutex);
+
+	return error ? error : count;
+}
+
+static ssize_t show_snap_pre(struct device *dev, struct device_attribute *attr,
+			     char *buf)
+{
+	return snprintf(buf, PAGE_SIZE, "%u\n", snap.pre_ms);
+}
+
+static ssize_t store_snap_pre(struct device *dev, struct device_attribute *attr,
+			      const char *buf, size_t count)
+{
+	unsigned long ms = simple_strtoul(buf, NULL, 0);
+
+	if (ms > SNAP_MAX_MS)
+		return -EINVAL;
+	snap.pre_ms = ms;
+	return count;
+}
+
+static ssize_t show_snap_post(struct device *dev, struct device_attribute *attr,
+			      char *buf)
+{
+	return snprintf(buf, PAGE_SIZE, "%u\n", snap.post_ms);
+}
+
+static ssize_t store_snap_post(struct device *dev, struct device_attribute *attr,
+			       const char *buf, size_t count)
+{
+	unsigned long ms = simple_strtoul(buf, NULL, 0);
+
+	if (ms > SNAP_MAX_MS)
+		return -EINVAL;
+	snap.post_ms = ms;
+	return count;
+}
+
+static ssize_t show_snap_trigger(struct device *dev, struct device_attribute *attr,
+				 char *buf)
+{
+	ssize_t len;
+
+	mutex_lock(&snap.mutex);
+	if (snap.trigger_alert)
+		len = snprintf(buf, PAGE_SIZE, "alert\n");
+	else if (snap.trigger_src >= 0)
+		len = snprintf(buf, PAGE_SIZE, "%s\n", snap.trigger_name);
+	else
+		len = snprintf(buf, PAGE_SIZE, "none\n");
+	mutex_unlock(&snap.mutex);
+
+	return len;
+}
+
+/* "none", "alert" or the name of a source, e.g. PwrButton */
+static ssize_t store_snap_trigger(struct device *dev, struct device_attribute *attr,
+				  const char *buf, size_t count)
+{
+	char name[SIOS_CAP_NAME_LEN + 1];
+	int id = -1, alert = 0;
+
+	if (count > SIOS_CAP_NAME_LEN)
+		return -EINVAL;
+	memcpy(name, buf, count);
+	name[count] = '\0';
+	if (count && name[count - 1] == '\n')
+		name[count - 1] = '\0';
+
+	if (!strcmp(name, "alert")) {
+		if (!snap.res[0].irq)
+			return -ENODEV;
+		alert = 1;
+	} else if (strcmp(name, "none")) {
+		id = sios_source_lookup(name);
+		if (id < 0)
+			return id;
+	}
+
+	mutex_lock(&snap.mutex);
+	strlcpy(snap.trigger_name, name, sizeof(snap.trigger_name));
+	snap.trigger_alert = alert;
+	snap.trigger_src = id;
+	mutex_unlock(&snap.mutex);
+
+	return count;
+}
+
+static ssize_t show_snap_stats(struct device *dev, struct device_attribute *attr,
+			       char *buf)
+{
+	return snprintf(buf, PAGE_SIZE, "history\t%u\ntriggers\t%u\nignored\t%u\n"
+			"snapshots\t%u\nlast_events\t%u\nlast_pre_ms\t%u\n",
+			snapshot_events, snap.triggers, snap.ignored,
+			snap.seq, snap.last_events, snap.last_pre_ms);
+}
+
+static DEVICE_ATTR(state, S_IRUGO | S_IWUSR, show_snap_state, store_snap_state);
+static DEVICE_ATTR(pre_ms, S_IRUGO | S_IWUSR, show_snap_pre, store_snap_pre);
+static DEVICE_ATTR(post_ms, S_IRUGO | S_IWUSR, show_snap_post, store_snap_post);
+static DEVICE_ATTR(trigger, S_IRUGO | S_IWUSR, show_snap_trigger, store_snap_trigger);
+static DEVICE_ATTR(stats, S_IRUGO, show_snap_stats, NULL);
+
+static struct attribute *sios_snap_attrs[] = {
+	&dev_attr_state.attr,
+	&dev_attr_pre_ms.attr,
+	&dev_attr_post_ms.attr,
+	&dev_attr_trigger.attr,
+	&dev_attr_stats.attr,
+	NULL,
+};
+
+static struct attribute_group sios_snap_group = {
+	.attrs = sios_snap_attrs,
+};
+
+static int sios_snapshot_open(struct inode *inode, struct file *file)
+{
+	struct sios_snap_reader *rd;
+
+	if ((file->f_flags & O_ACCMODE) != O_RDONLY)
+		return -EINVAL;
+
+	rd = kzalloc(sizeof(*rd), GFP_KERNEL);
+	if (!rd)
+		return -ENOMEM;
+
+	file->private_data = rd;
+	return 0;
+}
+
+static int sios_snapshot_release(struct inode *inode, struct file *file)
+{
+	struct sios_snap_reader *rd = file->private_data;
+
+	if (rd->s)
+		kref_put(&rd->s->kref, sios_snapshot_free);
+	kfree(rd);
+	return 0;
+}
+
+static ssize_t sios_snapshot_read(struct file *file, char __user *buf,
+				  size_t count, loff_t *ppos)
+{
+	struct sios_snap_reader *rd = file->private_data;
+	struct sios_snapshot *s;
+	size_t n;
+	int error;
+
+	if (!rd->s) {
+		if (snap.seq == rd->seen) {
+			if (file->f_flags & O_NONBLOCK)
+				return -EAGAIN;
+			error = wait_event_interruptible(snap.wait, snap.seq != rd->seen);
+			if (error)
+				return error;
+		}
+
+		mutex_lock(&snap.mutex);
+		s = snap.latest;
+		kref_get(&s->kref);
+		mutex_unlock(&snap.mutex);
+
+		rd->s = s;
+		rd->seen = s->seq;
+		rd->off = 0;
+	}
+
+	s = rd->s;
+	n = min_t(size_t, count, s->size - rd->off);
+	if (copy_to_user(buf, s->data + rd->off, n))
+		return -EFAULT;
+	rd->off += n;
+
+	if (rd->off == s->size) {
+		rd->s = NULL;
+		kref_put(&s->kref, sios_snapshot_free);
+	}
+
+	return n;
+}
+
+static unsigned int sios_snapshot_poll(struct file *file, poll_table *wait)
+{
+	struct sios_snap_reader *rd = file->private_data;
+
+	poll_wait(file, &snap.wait, wait);
+	return (rd->s || snap.seq != rd->seen) ? POLLIN | POLLRDNORM : 0;
+}
+
+static const struct file_operations sios_snapshot_fops = {
+	.owner = THIS_MODULE,
+	.open = sios_snapshot_open,
+	.release = sios_snapshot_release,
+	.read = sios_snapshot_read,
+	.poll = sios_snapshot_poll,
+	.llseek = no_llseek,
+};
+
+static void sios_snapshot_dev_release(struct sios_device *sdev)
+{
+	return;
+}
+
+/* the device is registered without the ALERT line, claimed here */
+static int sios_snapshot_claim_alert(void)
+{
+	int error;
+
+	error = sios_board_claim(&sios_default_board, SIOS_CLAIM_SNAPSHOT, &snap.res[0]);
+	if (error)
+		return error;
+	snap.res[0].handler = sios_snapshot_alert;
+
+	snap.dev.num_resource = ARRAY_SIZE(snap.res);
+	error = sios_request_resources(&snap.dev);
+	if (error)
+		goto err;
+
+	error = sios_request_irqs(&snap.dev);
+	if (error)
+		goto release;
+
+	error = sios_resource_create_table(&snap.dev);
+	if (error)
+		goto free_irqs;
+
+	return 0;
+
+free_irqs:
+	sios_free_irqs(&snap.dev);
+release:
+	sios_release_resources(&snap.dev);
+err:
+	snap.dev.num_resource = 0;
+	return error;
+}
+
+int sios_snapshot_init(void)
+{
+	int error;
+
+	if (snapshot_events < 2)
+		snapshot_events = 2;
+	snapshot_events = roundup_pow_of_two(snapshot_events);
+
+	spin_lock_init(&snap.lock);
+	mutex_init(&snap.mutex);
+	init_waitqueue_head(&snap.wait);
+	INIT_DELAYED_WORK(&snap.work, sios_snapshot_freeze);
+	snap.pre_ms = 1000;
+	snap.post_ms = 1000;
+	snap.trigger_src = -1;
+
+
+	snap.dev.name = "sios:snapshot";
+	snap.dev.release = sios_snapshot_dev_release;
+	snap.dev.num_resource = 0;
+	snap.dev.resource = snap.res;
+
+	error = sios_device_register(&snap.dev);
+	if (error)
+		return error;
+
+	/* without the ALERT line the other triggers still work */
+	error = sios_snapshot_claim_alert();
+	if (error)
+		printk(KERN_WARNING "sios snapshot: ALERT trigger unavailable (%d)\n", error);
+
+	error = sysfs_create_group(&snap.dev.dev.kobj, &sios_snap_group);
+	if (error)
+		goto err_dev;
+
+	error = sios_chrdev_add(&snap.cdev, &sios_snapshot_fops,
+				SIOS_SNAPSHOT_MINOR, "snapshot");
+	if (error)
+		goto err_group;
+
+	return 0;
+
+err_group:
+	sysfs_remove_group(&snap.dev.dev.kobj, &sios_snap_group);
+err_dev:
+	sios_device_unregister(&snap.dev);
+	return error;
+}
+
+void sios_snapshot_exit(void)
+{
+	mutex_lock(&snap.mutex);
+	sios_snapshot_disarm();
+	mutex_unlock(&snap.mutex);
+
+	sios_chrdev_del(&snap.cdev, SIOS_SNAPSHOT_MINOR);
+	sysfs_remove_group(&snap.dev.dev.kobj, &sios_snap_group);
+	sios_device_unregister(&snap.dev);
+
+	if (snap.latest)
+		kref_put(&snap.latest->kref, sios_snapshot_free);
+	vfree(snap.hist);
+}